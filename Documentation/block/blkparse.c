@@ -0,0 +1,384 @@
+/*
+ * blkparse.c: collect and print block layer traces.
+ *
+ *	blkparse -d <device> [-w <seconds>]
+ *		trace <device> for the given time (default 10s) and print
+ *		the events and a latency summary
+ *	blkparse <file>...
+ *		print raw traces saved from debugfs block/<dev>/trace<cpu>
+ *
+ * The summary splits the life of a request into
+ *	Q2I	__make_request() to insertion into the io scheduler
+ *	I2D	insertion to issue to the driver
+ *	D2C	issue to completion by the device
+ * matching events by starting sector.
+ *
+ * Build with:	gcc -Wall -O2 -o blkparse blkparse.c
+ * See Documentation/block/blktrace.txt.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+/* From <linux/blktrace.h> */
+#define BLK_TC_WRITE		(1 << 1)
+#define BLK_TC_BARRIER		(1 << 2)
+#define BLK_TC_SYNC		(1 << 3)
+#define BLK_TC_SHIFT		(16)
+#define BLK_TC_ACT(act)		((act) << BLK_TC_SHIFT)
+
+enum blktrace_act {
+	__BLK_TA_QUEUE = 1,
+	__BLK_TA_BACKMERGE,
+	__BLK_TA_FRONTMERGE,
+	__BLK_TA_SLEEPRQ,
+	__BLK_TA_INSERT,
+	__BLK_TA_ISSUE,
+	__BLK_TA_REQUEUE,
+	__BLK_TA_COMPLETE,
+	__BLK_TA_PLUG,
+	__BLK_TA_UNPLUG,
+};
+
+#define BLK_IO_TRACE_MAGIC	0x65617400
+
+struct blk_io_trace {
+	__u32 magic;
+	__u32 sequence;
+	__u64 time;
+	__u64 sector;
+	__u32 bytes;
+	__u32 action;
+	__u32 pid;
+	__u32 device;
+	__u16 cpu;
+	__u16 error;
+	__u32 pad;
+};
+
+struct blk_user_trace_setup {
+	char name[32];
+	__u16 act_mask;
+	__u32 buf_size;
+	__u32 buf_nr;
+	__u64 start_lba;
+	__u64 end_lba;
+	__u32 pid;
+};
+
+#define BLKTRACESETUP	_IOWR(0x12, 115, struct blk_user_trace_setup)
+#define BLKTRACESTART	_IO(0x12, 116)
+#define BLKTRACESTOP	_IO(0x12, 117)
+#define BLKTRACETEARDOWN _IO(0x12, 118)
+
+#define DEBUGFS		"/sys/kernel/debug"
+#define MAX_CPUS	256
+#define HASH_SIZE	4096
+
+static struct blk_io_trace *traces;
+static unsigned long nr_traces, max_traces;
+
+struct pending {
+	__u32 device;
+	__u64 sector;
+	__u64 queued, inserted, issued;
+	struct pending *next;
+};
+
+static struct pending *hash[HASH_SIZE];
+
+struct stat_line {
+	const char *name;
+	unsigned long n;
+	double total, max;
+};
+
+static struct stat_line q2i = { "Q2I" }, i2d = { "I2D" }, d2c = { "D2C" },
+			q2c = { "Q2C" };
+
+static void add_trace(struct blk_io_trace *t)
+{
+	if (nr_traces == max_traces) {
+		max_traces = max_traces ? 2 * max_traces : 4096;
+		traces = realloc(traces, max_traces * sizeof(*traces));
+		if (!traces) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	traces[nr_traces++] = *t;
+}
+
+/* Append the whole records in buf; returns the bytes consumed */
+static size_t add_traces(char *buf, size_t len)
+{
+	struct blk_io_trace *t;
+	size_t done = 0;
+
+	while (len - done >= sizeof(*t)) {
+		t = (struct blk_io_trace *) (buf + done);
+		if ((t->magic & 0xffffff00) != BLK_IO_TRACE_MAGIC) {
+			fprintf(stderr, "bad trace magic %x\n", t->magic);
+			exit(1);
+		}
+		add_trace(t);
+		done += sizeof(*t);
+	}
+	return done;
+}
+
+static void read_file(const char *name)
+{
+	char buf[64 * sizeof(struct blk_io_trace)];
+	size_t have = 0, used;
+	ssize_t ret;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		perror(name);
+		exit(1);
+	}
+	while ((ret = read(fd, buf + have, sizeof(buf) - have)) > 0) {
+		have += ret;
+		used = add_traces(buf, have);
+		memmove(buf, buf + used, have - used);
+		have -= used;
+	}
+	close(fd);
+}
+
+static void trace_device(const char *dev, int seconds)
+{
+	struct blk_user_trace_setup buts;
+	char name[256], buf[64 * sizeof(struct blk_io_trace)];
+	int fds[MAX_CPUS], nr_fds = 0, devfd, i;
+	time_t end;
+	ssize_t ret;
+
+	devfd = open(dev, O_RDONLY | O_NONBLOCK);
+	if (devfd < 0) {
+		perror(dev);
+		exit(1);
+	}
+	memset(&buts, 0, sizeof(buts));
+	buts.buf_size = 512 * 1024;
+	buts.buf_nr = 4;
+	if (ioctl(devfd, BLKTRACESETUP, &buts) < 0) {
+		perror("BLKTRACESETUP");
+		exit(1);
+	}
+	for (i = 0; i < MAX_CPUS; i++) {
+		snprintf(name, sizeof(name), DEBUGFS "/block/%s/trace%d",
+			 buts.name, i);
+		fds[nr_fds] = open(name, O_RDONLY | O_NONBLOCK);
+		if (fds[nr_fds] >= 0)
+			nr_fds++;
+	}
+	if (!nr_fds) {
+		fprintf(stderr, "no trace files under " DEBUGFS "/block/%s; "
+			"is debugfs mounted?\n", buts.name);
+		ioctl(devfd, BLKTRACETEARDOWN);
+		exit(1);
+	}
+	if (ioctl(devfd, BLKTRACESTART) < 0) {
+		perror("BLKTRACESTART");
+		ioctl(devfd, BLKTRACETEARDOWN);
+		exit(1);
+	}
+
+	end = time(NULL) + seconds;
+	while (time(NULL) < end) {
+		for (i = 0; i < nr_fds; i++)
+			while ((ret = read(fds[i], buf, sizeof(buf))) > 0)
+				add_traces(buf, ret);
+		usleep(100000);
+	}
+
+	ioctl(devfd, BLKTRACESTOP);
+	for (i = 0; i < nr_fds; i++) {
+		while ((ret = read(fds[i], buf, sizeof(buf))) > 0)
+			add_traces(buf, ret);
+		close(fds[i]);
+	}
+	ioctl(devfd, BLKTRACETEARDOWN);
+	close(devfd);
+}
+
+static int trace_cmp(const void *a, const void *b)
+{
+	const struct blk_io_trace *ta = a, *tb = b;
+
+	if (ta->time < tb->time)
+		return -1;
+	return ta->time > tb->time;
+}
+
+static struct pending **find_pending(__u32 device, __u64 sector)
+{
+	struct pending **p = &hash[(sector ^ device) % HASH_SIZE];
+
+	while (*p && ((*p)->device != device || (*p)->sector != sector))
+		p = &(*p)->next;
+	return p;
+}
+
+static void drop_pending(struct pending **p)
+{
+	struct pending *old = *p;
+
+	*p = old->next;
+	free(old);
+}
+
+static void account(struct stat_line *s, __u64 from, __u64 to)
+{
+	double us;
+
+	if (!from || to < from)
+		return;
+	us = (to - from) / 1000.0;
+	s->n++;
+	s->total += us;
+	if (us > s->max)
+		s->max = us;
+}
+
+static void track(struct blk_io_trace *t)
+{
+	struct pending **p = find_pending(t->device, t->sector), *pd;
+
+	switch (t->action & 0xffff) {
+	case __BLK_TA_QUEUE:
+		if (!*p) {
+			pd = calloc(1, sizeof(*pd));
+			if (!pd)
+				return;
+			pd->device = t->device;
+			pd->sector = t->sector;
+			*p = pd;
+		}
+		(*p)->queued = t->time;
+		break;
+	case __BLK_TA_BACKMERGE:
+	case __BLK_TA_FRONTMERGE:
+		/* the bio now lives in another request */
+		if (*p && !(*p)->inserted)
+			drop_pending(p);
+		break;
+	case __BLK_TA_INSERT:
+		if (*p) {
+			(*p)->inserted = t->time;
+			account(&q2i, (*p)->queued, t->time);
+		}
+		break;
+	case __BLK_TA_ISSUE:
+		if (*p) {
+			(*p)->issued = t->time;
+			account(&i2d, (*p)->inserted, t->time);
+		}
+		break;
+	case __BLK_TA_COMPLETE:
+		if (*p) {
+			account(&d2c, (*p)->issued, t->time);
+			account(&q2c, (*p)->queued, t->time);
+			drop_pending(p);
+		}
+		break;
+	}
+}
+
+static char action_char(__u32 action)
+{
+	static const char acts[] = "?QMFSIDRCPU";
+
+	action &= 0xffff;
+	return action < sizeof(acts) - 1 ? acts[action] : '?';
+}
+
+static void print_trace(struct blk_io_trace *t, __u64 base)
+{
+	__u64 ns = t->time - base;
+	char rwbs[5];
+	int i = 0;
+
+	if (t->action & BLK_TC_ACT(BLK_TC_WRITE))
+		rwbs[i++] = 'W';
+	else
+		rwbs[i++] = 'R';
+	if (t->action & BLK_TC_ACT(BLK_TC_BARRIER))
+		rwbs[i++] = 'B';
+	if (t->action & BLK_TC_ACT(BLK_TC_SYNC))
+		rwbs[i++] = 'S';
+	rwbs[i] = 0;
+
+	printf("%3u,%-3u %2u %8u %5llu.%09llu %5u  %c %3s",
+	       t->device >> 20, t->device & 0xfffff, t->cpu, t->sequence,
+	       (unsigned long long) ns / 1000000000,
+	       (unsigned long long) ns % 1000000000, t->pid,
+	       action_char(t->action), rwbs);
+	if (t->bytes)
+		printf(" %llu + %u", (unsigned long long) t->sector,
+		       t->bytes >> 9);
+	if (t->error)
+		printf(" [%d]", t->error);
+	printf("\n");
+}
+
+static void print_stat(struct stat_line *s)
+{
+	if (!s->n)
+		printf("%s %10s\n", s->name, "-");
+	else
+		printf("%s %10lu %12.1f %12.1f\n", s->name, s->n,
+		       s->total / s->n, s->max);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long i;
+	int c, seconds = 10;
+	char *dev = NULL;
+
+	while ((c = getopt(argc, argv, "d:w:")) != -1) {
+		switch (c) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'w':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s -d <device> [-w <seconds>]"
+				" | <file>...\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (dev)
+		trace_device(dev, seconds);
+	for (; optind < argc; optind++)
+		read_file(argv[optind]);
+	if (!nr_traces)
+		return 0;
+
+	qsort(traces, nr_traces, sizeof(*traces), trace_cmp);
+	for (i = 0; i < nr_traces; i++) {
+		print_trace(&traces[i], traces[0].time);
+		track(&traces[i]);
+	}
+
+	printf("\n    %10s %12s %12s\n", "requests", "avg usec", "max usec");
+	print_stat(&q2i);
+	print_stat(&i2d);
+	print_stat(&d2c);
+	print_stat(&q2c);
+	return 0;
+}
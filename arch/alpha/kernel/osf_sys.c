@@ -990,7 +990,7 @@ osf_select(int n, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp,
 	char *bits;
 	size_t size;
 	long timeout;
-	int ret;
+	int ret, max_fdset;
 
 	timeout = MAX_SCHEDULE_TIMEOUT;
 	if (tvp) {
@@ -1012,7 +1012,10 @@ osf_select(int n, fd_set __user *inp, fd_set __user *outp, fd_set __user *exp,
 	}
 
 	ret = -EINVAL;
-	if (n < 0 || n > current->files->max_fdset)
+	rcu_read_lock();
+	max_fdset = files_fdtable(current->files)->max_fdset;
+	rcu_read_unlock();
+	if (n < 0 || n > max_fdset)
 		goto out_nofds;
 
 	/*
@@ -295,9 +295,9 @@ static inline int solaris_sockmod(unsigned int fd, unsigned int cmd, u32 arg)
 	struct inode *ino;
 	/* I wonder which of these tests are superfluous... --patrik */
 	spin_lock(&current->files->file_lock);
-	if (! current->files->fd[fd] ||
-	    ! current->files->fd[fd]->f_dentry ||
-	    ! (ino = current->files->fd[fd]->f_dentry->d_inode) ||
+	if (! files_fdtable(current->files)->fd[fd] ||
+	    ! files_fdtable(current->files)->fd[fd]->f_dentry ||
+	    ! (ino = files_fdtable(current->files)->fd[fd]->f_dentry->d_inode) ||
 	    ! S_ISSOCK(ino->i_mode)) {
 		spin_unlock(&current->files->file_lock);
 		return TBADF;
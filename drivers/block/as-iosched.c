@@ -67,6 +67,35 @@
  */
 #define MAX_THINKTIME (HZ/50UL)
 
+/*
+ * Anticipation is turned off for a device that keeps more than this many
+ * requests in flight: a TCQ disk or RAID array serves other streams while
+ * we would be waiting.
+ */
+#define default_antic_max_depth 4
+
+/*
+ * A request starting within this many sectors of where the previous one
+ * ended counts as not seeking when learning the device's seek cost.
+ */
+#define AS_CLOSE_SECTORS 64
+
+/* Cap on learned times, in usecs */
+#define AS_LEARN_MAX_USEC 500000UL
+
+/*
+ * Decaying average in fixed point, 1.0 == 1<<8, like the thinktime and
+ * seek statistics of struct as_io_context.  At least AS_LEARN_SAMPLES
+ * means a few real samples are in.
+ */
+struct as_stat {
+	unsigned long samples;
+	unsigned long total;
+	unsigned long mean;
+};
+
+#define AS_LEARN_SAMPLES 128
+
 /* Bits in as_io_context.state */
 enum as_io_states {
 	AS_TASK_RUNNING=0,	/* Process has not exitted */
@@ -126,12 +155,29 @@ struct as_data {
 	int ioc_finished; /* IO associated with io_context is finished */
 	int nr_dispatched;
 
+	/*
+	 * what this device learned about whether anticipation pays off
+	 */
+	unsigned long long antic_idle_start; /* ns: disk went idle for antic */
+	struct as_stat antic_wait;	/* usecs the disk idled per anticipation */
+	unsigned long antic_hit;	/* fraction of anticipations that got a
+					   close request, 1.0 == 256 */
+	struct as_stat close_service;	/* usecs to serve a read, no seek */
+	struct as_stat far_service;	/* usecs to serve a read after a seek */
+	sector_t head_pos;		/* where the last dispatch ended */
+	int hw_depth;			/* requests the device keeps in flight */
+	int depth_window_max;
+	unsigned long depth_window_end;
+	int antic_active;		/* anticipation currently used */
+
 	/*
 	 * settings that change how the i/o scheduler behaves
 	 */
 	unsigned long fifo_expire[2];
 	unsigned long batch_expire[2];
 	unsigned long antic_expire;
+	unsigned long antic_adaptive;	/* learn whether to anticipate */
+	unsigned long antic_max_depth;
 };
 
 #define list_entry_fifo(ptr)	list_entry((ptr), struct as_rq, fifo)
@@ -176,6 +222,13 @@ struct as_rq {
 
 	unsigned int is_sync;
 	enum arq_state state;
+
+	/*
+	 * service time sample: dispatched alone to an idle device
+	 */
+	unsigned int timed;
+	unsigned int close;		/* no seek from the previous request */
+	unsigned long long dispatch_time;	/* ns */
 };
 
 #define RQ_DATA(rq)	((struct as_rq *) (rq)->elevator_private)
@@ -539,6 +592,91 @@ static struct as_rq *as_find_next_arq(struct as_data *ad, struct as_rq *last)
  * anticipatory scheduling functions follow
  */
 
+static void as_stat_add(struct as_stat *st, unsigned long val)
+{
+	st->samples = (7*st->samples + 256) / 8;
+	st->total = (7*st->total + 256*val) / 8;
+	st->mean = (st->total + 128) / st->samples;
+}
+
+static unsigned long as_usecs_since(unsigned long long start)
+{
+	unsigned long long delta = sched_clock() - start;
+
+	do_div(delta, 1000);
+	return min_t(unsigned long long, delta, AS_LEARN_MAX_USEC);
+}
+
+/*
+ * as_update_antic_active decides from what the device has shown so far
+ * whether anticipation is worth it.  Waiting costs the time the disk sits
+ * idle; it gains the difference between serving a read after a seek and
+ * without one, whenever the wait does produce a close request.  Devices
+ * that keep many requests in flight never get anticipation.
+ */
+static void as_update_antic_active(struct as_data *ad)
+{
+	unsigned long gain;
+	int active = 1;
+
+	if (!ad->antic_adaptive)
+		goto out;
+
+	if (ad->hw_depth > ad->antic_max_depth) {
+		active = 0;
+		goto out;
+	}
+
+	if (ad->antic_wait.samples < AS_LEARN_SAMPLES
+			|| ad->close_service.samples < AS_LEARN_SAMPLES
+			|| ad->far_service.samples < AS_LEARN_SAMPLES)
+		goto out;
+
+	if (ad->far_service.mean <= ad->close_service.mean)
+		active = 0;
+	else {
+		gain = (ad->far_service.mean - ad->close_service.mean)
+						* ad->antic_hit / 256;
+		active = gain > ad->antic_wait.mean;
+	}
+out:
+	ad->antic_active = active;
+}
+
+/*
+ * as_antic_learn records how an anticipation ended: how long the disk sat
+ * idle, and whether we got the close request we were waiting for.
+ */
+static void as_antic_learn(struct as_data *ad, int hit)
+{
+	unsigned long wait = 0;
+
+	if (ad->antic_status == ANTIC_WAIT_NEXT)
+		wait = as_usecs_since(ad->antic_idle_start);
+
+	as_stat_add(&ad->antic_wait, wait);
+	ad->antic_hit = (7*ad->antic_hit + (hit ? 256 : 0)) / 8;
+	as_update_antic_active(ad);
+}
+
+/*
+ * as_update_depth tracks how many requests the device takes at once: the
+ * peak over the last second, decaying by half each second it isn't seen.
+ */
+static void as_update_depth(struct as_data *ad)
+{
+	if (ad->nr_dispatched > ad->depth_window_max)
+		ad->depth_window_max = ad->nr_dispatched;
+
+	if (time_before(jiffies, ad->depth_window_end))
+		return;
+
+	ad->hw_depth = max(ad->depth_window_max, ad->hw_depth / 2);
+	ad->depth_window_max = 0;
+	ad->depth_window_end = jiffies + HZ;
+	as_update_antic_active(ad);
+}
+
 /*
  * as_antic_expired tells us when we have anticipated too long.
  * The funny "absolute difference" math on the elapsed time is to handle
@@ -571,6 +709,7 @@ static void as_antic_waitnext(struct as_data *ad)
 	timeout = ad->antic_start + ad->antic_expire;
 
 	mod_timer(&ad->antic_timer, timeout);
+	ad->antic_idle_start = sched_clock();
 
 	ad->antic_status = ANTIC_WAIT_NEXT;
 }
@@ -622,6 +761,7 @@ static void as_antic_timeout(unsigned long data)
 			|| ad->antic_status == ANTIC_WAIT_NEXT) {
 		struct as_io_context *aic = ad->io_context->aic;
 
+		as_antic_learn(ad, 0);
 		ad->antic_status = ANTIC_FINISHED;
 		kblockd_schedule_work(&ad->antic_work);
 
@@ -906,8 +1046,12 @@ static void as_update_arq(struct as_data *ad, struct as_rq *arq)
 	 */
 	if (ad->antic_status == ANTIC_WAIT_REQ
 			|| ad->antic_status == ANTIC_WAIT_NEXT) {
-		if (as_can_break_anticipation(ad, arq))
+		if (as_can_break_anticipation(ad, arq)) {
+			as_antic_learn(ad, arq->io_context == ad->io_context
+					|| (arq->is_sync == REQ_SYNC
+						&& as_close_req(ad, arq)));
 			as_antic_stop(ad);
+		}
 	}
 }
 
@@ -950,6 +1094,10 @@ static void as_completed_request(request_queue_t *q, struct request *rq)
 
 	WARN_ON(!list_empty(&rq->queuelist));
 
+	/* requests cloned by request based dm carry no as_rq */
+	if (!arq)
+		return;
+
 	if (arq->state == AS_RQ_PRESCHED) {
 		WARN_ON(arq->io_context);
 		goto out;
@@ -977,6 +1125,14 @@ static void as_completed_request(request_queue_t *q, struct request *rq)
 	WARN_ON(ad->nr_dispatched == 0);
 	ad->nr_dispatched--;
 
+	if (arq->timed) {
+		struct as_stat *st;
+
+		st = arq->close ? &ad->close_service : &ad->far_service;
+		as_stat_add(st, as_usecs_since(arq->dispatch_time));
+		as_update_antic_active(ad);
+	}
+
 	/*
 	 * Start counting the batch from when a request of that direction is
 	 * actually serviced. This should help devices with big TCQ windows
@@ -1085,6 +1241,9 @@ static void as_remove_request(request_queue_t *q, struct request *rq)
 {
 	struct as_rq *arq = RQ_DATA(rq);
 
+	if (!arq)
+		return;
+
 	if (unlikely(arq->state == AS_RQ_NEW))
 		goto out;
 
@@ -1173,6 +1332,25 @@ static void as_move_to_dispatch(struct as_data *ad, struct as_rq *arq)
 	as_antic_stop(ad);
 	ad->antic_status = ANTIC_OFF;
 
+	/*
+	 * Reads sent to an otherwise idle device give a clean service time
+	 * sample, with or without a seek before them.
+	 */
+	arq->timed = 0;
+	if (data_dir == REQ_SYNC && !ad->nr_dispatched) {
+		sector_t dist;
+
+		if (rq->sector < ad->head_pos)
+			dist = ad->head_pos - rq->sector;
+		else
+			dist = rq->sector - ad->head_pos;
+
+		arq->timed = 1;
+		arq->close = dist <= AS_CLOSE_SECTORS;
+		arq->dispatch_time = sched_clock();
+	}
+	ad->head_pos = rq->sector + rq->nr_sectors;
+
 	/*
 	 * This has to be set in order to be correctly updated by
 	 * as_find_next_arq
@@ -1223,6 +1401,8 @@ static void as_move_to_dispatch(struct as_data *ad, struct as_rq *arq)
 	if (arq->io_context && arq->io_context->aic)
 		atomic_inc(&arq->io_context->aic->nr_dispatched);
 	ad->nr_dispatched++;
+
+	as_update_depth(ad);
 }
 
 /*
@@ -1254,7 +1434,8 @@ static int as_dispatch_request(struct as_data *ad)
 		 */
 		arq = ad->next_arq[ad->batch_data_dir];
 
-		if (ad->batch_data_dir == REQ_SYNC && ad->antic_expire) {
+		if (ad->batch_data_dir == REQ_SYNC && ad->antic_expire
+					&& ad->antic_active) {
 			if (as_fifo_expired(ad, REQ_SYNC))
 				goto fifo_expired;
 
@@ -1482,7 +1663,7 @@ static void as_requeue_request(request_queue_t *q, struct request *rq)
 		if (arq->io_context && arq->io_context->aic)
 			atomic_inc(&arq->io_context->aic->nr_dispatched);
 	} else
-		WARN_ON(blk_fs_request(rq)
+		WARN_ON(blk_fs_request(rq) && rq->rl
 			&& (!(rq->flags & (REQ_HARDBARRIER|REQ_SOFTBARRIER))) );
 
 	list_add(&rq->queuelist, ad->dispatch);
@@ -1499,8 +1680,10 @@ static void as_requeue_request(request_queue_t *q, struct request *rq)
  */
 static void as_account_queued_request(struct as_data *ad, struct request *rq)
 {
-	if (blk_fs_request(rq)) {
-		struct as_rq *arq = RQ_DATA(rq);
+	struct as_rq *arq = RQ_DATA(rq);
+
+	/* requests cloned by request based dm carry no as_rq */
+	if (blk_fs_request(rq) && arq) {
 		arq->state = AS_RQ_DISPATCHED;
 		ad->nr_dispatched++;
 	}
@@ -1909,6 +2092,10 @@ static int as_init_queue(request_queue_t *q, elevator_t *e)
 	ad->antic_expire = default_antic_expire;
 	ad->batch_expire[REQ_SYNC] = default_read_batch_expire;
 	ad->batch_expire[REQ_ASYNC] = default_write_batch_expire;
+	ad->antic_adaptive = 1;
+	ad->antic_max_depth = default_antic_max_depth;
+	ad->antic_hit = 256;
+	ad->antic_active = 1;
 	e->elevator_data = ad;
 
 	ad->current_batch_expires = jiffies + ad->batch_expire[REQ_SYNC];
@@ -1958,10 +2145,47 @@ static ssize_t as_est_show(struct as_data *ad, char *page)
 	pos += sprintf(page+pos, "%lu %% exit probability\n", 100*ad->exit_prob/256);
 	pos += sprintf(page+pos, "%lu ms new thinktime\n", ad->new_ttime_mean);
 	pos += sprintf(page+pos, "%llu sectors new seek distance\n", (unsigned long long)ad->new_seek_mean);
+	pos += sprintf(page+pos, "%lu us read service time, no seek\n", ad->close_service.mean);
+	pos += sprintf(page+pos, "%lu us read service time after seek\n", ad->far_service.mean);
+	pos += sprintf(page+pos, "%lu us idle per anticipation\n", ad->antic_wait.mean);
+	pos += sprintf(page+pos, "%lu %% anticipation success\n", 100*ad->antic_hit/256);
+	pos += sprintf(page+pos, "%d requests device queue depth\n", ad->hw_depth);
+	pos += sprintf(page+pos, "%s anticipation\n", ad->antic_active ? "using" : "not using");
 
 	return pos;
 }
 
+static ssize_t as_antic_adaptive_show(struct as_data *ad, char *page)
+{
+	return sprintf(page, "%lu\n", ad->antic_adaptive);
+}
+
+static ssize_t
+as_antic_adaptive_store(struct as_data *ad, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	ad->antic_adaptive = simple_strtoul(p, &p, 10) ? 1 : 0;
+	as_update_antic_active(ad);
+	return count;
+}
+
+static ssize_t as_antic_max_depth_show(struct as_data *ad, char *page)
+{
+	return sprintf(page, "%lu\n", ad->antic_max_depth);
+}
+
+static ssize_t
+as_antic_max_depth_store(struct as_data *ad, const char *page, size_t count)
+{
+	char *p = (char *) page;
+	unsigned long depth = simple_strtoul(p, &p, 10);
+
+	ad->antic_max_depth = depth ? depth : 1;
+	as_update_antic_active(ad);
+	return count;
+}
+
 #define SHOW_FUNCTION(__FUNC, __VAR)				\
 static ssize_t __FUNC(struct as_data *ad, char *page)		\
 {								\
@@ -2024,6 +2248,17 @@ static struct as_fs_entry as_write_batchexpire_entry = {
 	.store = as_write_batchexpire_store,
 };
 
+static struct as_fs_entry as_antic_adaptive_entry = {
+	.attr = {.name = "antic_adaptive", .mode = S_IRUGO | S_IWUSR },
+	.show = as_antic_adaptive_show,
+	.store = as_antic_adaptive_store,
+};
+static struct as_fs_entry as_antic_max_depth_entry = {
+	.attr = {.name = "antic_max_depth", .mode = S_IRUGO | S_IWUSR },
+	.show = as_antic_max_depth_show,
+	.store = as_antic_max_depth_store,
+};
+
 static struct attribute *default_attrs[] = {
 	&as_est_entry.attr,
 	&as_readexpire_entry.attr,
@@ -2031,6 +2266,8 @@ static struct attribute *default_attrs[] = {
 	&as_anticexpire_entry.attr,
 	&as_read_batchexpire_entry.attr,
 	&as_write_batchexpire_entry.attr,
+	&as_antic_adaptive_entry.attr,
+	&as_antic_max_depth_entry.attr,
 	NULL,
 };
 
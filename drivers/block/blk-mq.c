@@ -0,0 +1,472 @@
+/*
+ * Multi-queue block layer
+ *
+ * For devices that take commands on several hardware queues at once,
+ * typically flash.  The classic request_queue funnels every bio through
+ * one queue_lock and one io scheduler, which caps such a device at what
+ * one lock can pass.  Here each cpu builds requests on its own software
+ * queue (struct blk_mq_ctx) and hands them to the hardware queue it maps
+ * to (struct blk_mq_hw_ctx).  Requests are preallocated per hardware
+ * queue and indexed by a tag taken from a lockless bitmap, so a bio's
+ * way to the driver takes no lock shared between cpus except the one of
+ * its hardware queue's tag word.
+ *
+ * There is no io scheduler and no merging: the devices this is for gain
+ * nothing from either.  See Documentation/block/blk-mq.txt.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/blktrace.h>
+#include <linux/genhd.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+
+static int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *hint)
+{
+	unsigned int tag = *hint;
+	int wrapped = 0;
+
+	for (;;) {
+		if (tag >= tags->nr_tags) {
+			if (wrapped)
+				return -1;
+			wrapped = 1;
+			tag = 0;
+		}
+		tag = find_next_zero_bit(tags->map, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags)
+			continue;
+		if (!test_and_set_bit(tag, tags->map))
+			break;
+		tag++;
+	}
+
+	*hint = tag + 1;
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	smp_mb__before_clear_bit();
+	clear_bit(tag, tags->map);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware queue mapping
+ * @q:		the queue
+ * @cpu:	the cpu
+ **/
+struct blk_mq_hw_ctx *blk_mq_map_queue(request_queue_t *q, const int cpu)
+{
+	return q->queue_hw_ctx[cpu % q->nr_hw_queues];
+}
+
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+/*
+ * Take a tag on the hardware queue of the current cpu, sleeping for one
+ * unless the bio is readahead.
+ */
+static struct request *blk_mq_alloc_request(request_queue_t *q,
+					    struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct blk_mq_hw_ctx *hctx;
+	struct request *rq;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	ctx = per_cpu_ptr(q->queue_ctx, get_cpu());
+	hctx = ctx->hctx;
+	tag = blk_mq_get_tag(&hctx->tags, &ctx->last_tag);
+	put_cpu();
+
+	if (tag < 0) {
+		if (bio_rw_ahead(bio))
+			return NULL;
+
+		blk_add_trace_bio(q, bio, BLK_TA_SLEEPRQ);
+		for (;;) {
+			prepare_to_wait_exclusive(&hctx->tags.wait, &wait,
+						  TASK_UNINTERRUPTIBLE);
+			tag = blk_mq_get_tag(&hctx->tags, &ctx->last_tag);
+			if (tag >= 0)
+				break;
+			io_schedule();
+		}
+		finish_wait(&hctx->tags.wait, &wait);
+	}
+
+	rq = &hctx->rqs[tag];
+	memset(rq, 0, sizeof(*rq));
+	INIT_LIST_HEAD(&rq->queuelist);
+	INIT_LIST_HEAD(&rq->donelist);
+	rq->rq_status = RQ_ACTIVE;
+	rq->ref_count = 1;
+	rq->q = q;
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	return rq;
+}
+
+static void blk_mq_bio_to_request(struct request *rq, struct bio *bio)
+{
+	blk_rq_bio_prep(rq->q, rq, bio);
+
+	rq->flags |= REQ_CMD;
+	if (bio_rw_ahead(bio) || bio_failfast(bio))
+		rq->flags |= REQ_FAILFAST;
+	rq->hard_sector = rq->sector = bio->bi_sector;
+	rq->rq_disk = bio->bi_bdev->bd_disk;
+	rq->start_time = jiffies;
+	blk_rq_init_latency(rq);
+}
+
+/*
+ * Hand everything queued for hctx to the driver.  Runs concurrently on
+ * any number of cpus; only the lists are locked.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	request_queue_t *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int i;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/* requests turned away last time go first */
+	if (!list_empty(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for (i = 0; i < hctx->nr_ctx; i++) {
+		ctx = hctx->ctxs[i];
+		if (list_empty(&ctx->rq_list))
+			continue;
+		spin_lock(&ctx->lock);
+		list_splice_init(&ctx->rq_list, rq_list.prev);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_entry(rq_list.next, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+		rq->issue_ns = sched_clock();
+		switch (q->mq_ops->queue_rq(hctx, rq)) {
+		case BLK_MQ_RQ_QUEUE_OK:
+			continue;
+		case BLK_MQ_RQ_QUEUE_BUSY:
+			/*
+			 * Keep the rest in order for when the driver
+			 * restarts the queue.
+			 */
+			blk_add_trace_rq(q, rq, BLK_TA_REQUEUE);
+			list_add(&rq->queuelist, &rq_list);
+			spin_lock(&hctx->lock);
+			list_splice(&rq_list, &hctx->dispatch);
+			spin_unlock(&hctx->lock);
+			return;
+		default:
+			printk(KERN_ERR "blk-mq: bad return from queue_rq\n");
+			/* fall through */
+		case BLK_MQ_RQ_QUEUE_ERROR:
+			blk_mq_end_io(rq, -EIO);
+			break;
+		}
+	}
+}
+
+static void blk_mq_run_work_fn(void *data)
+{
+	__blk_mq_run_hw_queue(data);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the requests waiting for a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave it to kblockd instead of dispatching from this context
+ *
+ * Description:
+ *    From interrupt context the run is always left to kblockd.
+ **/
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, int async)
+{
+	if (async || in_interrupt())
+		kblockd_schedule_work(&hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(request_queue_t *q, int async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *    For drivers that run out of room, usually together with returning
+ *    BLK_MQ_RQ_QUEUE_BUSY from queue_rq.  New requests collect on the
+ *    software queues until blk_mq_start_hw_queue().
+ **/
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+/**
+ * blk_mq_start_hw_queue - restart a stopped hardware queue
+ * @hctx:	the hardware queue
+ *
+ * Description:
+ *    May be called from interrupt context; dispatch resumes from kblockd.
+ **/
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	blk_mq_run_hw_queue(hctx, 1);
+}
+
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+/**
+ * blk_mq_end_io - end I/O on a whole request
+ * @rq:		the request
+ * @error:	0 or a negative errno
+ *
+ * Description:
+ *    Completes every bio of @rq and gives its tag back.  Takes no lock
+ *    and may be called from any context, for example from the queue's
+ *    softirq_done_fn after blk_complete_request().
+ **/
+void blk_mq_end_io(struct request *rq, int error)
+{
+	struct blk_mq_hw_ctx *hctx = rq->mq_ctx->hctx;
+	struct gendisk *disk = rq->rq_disk;
+
+	end_that_request_first(rq, error ? error : 1, rq->hard_nr_sectors);
+
+	if (disk && blk_fs_request(rq)) {
+		unsigned long duration = jiffies - rq->start_time;
+
+		if (rq_data_dir(rq) == WRITE) {
+			disk_stat_inc(disk, writes);
+			disk_stat_add(disk, write_ticks, duration);
+		} else {
+			disk_stat_inc(disk, reads);
+			disk_stat_add(disk, read_ticks, duration);
+		}
+		blk_account_latency(rq);
+	}
+
+	rq->rq_status = RQ_INACTIVE;
+	blk_mq_put_tag(&hctx->tags, rq->tag);
+}
+
+EXPORT_SYMBOL(blk_mq_end_io);
+
+static int blk_mq_make_request(request_queue_t *q, struct bio *bio)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	blk_queue_bounce(q, &bio);
+
+	blk_add_trace_bio(q, bio, BLK_TA_QUEUE);
+
+	/* no ordering across hardware queues */
+	if (unlikely(bio_barrier(bio))) {
+		bio_endio(bio, bio->bi_size, -EOPNOTSUPP);
+		return 0;
+	}
+
+	rq = blk_mq_alloc_request(q, bio);
+	if (!rq) {
+		bio_endio(bio, bio->bi_size, -EWOULDBLOCK);
+		return 0;
+	}
+	blk_mq_bio_to_request(rq, bio);
+
+	if (rq->rq_disk) {
+		if (rq_data_dir(rq) == WRITE)
+			disk_stat_add(rq->rq_disk, write_sectors, rq->nr_sectors);
+		else
+			disk_stat_add(rq->rq_disk, read_sectors, rq->nr_sectors);
+	}
+
+	blk_add_trace_rq(q, rq, BLK_TA_INSERT);
+
+	ctx = rq->mq_ctx;
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock(&ctx->lock);
+
+	blk_mq_run_hw_queue(ctx->hctx, 0);
+	return 0;
+}
+
+/*
+ * Requests are started as soon as they are queued; this only picks up
+ * what a stopped queue left behind.
+ */
+static void blk_mq_unplug(request_queue_t *q)
+{
+	blk_mq_run_queues(q, 0);
+}
+
+static int blk_mq_init_hw_ctx(request_queue_t *q, struct blk_mq_hw_ctx *hctx,
+			      unsigned int depth)
+{
+	unsigned int map_size;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn, hctx);
+	hctx->queue = q;
+
+	hctx->ctxs = kmalloc(NR_CPUS * sizeof(struct blk_mq_ctx *), GFP_KERNEL);
+	if (!hctx->ctxs)
+		return -ENOMEM;
+
+	map_size = BITS_TO_LONGS(depth) * sizeof(unsigned long);
+	hctx->tags.map = kmalloc(map_size, GFP_KERNEL);
+	if (!hctx->tags.map)
+		return -ENOMEM;
+	memset(hctx->tags.map, 0, map_size);
+	hctx->tags.nr_tags = depth;
+	init_waitqueue_head(&hctx->tags.wait);
+
+	hctx->rqs = kmalloc(depth * sizeof(struct request), GFP_KERNEL);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	hardware queues, their depth and the driver's operations
+ * @driver_data: stored in q->queuedata and passed to ops->init_hctx
+ *
+ * Description:
+ *    The queue is torn down with blk_cleanup_queue() as usual.  Returns
+ *    NULL on failure.
+ **/
+request_queue_t *blk_mq_init_queue(struct blk_mq_reg *reg, void *driver_data)
+{
+	map_queue_fn *map_queue;
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	request_queue_t *q;
+	unsigned int depth;
+	int i;
+
+	if (!reg->nr_hw_queues || !reg->queue_depth || !reg->ops->queue_rq)
+		return NULL;
+	depth = min_t(unsigned int, reg->queue_depth, BLK_MQ_MAX_DEPTH);
+
+	q = blk_alloc_queue(GFP_KERNEL);
+	if (!q)
+		return NULL;
+
+	q->mq_ops = reg->ops;
+	q->queuedata = driver_data;
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kmalloc(reg->nr_hw_queues * sizeof(hctx), GFP_KERNEL);
+	if (!q->queue_ctx || !q->queue_hw_ctx)
+		goto fail;
+	memset(q->queue_hw_ctx, 0, reg->nr_hw_queues * sizeof(hctx));
+	q->nr_hw_queues = reg->nr_hw_queues;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = kmalloc(sizeof(*hctx), GFP_KERNEL);
+		if (!hctx)
+			goto fail;
+		memset(hctx, 0, sizeof(*hctx));
+		q->queue_hw_ctx[i] = hctx;
+		hctx->queue_num = i;
+		if (blk_mq_init_hw_ctx(q, hctx, depth))
+			goto fail;
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			goto fail;
+	}
+
+	map_queue = reg->ops->map_queue ? reg->ops->map_queue :
+		blk_mq_map_queue;
+	for_each_cpu(i) {
+		ctx = per_cpu_ptr(q->queue_ctx, i);
+		memset(ctx, 0, sizeof(*ctx));
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		/* cpus sharing a tag map start searching it apart */
+		ctx->last_tag = (i * depth / NR_CPUS) % depth;
+		hctx = map_queue(q, i);
+		ctx->hctx = hctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	return q;
+
+fail:
+	blk_cleanup_queue(q);
+	return NULL;
+}
+
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue(), with the queue idle.
+ */
+void blk_mq_free_queue(request_queue_t *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	if (q->queue_hw_ctx) {
+		for (i = 0; i < q->nr_hw_queues; i++) {
+			hctx = q->queue_hw_ctx[i];
+			if (!hctx)
+				continue;
+			kfree(hctx->rqs);
+			kfree(hctx->tags.map);
+			kfree(hctx->ctxs);
+			kfree(hctx);
+		}
+		kfree(q->queue_hw_ctx);
+	}
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+}
@@ -0,0 +1,487 @@
+/*
+ * Block I/O tracing
+ *
+ * Each traced queue gets a directory block/<dev>/ in debugfs holding one
+ * trace<cpu> file per CPU and a "dropped" counter.  The hooks in
+ * ll_rw_blk.c and elevator.c append fixed size struct blk_io_trace
+ * records to the ring of the CPU they run on, with interrupts off and no
+ * shared cache lines, and readers drain the rings.  A full ring drops
+ * new records rather than stall I/O.
+ *
+ * The queue's blk_trace pointer is only looked at with interrupts
+ * disabled, so teardown clears it and waits with synchronize_kernel()
+ * before freeing the buffers.
+ */
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/blkdev.h>
+#include <linux/blktrace.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <asm/uaccess.h>
+
+#define BLK_TRACE_MAX_BUF	(16 << 20)	/* per CPU */
+
+enum {
+	Blktrace_setup = 1,
+	Blktrace_running,
+	Blktrace_stopped,
+};
+
+struct blk_trace;
+
+struct blk_trace_buf {
+	spinlock_t		lock;
+	struct blk_io_trace	*data;
+	unsigned long		nr;		/* records in data */
+	unsigned long		head;		/* records written */
+	unsigned long		tail;		/* records read */
+	u32			sequence;
+	unsigned int		dropped;
+	wait_queue_head_t	wait;
+	struct dentry		*dentry;
+	struct blk_trace	*bt;
+};
+
+struct blk_trace {
+	int			trace_state;
+	u16			act_mask;
+	u64			start_lba;
+	u64			end_lba;
+	u32			pid;
+	dev_t			dev;
+	atomic_t		refcnt;		/* setup + open files */
+	struct dentry		*dir;
+	struct dentry		*dropped_file;
+	struct blk_trace_buf	*bufs[NR_CPUS];
+};
+
+/* Serialises setup, teardown and opening of trace files */
+static DECLARE_MUTEX(blk_trace_sem);
+static struct dentry *blk_tree_root;
+static int blk_tree_users;
+
+void __blk_add_trace(request_queue_t *q, sector_t sector, int bytes,
+		     int rw, u32 what, int error)
+{
+	struct blk_trace *bt;
+	struct blk_trace_buf *buf;
+	struct blk_io_trace *t;
+	unsigned long flags;
+	int cpu;
+
+	what |= BLK_TC_ACT((rw & WRITE) ? BLK_TC_WRITE : BLK_TC_READ);
+	if (rw & (1 << BIO_RW_BARRIER))
+		what |= BLK_TC_ACT(BLK_TC_BARRIER);
+	if (rw & (1 << BIO_RW_SYNC))
+		what |= BLK_TC_ACT(BLK_TC_SYNC);
+
+	local_irq_save(flags);
+	bt = q->blk_trace;
+	if (!bt || bt->trace_state != Blktrace_running)
+		goto out;
+	if (!((bt->act_mask << BLK_TC_SHIFT) & what))
+		goto out;
+	if (bytes && bt->end_lba &&
+	    (sector < bt->start_lba || sector >= bt->end_lba))
+		goto out;
+	/* only queueing runs in the context of the submitter */
+	if (bt->pid && (what & BLK_TC_ACT(BLK_TC_QUEUE)) &&
+	    current->pid != bt->pid)
+		goto out;
+
+	cpu = smp_processor_id();
+	buf = bt->bufs[cpu];
+	spin_lock(&buf->lock);
+	if (buf->head - buf->tail >= buf->nr) {
+		buf->sequence++;
+		buf->dropped++;
+		spin_unlock(&buf->lock);
+		goto out;
+	}
+	t = &buf->data[buf->head % buf->nr];
+	t->magic = BLK_IO_TRACE_MAGIC | BLK_IO_TRACE_VERSION;
+	t->sequence = buf->sequence++;
+	t->time = sched_clock();
+	t->sector = sector;
+	t->bytes = bytes;
+	t->action = what;
+	t->pid = current->pid;
+	t->device = bt->dev;
+	t->cpu = cpu;
+	t->error = -error;
+	t->pad = 0;
+	buf->head++;
+	spin_unlock(&buf->lock);
+
+	if (waitqueue_active(&buf->wait))
+		wake_up_interruptible(&buf->wait);
+out:
+	local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL_GPL(__blk_add_trace);
+
+static void blk_trace_free(struct blk_trace *bt)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		if (bt->bufs[cpu]) {
+			vfree(bt->bufs[cpu]->data);
+			kfree(bt->bufs[cpu]);
+		}
+	}
+	kfree(bt);
+}
+
+static void blk_trace_put(struct blk_trace *bt)
+{
+	if (atomic_dec_and_test(&bt->refcnt))
+		blk_trace_free(bt);
+}
+
+static int blk_trace_open(struct inode *inode, struct file *file)
+{
+	struct blk_trace_buf *buf;
+
+	down(&blk_trace_sem);
+	buf = inode->u.generic_ip;
+	if (!buf) {
+		up(&blk_trace_sem);
+		return -ENODEV;
+	}
+	atomic_inc(&buf->bt->refcnt);
+	file->private_data = buf;
+	up(&blk_trace_sem);
+	return 0;
+}
+
+static int blk_trace_release(struct inode *inode, struct file *file)
+{
+	struct blk_trace_buf *buf = file->private_data;
+
+	blk_trace_put(buf->bt);
+	return 0;
+}
+
+/*
+ * Hand out whole records.  Blocks while the trace runs and the ring is
+ * empty; once tracing is stopped an empty ring reads as end of file.
+ */
+static ssize_t blk_trace_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct blk_trace_buf *buf = file->private_data;
+	struct blk_trace *bt = buf->bt;
+	struct blk_io_trace t;
+	size_t done = 0;
+	int ret;
+
+	if (count < sizeof(t))
+		return -EINVAL;
+
+	while (done + sizeof(t) <= count) {
+		spin_lock_irq(&buf->lock);
+		if (buf->tail == buf->head) {
+			spin_unlock_irq(&buf->lock);
+			if (done || bt->trace_state != Blktrace_running)
+				break;
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+			ret = wait_event_interruptible(buf->wait,
+				buf->tail != buf->head ||
+				bt->trace_state != Blktrace_running);
+			if (ret)
+				return ret;
+			continue;
+		}
+		t = buf->data[buf->tail % buf->nr];
+		buf->tail++;
+		spin_unlock_irq(&buf->lock);
+
+		if (copy_to_user(ubuf + done, &t, sizeof(t)))
+			return done ? done : -EFAULT;
+		done += sizeof(t);
+	}
+	return done;
+}
+
+static struct file_operations blk_trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= blk_trace_open,
+	.release	= blk_trace_release,
+	.read		= blk_trace_read,
+};
+
+static ssize_t blk_dropped_read(struct file *file, char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct blk_trace *bt = file->private_data;
+	unsigned long dropped = 0;
+	char tmp[24];
+	int cpu, len;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (bt->bufs[cpu])
+			dropped += bt->bufs[cpu]->dropped;
+	len = sprintf(tmp, "%lu\n", dropped);
+	if (*ppos >= len)
+		return 0;
+	if (count > len - *ppos)
+		count = len - *ppos;
+	if (copy_to_user(ubuf, tmp + *ppos, count))
+		return -EFAULT;
+	*ppos += count;
+	return count;
+}
+
+static int blk_dropped_open(struct inode *inode, struct file *file)
+{
+	down(&blk_trace_sem);
+	file->private_data = inode->u.generic_ip;
+	if (!file->private_data) {
+		up(&blk_trace_sem);
+		return -ENODEV;
+	}
+	atomic_inc(&((struct blk_trace *)file->private_data)->refcnt);
+	up(&blk_trace_sem);
+	return 0;
+}
+
+static int blk_dropped_release(struct inode *inode, struct file *file)
+{
+	blk_trace_put(file->private_data);
+	return 0;
+}
+
+static struct file_operations blk_dropped_fops = {
+	.owner		= THIS_MODULE,
+	.open		= blk_dropped_open,
+	.release	= blk_dropped_release,
+	.read		= blk_dropped_read,
+};
+
+/*
+ * Remove the debugfs entries.  Cut the inodes loose from the trace
+ * first, so that an open racing with us finds nothing.  Called with
+ * blk_trace_sem held.
+ */
+static void blk_trace_remove_files(struct blk_trace *bt)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		struct blk_trace_buf *buf = bt->bufs[cpu];
+
+		if (buf && buf->dentry) {
+			buf->dentry->d_inode->u.generic_ip = NULL;
+			debugfs_remove(buf->dentry);
+		}
+	}
+	if (bt->dropped_file) {
+		bt->dropped_file->d_inode->u.generic_ip = NULL;
+		debugfs_remove(bt->dropped_file);
+	}
+	if (bt->dir)
+		debugfs_remove(bt->dir);
+	if (!--blk_tree_users) {
+		debugfs_remove(blk_tree_root);
+		blk_tree_root = NULL;
+	}
+}
+
+static int blk_trace_setup(request_queue_t *q, struct block_device *bdev,
+			   char __user *arg)
+{
+	struct blk_user_trace_setup buts;
+	struct blk_trace *bt;
+	char name[BDEVNAME_SIZE], file[16];
+	unsigned long size;
+	int cpu, ret;
+
+	if (copy_from_user(&buts, arg, sizeof(buts)))
+		return -EFAULT;
+	if (!buts.buf_size || !buts.buf_nr)
+		return -EINVAL;
+	size = (unsigned long)buts.buf_size * buts.buf_nr;
+	if (size / buts.buf_nr != buts.buf_size || size > BLK_TRACE_MAX_BUF ||
+	    size < sizeof(struct blk_io_trace))
+		return -EINVAL;
+	if (q->blk_trace)
+		return -EBUSY;
+
+	bt = kmalloc(sizeof(*bt), GFP_KERNEL);
+	if (!bt)
+		return -ENOMEM;
+	memset(bt, 0, sizeof(*bt));
+	atomic_set(&bt->refcnt, 1);
+	bt->trace_state = Blktrace_setup;
+	bt->act_mask = buts.act_mask ? buts.act_mask : (u16) -1;
+	bt->start_lba = buts.start_lba;
+	bt->end_lba = buts.end_lba;
+	bt->pid = buts.pid;
+	bt->dev = bdev->bd_dev;
+
+	/* a partition only sees its own sectors */
+	if (bdev != bdev->bd_contains && !bt->end_lba) {
+		bt->start_lba = bdev->bd_part->start_sect;
+		bt->end_lba = bt->start_lba + bdev->bd_part->nr_sects;
+	}
+
+	ret = -ENOMEM;
+	for_each_cpu(cpu) {
+		struct blk_trace_buf *buf;
+
+		buf = kmalloc(sizeof(*buf), GFP_KERNEL);
+		if (!buf)
+			goto err;
+		memset(buf, 0, sizeof(*buf));
+		bt->bufs[cpu] = buf;
+		buf->nr = size / sizeof(struct blk_io_trace);
+		buf->data = vmalloc(buf->nr * sizeof(struct blk_io_trace));
+		if (!buf->data)
+			goto err;
+		spin_lock_init(&buf->lock);
+		init_waitqueue_head(&buf->wait);
+		buf->bt = bt;
+	}
+
+	bdevname(bdev, name);
+	if (!blk_tree_root) {
+		blk_tree_root = debugfs_create_dir("block", NULL);
+		if (!blk_tree_root)
+			goto err;
+	}
+	blk_tree_users++;
+	bt->dir = debugfs_create_dir(name, blk_tree_root);
+	if (!bt->dir)
+		goto err_files;
+	for_each_cpu(cpu) {
+		sprintf(file, "trace%d", cpu);
+		bt->bufs[cpu]->dentry = debugfs_create_file(file, 0400,
+				bt->dir, bt->bufs[cpu], &blk_trace_fops);
+		if (!bt->bufs[cpu]->dentry)
+			goto err_files;
+	}
+	bt->dropped_file = debugfs_create_file("dropped", 0444, bt->dir, bt,
+					       &blk_dropped_fops);
+	if (!bt->dropped_file)
+		goto err_files;
+
+	strncpy(buts.name, name, sizeof(buts.name));
+	buts.name[sizeof(buts.name) - 1] = 0;
+	ret = -EFAULT;
+	if (copy_to_user(arg, &buts, sizeof(buts)))
+		goto err_files;
+
+	/*
+	 * Not under q->queue_lock: queues from blk_alloc_queue() have none.
+	 * blk_trace_sem serialises us, and xchg() orders the setup above
+	 * before __blk_add_trace() can see bt.
+	 */
+	xchg(&q->blk_trace, bt);
+	return 0;
+
+err_files:
+	blk_trace_remove_files(bt);
+err:
+	blk_trace_free(bt);
+	return ret;
+}
+
+static int blk_trace_startstop(request_queue_t *q, int start)
+{
+	struct blk_trace *bt = q->blk_trace;
+	int cpu;
+
+	if (!bt)
+		return -EINVAL;
+
+	if (start) {
+		if (bt->trace_state == Blktrace_running)
+			return -EINVAL;
+		bt->trace_state = Blktrace_running;
+		return 0;
+	}
+
+	if (bt->trace_state != Blktrace_running)
+		return -EINVAL;
+	bt->trace_state = Blktrace_stopped;
+	/* let blocked readers see the end of the trace */
+	for (cpu = 0; cpu < NR_CPUS; cpu++)
+		if (bt->bufs[cpu])
+			wake_up_interruptible(&bt->bufs[cpu]->wait);
+	return 0;
+}
+
+static int blk_trace_remove(request_queue_t *q)
+{
+	struct blk_trace *bt = q->blk_trace;
+
+	if (!bt)
+		return -EINVAL;
+	if (bt->trace_state == Blktrace_running)
+		blk_trace_startstop(q, 0);
+
+	xchg(&q->blk_trace, NULL);
+	/* every __blk_add_trace() that saw bt has finished */
+	synchronize_kernel();
+
+	blk_trace_remove_files(bt);
+	blk_trace_put(bt);
+	return 0;
+}
+
+/**
+ * blk_trace_ioctl - handle the BLKTRACE* ioctls
+ * @bdev:	the block device
+ * @cmd:	the ioctl cmd
+ * @arg:	the argument data, if any
+ */
+int blk_trace_ioctl(struct block_device *bdev, unsigned cmd, char __user *arg)
+{
+	request_queue_t *q = bdev_get_queue(bdev);
+	int ret;
+
+	if (!q)
+		return -ENXIO;
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+
+	down(&blk_trace_sem);
+	switch (cmd) {
+	case BLKTRACESETUP:
+		ret = blk_trace_setup(q, bdev, arg);
+		break;
+	case BLKTRACESTART:
+		ret = blk_trace_startstop(q, 1);
+		break;
+	case BLKTRACESTOP:
+		ret = blk_trace_startstop(q, 0);
+		break;
+	case BLKTRACETEARDOWN:
+		ret = blk_trace_remove(q);
+		break;
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	up(&blk_trace_sem);
+	return ret;
+}
+
+/**
+ * blk_trace_shutdown - stop and tear down tracing of a dying queue
+ * @q:	the request queue
+ */
+void blk_trace_shutdown(request_queue_t *q)
+{
+	down(&blk_trace_sem);
+	if (q->blk_trace)
+		blk_trace_remove(q);
+	up(&blk_trace_sem);
+}
@@ -21,6 +21,7 @@
 #include <linux/hash.h>
 #include <linux/rbtree.h>
 #include <linux/mempool.h>
+#include <linux/ioprio.h>
 
 static unsigned long max_elapsed_crq;
 static unsigned long max_elapsed_dispatch;
@@ -30,12 +31,26 @@ static unsigned long max_elapsed_dispatch;
  */
 static int cfq_quantum = 4;		/* max queue in one round of service */
 static int cfq_queued = 8;		/* minimum rq allocate limit per-queue*/
-static int cfq_service = HZ;		/* period over which service is avg */
 static int cfq_fifo_expire_r = HZ / 2;	/* fifo timeout for sync requests */
 static int cfq_fifo_expire_w = 5 * HZ;	/* fifo timeout for async requests */
 static int cfq_fifo_rate = HZ / 8;	/* fifo expiry rate */
 static int cfq_back_max = 16 * 1024;	/* maximum backwards seek, in KiB */
 static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
+static int cfq_slice_sync = HZ / 10;	/* base time slice of a sync queue */
+static int cfq_slice_async = HZ / 25;	/* base time slice of an async queue */
+static int cfq_slice_async_rq = 2;	/* base requests per async slice */
+static int cfq_slice_idle = HZ / 125;	/* how long to wait for the next io */
+
+/*
+ * slices are scaled by priority: each level is worth 1/CFQ_SLICE_SCALE
+ * of the base slice, level 4 gets exactly the base
+ */
+#define CFQ_SLICE_SCALE		(5)
+
+/*
+ * idle class io is only served once the disk has been quiet this long
+ */
+#define CFQ_IDLE_GRACE		(HZ / 10)
 
 /*
  * for the hash of cfqq inside the cfqd
@@ -76,9 +91,10 @@ static int cfq_back_penalty = 2;	/* penalty of a backwards seek */
 #define rq_rb_key(rq)		(rq)->sector
 
 /*
- * threshold for switching off non-tag accounting
+ * one round robin list per io priority class
  */
-#define CFQ_MAX_TAG		(4)
+#define CFQ_NR_CLASSES		(3)
+#define cfq_class_list(cfqd, class)	(&(cfqd)->rr_list[(class) - IOPRIO_CLASS_RT])
 
 /*
  * sort key types and names
@@ -98,7 +114,8 @@ static kmem_cache_t *cfq_pool;
 static kmem_cache_t *cfq_ioc_pool;
 
 struct cfq_data {
-	struct list_head rr_list;
+	/* busy queues of each class, rt sorted by level, be and idle fifo */
+	struct list_head rr_list[CFQ_NR_CLASSES];
 	struct list_head empty_list;
 
 	struct hlist_head *cfq_hash;
@@ -121,6 +138,18 @@ struct cfq_data {
 
 	int rq_in_driver;
 
+	/* queue owning the current time slice */
+	struct cfq_queue *active_queue;
+	/* ends the wait for the next request of an idling active_queue */
+	struct timer_list idle_slice_timer;
+	/* rechecks idle class queues after CFQ_IDLE_GRACE */
+	struct timer_list idle_class_timer;
+	/* runs the queue from process context after a timer or completion */
+	struct work_struct unplug_work;
+
+	/* last completion of non-idle class io */
+	unsigned long last_end_request;
+
 	/*
 	 * tunables, see top of file
 	 */
@@ -132,8 +161,9 @@ struct cfq_data {
 	unsigned int cfq_back_penalty;
 	unsigned int cfq_back_max;
 	unsigned int find_best_crq;
-
-	unsigned int cfq_tagged;
+	unsigned int cfq_slice[2];
+	unsigned int cfq_slice_async_rq;
+	unsigned int cfq_slice_idle;
 };
 
 struct cfq_queue {
@@ -164,15 +194,31 @@ struct cfq_queue {
 
 	int key_type;
 
-	unsigned long service_start;
-	unsigned long service_used;
-
-	unsigned int max_rate;
-
 	/* number of requests that have been handed to the driver */
 	int in_flight;
 	/* number of currently allocated requests */
 	int alloc_limit[2];
+
+	/* io priority class and level, taken from the allocating task */
+	unsigned short ioprio_class;
+	unsigned short ioprio;
+
+	/* end of the current slice, 0 until the first dispatch in it */
+	unsigned long slice_end;
+	/* requests dispatched in the current slice */
+	int slice_dispatch;
+	/* slice was started with sync io pending */
+	unsigned int slice_sync : 1;
+	/* idle_slice_timer armed, waiting for a new request */
+	unsigned int wait_request : 1;
+	/* owner usually issues its next sync io within cfq_slice_idle */
+	unsigned int idle_window : 1;
+
+	/* think time: from completion of sync io to the next sync request */
+	unsigned long last_end_request;
+	unsigned long ttime_total;
+	unsigned long ttime_samples;
+	unsigned long ttime_mean;
 };
 
 struct cfq_rq {
@@ -198,6 +244,26 @@ static void cfq_dispatch_sort(request_queue_t *, struct cfq_rq *);
 static void cfq_update_next_crq(struct cfq_rq *);
 static void cfq_put_cfqd(struct cfq_data *cfqd);
 
+static inline int cfq_class_idle(struct cfq_queue *cfqq)
+{
+	return cfqq->ioprio_class == IOPRIO_CLASS_IDLE;
+}
+
+static inline int cfq_class_rt(struct cfq_queue *cfqq)
+{
+	return cfqq->ioprio_class == IOPRIO_CLASS_RT;
+}
+
+/*
+ * run the queue from kblockd, for callers that can't call ->request_fn
+ * themselves (timers, and paths already inside the io scheduler)
+ */
+static inline void cfq_schedule_dispatch(struct cfq_data *cfqd)
+{
+	if (cfqd->busy_queues)
+		kblockd_schedule_work(&cfqd->unplug_work);
+}
+
 /*
  * what the fairness is based on (ie how processes are grouped and
  * differentiated)
@@ -401,66 +467,35 @@ static void cfq_update_next_crq(struct cfq_rq *crq)
 		cfqq->next_crq = cfq_find_next_crq(cfqq->cfqd, cfqq, crq);
 }
 
-static int cfq_check_sort_rr_list(struct cfq_queue *cfqq)
-{
-	struct list_head *head = &cfqq->cfqd->rr_list;
-	struct list_head *next, *prev;
-
-	/*
-	 * list might still be ordered
-	 */
-	next = cfqq->cfq_list.next;
-	if (next != head) {
-		struct cfq_queue *cnext = list_entry_cfqq(next);
-
-		if (cfqq->service_used > cnext->service_used)
-			return 1;
-	}
-
-	prev = cfqq->cfq_list.prev;
-	if (prev != head) {
-		struct cfq_queue *cprev = list_entry_cfqq(prev);
-
-		if (cfqq->service_used < cprev->service_used)
-			return 1;
-	}
-
-	return 0;
-}
-
-static void cfq_sort_rr_list(struct cfq_queue *cfqq, int new_queue)
+/*
+ * put a busy queue back in line. realtime queues are kept sorted by level,
+ * a queue goes behind those of the same level. best-effort and idle queues
+ * are served round robin, their level only sets the length of their slice.
+ * a preempted queue goes to the front, it still has slice left.
+ */
+static void cfq_resort_rr_list(struct cfq_queue *cfqq, int preempted)
 {
-	struct list_head *entry = &cfqq->cfqd->rr_list;
+	struct cfq_data *cfqd = cfqq->cfqd;
+	struct list_head *list, *entry;
 
 	if (!cfqq->on_rr)
 		return;
-	if (!new_queue && !cfq_check_sort_rr_list(cfqq))
-		return;
 
 	list_del(&cfqq->cfq_list);
 
-	/*
-	 * sort by our mean service_used, sub-sort by in-flight requests
-	 */
-	while ((entry = entry->prev) != &cfqq->cfqd->rr_list) {
-		struct cfq_queue *__cfqq = list_entry_cfqq(entry);
+	list = cfq_class_list(cfqd, cfqq->ioprio_class);
+	entry = list->prev;
 
-		if (cfqq->service_used > __cfqq->service_used)
-			break;
-		else if (cfqq->service_used == __cfqq->service_used) {
-			struct list_head *prv;
-
-			while ((prv = entry->prev) != &cfqq->cfqd->rr_list) {
-				__cfqq = list_entry_cfqq(prv);
+	if (preempted)
+		entry = list;
+	else if (cfq_class_rt(cfqq)) {
+		while (entry != list) {
+			struct cfq_queue *__cfqq = list_entry_cfqq(entry);
 
-				WARN_ON(__cfqq->service_used > cfqq->service_used);
-				if (cfqq->service_used != __cfqq->service_used)
-					break;
-				if (cfqq->in_flight > __cfqq->in_flight)
-					break;
+			if (__cfqq->ioprio <= cfqq->ioprio)
+				break;
 
-				entry = prv;
-			}
+			entry = entry->prev;
 		}
 	}
 
@@ -468,8 +503,7 @@ static void cfq_sort_rr_list(struct cfq_queue *cfqq, int new_queue)
 }
 
 /*
- * add to busy list of queues for service, trying to be fair in ordering
- * the pending list according to requests serviced
+ * add to busy list of queues for service
  */
 static inline void
 cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
@@ -480,10 +514,7 @@ cfq_add_cfqq_rr(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	cfqq->on_rr = 1;
 	cfqd->busy_queues++;
 
-	if (time_after(jiffies, cfqq->service_start + cfq_service))
-		cfqq->service_used >>= 3;
-
-	cfq_sort_rr_list(cfqq, 1);
+	cfq_resort_rr_list(cfqq, 0);
 }
 
 static inline void
@@ -617,11 +648,6 @@ static void cfq_requeue_request(request_queue_t *q, struct request *rq)
 	if (crq) {
 		struct cfq_queue *cfqq = crq->cfq_queue;
 
-		if (cfqq->cfqd->cfq_tagged) {
-			cfqq->service_used--;
-			cfq_sort_rr_list(cfqq, 0);
-		}
-
 		if (crq->accounted) {
 			crq->accounted = 0;
 			cfqq->cfqd->rq_in_driver--;
@@ -816,46 +842,240 @@ cfq_dispatch_request(request_queue_t *q, struct cfq_data *cfqd,
 	cfq_dispatch_sort(q, crq);
 }
 
-static int cfq_dispatch_requests(request_queue_t *q, int max_dispatch)
+/*
+ * length of a time slice: level 0 gets 1.8, level 7 0.4 times the base
+ */
+static inline int
+cfq_prio_slice(struct cfq_data *cfqd, int sync, unsigned short prio)
 {
-	struct cfq_data *cfqd = q->elevator->elevator_data;
-	struct cfq_queue *cfqq;
-	struct list_head *entry, *tmp;
-	int queued, busy_queues, first_round;
+	const int base_slice = cfqd->cfq_slice[sync];
+
+	WARN_ON(prio >= IOPRIO_BE_NR);
+
+	return base_slice + (base_slice / CFQ_SLICE_SCALE * (4 - prio));
+}
+
+/*
+ * async slices are counted in requests rather than time, writes mostly
+ * complete into the drive cache
+ */
+static inline int cfq_prio_to_maxrq(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	const int base_rq = cfqd->cfq_slice_async_rq;
 
-	if (list_empty(&cfqd->rr_list))
+	WARN_ON(cfqq->ioprio >= IOPRIO_BE_NR);
+
+	return 2 * (base_rq + base_rq * (IOPRIO_BE_NR - 1 - cfqq->ioprio));
+}
+
+static void cfq_set_active_queue(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	if (cfqq) {
+		cfqq->slice_end = 0;
+		cfqq->slice_dispatch = 0;
+		cfqq->slice_sync = 0;
+		cfqq->wait_request = 0;
+	}
+
+	cfqd->active_queue = cfqq;
+}
+
+/*
+ * current slice is done, put the queue back in line
+ */
+static void
+__cfq_slice_expired(struct cfq_data *cfqd, struct cfq_queue *cfqq, int preempted)
+{
+	if (cfqq->wait_request) {
+		cfqq->wait_request = 0;
+		del_timer(&cfqd->idle_slice_timer);
+	}
+
+	cfq_resort_rr_list(cfqq, preempted);
+
+	if (cfqq == cfqd->active_queue)
+		cfqd->active_queue = NULL;
+}
+
+static inline void cfq_slice_expired(struct cfq_data *cfqd, int preempted)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (cfqq)
+		__cfq_slice_expired(cfqd, cfqq, preempted);
+}
+
+/*
+ * the active queue ran dry. if its owner usually comes back with more
+ * sync io quickly, keep the disk for it a little longer instead of
+ * seeking away. returns 1 if the timer was armed.
+ */
+static int cfq_arm_slice_timer(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long sl = cfqd->cfq_slice_idle;
+
+	WARN_ON(!RB_EMPTY(&cfqq->sort_list));
+	WARN_ON(cfqq != cfqd->active_queue);
+
+	if (!sl || !cfqq->slice_sync || !cfqq->idle_window)
 		return 0;
 
-	queued = 0;
-	first_round = 1;
-restart:
-	busy_queues = 0;
-	list_for_each_safe(entry, tmp, &cfqd->rr_list) {
-		cfqq = list_entry_cfqq(entry);
+	/*
+	 * don't wait past the end of the slice
+	 */
+	if (cfqq->slice_end) {
+		if (!time_before(jiffies, cfqq->slice_end))
+			return 0;
 
-		BUG_ON(RB_EMPTY(&cfqq->sort_list));
+		sl = min(sl, cfqq->slice_end - jiffies);
+	}
 
-		/*
-		 * first round of queueing, only select from queues that
-		 * don't already have io in-flight
-		 */
-		if (first_round && cfqq->in_flight)
-			continue;
+	cfqq->wait_request = 1;
+	mod_timer(&cfqd->idle_slice_timer, jiffies + sl);
+	return 1;
+}
 
-		cfq_dispatch_request(q, cfqd, cfqq);
+/*
+ * pick the queue to get the next slice: realtime first, then best-effort.
+ * idle class queues only once the disk has had no other io for
+ * CFQ_IDLE_GRACE, unless we are draining everything (force).
+ */
+static struct cfq_queue *cfq_get_next_queue(struct cfq_data *cfqd, int force)
+{
+	struct list_head *list;
+	unsigned long end;
+
+	list = cfq_class_list(cfqd, IOPRIO_CLASS_RT);
+	if (!list_empty(list))
+		return list_entry_cfqq(list->next);
+
+	list = cfq_class_list(cfqd, IOPRIO_CLASS_BE);
+	if (!list_empty(list))
+		return list_entry_cfqq(list->next);
+
+	list = cfq_class_list(cfqd, IOPRIO_CLASS_IDLE);
+	if (list_empty(list))
+		return NULL;
+
+	if (force)
+		return list_entry_cfqq(list->next);
+
+	/*
+	 * other io still in the drive: the last completion will get us
+	 * back here
+	 */
+	if (cfqd->rq_in_driver)
+		return NULL;
+
+	end = cfqd->last_end_request + CFQ_IDLE_GRACE;
+	if (!time_before(jiffies, end))
+		return list_entry_cfqq(list->next);
+
+	if (!timer_pending(&cfqd->idle_class_timer))
+		mod_timer(&cfqd->idle_class_timer, end);
 
-		if (!RB_EMPTY(&cfqq->sort_list))
-			busy_queues++;
+	return NULL;
+}
 
-		queued++;
+/*
+ * get the queue to dispatch from. the active queue keeps the disk until its
+ * slice is used up, or it runs dry and is not worth waiting for. returns
+ * NULL while we wait.
+ */
+static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd, int force)
+{
+	struct cfq_queue *cfqq = cfqd->active_queue;
+
+	if (!cfqq)
+		goto new_queue;
+
+	if (cfqq->slice_end && time_after(jiffies, cfqq->slice_end))
+		goto expire;
+
+	if (!RB_EMPTY(&cfqq->sort_list))
+		goto keep_queue;
+
+	/*
+	 * wait for the io in flight to complete, the completion decides
+	 * whether to idle. or we are idling already.
+	 */
+	if (!force && cfqq->slice_sync && cfqq->idle_window) {
+		if (cfqq->wait_request || cfqq->in_flight)
+			return NULL;
+		if (cfq_arm_slice_timer(cfqd, cfqq))
+			return NULL;
 	}
 
-	if ((queued < max_dispatch) && (busy_queues || first_round)) {
-		first_round = 0;
-		goto restart;
+expire:
+	cfq_slice_expired(cfqd, 0);
+new_queue:
+	cfqq = cfq_get_next_queue(cfqd, force);
+	cfq_set_active_queue(cfqd, cfqq);
+keep_queue:
+	return cfqq;
+}
+
+static int
+__cfq_dispatch_requests(request_queue_t *q, struct cfq_data *cfqd,
+			struct cfq_queue *cfqq, int max_dispatch)
+{
+	int dispatched = 0;
+
+	BUG_ON(RB_EMPTY(&cfqq->sort_list));
+
+	/*
+	 * the slice starts with its first request, the queue may have had
+	 * to wait for the disk to be idle
+	 */
+	if (!cfqq->slice_end) {
+		cfqq->slice_sync = cfqq->queued[1] != 0;
+		cfqq->slice_end = jiffies +
+			cfq_prio_slice(cfqd, cfqq->slice_sync, cfqq->ioprio);
 	}
 
-	return queued;
+	do {
+		cfq_dispatch_request(q, cfqd, cfqq);
+
+		dispatched++;
+		cfqq->slice_dispatch++;
+
+		if (RB_EMPTY(&cfqq->sort_list))
+			break;
+	} while (dispatched < max_dispatch);
+
+	/*
+	 * idle class queues get a single request per turn, async slices end
+	 * after a number of requests
+	 */
+	if (cfq_class_idle(cfqq) || (!cfqq->slice_sync &&
+	    cfqq->slice_dispatch >= cfq_prio_to_maxrq(cfqd, cfqq)))
+		cfq_slice_expired(cfqd, 0);
+
+	return dispatched;
+}
+
+/*
+ * move up to max_dispatch requests of the active queue to the dispatch
+ * list. with force set nothing is held back, used to drain the scheduler.
+ */
+static int cfq_dispatch_requests(request_queue_t *q, int max_dispatch, int force)
+{
+	struct cfq_data *cfqd = q->elevator->elevator_data;
+	struct cfq_queue *cfqq;
+
+	if (!cfqd->busy_queues)
+		return 0;
+
+	cfqq = cfq_select_queue(cfqd, force);
+	if (!cfqq)
+		return 0;
+
+	if (cfqq->wait_request) {
+		cfqq->wait_request = 0;
+		del_timer(&cfqd->idle_slice_timer);
+	}
+
+	return __cfq_dispatch_requests(q, cfqd, cfqq, max_dispatch);
 }
 
 static inline void cfq_account_dispatch(struct cfq_rq *crq)
@@ -875,42 +1095,20 @@ static inline void cfq_account_dispatch(struct cfq_rq *crq)
 		return;
 
 	now = jiffies;
-	if (cfqq->service_start == ~0UL)
-		cfqq->service_start = now;
-
-	/*
-	 * on drives with tagged command queueing, command turn-around time
-	 * doesn't necessarily reflect the time spent processing this very
-	 * command inside the drive. so do the accounting differently there,
-	 * by just sorting on the number of requests
-	 */
-	if (cfqd->cfq_tagged) {
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used /= 10;
-		}
-
-		cfqq->service_used++;
-		cfq_sort_rr_list(cfqq, 0);
-	}
-
 	elapsed = now - crq->queue_start;
 	if (elapsed > max_elapsed_dispatch)
 		max_elapsed_dispatch = elapsed;
 
 	crq->accounted = 1;
 	crq->service_start = now;
-
-	if (++cfqd->rq_in_driver >= CFQ_MAX_TAG && !cfqd->cfq_tagged) {
-		cfqq->cfqd->cfq_tagged = 1;
-		printk("cfq: depth %d reached, tagging now on\n", CFQ_MAX_TAG);
-	}
+	cfqd->rq_in_driver++;
 }
 
 static inline void
 cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 {
 	struct cfq_data *cfqd = cfqq->cfqd;
+	unsigned long duration;
 
 	if (!crq->accounted)
 		return;
@@ -918,21 +1116,9 @@ cfq_account_completion(struct cfq_queue *cfqq, struct cfq_rq *crq)
 	WARN_ON(!cfqd->rq_in_driver);
 	cfqd->rq_in_driver--;
 
-	if (!cfqd->cfq_tagged) {
-		unsigned long now = jiffies;
-		unsigned long duration = now - crq->service_start;
-
-		if (time_after(now, cfqq->service_start + cfq_service)) {
-			cfqq->service_start = now;
-			cfqq->service_used >>= 3;
-		}
-
-		cfqq->service_used += duration;
-		cfq_sort_rr_list(cfqq, 0);
-
-		if (duration > max_elapsed_crq)
-			max_elapsed_crq = duration;
-	}
+	duration = jiffies - crq->service_start;
+	if (duration > max_elapsed_crq)
+		max_elapsed_crq = duration;
 }
 
 static struct request *cfq_next_request(request_queue_t *q)
@@ -953,7 +1139,7 @@ dispatch:
 		return rq;
 	}
 
-	if (cfq_dispatch_requests(q, cfqd->cfq_quantum))
+	if (cfq_dispatch_requests(q, cfqd->cfq_quantum, 0))
 		goto dispatch;
 
 	return NULL;
@@ -975,6 +1161,9 @@ static void cfq_put_queue(struct cfq_queue *cfqq)
 	BUG_ON(rb_first(&cfqq->sort_list));
 	BUG_ON(cfqq->on_rr);
 
+	if (unlikely(cfqq->cfqd->active_queue == cfqq))
+		__cfq_slice_expired(cfqq->cfqd, cfqq, 0);
+
 	cfq_put_cfqd(cfqq->cfqd);
 
 	/*
@@ -1219,7 +1408,6 @@ retry:
 		cfqq->cfqd = cfqd;
 		atomic_inc(&cfqd->ref);
 		cfqq->key_type = cfqd->key_type;
-		cfqq->service_start = ~0UL;
 	}
 
 	if (new_cfqq)
@@ -1231,6 +1419,77 @@ out:
 	return cfqq;
 }
 
+/*
+ * take the io priority of the task allocating a request for the queue.
+ * tasks without one are best-effort at the level of their nice value.
+ */
+static void cfq_init_prio_data(struct cfq_queue *cfqq, struct task_struct *tsk)
+{
+	const int ioprio = task_ioprio(tsk);
+	unsigned short ioprio_class, prio;
+
+	ioprio_class = IOPRIO_PRIO_CLASS(ioprio);
+	if (ioprio_class == IOPRIO_CLASS_IDLE)
+		prio = IOPRIO_BE_NR - 1;
+	else
+		prio = IOPRIO_PRIO_DATA(ioprio);
+
+	if (cfqq->ioprio_class == ioprio_class && cfqq->ioprio == prio)
+		return;
+
+	cfqq->ioprio_class = ioprio_class;
+	cfqq->ioprio = prio;
+	cfq_resort_rr_list(cfqq, 0);
+}
+
+/*
+ * mean time between the completion of a sync request and the next sync
+ * request of the queue, as a decaying average
+ */
+static void
+cfq_update_io_thinktime(struct cfq_data *cfqd, struct cfq_queue *cfqq)
+{
+	unsigned long elapsed, ttime;
+
+	if (!cfqq->last_end_request)
+		return;
+
+	elapsed = jiffies - cfqq->last_end_request;
+	ttime = min(elapsed, 2UL * cfqd->cfq_slice_idle);
+
+	cfqq->ttime_samples = (7*cfqq->ttime_samples + 256) / 8;
+	cfqq->ttime_total = (7*cfqq->ttime_total + 256*ttime) / 8;
+	cfqq->ttime_mean = (cfqq->ttime_total + 128) / cfqq->ttime_samples;
+
+	cfqq->idle_window = cfqd->cfq_slice_idle &&
+			    cfqq->ttime_mean <= cfqd->cfq_slice_idle;
+}
+
+/*
+ * a new request for cfqq: end the wait if we were idling for it, and take
+ * the disk from a queue of a lower class
+ */
+static void
+cfq_crq_enqueued(struct cfq_data *cfqd, struct cfq_queue *cfqq,
+		 struct cfq_rq *crq)
+{
+	struct cfq_queue *active = cfqd->active_queue;
+
+	if (crq->is_sync)
+		cfq_update_io_thinktime(cfqd, cfqq);
+
+	if (cfqq == active) {
+		if (cfqq->wait_request) {
+			cfqq->wait_request = 0;
+			del_timer(&cfqd->idle_slice_timer);
+			cfq_schedule_dispatch(cfqd);
+		}
+	} else if (active && cfqq->ioprio_class < active->ioprio_class) {
+		cfq_slice_expired(cfqd, 1);
+		cfq_schedule_dispatch(cfqd);
+	}
+}
+
 static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 {
 	crq->is_sync = 0;
@@ -1241,6 +1500,8 @@ static void cfq_enqueue(struct cfq_data *cfqd, struct cfq_rq *crq)
 	crq->queue_start = jiffies;
 
 	list_add_tail(&crq->request->queuelist, &crq->cfq_queue->fifo[crq->is_sync]);
+
+	cfq_crq_enqueued(cfqd, crq->cfq_queue, crq);
 }
 
 static void
@@ -1251,7 +1512,7 @@ cfq_insert_request(request_queue_t *q, struct request *rq, int where)
 
 	switch (where) {
 		case ELEVATOR_INSERT_BACK:
-			while (cfq_dispatch_requests(q, cfqd->cfq_quantum))
+			while (cfq_dispatch_requests(q, cfqd->cfq_quantum, 1))
 				;
 			list_add_tail(&rq->queuelist, &q->queue_head);
 			break;
@@ -1279,18 +1540,22 @@ static int cfq_queue_empty(request_queue_t *q)
 {
 	struct cfq_data *cfqd = q->elevator->elevator_data;
 
-	return list_empty(&q->queue_head) && list_empty(&cfqd->rr_list);
+	return list_empty(&q->queue_head) && !cfqd->busy_queues;
 }
 
 static void cfq_completed_request(request_queue_t *q, struct request *rq)
 {
 	struct cfq_rq *crq = RQ_DATA(rq);
+	struct cfq_data *cfqd;
 	struct cfq_queue *cfqq;
+	unsigned long now;
 
-	if (unlikely(!blk_fs_request(rq)))
+	if (unlikely(!crq || !blk_fs_request(rq)))
 		return;
 
 	cfqq = crq->cfq_queue;
+	cfqd = cfqq->cfqd;
+	now = jiffies;
 
 	if (crq->in_flight) {
 		WARN_ON(!cfqq->in_flight);
@@ -1298,6 +1563,24 @@ static void cfq_completed_request(request_queue_t *q, struct request *rq)
 	}
 
 	cfq_account_completion(cfqq, crq);
+
+	if (!cfq_class_idle(cfqq))
+		cfqd->last_end_request = now;
+	if (crq->is_sync)
+		cfqq->last_end_request = now;
+
+	/*
+	 * the active queue has nothing left queued or in flight: wait a
+	 * little for its next request, or hand the disk on
+	 */
+	if (cfqd->active_queue == cfqq) {
+		if (!cfqq->in_flight && RB_EMPTY(&cfqq->sort_list) &&
+		    !cfqq->wait_request && !cfq_arm_slice_timer(cfqd, cfqq)) {
+			cfq_slice_expired(cfqd, 0);
+			cfq_schedule_dispatch(cfqd);
+		}
+	} else if (!cfqd->active_queue && !cfqd->rq_in_driver)
+		cfq_schedule_dispatch(cfqd);
 }
 
 static struct request *
@@ -1420,6 +1703,8 @@ static int cfq_set_request(request_queue_t *q, struct request *rq, int gfp_mask)
 	if (!cfqq)
 		goto out_lock;
 
+	cfq_init_prio_data(cfqq, current);
+
 repeat:
 	if (cfqq->allocated[rw] >= cfqd->max_queued)
 		goto out_lock;
@@ -1485,9 +1770,54 @@ static void cfq_put_cfqd(struct cfq_data *cfqd)
 	kfree(cfqd);
 }
 
+static void cfq_idle_slice_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	struct cfq_queue *cfqq;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+
+	/*
+	 * no new request within cfq_slice_idle, give up the slice
+	 */
+	cfqq = cfqd->active_queue;
+	if (cfqq && cfqq->wait_request) {
+		cfqq->wait_request = 0;
+		if (RB_EMPTY(&cfqq->sort_list))
+			cfq_slice_expired(cfqd, 0);
+	}
+
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+static void cfq_idle_class_timer(unsigned long data)
+{
+	struct cfq_data *cfqd = (struct cfq_data *) data;
+	unsigned long flags;
+
+	spin_lock_irqsave(cfqd->queue->queue_lock, flags);
+	cfq_schedule_dispatch(cfqd);
+	spin_unlock_irqrestore(cfqd->queue->queue_lock, flags);
+}
+
+static void cfq_kick_queue(void *data)
+{
+	request_queue_t *q = data;
+
+	blk_run_queue(q);
+}
+
 static void cfq_exit_queue(elevator_t *e)
 {
-	cfq_put_cfqd(e->elevator_data);
+	struct cfq_data *cfqd = e->elevator_data;
+
+	del_timer_sync(&cfqd->idle_slice_timer);
+	del_timer_sync(&cfqd->idle_class_timer);
+	kblockd_flush();
+
+	cfq_put_cfqd(cfqd);
 }
 
 static int cfq_init_queue(request_queue_t *q, elevator_t *e)
@@ -1500,7 +1830,8 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 		return -ENOMEM;
 
 	memset(cfqd, 0, sizeof(*cfqd));
-	INIT_LIST_HEAD(&cfqd->rr_list);
+	for (i = 0; i < CFQ_NR_CLASSES; i++)
+		INIT_LIST_HEAD(&cfqd->rr_list[i]);
 	INIT_LIST_HEAD(&cfqd->empty_list);
 
 	cfqd->crq_hash = kmalloc(sizeof(struct hlist_head) * CFQ_MHASH_ENTRIES, GFP_KERNEL);
@@ -1525,6 +1856,16 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->queue = q;
 	atomic_inc(&q->refcnt);
 
+	init_timer(&cfqd->idle_slice_timer);
+	cfqd->idle_slice_timer.function = cfq_idle_slice_timer;
+	cfqd->idle_slice_timer.data = (unsigned long) cfqd;
+
+	init_timer(&cfqd->idle_class_timer);
+	cfqd->idle_class_timer.function = cfq_idle_class_timer;
+	cfqd->idle_class_timer.data = (unsigned long) cfqd;
+
+	INIT_WORK(&cfqd->unplug_work, cfq_kick_queue, q);
+
 	/*
 	 * just set it to some high value, we want anyone to be able to queue
 	 * some requests. fairness is handled differently
@@ -1543,6 +1884,10 @@ static int cfq_init_queue(request_queue_t *q, elevator_t *e)
 	cfqd->cfq_fifo_batch_expire = cfq_fifo_rate;
 	cfqd->cfq_back_max = cfq_back_max;
 	cfqd->cfq_back_penalty = cfq_back_penalty;
+	cfqd->cfq_slice[0] = cfq_slice_async;
+	cfqd->cfq_slice[1] = cfq_slice_sync;
+	cfqd->cfq_slice_async_rq = cfq_slice_async_rq;
+	cfqd->cfq_slice_idle = cfq_slice_idle;
 
 	return 0;
 out_crqpool:
@@ -1667,6 +2012,10 @@ SHOW_FUNCTION(cfq_fifo_batch_expire_show, cfqd->cfq_fifo_batch_expire, 1);
 SHOW_FUNCTION(cfq_find_best_show, cfqd->find_best_crq, 0);
 SHOW_FUNCTION(cfq_back_max_show, cfqd->cfq_back_max, 0);
 SHOW_FUNCTION(cfq_back_penalty_show, cfqd->cfq_back_penalty, 0);
+SHOW_FUNCTION(cfq_slice_idle_show, cfqd->cfq_slice_idle, 1);
+SHOW_FUNCTION(cfq_slice_sync_show, cfqd->cfq_slice[1], 1);
+SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
+SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -1692,6 +2041,10 @@ STORE_FUNCTION(cfq_fifo_batch_expire_store, &cfqd->cfq_fifo_batch_expire, 0, UIN
 STORE_FUNCTION(cfq_find_best_store, &cfqd->find_best_crq, 0, 1, 0);
 STORE_FUNCTION(cfq_back_max_store, &cfqd->cfq_back_max, 0, UINT_MAX, 0);
 STORE_FUNCTION(cfq_back_penalty_store, &cfqd->cfq_back_penalty, 1, UINT_MAX, 0);
+STORE_FUNCTION(cfq_slice_idle_store, &cfqd->cfq_slice_idle, 0, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_sync_store, &cfqd->cfq_slice[1], 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_store, &cfqd->cfq_slice[0], 1, UINT_MAX, 1);
+STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1, UINT_MAX, 0);
 #undef STORE_FUNCTION
 
 static struct cfq_fs_entry cfq_quantum_entry = {
@@ -1734,6 +2087,26 @@ static struct cfq_fs_entry cfq_back_penalty_entry = {
 	.show = cfq_back_penalty_show,
 	.store = cfq_back_penalty_store,
 };
+static struct cfq_fs_entry cfq_slice_sync_entry = {
+	.attr = {.name = "slice_sync", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_sync_show,
+	.store = cfq_slice_sync_store,
+};
+static struct cfq_fs_entry cfq_slice_async_entry = {
+	.attr = {.name = "slice_async", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_show,
+	.store = cfq_slice_async_store,
+};
+static struct cfq_fs_entry cfq_slice_async_rq_entry = {
+	.attr = {.name = "slice_async_rq", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_async_rq_show,
+	.store = cfq_slice_async_rq_store,
+};
+static struct cfq_fs_entry cfq_slice_idle_entry = {
+	.attr = {.name = "slice_idle", .mode = S_IRUGO | S_IWUSR },
+	.show = cfq_slice_idle_show,
+	.store = cfq_slice_idle_store,
+};
 static struct cfq_fs_entry cfq_clear_elapsed_entry = {
 	.attr = {.name = "clear_elapsed", .mode = S_IWUSR },
 	.store = cfq_clear_elapsed,
@@ -1754,6 +2127,10 @@ static struct attribute *default_attrs[] = {
 	&cfq_find_best_entry.attr,
 	&cfq_back_max_entry.attr,
 	&cfq_back_penalty_entry.attr,
+	&cfq_slice_sync_entry.attr,
+	&cfq_slice_async_entry.attr,
+	&cfq_slice_async_rq_entry.attr,
+	&cfq_slice_idle_entry.attr,
 	&cfq_clear_elapsed_entry.attr,
 	NULL,
 };
@@ -26,6 +26,26 @@ static int write_expire = 5 * HZ; /* ditto for writes, these limits are SOFT! */
 static int writes_starved = 2;    /* max times reads can starve a write */
 static int fifo_batch = 16;       /* # of sequential requests treated as one
 				     by the above parameters. For throughput. */
+static int read_batch_sectors = 1024;	/* most sectors in one read batch */
+static int write_batch_sectors = 512;	/* ditto for writes, kept smaller so
+					   large writes can't hold up reads */
+
+/*
+ * latency histograms: bucket 0 counts requests done in under 1ms, bucket
+ * n those taking [2^(n-1), 2^n) ms, the last bucket everything slower
+ */
+#define DL_HIST_BUCKETS		12
+
+/*
+ * per data direction statistics, from completed requests
+ */
+struct deadline_stats {
+	unsigned long long requests;
+	unsigned long long sectors;
+	unsigned long long service_us;	/* dispatch to completion */
+	unsigned long long latency_us;	/* insertion to completion */
+	unsigned long hist[DL_HIST_BUCKETS];	/* of latency */
+};
 
 static const int deadline_hash_shift = 5;
 #define DL_HASH_BLOCK(sec)	((sec) >> 3)
@@ -61,6 +81,9 @@ struct deadline_data {
 	sector_t last_sector;		/* head position */
 	/* ΪύдĴwrites_starvedҪύд */
 	unsigned int starved;		/* times reads have starved writes */
+	unsigned int batch_sectors;	/* sectors dispatched in this batch */
+
+	struct deadline_stats stats[2];
 
 	/*
 	 * settings that change how the i/o scheduler behaves
@@ -68,6 +91,7 @@ struct deadline_data {
 	/* ʱύ */
 	int fifo_expire[2];
 	int fifo_batch;
+	int fifo_batch_sectors[2];
 	/* д */
 	int writes_starved;
 	/* ĬΪ1ʾǰϲ */
@@ -99,6 +123,12 @@ struct deadline_rq {
 	 */
 	struct list_head fifo;
 	unsigned long expires;
+
+	/*
+	 * for the statistics, in ns
+	 */
+	unsigned long long insert_time;
+	unsigned long long dispatch_time;
 };
 
 static void deadline_move_request(struct deadline_data *dd, struct deadline_rq *drq);
@@ -310,6 +340,7 @@ deadline_add_request(struct request_queue *q, struct request *rq)
 	 * set expire time (only used for reads) and add to fifo list
 	 */
 	drq->expires = jiffies + dd->fifo_expire[data_dir];/* ʱʱ-deadline */
+	drq->insert_time = sched_clock();
 	list_add_tail(&drq->fifo, &dd->fifo_list[data_dir]);/* ӵFIFO */
 
 	if (rq_mergeable(rq)) {
@@ -465,6 +496,7 @@ deadline_move_to_dispatch(struct deadline_data *dd, struct deadline_rq *drq)
 {
 	request_queue_t *q = drq->request->q;
 
+	drq->dispatch_time = sched_clock();
 	deadline_remove_request(q, drq->request);
 	list_add_tail(&drq->request->queuelist, dd->dispatch);
 }
@@ -485,6 +517,7 @@ deadline_move_request(struct deadline_data *dd, struct deadline_rq *drq)
 		dd->next_drq[data_dir] = rb_entry_drq(rbnext);
 	
 	dd->last_sector = drq->request->sector + drq->request->nr_sectors;
+	dd->stats[data_dir].sectors += drq->request->nr_sectors;
 
 	/*
 	 * take it off the sort and fifo list, move
@@ -536,11 +569,22 @@ static int deadline_dispatch_requests(struct deadline_data *dd)
 		drq = dd->next_drq[WRITE];
 
 	if (drq) {/* δҸδδﵽֵ */
+		data_dir = rq_data_dir(drq->request);
+
 		/* we have a "next request" */
-		
 		if (dd->last_sector != drq->request->sector)
 			/* end the batch on a non sequential request */
 			dd->batching += dd->fifo_batch;
+
+		/*
+		 * a batch also ends when its sector budget is used up, and a
+		 * write batch as soon as a read has expired
+		 */
+		if (dd->batch_sectors >= dd->fifo_batch_sectors[data_dir])
+			dd->batching += dd->fifo_batch;
+		else if (data_dir == WRITE && reads &&
+			 deadline_check_fifo(dd, READ))
+			dd->batching += dd->fifo_batch;
 		
 		if (dd->batching < dd->fifo_batch)/* εδ޶ֱӴд */
 			/* we are still entitled to batch */
@@ -587,9 +631,11 @@ dispatch_find_request:
 	/*
 	 * we are not running a batch, find best request for selected data_dir
 	 */
+	dd->batching = 0;
+	dd->batch_sectors = 0;
+
 	if (deadline_check_fifo(dd, data_dir)) {/* FIFOǷй󣬻ߵѾͷҲFIFOȡһ */
 		/* An expired request exists - satisfy it */
-		dd->batching = 0;
 		drq = list_entry_fifo(dd->fifo_list[data_dir].next);/* ȡFIFOеһ */
 		
 	} else if (dd->next_drq[data_dir]) {
@@ -604,7 +650,6 @@ dispatch_find_request:
 		 * higher-sectored requests. Go back to the lowest sectored
 		 * request (1 way elevator) and start a new batch.
 		 */
-		dd->batching = 0;
 		drq = deadline_find_first_drq(dd, data_dir);
 	}
 
@@ -613,6 +658,7 @@ dispatch_request:
 	 * drq is the selected appropriate request.
 	 */
 	dd->batching++;/* batch */
+	dd->batch_sectors += drq->request->nr_sectors;
 	deadline_move_request(dd, drq);/* IOȶƵַ */
 
 	return 1;
@@ -667,6 +713,41 @@ deadline_insert_request(request_queue_t *q, struct request *rq, int where)
 	}
 }
 
+static unsigned long deadline_usecs(unsigned long long ns)
+{
+	do_div(ns, 1000);
+	return ns;
+}
+
+/*
+ * account a completed request in the statistics of its direction
+ */
+static void deadline_completed_request(request_queue_t *q, struct request *rq)
+{
+	struct deadline_data *dd = q->elevator->elevator_data;
+	struct deadline_rq *drq = RQ_DATA(rq);
+	struct deadline_stats *st;
+	unsigned long long now;
+	unsigned long latency, ms;
+	int i;
+
+	if (!drq || !drq->insert_time || !drq->dispatch_time)
+		return;
+
+	now = sched_clock();
+	st = &dd->stats[rq_data_dir(rq)];
+
+	latency = deadline_usecs(now - drq->insert_time);
+	st->requests++;
+	st->service_us += deadline_usecs(now - drq->dispatch_time);
+	st->latency_us += latency;
+
+	ms = latency / 1000;
+	for (i = 0; ms && i < DL_HIST_BUCKETS - 1; i++)
+		ms >>= 1;
+	st->hist[i]++;
+}
+
 static int deadline_queue_empty(request_queue_t *q)
 {
 	struct deadline_data *dd = q->elevator->elevator_data;
@@ -758,6 +839,8 @@ static int deadline_init_queue(request_queue_t *q, elevator_t *e)
 	dd->writes_starved = writes_starved;
 	dd->front_merges = 1;
 	dd->fifo_batch = fifo_batch;
+	dd->fifo_batch_sectors[READ] = read_batch_sectors;
+	dd->fifo_batch_sectors[WRITE] = write_batch_sectors;
 	e->elevator_data = dd;
 	return 0;
 }
@@ -834,6 +917,8 @@ SHOW_FUNCTION(deadline_writeexpire_show, dd->fifo_expire[WRITE], 1);
 SHOW_FUNCTION(deadline_writesstarved_show, dd->writes_starved, 0);
 SHOW_FUNCTION(deadline_frontmerges_show, dd->front_merges, 0);
 SHOW_FUNCTION(deadline_fifobatch_show, dd->fifo_batch, 0);
+SHOW_FUNCTION(deadline_readbatchsectors_show, dd->fifo_batch_sectors[READ], 0);
+SHOW_FUNCTION(deadline_writebatchsectors_show, dd->fifo_batch_sectors[WRITE], 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -856,8 +941,71 @@ STORE_FUNCTION(deadline_writeexpire_store, &dd->fifo_expire[WRITE], 0, INT_MAX,
 STORE_FUNCTION(deadline_writesstarved_store, &dd->writes_starved, INT_MIN, INT_MAX, 0);
 STORE_FUNCTION(deadline_frontmerges_store, &dd->front_merges, 0, 1, 0);
 STORE_FUNCTION(deadline_fifobatch_store, &dd->fifo_batch, 0, INT_MAX, 0);
+STORE_FUNCTION(deadline_readbatchsectors_store, &dd->fifo_batch_sectors[READ], 1, INT_MAX, 0);
+STORE_FUNCTION(deadline_writebatchsectors_store, &dd->fifo_batch_sectors[WRITE], 1, INT_MAX, 0);
 #undef STORE_FUNCTION
 
+static ssize_t deadline_hist_show(struct deadline_stats *st, char *page)
+{
+	int i, pos = 0;
+
+	for (i = 0; i < DL_HIST_BUCKETS; i++) {
+		if (!i)
+			pos += sprintf(page+pos, "<1 ms");
+		else if (i < DL_HIST_BUCKETS - 1)
+			pos += sprintf(page+pos, "%u-%u ms",
+				       1 << (i - 1), 1 << i);
+		else
+			pos += sprintf(page+pos, ">=%u ms", 1 << (i - 1));
+		pos += sprintf(page+pos, ": %lu\n", st->hist[i]);
+	}
+
+	return pos;
+}
+
+static ssize_t deadline_readlatency_show(struct deadline_data *dd, char *page)
+{
+	return deadline_hist_show(&dd->stats[READ], page);
+}
+
+static ssize_t deadline_writelatency_show(struct deadline_data *dd, char *page)
+{
+	return deadline_hist_show(&dd->stats[WRITE], page);
+}
+
+static ssize_t deadline_stats_show(struct deadline_data *dd, char *page)
+{
+	static const char *dir_name[2] = { "read", "write" };
+	unsigned long long service, latency;
+	int dir, pos = 0;
+
+	for (dir = READ; dir <= WRITE; dir++) {
+		struct deadline_stats *st = &dd->stats[dir];
+
+		service = latency = 0;
+		if (st->requests) {
+			service = st->service_us;
+			latency = st->latency_us;
+			do_div(service, st->requests);
+			do_div(latency, st->requests);
+		}
+
+		pos += sprintf(page+pos, "%s: %llu requests %llu sectors "
+			       "%llu us service %llu us latency\n",
+			       dir_name[dir], st->requests, st->sectors,
+			       service, latency);
+	}
+
+	return pos;
+}
+
+static ssize_t
+deadline_stats_store(struct deadline_data *dd, const char *page, size_t count)
+{
+	memset(dd->stats, 0, sizeof(dd->stats));
+	return count;
+}
+
 static struct deadline_fs_entry deadline_readexpire_entry = {
 	.attr = {.name = "read_expire", .mode = S_IRUGO | S_IWUSR },
 	.show = deadline_readexpire_show,
@@ -884,12 +1032,41 @@ static struct deadline_fs_entry deadline_fifobatch_entry = {
 	.store = deadline_fifobatch_store,
 };
 
+static struct deadline_fs_entry deadline_readbatchsectors_entry = {
+	.attr = {.name = "read_batch_sectors", .mode = S_IRUGO | S_IWUSR },
+	.show = deadline_readbatchsectors_show,
+	.store = deadline_readbatchsectors_store,
+};
+static struct deadline_fs_entry deadline_writebatchsectors_entry = {
+	.attr = {.name = "write_batch_sectors", .mode = S_IRUGO | S_IWUSR },
+	.show = deadline_writebatchsectors_show,
+	.store = deadline_writebatchsectors_store,
+};
+static struct deadline_fs_entry deadline_readlatency_entry = {
+	.attr = {.name = "read_latency", .mode = S_IRUGO },
+	.show = deadline_readlatency_show,
+};
+static struct deadline_fs_entry deadline_writelatency_entry = {
+	.attr = {.name = "write_latency", .mode = S_IRUGO },
+	.show = deadline_writelatency_show,
+};
+static struct deadline_fs_entry deadline_stats_entry = {
+	.attr = {.name = "stats", .mode = S_IRUGO | S_IWUSR },
+	.show = deadline_stats_show,
+	.store = deadline_stats_store,
+};
+
 static struct attribute *default_attrs[] = {
 	&deadline_readexpire_entry.attr,
 	&deadline_writeexpire_entry.attr,
 	&deadline_writesstarved_entry.attr,
 	&deadline_frontmerges_entry.attr,
 	&deadline_fifobatch_entry.attr,
+	&deadline_readbatchsectors_entry.attr,
+	&deadline_writebatchsectors_entry.attr,
+	&deadline_readlatency_entry.attr,
+	&deadline_writelatency_entry.attr,
+	&deadline_stats_entry.attr,
 	NULL,
 };
 
@@ -939,6 +1116,7 @@ static struct elevator_type iosched_deadline = {
 		.elevator_add_req_fn =		deadline_insert_request,
 		.elevator_remove_req_fn =	deadline_remove_request,
 		.elevator_queue_empty_fn =	deadline_queue_empty,
+		.elevator_completed_req_fn =	deadline_completed_request,
 		.elevator_former_req_fn =	deadline_former_request,
 		.elevator_latter_req_fn =	deadline_latter_request,
 		.elevator_set_req_fn =		deadline_set_request,
@@ -27,6 +27,7 @@
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/blkdev.h>
+#include <linux/blktrace.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/config.h>
@@ -294,6 +295,7 @@ void __elv_add_request(request_queue_t *q, struct request *rq, int where,
 		blk_plug_device(q);
 
 	rq->q = q;
+	blk_add_trace_rq(q, rq, BLK_TA_INSERT);
 
 	if (!test_bit(QUEUE_FLAG_DRAIN, &q->queue_flags)) {
 		/* 㷨˵صdeadline_add_request */
@@ -349,6 +351,10 @@ struct request *elv_next_request(request_queue_t *q)
 		 * that has been delayed should not be passed by new incoming
 		 * requests
 		 */
+		if (!(rq->flags & REQ_STARTED)) {
+			blk_add_trace_rq(q, rq, BLK_TA_ISSUE);
+			rq->issue_ns = sched_clock();
+		}
 		rq->flags |= REQ_STARTED;/* Ӷȡٿ󣬱ӵ */
 
 		if (rq == q->last_merge)/* ǰǶе߽(IO) */
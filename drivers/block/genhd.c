@@ -220,6 +220,11 @@ void add_disk(struct gendisk *disk)
 	 * עǶkobjectṹ
 	 */
 	blk_register_queue(disk);
+	/**
+	 * ΪרõĻд̡߳
+	 */
+	if (disk->queue)
+		bdi_register(&disk->queue->backing_dev_info, disk->disk_name);
 }
 
 EXPORT_SYMBOL(add_disk);
@@ -227,6 +232,8 @@ EXPORT_SYMBOL(del_gendisk);	/* in partitions/check.c */
 
 void unlink_gendisk(struct gendisk *disk)
 {
+	if (disk->queue)
+		bdi_unregister(&disk->queue->backing_dev_info);
 	blk_unregister_queue(disk);
 	blk_unregister_region(MKDEV(disk->major, disk->first_minor),
 			      disk->minors);
@@ -338,6 +345,61 @@ static int __init genhd_device_init(void)
 
 subsys_initcall(genhd_device_init);
 
+/*
+ * The partition of @disk holding @sector, or NULL.  A linear scan, but
+ * disks carry a handful of partitions.
+ */
+struct hd_struct *disk_map_sector(struct gendisk *disk, sector_t sector)
+{
+	struct hd_struct *part;
+	int i;
+
+	for (i = 0; i < disk->minors - 1; i++) {
+		part = disk->part[i];
+		if (part && sector >= part->start_sect &&
+		    sector - part->start_sect < part->nr_sects)
+			return part;
+	}
+	return NULL;
+}
+
+/*
+ * Print the latency histograms of a disk or partition, summed over all
+ * cpus: one line per bucket, counts for read queue/device time and write
+ * queue/device time.
+ */
+ssize_t disk_latency_read(struct disk_latency *lat, char *page)
+{
+	struct disk_latency *l;
+	unsigned long sum[4];
+	char range[24];
+	int i, cpu, pos;
+
+	pos = sprintf(page, "%-16s %12s %12s %12s %12s\n", "usecs",
+		      "read queue", "read device", "write queue", "write device");
+	for (i = 0; i < DISK_LAT_BUCKETS; i++) {
+		memset(sum, 0, sizeof(sum));
+		for (cpu = 0; cpu < NR_CPUS; cpu++) {
+			if (!cpu_possible(cpu))
+				continue;
+			l = per_cpu_ptr(lat, cpu);
+			sum[0] += l->queue[READ][i];
+			sum[1] += l->device[READ][i];
+			sum[2] += l->queue[WRITE][i];
+			sum[3] += l->device[WRITE][i];
+		}
+		if (!i)
+			sprintf(range, "<1");
+		else if (i < DISK_LAT_BUCKETS - 1)
+			sprintf(range, "%lu-%lu", 1UL << (i - 1), 1UL << i);
+		else
+			sprintf(range, ">=%lu", 1UL << (i - 1));
+		pos += sprintf(page+pos, "%-16s %12lu %12lu %12lu %12lu\n",
+			       range, sum[0], sum[1], sum[2], sum[3]);
+	}
+	return pos;
+}
+
 
 
 /*
@@ -401,6 +463,12 @@ static ssize_t disk_stats_read(struct gendisk * disk, char *page)
 		jiffies_to_msecs(disk_stat_read(disk, io_ticks)),
 		jiffies_to_msecs(disk_stat_read(disk, time_in_queue)));
 }
+static ssize_t disk_latency_show(struct gendisk * disk, char *page)
+{
+	if (!disk->lat)
+		return 0;
+	return disk_latency_read(disk->lat, page);
+}
 static struct disk_attribute disk_attr_dev = {
 	.attr = {.name = "dev", .mode = S_IRUGO },
 	.show	= disk_dev_read
@@ -421,6 +489,10 @@ static struct disk_attribute disk_attr_stat = {
 	.attr = {.name = "stat", .mode = S_IRUGO },
 	.show	= disk_stats_read
 };
+static struct disk_attribute disk_attr_latency = {
+	.attr = {.name = "latency", .mode = S_IRUGO },
+	.show	= disk_latency_show
+};
 
 static struct attribute * default_attrs[] = {
 	&disk_attr_dev.attr,
@@ -428,6 +500,7 @@ static struct attribute * default_attrs[] = {
 	&disk_attr_removable.attr,
 	&disk_attr_size.attr,
 	&disk_attr_stat.attr,
+	&disk_attr_latency.attr,
 	NULL,
 };
 
@@ -437,6 +510,8 @@ static void disk_release(struct kobject * kobj)
 	kfree(disk->random);
 	kfree(disk->part);
 	free_disk_stats(disk);
+	if (disk->lat)
+		free_percpu(disk->lat);
 	kfree(disk);
 }
 
@@ -618,6 +693,8 @@ struct gendisk *alloc_disk(int minors)
 			}
 			memset(disk->part, 0, size);
 		}
+		/* without it the disk just has no latency histograms */
+		disk->lat = alloc_percpu(struct disk_latency);
 		disk->minors = minors;
 		/* sysļϵͳ */
 		kobj_set_kset_s(disk,block_subsys);
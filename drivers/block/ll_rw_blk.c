@@ -18,6 +18,8 @@
 #include <linux/backing-dev.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/blktrace.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
 #include <linux/kernel_stat.h>
@@ -28,6 +30,8 @@
 #include <linux/slab.h>
 #include <linux/swap.h>
 #include <linux/writeback.h>
+#include <linux/interrupt.h>
+#include <linux/cpu.h>
 
 /*
  * for max sense size
@@ -312,6 +316,18 @@ void blk_queue_issue_flush_fn(request_queue_t *q, issue_flush_fn *iff)
 
 EXPORT_SYMBOL(blk_queue_issue_flush_fn);
 
+/**
+ * blk_queue_softirq_done - set the completion handler run from softirq
+ * @q:     the request queue
+ * @fn:    called for each request passed to blk_complete_request()
+ **/
+void blk_queue_softirq_done(request_queue_t *q, softirq_done_fn *fn)
+{
+	q->softirq_done_fn = fn;
+}
+
+EXPORT_SYMBOL(blk_queue_softirq_done);
+
 /**
  * blk_queue_bounce_limit - set bounce buffer limit for queue
  * @q:  the request queue for the device
@@ -909,6 +925,9 @@ static char *rq_flags[] = {
 	"REQ_PM_SUSPEND",
 	"REQ_PM_RESUME",
 	"REQ_PM_SHUTDOWN",
+	"REQ_BAR_PREFLUSH",
+	"REQ_BAR_POSTFLUSH",
+	"REQ_CLONE",
 };
 
 void blk_dump_rq_flags(struct request *rq, char *msg)
@@ -1286,8 +1305,10 @@ void blk_plug_device(request_queue_t *q)
 	 * queue_flagsֶеQUEUE_FLAG_PLUGGED.
 	 * Ȼunplug_timerֶеǶ̬ʱ
 	 */
-	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags))
+	if (!test_and_set_bit(QUEUE_FLAG_PLUGGED, &q->queue_flags)) {
 		mod_timer(&q->unplug_timer, jiffies + q->unplug_delay);  // Ĭ 3ms, ʱ blk_unplug_timeout
+		blk_add_trace_generic(q, BLK_TA_PLUG);
+	}
 }
 
 EXPORT_SYMBOL(blk_plug_device);
@@ -1338,6 +1359,8 @@ void __generic_unplug_device(request_queue_t *q)
 	if (!blk_remove_plug(q))
 		return;
 
+	blk_add_trace_generic(q, BLK_TA_UNPLUG);
+
 	/*
 	 * was plugged, fire request_fn if queue has stuff to do
 	 */
@@ -1528,11 +1551,16 @@ void blk_cleanup_queue(request_queue_t * q)
 	if (!atomic_dec_and_test(&q->refcnt))
 		return;
 
+	blk_trace_shutdown(q);
+
 	if (q->elevator)
 		elevator_exit(q->elevator);
 
 	blk_sync_queue(q);
 
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
+
 	if (rl->rq_pool)
 		mempool_destroy(rl->rq_pool);
 
@@ -1628,8 +1656,36 @@ request_queue_t *blk_init_queue(request_fn_proc *rfn, spinlock_t *lock)
 	if (!q)
 		return NULL;
 
+	if (blk_init_allocated_queue(q, rfn, lock)) {
+		blk_cleanup_queue(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+EXPORT_SYMBOL(blk_init_queue);
+
+/**
+ * blk_init_allocated_queue - turn a queue from blk_alloc_queue() into a
+ *                            request queue
+ * @q:    the queue
+ * @rfn:  request_fn for the queue
+ * @lock: queue_lock for the queue
+ *
+ * Description:
+ *    Does the work of blk_init_queue() on a queue that already exists,
+ *    for a driver that only learns after creating it whether it wants
+ *    requests or bios (request based device-mapper).  Limits go back to
+ *    the defaults, so set them again afterwards.  On failure request_fn
+ *    is cleared again, but make_request_fn, unplug_fn and the limits
+ *    must be restored by a caller that goes on using @q.
+ **/
+int blk_init_allocated_queue(request_queue_t *q, request_fn_proc *rfn,
+			     spinlock_t *lock)
+{
 	if (blk_init_free_list(q))
-		goto out_init;
+		return -ENOMEM;
 
 	q->request_fn		= rfn;
 	q->back_merge_fn       	= ll_back_merge_fn;
@@ -1653,16 +1709,16 @@ request_queue_t *blk_init_queue(request_fn_proc *rfn, spinlock_t *lock)
 	 */
 	if (!elevator_init(q, NULL)) {
 		blk_queue_congestion_threshold(q);
-		return q;
+		return 0;
 	}
 
-	blk_cleanup_queue(q);
-out_init:
-	kmem_cache_free(requestq_cachep, q);
-	return NULL;
+	q->request_fn = NULL;
+	mempool_destroy(q->rq.rq_pool);
+	q->rq.rq_pool = NULL;
+	return -ENOMEM;
 }
 
-EXPORT_SYMBOL(blk_init_queue);
+EXPORT_SYMBOL(blk_init_allocated_queue);
 
 int blk_get_queue(request_queue_t *q)
 {
@@ -1871,6 +1927,7 @@ rq_starved:
 	rq->data_len = 0;
 	rq->data = NULL;
 	rq->sense = NULL;
+	rq->start_ns = 0;
 
 out:
 	put_io_context(ioc);
@@ -1948,6 +2005,8 @@ EXPORT_SYMBOL(blk_get_request);
  */
 void blk_requeue_request(request_queue_t *q, struct request *rq)
 {
+	blk_add_trace_rq(q, rq, BLK_TA_REQUEUE);
+
 	if (blk_rq_tagged(rq))
 		blk_queue_end_tag(q, rq);
 
@@ -2018,6 +2077,50 @@ void blk_insert_request(request_queue_t *q, struct request *rq,
 
 EXPORT_SYMBOL(blk_insert_request);
 
+/**
+ * blk_insert_cloned_request - queue a request built outside of @q
+ * @q:  the queue to submit the request to
+ * @rq: the request, with REQ_CLONE set and its bios and sizes filled in
+ *
+ * Description:
+ *    Request based device-mapper uses this to pass a request merged on
+ *    its own queue down to the queue of one path.  The request bypasses
+ *    __make_request(), so it is checked against the limits of @q here;
+ *    it goes to the back of the io scheduler queue, unmerged, and comes
+ *    back through rq->end_io once end_that_request_last() is called.
+ */
+int blk_insert_cloned_request(request_queue_t *q, struct request *rq)
+{
+	unsigned long flags;
+
+	if (!q->request_fn)
+		return -EIO;
+
+	if (rq->nr_sectors > q->max_sectors ||
+	    rq->nr_phys_segments > q->max_phys_segments ||
+	    rq->nr_hw_segments > q->max_hw_segments) {
+		printk(KERN_ERR "%s: over max size limit.\n", __FUNCTION__);
+		return -EIO;
+	}
+
+	spin_lock_irqsave(q->queue_lock, flags);
+
+	rq->start_time = jiffies;
+	blk_rq_init_latency(rq);
+	drive_stat_acct(rq, rq->nr_sectors, 1);
+	__elv_add_request(q, rq, ELEVATOR_INSERT_BACK, 0);
+
+	if (blk_queue_plugged(q))
+		__generic_unplug_device(q);
+	else
+		q->request_fn(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	return 0;
+}
+
+EXPORT_SYMBOL(blk_insert_cloned_request);
+
 /**
  * blk_rq_map_user - map user data to a request, for REQ_BLOCK_PC usage
  * @q:		request queue where request should be inserted
@@ -2263,6 +2366,101 @@ static inline void add_request(request_queue_t * q, struct request * req)
 	__elv_add_request(q, req, ELEVATOR_INSERT_SORT, 0);
 }
  
+/*
+ * Stamp a new fs request for blk_account_latency(): its arrival time and
+ * the partition its first sector belongs to.  The partition is looked up
+ * here because the bios have been remapped to the whole disk by now.
+ * Only its number is kept: the partition may be gone by completion, and
+ * delete_partition() waits only for lookups made with preemption off.
+ */
+void blk_rq_init_latency(struct request *rq)
+{
+	struct hd_struct *part;
+
+	rq->start_ns = sched_clock();
+	rq->issue_ns = 0;
+	rq->partno = 0;
+	if (rq->rq_disk->minors > 1) {
+		preempt_disable();
+		part = disk_map_sector(rq->rq_disk, rq->sector);
+		if (part)
+			rq->partno = part->partno;
+		preempt_enable();
+	}
+}
+
+static inline int disk_latency_bucket(unsigned long long start,
+				      unsigned long long end)
+{
+	unsigned long long ns = end - start;
+	unsigned long us;
+	int i;
+
+	/* sched_clock() of different cpus need not agree */
+	if (end <= start)
+		return 0;
+	do_div(ns, 1000);
+	us = ns > ~0UL ? ~0UL : ns;
+	for (i = 0; us && i < DISK_LAT_BUCKETS - 1; i++)
+		us >>= 1;
+	return i;
+}
+
+static inline void disk_latency_add(struct disk_latency *lat, int cpu,
+				    int rw, int queue, int device)
+{
+	lat = per_cpu_ptr(lat, cpu);
+	lat->queue[rw][queue]++;
+	lat->device[rw][device]++;
+}
+
+/*
+ * Account a completed fs request in the latency histograms of its disk
+ * and of the partition it went to.  Requests that never passed through
+ * elv_next_request() or the blk-mq dispatch count as issued on completion.
+ */
+void blk_account_latency(struct request *rq)
+{
+	struct gendisk *disk = rq->rq_disk;
+	struct hd_struct *part;
+	unsigned long long now;
+	int rw = rq_data_dir(rq), queue, device, cpu;
+
+	if (!rq->start_ns)
+		return;
+
+	now = sched_clock();
+	if (!rq->issue_ns)
+		rq->issue_ns = now;
+	queue = disk_latency_bucket(rq->start_ns, rq->issue_ns);
+	device = disk_latency_bucket(rq->issue_ns, now);
+
+	/* get_cpu() also keeps delete_partition() from freeing part */
+	cpu = get_cpu();
+	if (disk->lat)
+		disk_latency_add(disk->lat, cpu, rw, queue, device);
+	if (rq->partno && rq->partno < disk->minors) {
+		part = disk->part[rq->partno - 1];
+		if (part && part->lat)
+			disk_latency_add(part->lat, cpu, rw, queue, device);
+	}
+	put_cpu();
+}
+
+/*
+ * Nanoseconds since @rq was queued on the clock of the latency
+ * histograms, or 0 if it was never stamped.  For stacking drivers that
+ * weigh the devices underneath by how fast they complete.
+ */
+unsigned long long blk_rq_age_ns(struct request *rq)
+{
+	if (!rq->start_ns)
+		return 0;
+	return sched_clock() - rq->start_ns;
+}
+
+EXPORT_SYMBOL(blk_rq_age_ns);
+
 /*
  * disk_round_stats()	- Round off the performance stats on a struct
  * disk_stats.
@@ -2407,6 +2605,8 @@ static int attempt_merge(request_queue_t *q, struct request *req,
 	 */
 	if (time_after(req->start_time, next->start_time))
 		req->start_time = next->start_time;
+	if (next->start_ns < req->start_ns)
+		req->start_ns = next->start_ns;
 
 	req->biotail->bi_next = next->bio;
 	req->biotail = next->biotail;
@@ -2478,6 +2678,125 @@ void __blk_attempt_remerge(request_queue_t *q, struct request *rq)
 
 EXPORT_SYMBOL(__blk_attempt_remerge);
 
+/*
+ * Fill in a freshly allocated request for the single bio it starts with.
+ */
+static void init_request_from_bio(request_queue_t *q, struct request *req,
+				  struct bio *bio)
+{
+	/**
+	 * һα׼Ķд־
+	 */
+	req->flags |= REQ_CMD;
+
+	/*
+	 * inherit FAILFAST from bio (for read-ahead, and explicit FAILFAST)
+	 */
+	/**
+	 * һԤʧֱܾӷزԡ
+	 */
+	if (bio_rw_ahead(bio) || bio_failfast(bio))
+		req->flags |= REQ_FAILFAST;
+
+	/*
+	 * REQ_BARRIER implies no merging, but lets make it explicit
+	 */
+	if (bio_barrier(bio))
+		req->flags |= (REQ_HARDBARRIER | REQ_NOMERGE);
+
+	/**
+	 * ʼеֶΡ
+	 */
+	req->errors = 0;
+	req->hard_sector = req->sector = bio->bi_sector;
+	req->hard_nr_sectors = req->nr_sectors = bio_sectors(bio);
+	req->current_nr_sectors = req->hard_cur_sectors = bio_cur_sectors(bio);
+	req->nr_phys_segments = bio_phys_segments(q, bio);
+	req->nr_hw_segments = bio_hw_segments(q, bio);
+	req->buffer = bio_data(bio);	/* see ->buffer comment above */
+	req->waiting = NULL;
+	req->bio = req->biotail = bio;
+	req->rq_disk = bio->bi_bdev->bd_disk;
+	req->start_time = jiffies;
+	blk_rq_init_latency(req);
+}
+
+/*
+ * Merge bio into one of the requests on the task's plug.  Only this task
+ * sees the plug, so no lock is needed.  The sectors of the merged bio are
+ * accounted when the request is finally queued.
+ */
+static int blk_plug_merge(struct blk_plug *plug, request_queue_t *q,
+			  struct bio *bio)
+{
+	struct request *req;
+	int nr_sectors = bio_sectors(bio);
+
+	list_for_each_entry_reverse(req, &plug->list, queuelist) {
+		if (req->q != q || !elv_rq_merge_ok(req, bio))
+			continue;
+
+		if (req->sector + req->nr_sectors == bio->bi_sector) {
+			if (!q->back_merge_fn(q, req, bio))
+				return 0;
+			req->biotail->bi_next = bio;
+			req->biotail = bio;
+			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
+			return 1;
+		}
+
+		if (bio->bi_sector + nr_sectors == req->sector) {
+			if (!q->front_merge_fn(q, req, bio))
+				return 0;
+			bio->bi_next = req->bio;
+			req->bio = bio;
+			req->buffer = bio_data(bio);
+			req->current_nr_sectors = bio_cur_sectors(bio);
+			req->hard_cur_sectors = req->current_nr_sectors;
+			req->sector = req->hard_sector = bio->bi_sector;
+			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void blk_flush_plug_list(struct blk_plug *plug, int from_schedule);
+
+/*
+ * Hold bio on the task's plug, merged into a plugged request or in a new
+ * one.  Allocation is the only place queue_lock is taken.
+ */
+static int blk_plug_bio(struct blk_plug *plug, request_queue_t *q,
+			struct bio *bio)
+{
+	struct request *req;
+	int rw = bio_data_dir(bio);
+
+	if (blk_plug_merge(plug, q, bio))
+		return 0;
+
+	req = get_request(q, rw, GFP_ATOMIC);
+	if (!req) {
+		if (bio_rw_ahead(bio)) {
+			bio_endio(bio, bio->bi_size, -EWOULDBLOCK);
+			return 0;
+		}
+		blk_add_trace_bio(q, bio, BLK_TA_SLEEPRQ);
+		/* sleeping flushes the plug, see schedule() */
+		req = get_request_wait(q, rw);
+	}
+
+	init_request_from_bio(q, req, bio);
+	list_add_tail(&req->queuelist, &plug->list);
+	if (++plug->count >= BLK_MAX_PLUG_REQUESTS)
+		blk_flush_plug_list(plug, 0);
+	return 0;
+}
+
 /**
  * ͨÿô˺IOȲķ
  */
@@ -2503,6 +2822,8 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	blk_add_trace_bio(q, bio, BLK_TA_QUEUE);
+
 	spin_lock_prefetch(q->queue_lock);
 
 	barrier = bio_barrier(bio);
@@ -2512,6 +2833,16 @@ static int __make_request(request_queue_t *q, struct bio *bio)
 		goto end_io;
 	}
 
+	if (current->plug) {
+		/*
+		 * Barriers and sync I/O go straight to the queue, behind
+		 * what the task already has plugged.
+		 */
+		if (!barrier && !bio_sync(bio))
+			return blk_plug_bio(current->plug, q, bio);
+		blk_flush_plug(current);
+	}
+
 again:
 	spin_lock_irq(q->queue_lock);
 
@@ -2549,6 +2880,7 @@ again:
 			req->biotail = bio;
 			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
 			drive_stat_acct(req, nr_sectors, 0);
+			blk_add_trace_bio(q, bio, BLK_TA_BACKMERGE);
 			/**
 			 * Ƿϲ
 			 */
@@ -2582,6 +2914,7 @@ again:
 			req->sector = req->hard_sector = sector;
 			req->nr_sectors = req->hard_nr_sectors += nr_sectors;
 			drive_stat_acct(req, nr_sectors, 0);
+			blk_add_trace_bio(q, bio, BLK_TA_FRONTMERGE);
 			/**
 			 * Ƿbioнһĺϲ
 			 */
@@ -2628,45 +2961,13 @@ get_rq:
 			/**
 			 * ֱӷһôȴڴãһų 
 			 */
+			blk_add_trace_bio(q, bio, BLK_TA_SLEEPRQ);
 			freereq = get_request_wait(q, rw);
 		}
 		goto again;
 	}
 
-	/**
-	 * һα׼Ķд־
-	 */
-	req->flags |= REQ_CMD;
-
-	/*
-	 * inherit FAILFAST from bio (for read-ahead, and explicit FAILFAST)
-	 */
-	/**
-	 * һԤʧֱܾӷزԡ
-	 */
-	if (bio_rw_ahead(bio) || bio_failfast(bio))
-		req->flags |= REQ_FAILFAST;
-
-	/*
-	 * REQ_BARRIER implies no merging, but lets make it explicit
-	 */
-	if (barrier)
-		req->flags |= (REQ_HARDBARRIER | REQ_NOMERGE);
-
-	/**
-	 * ʼеֶΡ
-	 */
-	req->errors = 0;
-	req->hard_sector = req->sector = sector;
-	req->hard_nr_sectors = req->nr_sectors = nr_sectors;
-	req->current_nr_sectors = req->hard_cur_sectors = cur_nr_sectors;
-	req->nr_phys_segments = bio_phys_segments(q, bio);
-	req->nr_hw_segments = bio_hw_segments(q, bio);
-	req->buffer = bio_data(bio);	/* see ->buffer comment above */
-	req->waiting = NULL;
-	req->bio = req->biotail = bio;
-	req->rq_disk = bio->bi_bdev->bd_disk;
-	req->start_time = jiffies;
+	init_request_from_bio(q, req, bio);
 
 	/**
 	 * bio
@@ -2686,6 +2987,118 @@ end_io:
 	return 0;
 }
 
+/*
+ * Start a queue the plug just fed; queue_lock is held.  From schedule()
+ * the task is no longer running, so leave request_fn to kblockd the way
+ * blk_start_queue() does.
+ */
+static void blk_run_plugged_queue(request_queue_t *q, int from_schedule)
+{
+	if (from_schedule) {
+		blk_plug_device(q);
+		kblockd_schedule_work(&q->unplug_work);
+	} else
+		__generic_unplug_device(q);
+}
+
+/*
+ * Queue the plugged requests, sorted by queue and sector, taking each
+ * queue's lock once, and start the queues.
+ */
+static void blk_flush_plug_list(struct blk_plug *plug, int from_schedule)
+{
+	LIST_HEAD(list);
+	struct request *rq, *pos;
+	request_queue_t *q = NULL;
+
+	if (list_empty(&plug->list))
+		return;
+
+	/* insertion sort, the plug holds only a few requests */
+	while (!list_empty(&plug->list)) {
+		rq = list_entry(plug->list.next, struct request, queuelist);
+		list_del(&rq->queuelist);
+		list_for_each_entry(pos, &list, queuelist)
+			if (pos->q > rq->q ||
+			    (pos->q == rq->q && pos->sector > rq->sector))
+				break;
+		list_add_tail(&rq->queuelist, &pos->queuelist);
+	}
+	plug->count = 0;
+
+	while (!list_empty(&list)) {
+		rq = list_entry(list.next, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+		if (rq->q != q) {
+			if (q) {
+				blk_run_plugged_queue(q, from_schedule);
+				spin_unlock_irq(q->queue_lock);
+			}
+			q = rq->q;
+			spin_lock_irq(q->queue_lock);
+			if (elv_queue_empty(q))
+				blk_plug_device(q);
+		}
+		add_request(q, rq);
+	}
+	blk_run_plugged_queue(q, from_schedule);
+	spin_unlock_irq(q->queue_lock);
+}
+
+/**
+ * blk_start_plug - hold back the requests this task is about to build
+ * @plug:	plug to use, normally on the caller's stack
+ *
+ * Description:
+ *    Until blk_finish_plug(), bios the task submits to request based
+ *    queues are merged into requests kept on @plug without touching the
+ *    queue lock, and reach the io schedulers in sorted batches.  The plug
+ *    is also flushed when the task sleeps.  With a plug already in place
+ *    the outer one stays in charge.
+ **/
+void blk_start_plug(struct blk_plug *plug)
+{
+	INIT_LIST_HEAD(&plug->list);
+	plug->count = 0;
+	if (!current->plug)
+		current->plug = plug;
+}
+
+EXPORT_SYMBOL(blk_start_plug);
+
+/**
+ * blk_finish_plug - queue the requests held back since blk_start_plug()
+ * @plug:	the plug passed to blk_start_plug()
+ **/
+void blk_finish_plug(struct blk_plug *plug)
+{
+	if (current->plug != plug)
+		return;
+	blk_flush_plug_list(plug, 0);
+	current->plug = NULL;
+}
+
+EXPORT_SYMBOL(blk_finish_plug);
+
+/*
+ * Queue and start the task's plugged requests before it issues sync I/O.
+ */
+void blk_flush_plug(struct task_struct *tsk)
+{
+	if (tsk->plug)
+		blk_flush_plug_list(tsk->plug, 0);
+}
+
+/*
+ * Called by schedule() for tasks going to sleep.  Must not sleep.  The
+ * requests are queued, but the queues are run from kblockd.
+ */
+void blk_schedule_flush_plug(struct task_struct *tsk)
+{
+	if (tsk->plug)
+		blk_flush_plug_list(tsk->plug, 1);
+}
+
 /*
  * If bio->bi_dev is a partition, remap the location
  */
@@ -3074,6 +3487,10 @@ static int __end_that_request_first(struct request *req, int uptodate,
 	if (!blk_pc_request(req))
 		req->errors = 0;
 
+	if (req->q)
+		blk_add_trace(req->q, req->hard_sector, nr_bytes,
+			      rq_data_dir(req), BLK_TA_COMPLETE, error);
+
 	if (!uptodate) {
 		if (blk_fs_request(req) && !(req->flags & REQ_QUIET))
 			printk("end_request: I/O error, dev %s, sector %llu\n",
@@ -3263,8 +3680,14 @@ void end_that_request_last(struct request *req)
 		}
 		disk_round_stats(disk);
 		disk->in_flight--;
+		blk_account_latency(req);
 	}
-	__blk_put_request(req->q, req);
+	if (req->flags & REQ_CLONE) {
+		/* no __blk_put_request() for a clone: balance the dequeue */
+		elv_completed_request(req->q, req);
+		req->end_io(req);
+	} else
+		__blk_put_request(req->q, req);
 	/* Do this LAST! The structure may be freed immediately afterwards */
 	if (waiting)
 		complete(waiting);
@@ -3283,6 +3706,74 @@ void end_request(struct request *req, int uptodate)
 
 EXPORT_SYMBOL(end_request);
 
+/*
+ * Requests completed on each CPU, waiting for BLOCK_SOFTIRQ.
+ */
+static DEFINE_PER_CPU(struct list_head, blk_cpu_done);
+
+static void blk_done_softirq(struct softirq_action *h)
+{
+	struct request *rq;
+	LIST_HEAD(local_list);
+
+	local_irq_disable();
+	list_splice_init(&__get_cpu_var(blk_cpu_done), &local_list);
+	local_irq_enable();
+
+	while (!list_empty(&local_list)) {
+		rq = list_entry(local_list.next, struct request, donelist);
+		list_del_init(&rq->donelist);
+		rq->q->softirq_done_fn(rq);
+	}
+}
+
+#ifdef CONFIG_HOTPLUG_CPU
+static int blk_cpu_notify(struct notifier_block *self, unsigned long action,
+			  void *hcpu)
+{
+	/* finish what a dead cpu left behind */
+	if (action == CPU_DEAD) {
+		int cpu = (unsigned long) hcpu;
+
+		local_irq_disable();
+		list_splice_init(&per_cpu(blk_cpu_done, cpu),
+				 &__get_cpu_var(blk_cpu_done));
+		raise_softirq_irqoff(BLOCK_SOFTIRQ);
+		local_irq_enable();
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block blk_cpu_notifier = {
+	.notifier_call	= blk_cpu_notify,
+};
+#endif
+
+/**
+ * blk_complete_request - end a request from softirq context
+ * @req:      the request being completed
+ *
+ * Description:
+ *     For drivers that set a handler with blk_queue_softirq_done().
+ *     Called from the driver's interrupt handler instead of ending the
+ *     request there; the handler then runs from BLOCK_SOFTIRQ on this
+ *     cpu, for a burst of completions back to back and with the
+ *     interrupt already acknowledged.
+ **/
+void blk_complete_request(struct request *req)
+{
+	unsigned long flags;
+
+	BUG_ON(!req->q->softirq_done_fn);
+
+	local_irq_save(flags);
+	list_add_tail(&req->donelist, &__get_cpu_var(blk_cpu_done));
+	raise_softirq_irqoff(BLOCK_SOFTIRQ);
+	local_irq_restore(flags);
+}
+
+EXPORT_SYMBOL(blk_complete_request);
+
 void blk_rq_bio_prep(request_queue_t *q, struct request *rq, struct bio *bio)
 {
 	/* first three bits are identical in rq->flags and bio->bi_rw */
@@ -3315,6 +3806,8 @@ EXPORT_SYMBOL(kblockd_flush);
 
 int __init blk_dev_init(void)
 {
+	int i;
+
 	kblockd_workqueue = create_workqueue("kblockd");
 	if (!kblockd_workqueue)
 		panic("Failed to create kblockd\n");
@@ -3328,6 +3821,14 @@ int __init blk_dev_init(void)
 	iocontext_cachep = kmem_cache_create("blkdev_ioc",
 			sizeof(struct io_context), 0, SLAB_PANIC, NULL, NULL);
 
+	for_each_cpu(i)
+		INIT_LIST_HEAD(&per_cpu(blk_cpu_done, i));
+
+	open_softirq(BLOCK_SOFTIRQ, blk_done_softirq, NULL);
+#ifdef CONFIG_HOTPLUG_CPU
+	register_cpu_notifier(&blk_cpu_notifier);
+#endif
+
 	blk_max_low_pfn = max_low_pfn;
 	blk_max_pfn = max_pfn;
 
@@ -3689,6 +4190,8 @@ int blk_register_queue(struct gendisk *disk)
 	return 0;
 }
 
+EXPORT_SYMBOL(blk_register_queue);
+
 void blk_unregister_queue(struct gendisk *disk)
 {
 	request_queue_t *q = disk->queue;
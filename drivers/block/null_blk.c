@@ -0,0 +1,241 @@
+/*
+ * null_blk.c - block devices that complete every request at once
+ *
+ * A benchmark target for the block layer itself: no data is moved, so
+ * what a test measures is the cost of getting I/O to a driver and back.
+ * queue_mode selects how requests reach the driver:
+ *
+ *	0	bio:	own make_request_fn, no requests at all
+ *	1	rq:	classic request_queue with queue_lock and io scheduler
+ *	2	mq:	multi-queue, submit_queues hardware queues (blk-mq.c)
+ *
+ * and irqmode how they complete: 0 inline from the submitter, 1 from the
+ * block softirq through blk_complete_request().  Reads return whatever is
+ * in the buffers, writes are dropped.
+ */
+
+#include <linux/config.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/genhd.h>
+#include <linux/interrupt.h>
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+};
+
+struct nullb {
+	request_queue_t		*q;
+	struct gendisk		*disk;
+	spinlock_t		lock;		/* queue_lock in rq mode */
+};
+
+static struct nullb *nullbs;
+static int null_major;
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, 0);
+MODULE_PARM_DESC(queue_mode, "0: bio, 1: request queue, 2: multi-queue");
+
+static int nr_devices = 2;
+module_param(nr_devices, int, 0);
+MODULE_PARM_DESC(nr_devices, "Number of devices");
+
+static int gb = 250;
+module_param(gb, int, 0);
+MODULE_PARM_DESC(gb, "Size of each device in GB");
+
+static int bs = 512;
+module_param(bs, int, 0);
+MODULE_PARM_DESC(bs, "Logical block size in bytes");
+
+static int submit_queues;
+module_param(submit_queues, int, 0);
+MODULE_PARM_DESC(submit_queues, "Hardware queues in mq mode, default one per cpu");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, 0);
+MODULE_PARM_DESC(hw_queue_depth, "Tags per hardware queue in mq mode");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, 0);
+MODULE_PARM_DESC(irqmode, "0: complete inline, 1: complete from softirq");
+
+static struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+};
+
+/* rq mode, queue_lock held */
+static void null_end_request(struct request *rq)
+{
+	end_that_request_first(rq, 1, rq->hard_nr_sectors);
+	end_that_request_last(rq);
+}
+
+static void null_softirq_done(struct request *rq)
+{
+	unsigned long flags;
+
+	if (queue_mode == NULL_Q_MQ) {
+		blk_mq_end_io(rq, 0);
+		return;
+	}
+
+	spin_lock_irqsave(rq->q->queue_lock, flags);
+	null_end_request(rq);
+	spin_unlock_irqrestore(rq->q->queue_lock, flags);
+}
+
+static int null_make_request(request_queue_t *q, struct bio *bio)
+{
+	bio_endio(bio, bio->bi_size, 0);
+	return 0;
+}
+
+static void null_request_fn(request_queue_t *q)
+{
+	struct request *rq;
+
+	while ((rq = elv_next_request(q)) != NULL) {
+		blkdev_dequeue_request(rq);
+		if (irqmode == NULL_IRQ_SOFTIRQ)
+			blk_complete_request(rq);
+		else
+			null_end_request(rq);
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	if (irqmode == NULL_IRQ_SOFTIRQ)
+		blk_complete_request(rq);
+	else
+		blk_mq_end_io(rq, 0);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+};
+
+static int __init null_add_dev(struct nullb *nullb, int index)
+{
+	struct blk_mq_reg reg;
+	struct gendisk *disk;
+
+	spin_lock_init(&nullb->lock);
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		reg.ops = &null_mq_ops;
+		reg.nr_hw_queues = submit_queues;
+		reg.queue_depth = hw_queue_depth;
+		nullb->q = blk_mq_init_queue(&reg, nullb);
+		break;
+	case NULL_Q_RQ:
+		nullb->q = blk_init_queue(null_request_fn, &nullb->lock);
+		break;
+	default:
+		nullb->q = blk_alloc_queue(GFP_KERNEL);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_make_request);
+		break;
+	}
+	if (!nullb->q)
+		return -ENOMEM;
+
+	nullb->q->queuedata = nullb;
+	blk_queue_softirq_done(nullb->q, null_softirq_done);
+	blk_queue_hardsect_size(nullb->q, bs);
+
+	disk = nullb->disk = alloc_disk(1);
+	if (!disk) {
+		blk_cleanup_queue(nullb->q);
+		return -ENOMEM;
+	}
+
+	disk->major = null_major;
+	disk->first_minor = index;
+	disk->fops = &null_fops;
+	disk->private_data = nullb;
+	disk->queue = nullb->q;
+	sprintf(disk->disk_name, "nullb%d", index);
+	set_capacity(disk, (sector_t) gb * 1024 * 1024 * 2);
+	add_disk(disk);
+	return 0;
+}
+
+static void null_del_dev(struct nullb *nullb)
+{
+	del_gendisk(nullb->disk);
+	put_disk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+}
+
+static int __init null_init(void)
+{
+	int i, err;
+
+	if (queue_mode < NULL_Q_BIO || queue_mode > NULL_Q_MQ)
+		queue_mode = NULL_Q_MQ;
+	if (submit_queues <= 0 || submit_queues > num_online_cpus())
+		submit_queues = num_online_cpus();
+	if (bs < 512 || bs > PAGE_SIZE || (bs & (bs - 1)))
+		bs = 512;
+	if (nr_devices <= 0 || nr_devices > 256)
+		return -EINVAL;
+
+	nullbs = kmalloc(nr_devices * sizeof(struct nullb), GFP_KERNEL);
+	if (!nullbs)
+		return -ENOMEM;
+	memset(nullbs, 0, nr_devices * sizeof(struct nullb));
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0) {
+		kfree(nullbs);
+		return null_major;
+	}
+
+	for (i = 0; i < nr_devices; i++) {
+		err = null_add_dev(&nullbs[i], i);
+		if (err)
+			goto out;
+	}
+
+	printk(KERN_INFO "null_blk: %d devices, %s mode\n", nr_devices,
+	       queue_mode == NULL_Q_MQ ? "multi-queue" :
+	       queue_mode == NULL_Q_RQ ? "request" : "bio");
+	return 0;
+
+out:
+	while (--i >= 0)
+		null_del_dev(&nullbs[i]);
+	unregister_blkdev(null_major, "nullb");
+	kfree(nullbs);
+	return err;
+}
+
+static void __exit null_exit(void)
+{
+	int i;
+
+	for (i = 0; i < nr_devices; i++)
+		null_del_dev(&nullbs[i]);
+	unregister_blkdev(null_major, "nullb");
+	kfree(nullbs);
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
@@ -2446,7 +2446,7 @@ static void __do_SAK(void *arg)
 		task_lock(p);
 		if (p->files) {
 			spin_lock(&p->files->file_lock);
-			for (i=0; i < p->files->max_fds; i++) {
+			for (i=0; i < files_fdtable(p->files)->max_fds; i++) {
 				filp = fcheck_files(p->files, i);
 				if (!filp)
 					continue;
@@ -0,0 +1,521 @@
+/*
+ * dm-mpath.c - request based multipath target
+ *
+ *	<nr_features> [queue_if_no_path] <path_selector> <nr_paths> <dev>...
+ *
+ * A multipath table holds this one target, which makes the mapped device
+ * request based (see dm.c): bios are merged by the io scheduler of the
+ * multipath device, and every request goes down one path whole.  The
+ * path is picked by the path selector:
+ *
+ *	round-robin	each path in turn
+ *	queue-length	the path with the fewest requests in flight
+ *	service-time	the path with the smallest (in flight + 1) times its
+ *			average service time, so faster paths get deeper
+ *			queues
+ *
+ * A request that fails fails its path and is retried on another one.
+ * With no path left it fails too, unless queue_if_no_path is set: then
+ * it waits in the queue until a path is reinstated.  Messages:
+ *
+ *	fail_path <dev>, reinstate_path <dev>
+ *	queue_if_no_path, fail_if_no_path
+ */
+
+#include "dm.h"
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <asm/div64.h>
+
+/* new service time samples weigh 1/8 in the running average */
+#define MPATH_SVC_SHIFT	3
+
+struct path {
+	struct dm_dev *dev;
+	int active;
+	unsigned int fail_count;
+	atomic_t in_flight;		/* clones sent and not completed */
+	unsigned long svc_us;		/* average service time */
+};
+
+struct multipath;
+
+struct path_selector {
+	const char *name;
+	/* called with m->lock held, returns an active path or NULL */
+	struct path *(*select)(struct multipath *m);
+};
+
+struct multipath {
+	struct dm_target *ti;
+	spinlock_t lock;
+
+	struct path_selector *ps;
+	unsigned int next;		/* first path the next select looks at */
+	unsigned int nr_paths;
+	unsigned int nr_valid_paths;
+	int queue_if_no_path;
+
+	struct work_struct trigger_event;
+
+	struct path paths[0];
+};
+
+/*-----------------------------------------------------------------
+ * Path selectors.  Each scans from m->next so that equal paths
+ * take turns.
+ *---------------------------------------------------------------*/
+static inline struct path *nth_path(struct multipath *m, unsigned int i)
+{
+	return m->paths + (m->next + i) % m->nr_paths;
+}
+
+static inline void advance(struct multipath *m, struct path *p)
+{
+	m->next = (p - m->paths + 1) % m->nr_paths;
+}
+
+static struct path *rr_select(struct multipath *m)
+{
+	struct path *p;
+	unsigned int i;
+
+	for (i = 0; i < m->nr_paths; i++) {
+		p = nth_path(m, i);
+		if (p->active) {
+			advance(m, p);
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static struct path *ql_select(struct multipath *m)
+{
+	struct path *p, *best = NULL;
+	unsigned int i;
+
+	for (i = 0; i < m->nr_paths; i++) {
+		p = nth_path(m, i);
+		if (!p->active)
+			continue;
+		if (!best ||
+		    atomic_read(&p->in_flight) < atomic_read(&best->in_flight))
+			best = p;
+	}
+
+	if (best)
+		advance(m, best);
+	return best;
+}
+
+static struct path *st_select(struct multipath *m)
+{
+	struct path *p, *best = NULL;
+	unsigned long long cost, best_cost = 0;
+	unsigned int i;
+
+	for (i = 0; i < m->nr_paths; i++) {
+		p = nth_path(m, i);
+		if (!p->active)
+			continue;
+
+		/* a path that has not completed anything yet looks fast */
+		cost = (unsigned long long) (atomic_read(&p->in_flight) + 1) *
+		       (p->svc_us + 1);
+		if (!best || cost < best_cost) {
+			best = p;
+			best_cost = cost;
+		}
+	}
+
+	if (best)
+		advance(m, best);
+	return best;
+}
+
+static struct path_selector path_selectors[] = {
+	{ "round-robin",	rr_select },
+	{ "queue-length",	ql_select },
+	{ "service-time",	st_select },
+};
+
+static struct path_selector *find_selector(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(path_selectors); i++)
+		if (!strcmp(name, path_selectors[i].name))
+			return path_selectors + i;
+
+	return NULL;
+}
+
+/*-----------------------------------------------------------------
+ * Path state.  m->lock held.
+ *---------------------------------------------------------------*/
+static void trigger_event(void *data)
+{
+	struct multipath *m = (struct multipath *) data;
+
+	dm_table_event(m->ti->table);
+}
+
+static void fail_path(struct multipath *m, struct path *p)
+{
+	char buffer[32];
+
+	if (!p->active)
+		return;
+
+	format_dev_t(buffer, p->dev->bdev->bd_dev);
+	DMWARN("dm-multipath: failing path %s", buffer);
+
+	p->active = 0;
+	p->fail_count++;
+	m->nr_valid_paths--;
+	schedule_work(&m->trigger_event);
+}
+
+static void reinstate_path(struct multipath *m, struct path *p)
+{
+	if (p->active)
+		return;
+
+	p->active = 1;
+	m->nr_valid_paths++;
+	schedule_work(&m->trigger_event);
+}
+
+/*-----------------------------------------------------------------
+ * Target hooks
+ *---------------------------------------------------------------*/
+static int multipath_ctr(struct dm_target *ti, unsigned int argc, char **argv)
+{
+	struct multipath *m;
+	struct path_selector *ps;
+	struct path *p;
+	unsigned int nr_features, nr_paths, i;
+	int queue_if_no_path = 0;
+
+	if (argc < 1 || sscanf(argv[0], "%u", &nr_features) != 1 ||
+	    nr_features > 1 || argc < 1 + nr_features) {
+		ti->error = "dm-multipath: Invalid feature count";
+		return -EINVAL;
+	}
+
+	if (nr_features) {
+		if (strcmp(argv[1], "queue_if_no_path")) {
+			ti->error = "dm-multipath: Unknown feature";
+			return -EINVAL;
+		}
+		queue_if_no_path = 1;
+	}
+	argc -= 1 + nr_features;
+	argv += 1 + nr_features;
+
+	if (argc < 2) {
+		ti->error = "dm-multipath: Missing path selector or paths";
+		return -EINVAL;
+	}
+
+	ps = find_selector(argv[0]);
+	if (!ps) {
+		ti->error = "dm-multipath: Unknown path selector";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[1], "%u", &nr_paths) != 1 || !nr_paths ||
+	    nr_paths != argc - 2) {
+		ti->error = "dm-multipath: Invalid path count";
+		return -EINVAL;
+	}
+	argv += 2;
+
+	m = kmalloc(sizeof(*m) + nr_paths * sizeof(*p), GFP_KERNEL);
+	if (!m) {
+		ti->error = "dm-multipath: Cannot allocate multipath context";
+		return -ENOMEM;
+	}
+
+	memset(m, 0, sizeof(*m) + nr_paths * sizeof(*p));
+	m->ti = ti;
+	spin_lock_init(&m->lock);
+	m->ps = ps;
+	m->queue_if_no_path = queue_if_no_path;
+	INIT_WORK(&m->trigger_event, trigger_event, m);
+
+	for (i = 0; i < nr_paths; i++) {
+		p = m->paths + i;
+
+		if (dm_get_device(ti, argv[i], 0, ti->len,
+				  dm_table_get_mode(ti->table), &p->dev)) {
+			ti->error = "dm-multipath: Device lookup failed";
+			goto bad;
+		}
+		m->nr_paths++;
+
+		/*
+		 * Clones are not remapped by partition and go straight
+		 * into the queue, which needs a request_fn for that.
+		 */
+		if (p->dev->bdev != p->dev->bdev->bd_contains ||
+		    !bdev_get_queue(p->dev->bdev)->request_fn) {
+			ti->error = "dm-multipath: Paths must be whole disks "
+				    "with a request queue";
+			goto bad;
+		}
+
+		p->active = 1;
+		atomic_set(&p->in_flight, 0);
+	}
+	m->nr_valid_paths = nr_paths;
+
+	ti->private = m;
+	return 0;
+
+      bad:
+	for (i = 0; i < m->nr_paths; i++)
+		dm_put_device(ti, m->paths[i].dev);
+	kfree(m);
+	return -EINVAL;
+}
+
+static void multipath_dtr(struct dm_target *ti)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	unsigned int i;
+
+	flush_scheduled_work();
+
+	for (i = 0; i < m->nr_paths; i++)
+		dm_put_device(ti, m->paths[i].dev);
+	kfree(m);
+}
+
+static int multipath_map_rq(struct dm_target *ti, struct request *clone,
+			    union map_info *map_context)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	struct block_device *bdev;
+	struct path *p;
+	struct bio *bio;
+	unsigned long flags;
+
+	spin_lock_irqsave(&m->lock, flags);
+	p = m->ps->select(m);
+	if (p)
+		atomic_inc(&p->in_flight);
+	spin_unlock_irqrestore(&m->lock, flags);
+
+	if (!p)
+		/* dm retries queued requests from the plug timer */
+		return m->queue_if_no_path ? 0 : -EIO;
+
+	bdev = p->dev->bdev;
+	clone->q = bdev_get_queue(bdev);
+	clone->rq_disk = bdev->bd_disk;
+	/* errors come straight back here, another path is the retry */
+	clone->flags |= REQ_FAILFAST;
+	for (bio = clone->bio; bio; bio = bio->bi_next)
+		bio->bi_bdev = bdev;
+
+	map_context->ptr = p;
+	return 1;
+}
+
+static int multipath_end_io(struct dm_target *ti, struct request *clone,
+			    int error, union map_info *map_context)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	struct path *p = (struct path *) map_context->ptr;
+	unsigned long long ns;
+	unsigned long flags;
+	int r = 0;
+
+	atomic_dec(&p->in_flight);
+
+	if (!error) {
+		ns = blk_rq_age_ns(clone);
+		do_div(ns, 1000);
+
+		spin_lock_irqsave(&m->lock, flags);
+		p->svc_us += ((unsigned long) ns >> MPATH_SVC_SHIFT) -
+			     (p->svc_us >> MPATH_SVC_SHIFT);
+		spin_unlock_irqrestore(&m->lock, flags);
+		return 0;
+	}
+
+	/* the device refused the request itself, no path will do better */
+	if (error == -EOPNOTSUPP)
+		return 0;
+
+	spin_lock_irqsave(&m->lock, flags);
+	fail_path(m, p);
+	if (m->nr_valid_paths || m->queue_if_no_path)
+		r = 1;
+	spin_unlock_irqrestore(&m->lock, flags);
+
+	return r;
+}
+
+/*
+ * Busy while every usable path has a full queue's worth of requests in
+ * flight: dm then leaves further requests in the io scheduler, where
+ * they keep merging.
+ */
+static int multipath_busy(struct dm_target *ti)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	struct path *p;
+	unsigned int i;
+
+	for (i = 0; i < m->nr_paths; i++) {
+		p = m->paths + i;
+		if (p->active && atomic_read(&p->in_flight) <
+		    bdev_get_queue(p->dev->bdev)->nr_requests)
+			return 0;
+	}
+
+	return m->nr_valid_paths != 0;
+}
+
+static int multipath_status(struct dm_target *ti, status_type_t type,
+			    char *result, unsigned int maxlen)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	unsigned int sz = 0;
+	unsigned int i;
+	unsigned long flags;
+	char buffer[32];
+	struct path *p;
+
+	spin_lock_irqsave(&m->lock, flags);
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%u", m->nr_valid_paths);
+		for (i = 0; i < m->nr_paths; i++) {
+			p = m->paths + i;
+			format_dev_t(buffer, p->dev->bdev->bd_dev);
+			DMEMIT(" %s %c %u %d %lu", buffer,
+			       p->active ? 'A' : 'F', p->fail_count,
+			       atomic_read(&p->in_flight), p->svc_us);
+		}
+		break;
+
+	case STATUSTYPE_TABLE:
+		if (m->queue_if_no_path)
+			DMEMIT("1 queue_if_no_path ");
+		else
+			DMEMIT("0 ");
+		DMEMIT("%s %u", m->ps->name, m->nr_paths);
+		for (i = 0; i < m->nr_paths; i++) {
+			format_dev_t(buffer, m->paths[i].dev->bdev->bd_dev);
+			DMEMIT(" %s", buffer);
+		}
+		break;
+	}
+
+	spin_unlock_irqrestore(&m->lock, flags);
+	return 0;
+}
+
+static int multipath_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct multipath *m = (struct multipath *) ti->private;
+	struct path *p = NULL;
+	struct dm_dev *dev;
+	unsigned long flags;
+	unsigned int i;
+	int r = 0;
+
+	if (argc == 1) {
+		spin_lock_irqsave(&m->lock, flags);
+		if (!strcmp(argv[0], "queue_if_no_path"))
+			m->queue_if_no_path = 1;
+		else if (!strcmp(argv[0], "fail_if_no_path"))
+			m->queue_if_no_path = 0;
+		else
+			r = -EINVAL;
+		spin_unlock_irqrestore(&m->lock, flags);
+		goto out;
+	}
+
+	if (argc != 2) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (dm_get_device(ti, argv[1], 0, ti->len,
+			  dm_table_get_mode(ti->table), &dev)) {
+		DMWARN("dm-multipath: message: device %s not found", argv[1]);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&m->lock, flags);
+	for (i = 0; i < m->nr_paths; i++)
+		if (m->paths[i].dev == dev)
+			p = m->paths + i;
+
+	if (!p)
+		r = -EINVAL;
+	else if (!strcmp(argv[0], "fail_path"))
+		fail_path(m, p);
+	else if (!strcmp(argv[0], "reinstate_path"))
+		reinstate_path(m, p);
+	else
+		r = -EINVAL;
+	spin_unlock_irqrestore(&m->lock, flags);
+
+	dm_put_device(ti, dev);
+
+      out:
+	if (r)
+		DMWARN("dm-multipath: unrecognised message received.");
+	return r;
+}
+
+static struct target_type multipath_target = {
+	.name = "multipath",
+	.module = THIS_MODULE,
+	.version = {1, 0, 0},
+	.ctr = multipath_ctr,
+	.dtr = multipath_dtr,
+	.map_rq = multipath_map_rq,
+	.rq_end_io = multipath_end_io,
+	.busy = multipath_busy,
+	.status = multipath_status,
+	.message = multipath_message,
+};
+
+int __init dm_multipath_init(void)
+{
+	int r = dm_register_target(&multipath_target);
+
+	if (r < 0)
+		DMERR("multipath: register failed %d", r);
+
+	return r;
+}
+
+void __exit dm_multipath_exit(void)
+{
+	int r = dm_unregister_target(&multipath_target);
+
+	if (r < 0)
+		DMERR("multipath: unregister failed %d", r);
+}
+
+module_init(dm_multipath_init)
+module_exit(dm_multipath_exit)
+
+MODULE_DESCRIPTION(DM_NAME " request based multipath target");
+MODULE_LICENSE("GPL");
@@ -61,6 +61,9 @@ struct dm_table {
 	 */
 	struct io_restrictions limits;
 
+	/* the target maps requests rather than bios, see dm_table_complete */
+	int request_based;
+
 	/* events get handed up using this callback */
 	/* ӳ¼ص */
 	void (*event_fn)(void *);
@@ -764,10 +767,23 @@ static int setup_indexes(struct dm_table *t)
 int dm_table_complete(struct dm_table *t)
 {
 	int r = 0;
-	unsigned int leaf_nodes;
+	unsigned int i, leaf_nodes;
 
 	check_for_valid_limits(&t->limits);
 
+	/*
+	 * A request may span any number of bios, so a table that maps
+	 * requests cannot be split between targets.
+	 */
+	for (i = 0; i < t->num_targets; i++)
+		if (t->targets[i].type->map_rq)
+			t->request_based = 1;
+
+	if (t->request_based && t->num_targets != 1) {
+		DMERR("a request based target must be alone in its table");
+		return -EINVAL;
+	}
+
 	/* how many indexes will the btree have ? */
 	leaf_nodes = dm_div_up(t->num_targets, KEYS_PER_NODE);
 	t->depth = 1 + int_log(leaf_nodes, CHILDREN_PER_NODE);
@@ -851,6 +867,24 @@ void dm_table_set_restrictions(struct dm_table *t, struct request_queue *q)
 	q->hardsect_size = t->limits.hardsect_size;
 	q->max_segment_size = t->limits.max_segment_size;
 	q->seg_boundary_mask = t->limits.seg_boundary_mask;
+
+	/*
+	 * Clones are put straight on the queues underneath, without
+	 * passing through their make_request_fn, so bounce up here.
+	 */
+	if (t->request_based) {
+		struct list_head *d, *devices = dm_table_get_devices(t);
+		unsigned long bounce_pfn = ~0UL;
+
+		for (d = devices->next; d != devices; d = d->next) {
+			struct dm_dev *dd = list_entry(d, struct dm_dev, list);
+			request_queue_t *bq = bdev_get_queue(dd->bdev);
+
+			if (bq->bounce_pfn < bounce_pfn)
+				bounce_pfn = bq->bounce_pfn;
+		}
+		blk_queue_bounce_limit(q, (u64) bounce_pfn << PAGE_SHIFT);
+	}
 }
 
 unsigned int dm_table_get_num_targets(struct dm_table *t)
@@ -863,6 +897,11 @@ struct list_head *dm_table_get_devices(struct dm_table *t)
 	return &t->devices;
 }
 
+int dm_table_request_based(struct dm_table *t)
+{
+	return t->request_based;
+}
+
 int dm_table_get_mode(struct dm_table *t)
 {
 	return t->mode;
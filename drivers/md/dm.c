@@ -45,12 +45,34 @@ struct target_io {
 	union map_info info;
 };
 
+/*
+ * One of these is allocated per request of a request based device,
+ * and carries the clone that goes down to the target's queue.
+ */
+struct dm_rq_target_io {
+	struct mapped_device *md;
+	struct dm_target *ti;
+	struct request *orig, clone;
+	int error;
+	union map_info info;
+};
+
+/*
+ * One of these per bio of a clone, to get back to the original bio
+ * and to the request when the clone bio completes.
+ */
+struct dm_rq_clone_bio_info {
+	struct bio *orig;
+	struct dm_rq_target_io *tio;
+};
+
 /*
  * Bits for the md->flags field.
  */
 #define DMF_BLOCK_IO 0
 #define DMF_SUSPENDED 1
 #define DMF_FS_LOCKED 2
+#define DMF_REQUEST_BASED 3
 
 /* ӳ豸 */
 struct mapped_device {
@@ -108,11 +130,21 @@ struct mapped_device {
 	 */
 	/* ӳ豸ļϵͳļϵͳǿƽһ״̬ */
 	struct super_block *frozen_sb;
+
+	/*
+	 * Request based devices: lock of the request queue once it
+	 * has an io scheduler, and pools for the clones.
+	 */
+	spinlock_t queue_lock;
+	mempool_t *rq_tio_pool;
+	mempool_t *rq_bio_info_pool;
 };
 
 #define MIN_IOS 256
 static kmem_cache_t *_io_cache;
 static kmem_cache_t *_tio_cache;
+static kmem_cache_t *_rq_tio_cache;
+static kmem_cache_t *_rq_bio_info_cache;
 
 static int __init local_init(void)
 {
@@ -132,22 +164,46 @@ static int __init local_init(void)
 		return -ENOMEM;
 	}
 
+	_rq_tio_cache = kmem_cache_create("dm_rq_tio",
+					  sizeof(struct dm_rq_target_io),
+					  0, 0, NULL, NULL);
+	if (!_rq_tio_cache) {
+		r = -ENOMEM;
+		goto out_tio;
+	}
+
+	_rq_bio_info_cache = kmem_cache_create("dm_rq_bio_info",
+					sizeof(struct dm_rq_clone_bio_info),
+					0, 0, NULL, NULL);
+	if (!_rq_bio_info_cache) {
+		r = -ENOMEM;
+		goto out_rq_tio;
+	}
+
 	_major = major;
 	r = register_blkdev(_major, _name);
-	if (r < 0) {
-		kmem_cache_destroy(_tio_cache);
-		kmem_cache_destroy(_io_cache);
-		return r;
-	}
+	if (r < 0)
+		goto out_rq_bio_info;
 
 	if (!_major)
 		_major = r;
 
 	return 0;
+
+ out_rq_bio_info:
+	kmem_cache_destroy(_rq_bio_info_cache);
+ out_rq_tio:
+	kmem_cache_destroy(_rq_tio_cache);
+ out_tio:
+	kmem_cache_destroy(_tio_cache);
+	kmem_cache_destroy(_io_cache);
+	return r;
 }
 
 static void local_exit(void)
 {
+	kmem_cache_destroy(_rq_bio_info_cache);
+	kmem_cache_destroy(_rq_tio_cache);
 	kmem_cache_destroy(_tio_cache);
 	kmem_cache_destroy(_io_cache);
 
@@ -246,6 +302,28 @@ static inline void free_tio(struct mapped_device *md, struct target_io *tio)
 	mempool_free(tio, md->tio_pool);
 }
 
+static inline struct dm_rq_target_io *alloc_rq_tio(struct mapped_device *md)
+{
+	return mempool_alloc(md->rq_tio_pool, GFP_ATOMIC);
+}
+
+static inline void free_rq_tio(struct mapped_device *md,
+			       struct dm_rq_target_io *tio)
+{
+	mempool_free(tio, md->rq_tio_pool);
+}
+
+static inline struct dm_rq_clone_bio_info *alloc_bio_info(struct mapped_device *md)
+{
+	return mempool_alloc(md->rq_bio_info_pool, GFP_ATOMIC);
+}
+
+static inline void free_bio_info(struct mapped_device *md,
+				 struct dm_rq_clone_bio_info *info)
+{
+	mempool_free(info, md->rq_bio_info_pool);
+}
+
 /*
  * Add the bio to the list of deferred io.
  */
@@ -629,6 +707,295 @@ static int dm_request(request_queue_t *q, struct bio *bio)
 	return 0;
 }
 
+/*-----------------------------------------------------------------
+ * Request based devices.  The table's target maps requests, so
+ * the queue of the device gets an io scheduler of its own and
+ * dm_request() is not used: bios are merged into requests here,
+ * and each request is cloned and inserted into the queue the
+ * target picks, sharing the data pages of the original.
+ *---------------------------------------------------------------*/
+static void rq_completed(struct mapped_device *md)
+{
+	if (atomic_dec_and_test(&md->pending))
+		/* nudge anyone waiting on suspend queue */
+		wake_up(&md->wait);
+}
+
+static void free_clone_bios(struct mapped_device *md, struct request *clone)
+{
+	struct bio *bio;
+
+	while ((bio = clone->bio) != NULL) {
+		clone->bio = bio->bi_next;
+		free_bio_info(md, bio->bi_private);
+		bio_put(bio);
+	}
+}
+
+/*
+ * Completion of one bio of a clone.  The data of the matching bio of
+ * the original is passed up right away, unless something before it
+ * failed: the original is then ended by dm_softirq_done().
+ */
+static int end_clone_bio(struct bio *clone, unsigned int done, int error)
+{
+	struct dm_rq_clone_bio_info *info = clone->bi_private;
+	struct dm_rq_target_io *tio = info->tio;
+	struct bio *bio = info->orig;
+
+	if (clone->bi_size)
+		return 1;
+
+	if (!bio_flagged(clone, BIO_UPTODATE) && !error)
+		error = -EIO;
+
+	free_bio_info(tio->md, info);
+	bio_put(clone);
+
+	if (tio->error)
+		return 0;
+
+	if (error) {
+		tio->error = error;
+		return 0;
+	}
+
+	/* the bios of a request complete in order */
+	if (tio->orig->bio != bio)
+		DMERR("clone bio completed out of order");
+
+	end_that_request_chunk(tio->orig, 1, bio->bi_size);
+	return 0;
+}
+
+/*
+ * end_io of the clone, called with the queue lock of the path held.
+ * The rest is done from the softirq of the mapped device.
+ */
+static void end_clone_request(struct request *clone)
+{
+	struct dm_rq_target_io *tio = clone->end_io_data;
+
+	blk_complete_request(tio->orig);
+}
+
+static void dm_softirq_done(struct request *rq)
+{
+	struct dm_rq_target_io *tio = rq->special;
+	struct mapped_device *md = tio->md;
+	struct dm_target *ti = tio->ti;
+	request_queue_t *q = rq->q;
+	int error = tio->error, r = 0;
+	unsigned long flags;
+
+	if (ti->type->rq_end_io)
+		r = ti->type->rq_end_io(ti, &tio->clone, error, &tio->info);
+
+	free_clone_bios(md, &tio->clone);
+	free_rq_tio(md, tio);
+	rq->special = NULL;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	if (r == 1)
+		/* the target wants another shot at what is left */
+		blk_requeue_request(q, rq);
+	else {
+		if (rq->bio)
+			end_that_request_chunk(rq, error ? error : -EIO,
+					       rq->hard_nr_sectors << 9);
+		end_that_request_last(rq);
+	}
+	spin_unlock_irqrestore(q->queue_lock, flags);
+
+	blk_run_queue(q);
+	rq_completed(md);
+}
+
+static int setup_clone(struct request *clone, struct request *rq,
+		       struct dm_rq_target_io *tio)
+{
+	struct mapped_device *md = tio->md;
+	struct dm_rq_clone_bio_info *info;
+	struct bio *bio, *clone_bio;
+
+	memset(clone, 0, sizeof(*clone));
+	INIT_LIST_HEAD(&clone->queuelist);
+	INIT_LIST_HEAD(&clone->donelist);
+	clone->flags = (rq->flags & (REQ_RW | REQ_FAILFAST | REQ_CMD)) |
+		       REQ_NOMERGE | REQ_CLONE;
+	clone->sector = clone->hard_sector = rq->sector;
+	clone->nr_sectors = clone->hard_nr_sectors = rq->nr_sectors;
+	clone->current_nr_sectors = rq->current_nr_sectors;
+	clone->hard_cur_sectors = rq->hard_cur_sectors;
+	clone->nr_phys_segments = rq->nr_phys_segments;
+	clone->nr_hw_segments = rq->nr_hw_segments;
+	clone->buffer = rq->buffer;
+	clone->rq_status = RQ_ACTIVE;
+	clone->tag = -1;
+	clone->ref_count = 1;
+	clone->end_io = end_clone_request;
+	clone->end_io_data = tio;
+
+	rq_for_each_bio(bio, rq) {
+		info = alloc_bio_info(md);
+		if (!info)
+			goto bad;
+
+		clone_bio = bio_clone(bio, GFP_ATOMIC);
+		if (!clone_bio) {
+			free_bio_info(md, info);
+			goto bad;
+		}
+
+		info->orig = bio;
+		info->tio = tio;
+		clone_bio->bi_end_io = end_clone_bio;
+		clone_bio->bi_private = info;
+
+		if (clone->bio) {
+			clone->biotail->bi_next = clone_bio;
+			clone->biotail = clone_bio;
+		} else
+			clone->bio = clone->biotail = clone_bio;
+	}
+
+	return 0;
+
+ bad:
+	free_clone_bios(md, clone);
+	return -ENOMEM;
+}
+
+/*
+ * Called without the queue lock but with interrupts off, for a
+ * request already taken off the queue and counted in md->pending.
+ */
+static void map_request(struct dm_target *ti, struct request *rq,
+			struct mapped_device *md)
+{
+	request_queue_t *q = rq->q;
+	struct dm_rq_target_io *tio;
+	struct request *clone;
+	unsigned long flags;
+	int r;
+
+	tio = alloc_rq_tio(md);
+	if (!tio)
+		goto requeue;
+
+	tio->md = md;
+	tio->ti = ti;
+	tio->orig = rq;
+	tio->error = 0;
+	memset(&tio->info, 0, sizeof(tio->info));
+
+	clone = &tio->clone;
+	if (setup_clone(clone, rq, tio)) {
+		free_rq_tio(md, tio);
+		goto requeue;
+	}
+	rq->special = tio;
+
+	r = ti->type->map_rq(ti, clone, &tio->info);
+	if (r > 0) {
+		r = blk_insert_cloned_request(clone->q, clone);
+		if (!r)
+			return;
+
+		/* the target has seen the clone, let it see the failure */
+		tio->error = r;
+		blk_complete_request(rq);
+		return;
+	}
+
+	free_clone_bios(md, clone);
+	free_rq_tio(md, tio);
+	rq->special = NULL;
+
+	if (!r)
+		goto requeue;
+
+	spin_lock_irqsave(q->queue_lock, flags);
+	end_that_request_chunk(rq, r, rq->hard_nr_sectors << 9);
+	end_that_request_last(rq);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+	rq_completed(md);
+	return;
+
+ requeue:
+	/* try again when the plug timer fires */
+	spin_lock_irqsave(q->queue_lock, flags);
+	blk_requeue_request(q, rq);
+	blk_plug_device(q);
+	spin_unlock_irqrestore(q->queue_lock, flags);
+	rq_completed(md);
+}
+
+/*
+ * request_fn of a request based device.  md->pending is held across
+ * the whole function, so that dm_suspend() cannot finish (and the table
+ * cannot be swapped) while we are in here.
+ */
+static void dm_request_fn(request_queue_t *q)
+{
+	struct mapped_device *md = q->queuedata;
+	struct dm_table *map;
+	struct dm_target *ti;
+	struct request *rq;
+
+	atomic_inc(&md->pending);
+	smp_mb__after_atomic_inc();
+
+	/*
+	 * We run with interrupts off, so ours must not be the last
+	 * reference to the table: its destructor sleeps.  The table can
+	 * only be swapped out once dm_suspend() has set DMF_BLOCK_IO and
+	 * seen md->pending drop to zero, so if the flag is still clear now
+	 * that our count is visible, the table outlives this call.
+	 */
+	if (test_bit(DMF_BLOCK_IO, &md->flags))
+		goto out;
+
+	map = dm_get_table(md);
+	if (!map)
+		goto out;
+	ti = dm_table_get_target(map, 0);
+
+	while (!blk_queue_plugged(q) && !test_bit(DMF_BLOCK_IO, &md->flags)) {
+		/*
+		 * While the target is full, requests stay in the io
+		 * scheduler where they can still grow by merging; once
+		 * elv_next_request() has started one it can't.
+		 */
+		if (ti->type->busy && ti->type->busy(ti))
+			break;
+
+		rq = elv_next_request(q);
+		if (!rq)
+			break;
+
+		blkdev_dequeue_request(rq);
+		atomic_inc(&md->pending);
+
+		spin_unlock(q->queue_lock);
+		map_request(ti, rq, md);
+		spin_lock(q->queue_lock);
+	}
+
+	dm_table_put(map);
+ out:
+	rq_completed(md);
+}
+
+static int dm_prep_fn(request_queue_t *q, struct request *rq)
+{
+	/* only requests made of bios can be remapped */
+	if (!blk_fs_request(rq))
+		return BLKPREP_KILL;
+
+	return BLKPREP_OK;
+}
+
 static int dm_flush_all(request_queue_t *q, struct gendisk *disk,
 			sector_t *error_sector)
 {
@@ -663,6 +1030,9 @@ static int dm_any_congested(void *congested_data, int bdi_bits)
 
 	if (!map || test_bit(DMF_BLOCK_IO, &md->flags))
 		r = bdi_bits;
+	else if (test_bit(DMF_REQUEST_BASED, &md->flags))
+		/* requests wait in our own queue, not in the paths' */
+		r = md->queue->backing_dev_info.state & bdi_bits;
 	else
 		r = dm_table_any_congested(map, bdi_bits);
 
@@ -777,6 +1147,7 @@ static struct mapped_device *alloc_dev(unsigned int minor, int persistent)
 	memset(md, 0, sizeof(*md));
 	init_rwsem(&md->lock);
 	rwlock_init(&md->map_lock);
+	spin_lock_init(&md->queue_lock);
 	atomic_set(&md->holders, 1);
 	atomic_set(&md->event_nr, 0);
 
@@ -838,6 +1209,10 @@ static struct mapped_device *alloc_dev(unsigned int minor, int persistent)
 static void free_dev(struct mapped_device *md)
 {
 	free_minor(md->disk->first_minor);
+	if (md->rq_tio_pool) {
+		mempool_destroy(md->rq_bio_info_pool);
+		mempool_destroy(md->rq_tio_pool);
+	}
 	mempool_destroy(md->tio_pool);
 	mempool_destroy(md->io_pool);
 	del_gendisk(md->disk);
@@ -871,9 +1246,55 @@ static void __set_size(struct gendisk *disk, sector_t size)
 	}
 }
 
+/*
+ * The first request based table turns the queue of the device into a
+ * request queue with an io scheduler.  There is no way back, so every
+ * later table must be request based too.
+ */
+static int init_request_based(struct mapped_device *md)
+{
+	request_queue_t *q = md->queue;
+
+	md->rq_tio_pool = mempool_create(MIN_IOS, mempool_alloc_slab,
+					 mempool_free_slab, _rq_tio_cache);
+	if (!md->rq_tio_pool)
+		return -ENOMEM;
+
+	md->rq_bio_info_pool = mempool_create(MIN_IOS, mempool_alloc_slab,
+					      mempool_free_slab,
+					      _rq_bio_info_cache);
+	if (!md->rq_bio_info_pool)
+		goto bad;
+
+	if (blk_init_allocated_queue(q, dm_request_fn, &md->queue_lock)) {
+		/* back to a bio based queue */
+		blk_queue_make_request(q, dm_request);
+		q->unplug_fn = dm_unplug_all;
+		if (md->map)
+			dm_table_set_restrictions(md->map, q);
+		goto bad_info;
+	}
+
+	blk_queue_prep_rq(q, dm_prep_fn);
+	blk_queue_softirq_done(q, dm_softirq_done);
+	/* the sysfs queue directory, to pick and tune the io scheduler */
+	blk_register_queue(md->disk);
+
+	set_bit(DMF_REQUEST_BASED, &md->flags);
+	return 0;
+
+ bad_info:
+	mempool_destroy(md->rq_bio_info_pool);
+ bad:
+	mempool_destroy(md->rq_tio_pool);
+	md->rq_tio_pool = NULL;
+	return -ENOMEM;
+}
+
 static int __bind(struct mapped_device *md, struct dm_table *t)
 {
 	request_queue_t *q = md->queue;
+	unsigned long flags;
 	sector_t size;
 
 	/* ԭӳĳ */
@@ -883,9 +1304,10 @@ static int __bind(struct mapped_device *md, struct dm_table *t)
 	if (size == 0)
 		return 0;
 
-	write_lock(&md->map_lock);/* ӳ */
+	/* dm_request_fn() takes map_lock with interrupts off */
+	write_lock_irqsave(&md->map_lock, flags);/* ӳ */
 	md->map = t;
-	write_unlock(&md->map_lock);
+	write_unlock_irqrestore(&md->map_lock, flags);
 
 	dm_table_get(t);
 	/* ӳ¼ص */
@@ -898,14 +1320,15 @@ static int __bind(struct mapped_device *md, struct dm_table *t)
 static void __unbind(struct mapped_device *md)
 {
 	struct dm_table *map = md->map;
+	unsigned long flags;
 
 	if (!map)
 		return;
 
 	dm_table_event_callback(map, NULL, NULL);
-	write_lock(&md->map_lock);
+	write_lock_irqsave(&md->map_lock, flags);
 	md->map = NULL;
-	write_unlock(&md->map_lock);
+	write_unlock_irqrestore(&md->map_lock, flags);
 	dm_table_put(map);
 }
 
@@ -992,7 +1415,11 @@ static void __flush_deferred_io(struct mapped_device *md, struct bio *c)
 	while (c) {
 		n = c->bi_next;
 		c->bi_next = NULL;
-		__split_bio(md, c);
+		/* deferred before the device became request based */
+		if (test_bit(DMF_REQUEST_BASED, &md->flags))
+			generic_make_request(c);
+		else
+			__split_bio(md, c);
 		c = n;
 	}
 }
@@ -1012,6 +1439,20 @@ int dm_swap_table(struct mapped_device *md, struct dm_table *table)
 		return -EPERM;
 	}
 
+	if (dm_table_request_based(table)) {
+		r = 0;
+		if (!test_bit(DMF_REQUEST_BASED, &md->flags))
+			r = init_request_based(md);
+		if (r) {
+			up_write(&md->lock);
+			return r;
+		}
+	} else if (test_bit(DMF_REQUEST_BASED, &md->flags)) {
+		DMWARN("request based device can't take a bio based table");
+		up_write(&md->lock);
+		return -EINVAL;
+	}
+
 	__unbind(md);
 	r = __bind(md, table);/* ʵʵĽ */
 	if (r)
@@ -1176,6 +1617,9 @@ int dm_resume(struct mapped_device *md)
 	__flush_deferred_io(md, def);
 	up_write(&md->lock);
 	__unlock_fs(md);
+	if (test_bit(DMF_REQUEST_BASED, &md->flags))
+		/* dispatch what queued up while suspended */
+		blk_run_queue(md->queue);
 	dm_table_unplug_all(map);
 	dm_table_put(map);
 
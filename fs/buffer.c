@@ -448,6 +448,96 @@ out:
 	return ret;
 }
 
+#define VALID_SYNC_FILE_RANGE_FLAGS (SYNC_FILE_RANGE_WAIT_BEFORE |	\
+				     SYNC_FILE_RANGE_WRITE |		\
+				     SYNC_FILE_RANGE_WAIT_AFTER)
+
+/*
+ * Sync only the pages of a file which lie within [offset, endbyte]
+ * (inclusive).  Unlike fdatasync() this neither touches the rest of the
+ * file nor writes out any metadata, so it gives no integrity guarantee
+ * on its own: it is meant for streaming writeback of recently written
+ * data, with fdatasync() still used where the metadata must be on disk.
+ *
+ * SYNC_FILE_RANGE_WAIT_BEFORE: wait for writeout already in flight
+ * SYNC_FILE_RANGE_WRITE: start writeout of the dirty pages, don't wait
+ * SYNC_FILE_RANGE_WAIT_AFTER: wait for the writeout to complete
+ */
+int do_sync_file_range(struct file *file, loff_t offset, loff_t endbyte,
+			unsigned int flags)
+{
+	struct address_space *mapping = file->f_mapping;
+	pgoff_t start = offset >> PAGE_CACHE_SHIFT;
+	pgoff_t end = endbyte >> PAGE_CACHE_SHIFT;
+	int ret = 0;
+
+	if (flags & SYNC_FILE_RANGE_WAIT_BEFORE) {
+		ret = wait_on_page_writeback_range(mapping, start, end);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (flags & SYNC_FILE_RANGE_WRITE) {
+		ret = __filemap_fdatawrite_range(mapping, offset, endbyte,
+						WB_SYNC_NONE);
+		if (ret < 0)
+			goto out;
+	}
+
+	if (flags & SYNC_FILE_RANGE_WAIT_AFTER)
+		ret = wait_on_page_writeback_range(mapping, start, end);
+out:
+	return ret;
+}
+EXPORT_SYMBOL(do_sync_file_range);
+
+/*
+ * `nbytes' of zero means "to the end of the file".
+ */
+asmlinkage long sys_sync_file_range(int fd, loff_t offset, loff_t nbytes,
+				    unsigned int flags)
+{
+	struct file *file;
+	loff_t endbyte;			/* inclusive */
+	umode_t i_mode;
+	int fput_needed;
+	long ret;
+
+	ret = -EINVAL;
+	if (flags & ~VALID_SYNC_FILE_RANGE_FLAGS)
+		goto out;
+
+	endbyte = offset + nbytes;
+	if (offset < 0 || endbyte < 0 || endbyte < offset)
+		goto out;
+
+	/* Nothing past the pagecache's reach can be dirty */
+	ret = 0;
+	if (offset > MAX_LFS_FILESIZE)
+		goto out;
+	if (nbytes == 0 || endbyte > MAX_LFS_FILESIZE)
+		endbyte = MAX_LFS_FILESIZE;
+	else
+		endbyte--;
+
+	ret = -EBADF;
+	file = fget_light(fd, &fput_needed);
+	if (!file)
+		goto out;
+
+	i_mode = file->f_dentry->d_inode->i_mode;
+	ret = -ESPIPE;
+	if (!S_ISREG(i_mode) && !S_ISBLK(i_mode) && !S_ISDIR(i_mode) &&
+	    !S_ISLNK(i_mode))
+		goto out_put;
+
+	ret = do_sync_file_range(file, offset, endbyte, flags);
+out_put:
+	fput_light(file, fput_needed);
+out:
+	return ret;
+}
+
 /*
  * Various filesystems appear to want __find_get_block to be non-blocking.
  * But it's the page lock which protects the buffers.  To get around this,
@@ -970,8 +1060,11 @@ int __set_page_dirty_buffers(struct page *page)
 	if (!TestSetPageDirty(page)) {
 		spin_lock_irq(&mapping->tree_lock);
 		if (page->mapping) {	/* Race with truncate? */
-			if (!mapping->backing_dev_info->memory_backed)
+			if (!mapping->backing_dev_info->memory_backed) {
 				inc_page_state(nr_dirty);
+				inc_bdi_stat(mapping->backing_dev_info,
+						BDI_RECLAIMABLE);
+			}
 			radix_tree_tag_set(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
@@ -3216,8 +3309,11 @@ int submit_bh(int rw, struct buffer_head * bh) //
  */
 void ll_rw_block(int rw, int nr, struct buffer_head *bhs[])
 {
+	struct blk_plug plug;
 	int i;
 
+	blk_start_plug(&plug);
+
 	/**
 	 * лײѭ
 	 */
@@ -3276,6 +3372,7 @@ void ll_rw_block(int rw, int nr, struct buffer_head *bhs[])
 		 */
 		put_bh(bh);
 	}
+	blk_finish_plug(&plug);
 }
 
 /*
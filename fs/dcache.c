@@ -32,6 +32,7 @@
 #include <linux/seqlock.h>
 #include <linux/swap.h>
 #include <linux/bootmem.h>
+#include <linux/seq_file.h>
 
 /* #define DCACHE_DEBUG 1 */
 
@@ -72,16 +73,101 @@ static unsigned int d_hash_shift;
  * Ŀ¼ɢбһָ飬ÿָһͬɢֵdentry
  */
 static struct hlist_head *dentry_hashtable;
-/**
- * δʹĿ¼
- */
-static LIST_HEAD(dentry_unused);
-
 /* Statistics gathering. */
 struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/*
+ * Maximum number of unused negative dentries a single superblock may
+ * keep on its LRU.  Zero means no limit.
+ */
+int sysctl_dentry_negative_max;
+
+/*
+ * How far from the cold end of the LRU dput() looks for a negative
+ * dentry to free when a superblock is at its budget.
+ */
+#define DENTRY_NEGATIVE_SCAN	32
+
+/*
+ * Unused dentries are kept on a per-superblock LRU, sb->s_dentry_lru,
+ * so that one filesystem's churn can't push out everybody else's working
+ * set.  The helpers below keep the per-sb and global counters in sync;
+ * they must be called with dcache_lock held, and the ones which add
+ * with dentry->d_lock held too.  DCACHE_LRU_NEGATIVE only means anything
+ * while the dentry is on the LRU, so removal leaves d_flags alone.
+ */
+static inline void __dentry_lru_count(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	sb->s_nr_dentry_unused++;
+	dentry_stat.nr_unused++;
+	if (dentry->d_inode) {
+		dentry->d_flags &= ~DCACHE_LRU_NEGATIVE;
+	} else {
+		dentry->d_flags |= DCACHE_LRU_NEGATIVE;
+		sb->s_nr_dentry_negative++;
+		dentry_stat.nr_negative++;
+	}
+}
+
+static inline void dentry_lru_add(struct dentry *dentry)
+{
+	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
+	__dentry_lru_count(dentry);
+}
+
+static inline void dentry_lru_add_tail(struct dentry *dentry)
+{
+	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
+	__dentry_lru_count(dentry);
+}
+
+static inline void dentry_lru_del_init(struct dentry *dentry)
+{
+	struct super_block *sb = dentry->d_sb;
+
+	if (list_empty(&dentry->d_lru))
+		return;
+	list_del_init(&dentry->d_lru);
+	sb->s_nr_dentry_unused--;
+	dentry_stat.nr_unused--;
+	if (dentry->d_flags & DCACHE_LRU_NEGATIVE) {
+		sb->s_nr_dentry_negative--;
+		dentry_stat.nr_negative--;
+	}
+}
+
+/*
+ * @dentry, which d_lookup() may have left on the LRU, is getting an
+ * inode: it no longer counts as negative.  Called with dcache_lock held.
+ */
+static inline void dentry_lru_positive(struct dentry *dentry)
+{
+	if (list_empty(&dentry->d_lru) ||
+	    !(dentry->d_flags & DCACHE_LRU_NEGATIVE))
+		return;
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags &= ~DCACHE_LRU_NEGATIVE;
+	dentry->d_sb->s_nr_dentry_negative--;
+	dentry_stat.nr_negative--;
+	spin_unlock(&dentry->d_lock);
+}
+
+/*
+ * Would caching one more negative dentry put @sb over its budget?
+ */
+static inline int dentry_negative_over_budget(struct super_block *sb)
+{
+	return sysctl_dentry_negative_max &&
+		sb->s_nr_dentry_negative >= sysctl_dentry_negative_max;
+}
+
+static void prune_negative_dentry(struct super_block *sb,
+				  struct dentry *dentry);
+
 static void d_callback(struct rcu_head *head)
 {
 	struct dentry * dentry = container_of(head, struct dentry, d_rcu);
@@ -183,9 +269,18 @@ repeat:
  	if (d_unhashed(dentry))
 		goto kill_it;
   	if (list_empty(&dentry->d_lru)) {
+		/* Don't let one sb flood the cache with negative entries */
+		int full = !dentry->d_inode &&
+			   dentry_negative_over_budget(dentry->d_sb);
+
   		dentry->d_flags |= DCACHE_REFERENCED;
-  		list_add(&dentry->d_lru, &dentry_unused);
-  		dentry_stat.nr_unused++;
+  		dentry_lru_add(dentry);
+		if (full) {
+			spin_unlock(&dentry->d_lock);
+			prune_negative_dentry(dentry->d_sb, dentry);
+			spin_unlock(&dcache_lock);
+			return;
+		}
   	}
  	spin_unlock(&dentry->d_lock);
 	spin_unlock(&dcache_lock);
@@ -200,10 +295,7 @@ kill_it: {
 		/* If dentry was on d_lru list
 		 * delete it from there
 		 */
-  		if (!list_empty(&dentry->d_lru)) {
-  			list_del(&dentry->d_lru);
-  			dentry_stat.nr_unused--;
-  		}
+		dentry_lru_del_init(dentry);
   		list_del(&dentry->d_child);
 		dentry_stat.nr_dentry--;	/* For d_free, below */
 		/*drops the locks, at that point nobody can reach this dentry */
@@ -279,10 +371,7 @@ int d_invalidate(struct dentry * dentry)
 static inline struct dentry * __dget_locked(struct dentry *dentry)
 {
 	atomic_inc(&dentry->d_count);
-	if (!list_empty(&dentry->d_lru)) {
-		dentry_stat.nr_unused--;
-		list_del_init(&dentry->d_lru);
-	}
+	dentry_lru_del_init(dentry);
 	return dentry;
 }
 
@@ -405,26 +494,17 @@ static inline void prune_one_dentry(struct dentry * dentry)
 	spin_lock(&dcache_lock);
 }
 
-/**
- * prune_dcache - shrink the dcache
- * @count: number of entries to try and free
- *
- * Shrink the dcache. This is done when we need
- * more memory, or simply when we need to unmount
- * something (at which point we need to unuse
- * all dentries).
- *
- * This function may fail to free any resources if
- * all the dentries are in use.
+/*
+ * Scan up to @count dentries from the cold end of @sb's unused list and
+ * free those which are neither in use nor recently referenced.
+ * Called with dcache_lock held; it may be dropped and retaken.
  */
-/**
- * ЧĿ¼ա
- */ 
-static void prune_dcache(int count)
+static void __prune_dcache_sb(struct super_block *sb, int count)
 {
-	spin_lock(&dcache_lock);
+	struct list_head *lru = &sb->s_dentry_lru;
+
 	/**
-	 * ɨδĿ¼(dentry_unused)һֱͷŶɨϡ
+	 * ɨ賬δĿ¼(s_dentry_lru)һֱͷŶɨϡ
 	 */
 	for (; count ; count--) {
 		struct dentry *dentry;
@@ -432,22 +512,21 @@ static void prune_dcache(int count)
 
 		cond_resched_lock(&dcache_lock);
 
-		tmp = dentry_unused.prev;
+		tmp = lru->prev;
 		/**
 		 * ѾδĿ¼˳
 		 */
-		if (tmp == &dentry_unused)
+		if (tmp == lru)
 			break;
-		list_del_init(tmp);
-		prefetch(dentry_unused.prev);
- 		dentry_stat.nr_unused--;
+		prefetch(tmp->prev);
 		dentry = list_entry(tmp, struct dentry, d_lru);
 
  		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		/*
 		 * We found an inuse dentry which was not removed from
-		 * dentry_unused because of laziness during lookup.  Do not free
-		 * it - just keep it off the dentry_unused list.
+		 * the unused list because of laziness during lookup.  Do
+		 * not free it - just keep it off the unused list.
 		 */
  		if (atomic_read(&dentry->d_count)) {
  			spin_unlock(&dentry->d_lock);
@@ -456,28 +535,111 @@ static void prune_dcache(int count)
 		/* If the dentry was recently referenced, don't free it. */
 		if (dentry->d_flags & DCACHE_REFERENCED) {
 			dentry->d_flags &= ~DCACHE_REFERENCED;
- 			list_add(&dentry->d_lru, &dentry_unused);
- 			dentry_stat.nr_unused++;
+			dentry_lru_add(dentry);
  			spin_unlock(&dentry->d_lock);
 			continue;
 		}
 		prune_one_dentry(dentry);
 	}
-	spin_unlock(&dcache_lock);
 }
 
 /*
- * Shrink the dcache for the specified super block.
- * This allows us to unmount a device without disturbing
- * the dcache for the other devices.
+ * @sb went over its negative dentry budget when @dentry joined its LRU:
+ * free the coldest unused negative dentry, looking no further than
+ * DENTRY_NEGATIVE_SCAN entries from the cold end, or @dentry itself if
+ * there is none.  Called with dcache_lock held; it may be dropped.
+ */
+static void prune_negative_dentry(struct super_block *sb,
+				  struct dentry *dentry)
+{
+	struct list_head *lru = &sb->s_dentry_lru;
+	struct list_head *tmp = lru->prev;
+	int scan;
+
+	for (scan = 0; scan < DENTRY_NEGATIVE_SCAN && tmp != lru; scan++) {
+		struct dentry *victim = list_entry(tmp, struct dentry, d_lru);
+
+		if (victim->d_flags & DCACHE_LRU_NEGATIVE) {
+			dentry = victim;
+			break;
+		}
+		tmp = tmp->prev;
+	}
+
+	spin_lock(&dentry->d_lock);
+	/* d_lookup() may have picked it up meanwhile */
+	if (atomic_read(&dentry->d_count)) {
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+	dentry_lru_del_init(dentry);
+	prune_one_dentry(dentry);
+}
+
+static void prune_dcache_sb(struct super_block *sb, int count)
+{
+	spin_lock(&dcache_lock);
+	__prune_dcache_sb(sb, count);
+	spin_unlock(&dcache_lock);
+}
+
+/**
+ * prune_dcache - shrink the dcache
+ * @count: number of entries to try and free
+ *
+ * Shrink the dcache. This is done when we need
+ * more memory.  Each superblock is asked to scan a share of @count
+ * proportional to the number of unused dentries it holds, so the
+ * filesystems with the biggest unused caches give up the most.
  *
- * This implementation makes just two traversals of the
- * unused list.  On the first pass we move the selected
- * dentries to the most recent end, and on the second
- * pass we free them.  The second pass must restart after
- * each dput(), but since the target dentries are all at
- * the end, it's really just a single traversal.
+ * This function may fail to free any resources if
+ * all the dentries are in use.
  */
+/**
+ * ЧĿ¼աδĿ¼ıա
+ */ 
+static void prune_dcache(int count)
+{
+	struct super_block *sb;
+	int unused = dentry_stat.nr_unused;
+	int prune_ratio;
+	int w_count;
+
+	if (unused == 0 || count == 0)
+		return;
+	if (count >= unused)
+		prune_ratio = 1;
+	else
+		prune_ratio = unused / count;
+
+	spin_lock(&sb_lock);
+restart:
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		if (sb->s_nr_dentry_unused == 0)
+			continue;
+		sb->s_count++;
+		w_count = sb->s_nr_dentry_unused / prune_ratio;
+		if (!w_count)
+			w_count = 1;
+		spin_unlock(&sb_lock);
+		/*
+		 * Don't race with umount: if somebody holds s_umount for
+		 * write, the sb is going away or being set up.  Skip it.
+		 */
+		if (down_read_trylock(&sb->s_umount)) {
+			if (sb->s_root)
+				prune_dcache_sb(sb, w_count);
+			up_read(&sb->s_umount);
+		}
+		count -= w_count;
+		spin_lock(&sb_lock);
+		if (__put_super_and_need_restart(sb) && count > 0)
+			goto restart;
+		if (count <= 0)
+			break;
+	}
+	spin_unlock(&sb_lock);
+}
 
 /**
  * shrink_dcache_sb - shrink dcache for a superblock
@@ -490,45 +652,19 @@ static void prune_dcache(int count)
 
 void shrink_dcache_sb(struct super_block * sb)
 {
-	struct list_head *tmp, *next;
+	struct list_head *lru = &sb->s_dentry_lru;
 	struct dentry *dentry;
 
-	/*
-	 * Pass one ... move the dentries for the specified
-	 * superblock to the most recent end of the unused list.
-	 */
 	spin_lock(&dcache_lock);
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		list_del(tmp);
-		list_add(tmp, &dentry_unused);
-	}
-
-	/*
-	 * Pass two ... free the dentries for this superblock.
-	 */
-repeat:
-	next = dentry_unused.next;
-	while (next != &dentry_unused) {
-		tmp = next;
-		next = tmp->next;
-		dentry = list_entry(tmp, struct dentry, d_lru);
-		if (dentry->d_sb != sb)
-			continue;
-		dentry_stat.nr_unused--;
-		list_del_init(tmp);
+	while (!list_empty(lru)) {
+		dentry = list_entry(lru->prev, struct dentry, d_lru);
 		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		if (atomic_read(&dentry->d_count)) {
 			spin_unlock(&dentry->d_lock);
 			continue;
 		}
 		prune_one_dentry(dentry);
-		goto repeat;
 	}
 	spin_unlock(&dcache_lock);
 }
@@ -614,19 +750,17 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_child);
 		next = tmp->next;
 
-		if (!list_empty(&dentry->d_lru)) {
-			dentry_stat.nr_unused--;
-			list_del_init(&dentry->d_lru);
-		}
+		spin_lock(&dentry->d_lock);
+		dentry_lru_del_init(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
 		 * of the unused list for prune_dcache
 		 */
 		if (!atomic_read(&dentry->d_count)) {
-			list_add(&dentry->d_lru, dentry_unused.prev);
-			dentry_stat.nr_unused++;
+			dentry_lru_add_tail(dentry);
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -677,12 +811,12 @@ void shrink_dcache_parent(struct dentry * parent)
 	int found;
 
 	while ((found = select_parent(parent)) != 0)
-		prune_dcache(found);
+		prune_dcache_sb(parent->d_sb, found);
 }
 
 /**
  * shrink_dcache_anon - further prune the cache
- * @head: head of d_hash list of dentries to prune
+ * @sb: superblock whose anonymous dentries are to be pruned
  *
  * Prune the dentries that are anonymous
  *
@@ -690,8 +824,9 @@ void shrink_dcache_parent(struct dentry * parent)
  * done under dcache_lock.
  *
  */
-void shrink_dcache_anon(struct hlist_head *head)
+void shrink_dcache_anon(struct super_block *sb)
 {
+	struct hlist_head *head = &sb->s_anon;
 	struct hlist_node *lp;
 	int found;
 	do {
@@ -699,26 +834,71 @@ void shrink_dcache_anon(struct hlist_head *head)
 		spin_lock(&dcache_lock);
 		hlist_for_each(lp, head) {
 			struct dentry *this = hlist_entry(lp, struct dentry, d_hash);
-			if (!list_empty(&this->d_lru)) {
-				dentry_stat.nr_unused--;
-				list_del_init(&this->d_lru);
-			}
 
+			spin_lock(&this->d_lock);
+			dentry_lru_del_init(this);
 			/* 
 			 * move only zero ref count dentries to the end 
 			 * of the unused list for prune_dcache
 			 */
 			if (!atomic_read(&this->d_count)) {
-				list_add_tail(&this->d_lru, &dentry_unused);
-				dentry_stat.nr_unused++;
+				dentry_lru_add_tail(this);
 				found++;
 			}
+			spin_unlock(&this->d_lock);
 		}
+		__prune_dcache_sb(sb, found);
 		spin_unlock(&dcache_lock);
-		prune_dcache(found);
 	} while(found);
 }
 
+#ifdef CONFIG_PROC_FS
+/*
+ * /proc/dentrystat: unused and negative dentry counts per superblock.
+ */
+static void *dentry_sb_start(struct seq_file *m, loff_t *pos)
+{
+	struct list_head *p;
+	loff_t l = *pos;
+
+	spin_lock(&sb_lock);
+	list_for_each(p, &super_blocks)
+		if (!l--)
+			return list_entry(p, struct super_block, s_list);
+	return NULL;
+}
+
+static void *dentry_sb_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct list_head *p = ((struct super_block *)v)->s_list.next;
+
+	++*pos;
+	return p == &super_blocks ? NULL :
+		list_entry(p, struct super_block, s_list);
+}
+
+static void dentry_sb_stop(struct seq_file *m, void *v)
+{
+	spin_unlock(&sb_lock);
+}
+
+static int dentry_sb_show(struct seq_file *m, void *v)
+{
+	struct super_block *sb = v;
+
+	seq_printf(m, "%s %s %d %d\n", sb->s_id, sb->s_type->name,
+		   sb->s_nr_dentry_unused, sb->s_nr_dentry_negative);
+	return 0;
+}
+
+struct seq_operations dentry_sb_op = {
+	.start	= dentry_sb_start,
+	.next	= dentry_sb_next,
+	.stop	= dentry_sb_stop,
+	.show	= dentry_sb_show,
+};
+#endif
+
 /*
  * Scan `nr' dentries and return the number which remain.
  *
@@ -858,8 +1038,10 @@ void d_instantiate(struct dentry *entry, struct inode * inode)
 {
 	if (!list_empty(&entry->d_alias)) BUG();
 	spin_lock(&dcache_lock);
-	if (inode)
+	if (inode) {
 		list_add(&entry->d_alias, &inode->i_dentry);
+		dentry_lru_positive(entry);
+	}
 	entry->d_inode = inode;
 	spin_unlock(&dcache_lock);
 	security_d_instantiate(entry, inode);
@@ -905,6 +1087,7 @@ struct dentry *d_instantiate_unique(struct dentry *entry, struct inode *inode)
 		return alias;
 	}
 	list_add(&entry->d_alias, &inode->i_dentry);
+	dentry_lru_positive(entry);
 do_negative:
 	entry->d_inode = inode;
 	spin_unlock(&dcache_lock);
@@ -1045,6 +1228,7 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
 		} else {
 			/* d_instantiate takes dcache_lock, so we do it by hand */
 			list_add(&dentry->d_alias, &inode->i_dentry);
+			dentry_lru_positive(dentry);
 			dentry->d_inode = inode;
 			spin_unlock(&dcache_lock);
 			security_d_instantiate(dentry, inode);
@@ -1076,10 +1260,10 @@ struct dentry *d_splice_alias(struct inode *inode, struct dentry *dentry)
  * rcu_read_lock() and rcu_read_unlock() are used to disable preemption while
  * lookup is going on.
  *
- * dentry_unused list is not updated even if lookup finds the required dentry
- * in there. It is updated in places such as prune_dcache, shrink_dcache_sb,
- * select_parent and __dget_locked. This laziness saves lookup from dcache_lock
- * acquisition.
+ * The sb's unused list is not updated even if lookup finds the required
+ * dentry in there. It is updated in places such as prune_dcache,
+ * shrink_dcache_sb, select_parent and __dget_locked. This laziness saves
+ * lookup from dcache_lock acquisition.
  *
  * d_lookup() is protected against the concurrent renames in some unrelated
  * directory using the seqlockt_t rename_lock.
@@ -613,12 +613,18 @@ claim_block(spinlock_t *lock, int block, struct buffer_head *bh)
  * If we failed to allocate the desired block then we may end up crossing to a
  * new bitmap.  In that case we must release write access to the old one via
  * ext3_journal_release_buffer(), else we'll run out of credits.
+ *
+ * Up to *count blocks are claimed, the first one found and as many free
+ * blocks directly following it as fit in the search range.  The number
+ * actually claimed is returned in *count.
  */
 static int
 ext3_try_to_allocate(struct super_block *sb, handle_t *handle, int group,
-	struct buffer_head *bitmap_bh, int goal, struct ext3_reserve_window *my_rsv)
+	struct buffer_head *bitmap_bh, int goal, unsigned long *count,
+	struct ext3_reserve_window *my_rsv)
 {
 	int group_first_block, start, end;
+	unsigned long num = 0;
 
 	/* we do allocation within the reservation window if we have a window */
 	if (my_rsv) {
@@ -676,8 +682,18 @@ repeat:
 			goto fail_access;
 		goto repeat;
 	}
-	return goal;
+	num++;
+	goal++;
+	while (num < *count && goal < end &&
+	       ext3_test_allocatable(goal, bitmap_bh) &&
+	       claim_block(sb_bgl_lock(EXT3_SB(sb), group), goal, bitmap_bh)) {
+		num++;
+		goal++;
+	}
+	*count = num;
+	return goal - num;
 fail_access:
+	*count = num;
 	return -1;
 }
 
@@ -960,6 +976,39 @@ failed:
 	return -1;		/* failed */
 }
 
+/*
+ * Grow the reservation window by up to `size' blocks, as far as the next
+ * window allows, so that a multi-block request whose goal is near the end
+ * of the window can still be satisfied from it.  Called with the window's
+ * seqlock held for writing; gives up rather than wait for the rsv lock.
+ */
+static int try_to_extend_reservation(struct ext3_reserve_window_node *my_rsv,
+			struct super_block *sb, int size)
+{
+	struct ext3_reserve_window_node *next_rsv;
+	struct rb_node *next;
+	spinlock_t *rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
+
+	if (!spin_trylock(rsv_lock))
+		return -1;
+
+	next = rb_next(&my_rsv->rsv_node);
+
+	if (!next)
+		my_rsv->rsv_end += size;
+	else {
+		next_rsv = rb_entry(next, struct ext3_reserve_window_node,
+					rsv_node);
+
+		if ((next_rsv->rsv_start - my_rsv->rsv_end - 1) >= size)
+			my_rsv->rsv_end += size;
+		else
+			my_rsv->rsv_end = next_rsv->rsv_start - 1;
+	}
+	spin_unlock(rsv_lock);
+	return 0;
+}
+
 /*
  * This is the main function used to allocate a new block and its reservation
  * window.
@@ -985,10 +1034,11 @@ static int
 ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 			unsigned int group, struct buffer_head *bitmap_bh,
 			int goal, struct ext3_reserve_window_node * my_rsv,
-			int *errp)
+			unsigned long *count, int *errp)
 {
 	spinlock_t *rsv_lock;
 	unsigned long group_first_block;
+	unsigned long num = *count;
 	int ret = 0;
 	int fatal;
 	int credits = 0;
@@ -1014,7 +1064,8 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 	 * or last attempt to allocate a block with reservation turned on failed
 	 */
 	if (my_rsv == NULL ) {
-		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal, NULL);
+		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
+					   count, NULL);
 		goto out;
 	}
 	rsv_lock = &EXT3_SB(sb)->s_rsv_window_lock;
@@ -1054,6 +1105,11 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 
 		if (rsv_is_empty(&rsv_copy) || (ret < 0) ||
 			!goal_in_my_reservation(&rsv_copy, goal, group, sb)) {
+			/* a new window should hold the whole request */
+			if (atomic_read(&my_rsv->rsv_goal_size) < num)
+				atomic_set(&my_rsv->rsv_goal_size,
+					   min(num, (unsigned long)
+						    EXT3_MAX_RESERVE_BLOCKS));
 			spin_lock(rsv_lock);
 			write_seqlock(&my_rsv->rsv_seqlock);
 			ret = alloc_new_reservation(my_rsv, goal, sb,
@@ -1067,15 +1123,27 @@ ext3_try_to_allocate_with_rsv(struct super_block *sb, handle_t *handle,
 
 			if (!goal_in_my_reservation(&rsv_copy, goal, group, sb))
 				goal = -1;
+		} else if (goal >= 0 && num > 1 &&
+			   rsv_copy._rsv_end <
+				group_first_block + goal + num - 1) {
+			/* the window ends before the request would */
+			write_seqlock(&my_rsv->rsv_seqlock);
+			try_to_extend_reservation(my_rsv, sb,
+				group_first_block + goal + num - 1 -
+				my_rsv->rsv_end);
+			rsv_copy._rsv_start = my_rsv->rsv_start;
+			rsv_copy._rsv_end = my_rsv->rsv_end;
+			write_sequnlock(&my_rsv->rsv_seqlock);
 		}
 		if ((rsv_copy._rsv_start >= group_first_block + EXT3_BLOCKS_PER_GROUP(sb))
 		    || (rsv_copy._rsv_end < group_first_block))
 			BUG();
+		*count = num;
 		ret = ext3_try_to_allocate(sb, handle, group, bitmap_bh, goal,
-					   &rsv_copy);
+					   count, &rsv_copy);
 		if (ret >= 0) {
 			if (!read_seqretry(&my_rsv->rsv_seqlock, seq))
-				atomic_inc(&my_rsv->rsv_alloc_hit);
+				atomic_add(*count, &my_rsv->rsv_alloc_hit);
 			break;				/* succeed */
 		}
 	}
@@ -1096,13 +1164,23 @@ out:
 	return ret;
 }
 
-static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+/*
+ * Blocks promised to delayed-allocation buffers are not free any more,
+ * even though the bitmaps don't know about them yet.
+ */
+static long ext3_avail_blocks(struct ext3_sb_info *sbi)
 {
-	int free_blocks, root_blocks;
+	return percpu_counter_read_positive(&sbi->s_freeblocks_counter) -
+		percpu_counter_read_positive(&sbi->s_dirtyblocks_counter);
+}
 
-	free_blocks = percpu_counter_read_positive(&sbi->s_freeblocks_counter);
+static int ext3_has_free_blocks_nr(struct ext3_sb_info *sbi, long nr)
+{
+	long free_blocks, root_blocks;
+
+	free_blocks = ext3_avail_blocks(sbi);
 	root_blocks = le32_to_cpu(sbi->s_es->s_r_blocks_count);
-	if (free_blocks < root_blocks + 1 && !capable(CAP_SYS_RESOURCE) &&
+	if (free_blocks < root_blocks + nr && !capable(CAP_SYS_RESOURCE) &&
 		sbi->s_resuid != current->fsuid &&
 		(sbi->s_resgid == 0 || !in_group_p (sbi->s_resgid))) {
 		return 0;
@@ -1110,6 +1188,31 @@ static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
 	return 1;
 }
 
+static int ext3_has_free_blocks(struct ext3_sb_info *sbi)
+{
+	return ext3_has_free_blocks_nr(sbi, 1);
+}
+
+/*
+ * Reserve `nr' blocks for delayed allocation.  Like the free blocks
+ * check itself this works on the approximate per-cpu counts.
+ */
+int ext3_claim_free_blocks(struct super_block *sb, unsigned long nr)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (ext3_avail_blocks(sbi) < (long)nr ||
+	    !ext3_has_free_blocks_nr(sbi, nr))
+		return -ENOSPC;
+	percpu_counter_mod(&sbi->s_dirtyblocks_counter, nr);
+	return 0;
+}
+
+void ext3_release_free_blocks(struct super_block *sb, unsigned long nr)
+{
+	percpu_counter_mod(&EXT3_SB(sb)->s_dirtyblocks_counter, -(long)nr);
+}
+
 /*
  * ext3_should_retry_alloc() is called when ENOSPC is returned, and if
  * it is profitable to retry the operation, this function will wait
@@ -1127,15 +1230,17 @@ int ext3_should_retry_alloc(struct super_block *sb, int *retries)
 }
 
 /*
- * ext3_new_block uses a goal block to assist allocation.  If the goal is
+ * ext3_new_blocks uses a goal block to assist allocation.  If the goal is
  * free, or there is a free block within 32 blocks of the goal, that block
  * is allocated.  Otherwise a forward search is made for a free block; within 
  * each block group the search first looks for an entire free byte in the block
  * bitmap, and then for any free bit if that fails.
+ * Up to *count blocks are allocated contiguously after the first one, all
+ * from the same bitmap search; *count returns how many were allocated.
  * This function also updates quota and i_blocks field.
  */
-int ext3_new_block(handle_t *handle, struct inode *inode,
-			unsigned long goal, int *errp)
+int ext3_new_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, unsigned long *count, int *errp)
 {
 	struct buffer_head *bitmap_bh = NULL;
 	struct buffer_head *gdp_bh;
@@ -1158,6 +1263,7 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	static int goal_hits, goal_attempts;
 #endif
 	unsigned long ngroups;
+	unsigned long num = *count;
 
 	*errp = -ENOSPC;
 	sb = inode->i_sb;
@@ -1167,9 +1273,9 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	}
 
 	/*
-	 * Check quota for allocation of this block.
+	 * Check quota for allocation of these blocks.
 	 */
-	if (DQUOT_ALLOC_BLOCK(inode, 1)) {
+	if (DQUOT_ALLOC_BLOCK(inode, num)) {
 		*errp = -EDQUOT;
 		return 0;
 	}
@@ -1189,7 +1295,12 @@ int ext3_new_block(handle_t *handle, struct inode *inode,
 	if (test_opt(sb, RESERVATION) &&
 		S_ISREG(inode->i_mode) && (windowsz > 0))
 		my_rsv = rsv;
-	if (!ext3_has_free_blocks(sbi)) {
+	/*
+	 * Delayed blocks were reserved at write() time, and that reservation
+	 * (root's share included) is what ext3_has_free_blocks() sees as used.
+	 */
+	if (EXT3_I(inode)->i_da_alloc_task != current &&
+	    !ext3_has_free_blocks(sbi)) {
 		*errp = -ENOSPC;
 		goto out;
 	}
@@ -1216,7 +1327,8 @@ retry:
 		if (!bitmap_bh)
 			goto io_error;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, ret_block, my_rsv, &fatal);
+					bitmap_bh, ret_block, my_rsv,
+					&num, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0)
@@ -1252,8 +1364,9 @@ retry:
 		bitmap_bh = read_block_bitmap(sb, group_no);
 		if (!bitmap_bh)
 			goto io_error;
+		num = *count;
 		ret_block = ext3_try_to_allocate_with_rsv(sb, handle, group_no,
-					bitmap_bh, -1, my_rsv, &fatal);
+					bitmap_bh, -1, my_rsv, &num, &fatal);
 		if (fatal)
 			goto out;
 		if (ret_block >= 0) 
@@ -1269,6 +1382,7 @@ retry:
 	if (my_rsv) {
 		my_rsv = NULL;
 		group_no = goal_group;
+		num = *count;
 		goto retry;
 	}
 	/* No space left on the device */
@@ -1288,13 +1402,15 @@ allocated:
 	target_block = ret_block + group_no * EXT3_BLOCKS_PER_GROUP(sb)
 				+ le32_to_cpu(es->s_first_data_block);
 
-	if (target_block == le32_to_cpu(gdp->bg_block_bitmap) ||
-	    target_block == le32_to_cpu(gdp->bg_inode_bitmap) ||
+	if (in_range(le32_to_cpu(gdp->bg_block_bitmap), target_block, num) ||
+	    in_range(le32_to_cpu(gdp->bg_inode_bitmap), target_block, num) ||
 	    in_range(target_block, le32_to_cpu(gdp->bg_inode_table),
+		      EXT3_SB(sb)->s_itb_per_group) ||
+	    in_range(target_block + num - 1, le32_to_cpu(gdp->bg_inode_table),
 		      EXT3_SB(sb)->s_itb_per_group))
 		ext3_error(sb, "ext3_new_block",
 			    "Allocating block in system zone - "
-			    "block = %u", target_block);
+			    "blocks from %u, length %lu", target_block, num);
 
 	performed_allocation = 1;
 
@@ -1327,7 +1443,7 @@ allocated:
 	/* ret_block was blockgroup-relative.  Now it becomes fs-relative */
 	ret_block = target_block;
 
-	if (ret_block >= le32_to_cpu(es->s_blocks_count)) {
+	if (ret_block + num - 1 >= le32_to_cpu(es->s_blocks_count)) {
 		ext3_error(sb, "ext3_new_block",
 			    "block(%d) >= blocks count(%d) - "
 			    "block_group = %d, es == %p ", ret_block,
@@ -1345,9 +1461,9 @@ allocated:
 
 	spin_lock(sb_bgl_lock(sbi, group_no));
 	gdp->bg_free_blocks_count =
-			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - 1);
+			cpu_to_le16(le16_to_cpu(gdp->bg_free_blocks_count) - num);
 	spin_unlock(sb_bgl_lock(sbi, group_no));
-	percpu_counter_mod(&sbi->s_freeblocks_counter, -1);
+	percpu_counter_mod(&sbi->s_freeblocks_counter, -num);
 
 	BUFFER_TRACE(gdp_bh, "journal_dirty_metadata for group descriptor");
 	err = ext3_journal_dirty_metadata(handle, gdp_bh);
@@ -1360,6 +1476,10 @@ allocated:
 
 	*errp = 0;
 	brelse(bitmap_bh);
+	/* Give back the quota of the blocks we did not get */
+	if (num < *count)
+		DQUOT_FREE_BLOCK(inode, *count - num);
+	*count = num;
 	return ret_block;
 
 io_error:
@@ -1373,11 +1493,19 @@ out:
 	 * Undo the block allocation
 	 */
 	if (!performed_allocation)
-		DQUOT_FREE_BLOCK(inode, 1);
+		DQUOT_FREE_BLOCK(inode, *count);
 	brelse(bitmap_bh);
 	return 0;
 }
 
+int ext3_new_block(handle_t *handle, struct inode *inode,
+			unsigned long goal, int *errp)
+{
+	unsigned long count = 1;
+
+	return ext3_new_blocks(handle, inode, goal, &count, errp);
+}
+
 unsigned long ext3_count_free_blocks(struct super_block *sb)
 {
 	unsigned long desc_count;
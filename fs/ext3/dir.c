@@ -320,6 +320,9 @@ static struct dir_private_info *create_dir_info(loff_t pos)
 	p->curr_hash = pos2maj_hash(pos);
 	p->curr_minor_hash = pos2min_hash(pos);
 	p->next_hash = 0;
+	p->inode_order = 0;
+	p->batch_index = p->batch_skip = 0;
+	p->resume_pos = pos;
 	return p;
 }
 
@@ -330,7 +333,8 @@ void ext3_htree_free_dir_info(struct dir_private_info *p)
 }
 
 /*
- * Given a directory entry, enter it into the fname rb tree.
+ * Given a directory entry, enter it into the fname rb tree.  The tree is
+ * keyed by hash, or by inode number for an inode-ordered readdir.
  */
 int ext3_htree_store_dirent(struct file *dir_file, __u32 hash,
 			     __u32 minor_hash,
@@ -362,6 +366,20 @@ int ext3_htree_store_dirent(struct file *dir_file, __u32 hash,
 		parent = *p;
 		fname = rb_entry(parent, struct fname, rb_hash);
 
+		if (info->inode_order) {
+			/* Hard links to one inode share a list */
+			if (new_fn->inode == fname->inode) {
+				new_fn->next = fname->next;
+				fname->next = new_fn;
+				return 0;
+			}
+			if (new_fn->inode < fname->inode)
+				p = &(*p)->rb_left;
+			else
+				p = &(*p)->rb_right;
+			continue;
+		}
+
 		/*
 		 * If the hash and minor hash match up, then we put
 		 * them on a linked list.  This rarely happens...
@@ -412,15 +430,31 @@ static int call_filldir(struct file * filp, void * dirent,
 	}
 	curr_pos = hash2pos(fname->hash, fname->minor_hash);
 	while (fname) {
+		/*
+		 * Names of an inode-ordered batch are not in hash order: each
+		 * is given its index in the batch instead, and a reader
+		 * resuming there from another open (nfsd, seekdir) gets the
+		 * batch refilled and the names before it skipped.
+		 */
+		if (info->inode_order) {
+			if (info->batch_index < info->batch_skip) {
+				info->batch_index++;
+				fname = fname->next;
+				continue;
+			}
+			curr_pos = (info->batch_hash >> 1) +
+				min(info->batch_index, info->batch_max - 1);
+		}
 		error = filldir(dirent, fname->name,
 				fname->name_len, curr_pos, 
 				fname->inode,
 				get_dtype(sb, fname->file_type));
 		if (error) {
 			filp->f_pos = curr_pos;
-			info->extra_fname = fname->next;
+			info->extra_fname = fname;
 			return error;
 		}
+		info->batch_index++;
 		fname = fname->next;
 	}
 	return 0;
@@ -438,6 +472,7 @@ static int ext3_dx_readdir(struct file * filp,
 		info = create_dir_info(filp->f_pos);
 		if (!info)
 			return -ENOMEM;
+		info->inode_order = test_opt(inode->i_sb, SORTDIR) != 0;
 		filp->private_data = info;
 	}
 
@@ -451,15 +486,19 @@ static int ext3_dx_readdir(struct file * filp,
 		info->extra_fname = NULL;
 		info->curr_hash = pos2maj_hash(filp->f_pos);
 		info->curr_minor_hash = pos2min_hash(filp->f_pos);
+		info->resume_pos = filp->f_pos;
 	}
 
 	/*
 	 * If there are any leftover names on the hash collision
 	 * chain, return them first.
 	 */
-	if (info->extra_fname &&
-	    call_filldir(filp, dirent, filldir, info->extra_fname))
-		goto finished;
+	if (info->extra_fname) {
+		if (call_filldir(filp, dirent, filldir, info->extra_fname))
+			goto finished;
+		info->extra_fname = NULL;
+		goto next_node;
+	}
 
 	if (!info->curr_node)
 		info->curr_node = rb_first(&info->root);
@@ -468,10 +507,12 @@ static int ext3_dx_readdir(struct file * filp,
 		/*
 		 * Fill the rbtree if we have no more entries,
 		 * or the inode has changed since we last read in the
-		 * cached entries. 
+		 * cached entries.  An inode-ordered batch is always
+		 * finished first: refilling it would return names again.
 		 */
 		if ((!info->curr_node) ||
-		    (filp->f_version != inode->i_version)) {
+		    (filp->f_version != inode->i_version &&
+		     !info->inode_order)) {
 			info->curr_node = NULL;
 			free_rb_tree_fname(&info->root);
 			filp->f_version = inode->i_version;
@@ -485,14 +526,23 @@ static int ext3_dx_readdir(struct file * filp,
 				break;
 			}
 			info->curr_node = rb_first(&info->root);
+			/* skip what an earlier reader got of this batch */
+			info->batch_index = info->batch_skip = 0;
+			if (info->inode_order &&
+			    info->resume_pos > (info->batch_hash >> 1))
+				info->batch_skip = info->resume_pos -
+						   (info->batch_hash >> 1);
+			info->resume_pos = 0;
 		}
 
 		fname = rb_entry(info->curr_node, struct fname, rb_hash);
-		info->curr_hash = fname->hash;
-		info->curr_minor_hash = fname->minor_hash;
+		if (!info->inode_order) {
+			info->curr_hash = fname->hash;
+			info->curr_minor_hash = fname->minor_hash;
+		}
 		if (call_filldir(filp, dirent, filldir, fname))
 			break;
-
+next_node:
 		info->curr_node = rb_next(info->curr_node);
 		if (!info->curr_node) {
 			if (info->next_hash == ~0) {
@@ -0,0 +1,809 @@
+/*
+ *  linux/fs/ext3/extents.c
+ *
+ *  Extent-mapped files.
+ *
+ *  The block map of an inode with EXT3_EXTENTS_FL set is a B-tree of
+ *  (logical block, physical block, length) runs rooted in i_data; see
+ *  <linux/ext3_extents.h> for the on-disk format.  Mapping any offset takes
+ *  one block read per tree level, and a sequentially written file needs a
+ *  single leaf entry per EXT_MAX_LEN blocks instead of an indirect block per
+ *  1024, which also makes truncate of large files cheap.
+ *
+ *  Leaf and index entries are both 12 bytes with the logical block first,
+ *  so insertion and node splitting below treat them alike.
+ *
+ *  All tree walks and modifications are serialised by EXT3_I(inode)->truncate_sem.
+ */
+
+#include <linux/time.h>
+#include <linux/fs.h>
+#include <linux/jbd.h>
+#include <linux/ext3_fs.h>
+#include <linux/ext3_jbd.h>
+#include <linux/ext3_extents.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/quotaops.h>
+#include <linux/buffer_head.h>
+
+#define EXT_MAX_BLOCK	0xffffffffUL
+
+static inline int ext3_ext_space_root(struct inode *inode)
+{
+	return (sizeof(EXT3_I(inode)->i_data) -
+		sizeof(struct ext3_extent_header)) / sizeof(struct ext3_extent);
+}
+
+static inline int ext3_ext_space_block(struct inode *inode)
+{
+	return (inode->i_sb->s_blocksize -
+		sizeof(struct ext3_extent_header)) / sizeof(struct ext3_extent);
+}
+
+static int ext3_ext_check_header(struct inode *inode,
+				 struct ext3_extent_header *eh, int depth)
+{
+	const char *error_msg;
+
+	if (le16_to_cpu(eh->eh_magic) != EXT3_EXT_MAGIC) {
+		error_msg = "invalid magic";
+		goto corrupted;
+	}
+	if (le16_to_cpu(eh->eh_depth) != depth) {
+		error_msg = "unexpected eh_depth";
+		goto corrupted;
+	}
+	if (eh->eh_max == 0) {
+		error_msg = "invalid eh_max";
+		goto corrupted;
+	}
+	if (le16_to_cpu(eh->eh_entries) > le16_to_cpu(eh->eh_max)) {
+		error_msg = "invalid eh_entries";
+		goto corrupted;
+	}
+	return 0;
+
+corrupted:
+	ext3_error(inode->i_sb, "ext3_ext_check_header",
+		   "bad header in inode #%lu: %s - magic %x, "
+		   "entries %u, max %u, depth %u(%d)",
+		   inode->i_ino, error_msg, le16_to_cpu(eh->eh_magic),
+		   le16_to_cpu(eh->eh_entries), le16_to_cpu(eh->eh_max),
+		   le16_to_cpu(eh->eh_depth), depth);
+	return -EIO;
+}
+
+/*
+ * Get write access to / dirty the node at one level of a path.  The root
+ * is part of the inode.
+ */
+static int ext3_ext_get_access(handle_t *handle, struct inode *inode,
+			       struct buffer_head *bh)
+{
+	if (bh)
+		return ext3_journal_get_write_access(handle, bh);
+	return 0;
+}
+
+static int ext3_ext_dirty(handle_t *handle, struct inode *inode,
+			  struct buffer_head *bh)
+{
+	if (bh)
+		return ext3_journal_dirty_metadata(handle, bh);
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
+static void ext3_ext_drop_refs(struct ext3_ext_path *path)
+{
+	int depth = path->p_depth;
+	int i;
+
+	for (i = 0; i <= depth; i++, path++) {
+		if (path->p_bh) {
+			brelse(path->p_bh);
+			path->p_bh = NULL;
+		}
+	}
+}
+
+/*
+ * Set up an empty tree in a new inode; the caller marks it dirty.
+ */
+void ext3_ext_tree_init(struct inode *inode)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+
+	eh->eh_depth = 0;
+	eh->eh_entries = 0;
+	eh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	eh->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+	eh->eh_generation = 0;
+}
+
+/*
+ * Binary search for the index entry whose child covers `block'.
+ */
+static void ext3_ext_binsearch_idx(struct ext3_ext_path *path,
+				   unsigned long block)
+{
+	struct ext3_extent_header *eh = path->p_hdr;
+	struct ext3_extent_idx *l, *r, *m;
+
+	l = EXT_FIRST_INDEX(eh) + 1;
+	r = EXT_LAST_INDEX(eh);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ei_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_idx = l - 1;
+}
+
+/*
+ * Binary search for the last extent starting at or before `block', or the
+ * first extent of the leaf if they all start after it.
+ */
+static void ext3_ext_binsearch(struct ext3_ext_path *path, unsigned long block)
+{
+	struct ext3_extent_header *eh = path->p_hdr;
+	struct ext3_extent *l, *r, *m;
+
+	if (eh->eh_entries == 0)
+		return;
+
+	l = EXT_FIRST_EXTENT(eh) + 1;
+	r = EXT_LAST_EXTENT(eh);
+	while (l <= r) {
+		m = l + (r - l) / 2;
+		if (block < le32_to_cpu(m->ee_block))
+			r = m - 1;
+		else
+			l = m + 1;
+	}
+	path->p_ext = l - 1;
+}
+
+/*
+ * Walk from the root to the leaf which would hold `block'.  The returned
+ * array has one element per level, the root first; the caller drops the
+ * buffer references with ext3_ext_drop_refs() and frees it.
+ */
+static struct ext3_ext_path *
+ext3_ext_find_extent(struct inode *inode, unsigned long block)
+{
+	struct ext3_extent_header *eh = ext_inode_hdr(inode);
+	struct ext3_ext_path *path;
+	struct buffer_head *bh;
+	int depth, i, ppos = 0;
+
+	depth = ext_depth(inode);
+	if (ext3_ext_check_header(inode, eh, depth))
+		return ERR_PTR(-EIO);
+	if (depth > EXT3_EXT_MAX_DEPTH) {
+		ext3_error(inode->i_sb, "ext3_ext_find_extent",
+			   "inode #%lu: tree depth %d", inode->i_ino, depth);
+		return ERR_PTR(-EIO);
+	}
+
+	path = kmalloc(sizeof(struct ext3_ext_path) * (depth + 1), GFP_NOFS);
+	if (!path)
+		return ERR_PTR(-ENOMEM);
+	memset(path, 0, sizeof(struct ext3_ext_path) * (depth + 1));
+	path[0].p_hdr = eh;
+	path[0].p_depth = depth;
+
+	/* walk through the tree */
+	for (i = depth; i > 0; i--) {
+		if (eh->eh_entries == 0)
+			goto corrupted;
+		ext3_ext_binsearch_idx(path + ppos, block);
+		path[ppos].p_block = idx_pblock(path[ppos].p_idx);
+
+		bh = sb_bread(inode->i_sb, path[ppos].p_block);
+		if (!bh)
+			goto err;
+		eh = ext_block_hdr(bh);
+		ppos++;
+		path[ppos].p_bh = bh;
+		path[ppos].p_hdr = eh;
+		path[ppos].p_depth = i - 1;
+		if (ext3_ext_check_header(inode, eh, i - 1))
+			goto err;
+	}
+
+	ext3_ext_binsearch(path + ppos, block);
+	return path;
+
+corrupted:
+	ext3_error(inode->i_sb, "ext3_ext_find_extent",
+		   "inode #%lu: empty index node", inode->i_ino);
+err:
+	ext3_ext_drop_refs(path);
+	kfree(path);
+	return ERR_PTR(-EIO);
+}
+
+/*
+ * Insert a leaf or index entry into a node with room for it, keeping the
+ * entries sorted.  Returns where it went.
+ */
+static struct ext3_extent *ext3_ext_insert_at(struct ext3_extent_header *eh,
+					      struct ext3_extent *entry)
+{
+	struct ext3_extent *pos = EXT_FIRST_EXTENT(eh);
+	struct ext3_extent *end = pos + le16_to_cpu(eh->eh_entries);
+
+	while (pos < end &&
+	       le32_to_cpu(pos->ee_block) < le32_to_cpu(entry->ee_block))
+		pos++;
+	if (pos < end)
+		memmove(pos + 1, pos, (end - pos) * sizeof(struct ext3_extent));
+	*pos = *entry;
+	eh->eh_entries = cpu_to_le16(le16_to_cpu(eh->eh_entries) + 1);
+	return pos;
+}
+
+/*
+ * The first key of the node at `level' got smaller: carry it up into the
+ * index entries pointing at it.
+ */
+static int ext3_ext_correct_indexes(handle_t *handle, struct inode *inode,
+				    struct ext3_ext_path *path, int level)
+{
+	__le32 key = EXT_FIRST_EXTENT(path[level].p_hdr)->ee_block;
+	int err = 0;
+
+	while (level > 0) {
+		struct ext3_ext_path *up = path + level - 1;
+
+		err = ext3_ext_get_access(handle, inode, up->p_bh);
+		if (err)
+			break;
+		up->p_idx->ei_block = key;
+		err = ext3_ext_dirty(handle, inode, up->p_bh);
+		if (err || up->p_idx != EXT_FIRST_INDEX(up->p_hdr))
+			break;
+		level--;
+	}
+	return err;
+}
+
+static unsigned long ext3_ext_inode_goal(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long bg_start;
+	unsigned long colour;
+
+	bg_start = (ei->i_block_group * EXT3_BLOCKS_PER_GROUP(inode->i_sb)) +
+		le32_to_cpu(EXT3_SB(inode->i_sb)->s_es->s_first_data_block);
+	colour = (current->pid % 16) *
+			(EXT3_BLOCKS_PER_GROUP(inode->i_sb) / 16);
+	return bg_start + colour;
+}
+
+/*
+ * Allocate and zero a block for a new tree node.
+ */
+static struct buffer_head *ext3_ext_new_node(handle_t *handle,
+			struct inode *inode, unsigned long goal,
+			unsigned long *newblock, int *err)
+{
+	struct buffer_head *bh;
+
+	*newblock = ext3_new_block(handle, inode, goal, err);
+	if (!*newblock)
+		return NULL;
+
+	bh = sb_getblk(inode->i_sb, *newblock);
+	lock_buffer(bh);
+	BUFFER_TRACE(bh, "call get_create_access");
+	*err = ext3_journal_get_create_access(handle, bh);
+	if (*err) {
+		unlock_buffer(bh);
+		brelse(bh);
+		ext3_free_blocks(handle, inode, *newblock, 1);
+		return NULL;
+	}
+	memset(bh->b_data, 0, inode->i_sb->s_blocksize);
+	set_buffer_uptodate(bh);
+	unlock_buffer(bh);
+	return bh;
+}
+
+static int ext3_ext_insert_entry(handle_t *handle, struct inode *inode,
+				 struct ext3_ext_path *path, int level,
+				 struct ext3_extent *entry);
+
+/*
+ * The root is full: move its entries down into a new block and make the
+ * root a single index entry pointing at it.  The pending entry goes into
+ * the new block, which has plenty of room.
+ */
+static int ext3_ext_grow_indepth(handle_t *handle, struct inode *inode,
+				 struct ext3_extent *entry)
+{
+	struct ext3_extent_header *root = ext_inode_hdr(inode);
+	struct ext3_extent_header *neh;
+	struct ext3_extent_idx *ix;
+	struct buffer_head *bh;
+	unsigned long newblock;
+	int err = 0;
+
+	bh = ext3_ext_new_node(handle, inode, ext3_ext_inode_goal(inode),
+			       &newblock, &err);
+	if (!bh)
+		return err;
+
+	neh = ext_block_hdr(bh);
+	memcpy(neh, root, sizeof(EXT3_I(inode)->i_data));
+	neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	ext3_ext_insert_at(neh, entry);
+
+	BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+	err = ext3_journal_dirty_metadata(handle, bh);
+	if (err)
+		goto out;
+
+	root->eh_depth = cpu_to_le16(le16_to_cpu(root->eh_depth) + 1);
+	root->eh_entries = cpu_to_le16(1);
+	root->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+	ix = EXT_FIRST_INDEX(root);
+	ix->ei_block = EXT_FIRST_EXTENT(neh)->ee_block;
+	ext3_idx_store_pblock(ix, newblock);
+	ix->ei_unused = 0;
+	err = ext3_mark_inode_dirty(handle, inode);
+out:
+	brelse(bh);
+	return err;
+}
+
+/*
+ * The node at `level' (not the root) is full: move its upper half into a
+ * new sibling, put `entry' into the half which covers it and insert the
+ * sibling's index entry one level up.  An entry going past the end of the
+ * node, as for a file written sequentially, gets a sibling of its own so
+ * that the full node stays full.
+ */
+static int ext3_ext_split(handle_t *handle, struct inode *inode,
+			  struct ext3_ext_path *path, int level,
+			  struct ext3_extent *entry)
+{
+	struct ext3_ext_path *curp = path + level;
+	struct ext3_extent_header *eh = curp->p_hdr, *neh;
+	struct ext3_extent *pos = NULL, rec;
+	struct ext3_extent_idx *ix = (struct ext3_extent_idx *) &rec;
+	struct buffer_head *bh;
+	unsigned long newblock;
+	unsigned long key = le32_to_cpu(entry->ee_block);
+	int entries = le16_to_cpu(eh->eh_entries);
+	int m, err = 0;
+
+	if (key > le32_to_cpu(EXT_LAST_EXTENT(eh)->ee_block))
+		m = entries;
+	else
+		m = entries / 2;
+
+	bh = ext3_ext_new_node(handle, inode, curp->p_bh->b_blocknr,
+			       &newblock, &err);
+	if (!bh)
+		return err;
+
+	neh = ext_block_hdr(bh);
+	neh->eh_magic = cpu_to_le16(EXT3_EXT_MAGIC);
+	neh->eh_max = cpu_to_le16(ext3_ext_space_block(inode));
+	neh->eh_depth = eh->eh_depth;
+	neh->eh_entries = cpu_to_le16(entries - m);
+	memcpy(EXT_FIRST_EXTENT(neh), EXT_FIRST_EXTENT(eh) + m,
+	       (entries - m) * sizeof(struct ext3_extent));
+
+	err = ext3_ext_get_access(handle, inode, curp->p_bh);
+	if (err)
+		goto fail;
+	eh->eh_entries = cpu_to_le16(m);
+
+	if (m == entries || key >= le32_to_cpu(EXT_FIRST_EXTENT(neh)->ee_block))
+		ext3_ext_insert_at(neh, entry);
+	else
+		pos = ext3_ext_insert_at(eh, entry);
+
+	BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+	err = ext3_journal_dirty_metadata(handle, bh);
+	if (err)
+		goto fail;
+	err = ext3_ext_dirty(handle, inode, curp->p_bh);
+	if (err)
+		goto out;
+	if (pos == EXT_FIRST_EXTENT(eh)) {
+		err = ext3_ext_correct_indexes(handle, inode, path, level);
+		if (err)
+			goto out;
+	}
+
+	/* hook the new node into the parent */
+	memset(&rec, 0, sizeof(rec));
+	ix->ei_block = EXT_FIRST_EXTENT(neh)->ee_block;
+	ext3_idx_store_pblock(ix, newblock);
+	brelse(bh);
+	return ext3_ext_insert_entry(handle, inode, path, level - 1, &rec);
+
+fail:
+	ext3_free_blocks(handle, inode, newblock, 1);
+out:
+	brelse(bh);
+	return err;
+}
+
+/*
+ * Insert a leaf or index entry into the node at `level' of the path,
+ * splitting nodes and growing the tree as needed.
+ */
+static int ext3_ext_insert_entry(handle_t *handle, struct inode *inode,
+				 struct ext3_ext_path *path, int level,
+				 struct ext3_extent *entry)
+{
+	struct ext3_ext_path *curp = path + level;
+	struct ext3_extent_header *eh = curp->p_hdr;
+	struct ext3_extent *pos;
+	int err;
+
+	if (le16_to_cpu(eh->eh_entries) < le16_to_cpu(eh->eh_max)) {
+		err = ext3_ext_get_access(handle, inode, curp->p_bh);
+		if (err)
+			return err;
+		pos = ext3_ext_insert_at(eh, entry);
+		err = ext3_ext_dirty(handle, inode, curp->p_bh);
+		if (!err && level > 0 && pos == EXT_FIRST_EXTENT(eh))
+			err = ext3_ext_correct_indexes(handle, inode,
+						       path, level);
+		return err;
+	}
+
+	if (level == 0)
+		return ext3_ext_grow_indepth(handle, inode, entry);
+	return ext3_ext_split(handle, inode, path, level, entry);
+}
+
+/*
+ * First logical block allocated after `block', as seen from the path to
+ * it, or EXT_MAX_BLOCK.
+ */
+static unsigned long ext3_ext_next_allocated_block(struct ext3_ext_path *path,
+						   unsigned long block)
+{
+	int depth = path->p_depth;
+	struct ext3_extent *ex = path[depth].p_ext;
+
+	if (ex) {
+		if (le32_to_cpu(ex->ee_block) > block)
+			return le32_to_cpu(ex->ee_block);
+		if (ex < EXT_LAST_EXTENT(path[depth].p_hdr))
+			return le32_to_cpu((ex + 1)->ee_block);
+	}
+	while (--depth >= 0) {
+		if (path[depth].p_idx < EXT_LAST_INDEX(path[depth].p_hdr))
+			return le32_to_cpu((path[depth].p_idx + 1)->ei_block);
+	}
+	return EXT_MAX_BLOCK;
+}
+
+/*
+ * Place new data next to the extent found for it, so that appends extend
+ * that extent on disk.
+ */
+static unsigned long ext3_ext_find_goal(struct inode *inode,
+					struct ext3_ext_path *path,
+					unsigned long block)
+{
+	int depth = path->p_depth;
+	struct ext3_extent *ex = path[depth].p_ext;
+
+	if (ex) {
+		unsigned long ext_block = le32_to_cpu(ex->ee_block);
+		unsigned long ext_pblk = ext_pblock(ex);
+
+		if (block >= ext_block)
+			return ext_pblk + (block - ext_block);
+		if (ext_pblk > ext_block - block)
+			return ext_pblk - (ext_block - block);
+		return ext_pblk;
+	}
+
+	/* an empty leaf: near the leaf block itself */
+	if (path[depth].p_bh)
+		return path[depth].p_bh->b_blocknr;
+
+	return ext3_ext_inode_goal(inode);
+}
+
+/*
+ * Map up to `maxblocks' blocks at `iblock', allocating them if `create' is
+ * set and they are a hole.  Like ext3_get_blocks_handle(), returns the
+ * number of blocks mapped at bh_result->b_blocknr, zero for a hole when
+ * create == 0, or a negative error.
+ */
+int ext3_ext_get_blocks(handle_t *handle, struct inode *inode,
+			sector_t iblock, unsigned long maxblocks,
+			struct buffer_head *bh_result, int create,
+			int extend_disksize)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	struct ext3_ext_path *path;
+	struct ext3_extent *ex, newex;
+	unsigned long goal, newblock = 0, allocated = 0, next;
+	int depth, err = 0;
+
+	J_ASSERT(handle != NULL || create == 0);
+
+	down(&ei->truncate_sem);
+	path = ext3_ext_find_extent(inode, iblock);
+	if (IS_ERR(path)) {
+		err = PTR_ERR(path);
+		goto out_unlock;
+	}
+
+	depth = path->p_depth;
+	ex = path[depth].p_ext;
+	if (ex) {
+		unsigned long ee_block = le32_to_cpu(ex->ee_block);
+		unsigned long ee_len = le16_to_cpu(ex->ee_len);
+
+		/* Simplest case - block found, no allocation needed */
+		if (iblock >= ee_block && iblock < ee_block + ee_len) {
+			newblock = ext_pblock(ex) + (iblock - ee_block);
+			allocated = ee_len - (iblock - ee_block);
+			if (allocated > maxblocks)
+				allocated = maxblocks;
+			clear_buffer_new(bh_result);
+			goto out;
+		}
+	}
+
+	/* Next simple case - plain lookup of a hole */
+	if (!create)
+		goto out_drop;
+
+	if (create == EXT3_GET_BLOCKS_DELALLOC)
+		ei->i_da_alloc_task = current;
+
+	/* Allocate as much of the hole as was asked for */
+	next = ext3_ext_next_allocated_block(path, iblock);
+	allocated = next - iblock;
+	if (allocated > maxblocks)
+		allocated = maxblocks;
+	if (allocated > EXT_MAX_LEN)
+		allocated = EXT_MAX_LEN;
+	goal = ext3_ext_find_goal(inode, path, iblock);
+	newblock = ext3_new_blocks(handle, inode, goal, &allocated, &err);
+	if (!newblock)
+		goto out_drop;
+
+	if (ex && le32_to_cpu(ex->ee_block) + le16_to_cpu(ex->ee_len) == iblock &&
+	    ext_pblock(ex) + le16_to_cpu(ex->ee_len) == newblock &&
+	    le16_to_cpu(ex->ee_len) + allocated <= EXT_MAX_LEN) {
+		/* the new blocks continue the previous extent */
+		err = ext3_ext_get_access(handle, inode, path[depth].p_bh);
+		if (!err) {
+			ex->ee_len = cpu_to_le16(le16_to_cpu(ex->ee_len) +
+						 allocated);
+			err = ext3_ext_dirty(handle, inode, path[depth].p_bh);
+		}
+	} else {
+		newex.ee_block = cpu_to_le32(iblock);
+		newex.ee_len = cpu_to_le16(allocated);
+		ext3_ext_store_pblock(&newex, newblock);
+		err = ext3_ext_insert_entry(handle, inode, path, depth, &newex);
+	}
+	if (err) {
+		ext3_free_blocks(handle, inode, newblock, allocated);
+		goto out_drop;
+	}
+
+	/* i_disksize growing is protected by truncate_sem */
+	if (extend_disksize) {
+		if (create == EXT3_GET_BLOCKS_DELALLOC)
+			ext3_da_update_disksize(inode, iblock, allocated);
+		else if (inode->i_size > ei->i_disksize)
+			ei->i_disksize = inode->i_size;
+	}
+	set_buffer_new(bh_result);
+out:
+	map_bh(bh_result, inode->i_sb, newblock);
+	err = allocated;
+out_drop:
+	ext3_ext_drop_refs(path);
+	kfree(path);
+out_unlock:
+	ei->i_da_alloc_task = NULL;
+	up(&ei->truncate_sem);
+	return err;
+}
+
+/*
+ * Worst case number of metadata blocks touched by inserting one extent:
+ * every level may split, dirtying the old node, a new node and the bitmap
+ * and group descriptor it is allocated from, and the root may grow.
+ */
+int ext3_ext_calc_credits_for_insert(struct inode *inode)
+{
+	return 4 * (ext_depth(inode) + 2);
+}
+
+/*
+ * Make sure the handle has `needed' credits, restarting the transaction
+ * if it can't be extended.  The tree must be consistent on disk here.
+ */
+static int ext3_ext_truncate_extend(handle_t *handle, struct inode *inode,
+				    int needed)
+{
+	int err;
+
+	if (handle->h_buffer_credits >= needed)
+		return 0;
+	err = ext3_journal_extend(handle, needed);
+	if (err <= 0)
+		return err;
+	ext3_mark_inode_dirty(handle, inode);
+	jbd_debug(2, "restarting handle %p\n", handle);
+	return ext3_journal_restart(handle, needed);
+}
+
+/*
+ * Free `num' blocks at `block', revoking them first where needed just as
+ * ext3_clear_blocks() does for indirect-mapped files.
+ */
+static void ext3_ext_free_data(handle_t *handle, struct inode *inode,
+			       unsigned long block, unsigned long num)
+{
+	unsigned long i;
+
+	for (i = 0; i < num; i++) {
+		struct buffer_head *bh;
+
+		bh = sb_find_get_block(inode->i_sb, block + i);
+		ext3_forget(handle, 0, inode, bh, block + i);
+	}
+	ext3_free_blocks(handle, inode, block, num);
+}
+
+/*
+ * Remove the blocks from `start' on from a leaf, right to left.  Each
+ * extent is shortened or dropped in the same transaction that frees its
+ * blocks, so the tree is consistent whenever the handle is restarted.
+ */
+static int ext3_ext_rm_leaf(handle_t *handle, struct inode *inode,
+			    struct ext3_extent_header *eh,
+			    struct buffer_head *bh, unsigned long start)
+{
+	struct ext3_extent *ex = EXT_LAST_EXTENT(eh);
+	int credits_per_group = 2;
+	int err = 0;
+
+	while (ex >= EXT_FIRST_EXTENT(eh)) {
+		unsigned long ee_block = le32_to_cpu(ex->ee_block);
+		unsigned long ee_len = le16_to_cpu(ex->ee_len);
+		unsigned long block, num;
+
+		if (ee_block + ee_len <= start)
+			break;
+		if (ee_block >= start)
+			num = ee_len;
+		else
+			num = ee_block + ee_len - start;
+		block = ext_pblock(ex) + ee_len - num;
+
+		err = ext3_ext_truncate_extend(handle, inode,
+				credits_per_group *
+				(num / EXT3_BLOCKS_PER_GROUP(inode->i_sb) + 2) +
+				EXT3_RESERVE_TRANS_BLOCKS);
+		if (err)
+			break;
+		err = ext3_ext_get_access(handle, inode, bh);
+		if (err)
+			break;
+		if (num == ee_len) {
+			memmove(ex, ex + 1, (EXT_LAST_EXTENT(eh) - ex) *
+				sizeof(struct ext3_extent));
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+		} else
+			ex->ee_len = cpu_to_le16(ee_len - num);
+		err = ext3_ext_dirty(handle, inode, bh);
+		if (err)
+			break;
+		ext3_ext_free_data(handle, inode, block, num);
+		ex--;
+	}
+	return err;
+}
+
+/*
+ * Remove the blocks from `start' on below a node at `depth', freeing the
+ * nodes that become empty.
+ */
+static int ext3_ext_rm_node(handle_t *handle, struct inode *inode,
+			    struct ext3_extent_header *eh,
+			    struct buffer_head *bh, int depth,
+			    unsigned long start)
+{
+	struct ext3_extent_idx *ix;
+	int err = 0;
+
+	if (depth == 0)
+		return ext3_ext_rm_leaf(handle, inode, eh, bh, start);
+
+	ix = EXT_LAST_INDEX(eh);
+	while (ix >= EXT_FIRST_INDEX(eh)) {
+		unsigned long key = le32_to_cpu(ix->ei_block);
+		unsigned long blk = idx_pblock(ix);
+		struct buffer_head *child_bh;
+		struct ext3_extent_header *child;
+
+		child_bh = sb_bread(inode->i_sb, blk);
+		if (!child_bh)
+			return -EIO;
+		child = ext_block_hdr(child_bh);
+		err = ext3_ext_check_header(inode, child, depth - 1);
+		if (!err)
+			err = ext3_ext_rm_node(handle, inode, child, child_bh,
+					       depth - 1, start);
+		if (err || child->eh_entries != 0) {
+			brelse(child_bh);
+			if (err)
+				return err;
+		} else {
+			/* the child is empty: drop it from the tree */
+			err = ext3_ext_truncate_extend(handle, inode,
+					EXT3_RESERVE_TRANS_BLOCKS + 4);
+			if (!err)
+				err = ext3_ext_get_access(handle, inode, bh);
+			if (err) {
+				brelse(child_bh);
+				return err;
+			}
+			memmove(ix, ix + 1, (EXT_LAST_INDEX(eh) - ix) *
+				sizeof(struct ext3_extent_idx));
+			eh->eh_entries =
+				cpu_to_le16(le16_to_cpu(eh->eh_entries) - 1);
+			err = ext3_ext_dirty(handle, inode, bh);
+			ext3_forget(handle, 1, inode, child_bh, blk);
+			ext3_free_blocks(handle, inode, blk, 1);
+			if (err)
+				return err;
+		}
+		/* children to the left lie entirely before `start' */
+		if (key <= start)
+			break;
+		ix--;
+	}
+	return err;
+}
+
+/*
+ * Called by ext3_truncate() with truncate_sem held, the handle started and
+ * the inode on the orphan list: release everything past i_size.
+ */
+void ext3_ext_truncate(handle_t *handle, struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+	struct ext3_extent_header *root = ext_inode_hdr(inode);
+	unsigned long start;
+	int depth = ext_depth(inode);
+
+	start = (inode->i_size + sb->s_blocksize - 1) >>
+					EXT3_BLOCK_SIZE_BITS(sb);
+
+	if (ext3_ext_check_header(inode, root, depth))
+		return;
+	if (ext3_ext_rm_node(handle, inode, root, NULL, depth, start))
+		return;
+
+	/* an empty tree goes back to being a leaf in the inode */
+	if (depth && root->eh_entries == 0) {
+		root->eh_depth = 0;
+		root->eh_max = cpu_to_le16(ext3_ext_space_root(inode));
+		ext3_mark_inode_dirty(handle, inode);
+	}
+}
@@ -36,10 +36,12 @@
 #include <linux/writeback.h>
 #include <linux/mpage.h>
 #include <linux/uio.h>
+#include <linux/ext3_extents.h>
 #include "xattr.h"
 #include "acl.h"
 
 static int ext3_writepage_trans_blocks(struct inode *inode);
+static void ext3_da_release_blocks(struct inode *inode, unsigned long nr);
 
 /*
  * Test whether an inode is a fast symlink.
@@ -233,15 +235,6 @@ no_delete:
 	clear_inode(inode);	/* We must guarantee clearing of inode... */
 }
 
-static int ext3_alloc_block (handle_t *handle,
-			struct inode * inode, unsigned long goal, int *err)
-{
-	unsigned long result;
-
-	result = ext3_new_block(handle, inode, goal, err);
-	return result;
-}
-
 
 typedef struct {
 	__le32	*p;
@@ -267,8 +260,10 @@ static inline int verify_chain(Indirect *from, Indirect *to)
  *	@inode: inode in question (we are only interested in its superblock)
  *	@i_block: block number to be parsed
  *	@offsets: array to store the offsets in
- *      @boundary: set this non-zero if the referred-to block is likely to be
- *             followed (on disk) by an indirect block.
+ *	@boundary: set this to the number of blocks which follow the
+ *		referred-to block in the same indirect block (or in the
+ *		inode); zero means it is likely to be followed (on disk) by
+ *		an indirect block.
  *
  *	To store the locations of file's data ext3 uses a data structure common
  *	for UNIX filesystems - tree of pointers anchored in the inode, with
@@ -328,7 +323,7 @@ static int ext3_block_to_path(struct inode *inode,
 		ext3_warning (inode->i_sb, "ext3_block_to_path", "block > big");
 	}
 	if (boundary)
-		*boundary = (i_block & (ptrs - 1)) == (final - 1);
+		*boundary = final - 1 - (i_block & (ptrs - 1));
 	return n;
 }
 
@@ -485,15 +480,100 @@ static int ext3_find_goal(struct inode *inode, long block, Indirect chain[4],
 	return -EAGAIN;
 }
 
+/**
+ *	ext3_blks_to_allocate - count the data blocks to allocate in one go
+ *	@branch: chain of indirect blocks, starting with the missing link
+ *	@k: number of indirect blocks that have to be allocated
+ *	@blks: number of data blocks wanted
+ *	@blocks_to_boundary: blocks after the first one in the same
+ *		indirect block (see ext3_block_to_path)
+ *
+ *	If indirect blocks are missing, all of the data blocks they will map
+ *	are holes too.  Otherwise count the holes following the first one in
+ *	the existing indirect block.  A run never crosses an indirect block
+ *	boundary.
+ */
+static int ext3_blks_to_allocate(Indirect *branch, int k, unsigned long blks,
+				 int blocks_to_boundary)
+{
+	unsigned long count = 0;
+
+	if (k > 0) {
+		if (blks < blocks_to_boundary + 1)
+			count += blks;
+		else
+			count += blocks_to_boundary + 1;
+		return count;
+	}
+
+	count++;
+	while (count < blks && count <= blocks_to_boundary &&
+		le32_to_cpu(*(branch[0].p + count)) == 0) {
+		count++;
+	}
+	return count;
+}
+
+/**
+ *	ext3_alloc_blocks - allocate the indirect blocks and a run of data blocks
+ *	@indirect_blks: number of indirect blocks needed
+ *	@blks: number of data blocks wanted
+ *	@new_blocks: the indirect blocks, then the first data block, go here
+ *
+ *	The indirect blocks are taken from the front of the allocated runs so
+ *	that the data follows them on disk.  Returns the number of data
+ *	blocks allocated, at least one unless *@err is set.
+ */
+static int ext3_alloc_blocks(handle_t *handle, struct inode *inode,
+			unsigned long goal, int indirect_blks, int blks,
+			unsigned long new_blocks[4], int *err)
+{
+	int target, i;
+	unsigned long count = 0;
+	int index = 0;
+	unsigned long current_block = 0;
+
+	target = blks + indirect_blks;
+	while (1) {
+		count = target;
+		current_block = ext3_new_blocks(handle, inode, goal,
+						&count, err);
+		if (*err)
+			goto failed_out;
+
+		target -= count;
+		/* allocate the indirect blocks first */
+		while (index < indirect_blks && count) {
+			new_blocks[index++] = current_block++;
+			count--;
+		}
+		if (count > 0)
+			break;
+		goal = current_block;
+	}
+
+	/* the rest of the last run is data */
+	new_blocks[index] = current_block;
+	return count;
+
+failed_out:
+	for (i = 0; i < index; i++)
+		ext3_free_blocks(handle, inode, new_blocks[i], 1);
+	return 0;
+}
+
 /**
  *	ext3_alloc_branch - allocate and set up a chain of blocks.
  *	@inode: owner
- *	@num: depth of the chain (number of blocks to allocate)
+ *	@indirect_blks: number of indirect blocks to allocate
+ *	@blks: in: number of data blocks wanted, out: number allocated
  *	@offsets: offsets (in the blocks) to store the pointers to next.
  *	@branch: place to store the chain in.
  *
- *	This function allocates @num blocks, zeroes out all but the last one,
- *	links them into chain and (if we are synchronous) writes them to disk.
+ *	This function allocates @indirect_blks indirect blocks and a run of up
+ *	to *@blks data blocks, zeroes out the indirect blocks, links them into
+ *	chain and (if we are synchronous) writes them to disk.  The pointers to
+ *	all but the first data block are filled in the last indirect block.
  *	In other words, it prepares a branch that can be spliced onto the
  *	inode. It stores the information about that chain in the branch[], in
  *	the same format as ext3_get_branch() would do. We are calling it after
@@ -506,74 +586,83 @@ static int ext3_find_goal(struct inode *inode, long block, Indirect chain[4],
  *
  *	If allocation fails we free all blocks we've allocated (and forget
  *	their buffer_heads) and return the error value the from failed
- *	ext3_alloc_block() (normally -ENOSPC). Otherwise we set the chain
+ *	ext3_new_blocks() (normally -ENOSPC). Otherwise we set the chain
  *	as described above and return 0.
  */
 
 static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
-			     int num,
+			     int indirect_blks, int *blks,
 			     unsigned long goal,
 			     int *offsets,
 			     Indirect *branch)
 {
 	int blocksize = inode->i_sb->s_blocksize;
-	int n = 0, keys = 0;
+	int i, n = 0;
 	int err = 0;
-	int i;
-	int parent = ext3_alloc_block(handle, inode, goal, &err);
-
-	branch[0].key = cpu_to_le32(parent);
-	if (parent) {
-		for (n = 1; n < num; n++) {
-			struct buffer_head *bh;
-			/* Allocate the next block */
-			int nr = ext3_alloc_block(handle, inode, parent, &err);
-			if (!nr)
-				break;
-			branch[n].key = cpu_to_le32(nr);
-			keys = n+1;
+	struct buffer_head *bh;
+	int num;
+	unsigned long new_blocks[4];
+	unsigned long current_block;
 
-			/*
-			 * Get buffer_head for parent block, zero it out
-			 * and set the pointer to new one, then send
-			 * parent to disk.  
-			 */
-			bh = sb_getblk(inode->i_sb, parent);
-			branch[n].bh = bh;
-			lock_buffer(bh);
-			BUFFER_TRACE(bh, "call get_create_access");
-			err = ext3_journal_get_create_access(handle, bh);
-			if (err) {
-				unlock_buffer(bh);
-				brelse(bh);
-				break;
-			}
+	num = ext3_alloc_blocks(handle, inode, goal, indirect_blks,
+				*blks, new_blocks, &err);
+	if (err)
+		return err;
 
-			memset(bh->b_data, 0, blocksize);
-			branch[n].p = (__le32*) bh->b_data + offsets[n];
-			*branch[n].p = branch[n].key;
-			BUFFER_TRACE(bh, "marking uptodate");
-			set_buffer_uptodate(bh);
+	branch[0].key = cpu_to_le32(new_blocks[0]);
+	/*
+	 * metadata blocks and data blocks are allocated.
+	 */
+	for (n = 1; n <= indirect_blks;  n++) {
+		/*
+		 * Get buffer_head for parent block, zero it out
+		 * and set the pointer to new one, then send
+		 * parent to disk.
+		 */
+		bh = sb_getblk(inode->i_sb, new_blocks[n-1]);
+		branch[n].bh = bh;
+		lock_buffer(bh);
+		BUFFER_TRACE(bh, "call get_create_access");
+		err = ext3_journal_get_create_access(handle, bh);
+		if (err) {
 			unlock_buffer(bh);
+			brelse(bh);
+			goto failed;
+		}
 
-			BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
-			err = ext3_journal_dirty_metadata(handle, bh);
-			if (err)
-				break;
-
-			parent = nr;
+		memset(bh->b_data, 0, blocksize);
+		branch[n].p = (__le32*) bh->b_data + offsets[n];
+		branch[n].key = cpu_to_le32(new_blocks[n]);
+		*branch[n].p = branch[n].key;
+		if (n == indirect_blks) {
+			/* the rest of the data run */
+			current_block = new_blocks[n];
+			for (i = 1; i < num; i++)
+				*(branch[n].p + i) = cpu_to_le32(++current_block);
 		}
+		BUFFER_TRACE(bh, "marking uptodate");
+		set_buffer_uptodate(bh);
+		unlock_buffer(bh);
+
+		BUFFER_TRACE(bh, "call ext3_journal_dirty_metadata");
+		err = ext3_journal_dirty_metadata(handle, bh);
+		if (err)
+			goto failed;
 	}
-	if (n == num)
-		return 0;
+	*blks = num;
+	return err;
 
+failed:
 	/* Allocation failed, free what we already allocated */
-	for (i = 1; i < keys; i++) {
+	for (i = 1; i < n; i++) {
 		BUFFER_TRACE(branch[i].bh, "call journal_forget");
 		ext3_journal_forget(handle, branch[i].bh);
 	}
-	for (i = 0; i < keys; i++)
-		ext3_free_blocks(handle, inode, le32_to_cpu(branch[i].key), 1);
+	for (i = 0; i < indirect_blks; i++)
+		ext3_free_blocks(handle, inode, new_blocks[i], 1);
+
+	ext3_free_blocks(handle, inode, new_blocks[i], num);
+
 	return err;
 }
 
@@ -584,7 +673,8 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
  *	@chain: chain of indirect blocks (with a missing link - see
  *		ext3_alloc_branch)
  *	@where: location of missing link
- *	@num:   number of blocks we are adding
+ *	@num:   number of indirect blocks we are adding
+ *	@blks:  number of direct blocks we are adding
  *
  *	This function verifies that chain (up to the missing link) had not
  *	changed, fills the missing link and does all housekeeping needed in
@@ -595,11 +685,13 @@ static int ext3_alloc_branch(handle_t *handle, struct inode *inode,
  */
 
 static int ext3_splice_branch(handle_t *handle, struct inode *inode, long block,
-			      Indirect chain[4], Indirect *where, int num)
+			      Indirect chain[4], Indirect *where, int num,
+			      int blks)
 {
 	int i;
 	int err = 0;
 	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long current_block;
 
 	/*
 	 * If we're splicing into a [td]indirect block (as opposed to the
@@ -622,8 +714,17 @@ static int ext3_splice_branch(handle_t *handle, struct inode *inode, long block,
 	/* That's it */
 
 	*where->p = where->key;
-	ei->i_next_alloc_block = block;
-	ei->i_next_alloc_goal = le32_to_cpu(where[num-1].key);
+	/*
+	 * Spliced straight into an existing indirect block or the inode:
+	 * fill in the pointers to the rest of the data run as well.
+	 */
+	if (num == 0 && blks > 1) {
+		current_block = le32_to_cpu(where->key) + 1;
+		for (i = 1; i < blks; i++)
+			*(where->p + i) = cpu_to_le32(current_block++);
+	}
+	ei->i_next_alloc_block = block + blks - 1;
+	ei->i_next_alloc_goal = le32_to_cpu(where[num].key) + blks - 1;
 	/* Writer: end */
 
 	/* We are done with atomic stuff, now do the rest of housekeeping */
@@ -664,17 +765,20 @@ changed:
 	err = -EAGAIN;
 
 err_out:
-	for (i = 1; i < num; i++) {
+	for (i = 1; i <= num; i++) {
 		BUFFER_TRACE(where[i].bh, "call journal_forget");
 		ext3_journal_forget(handle, where[i].bh);
 	}
 	/* For the normal collision cleanup case, we free up the blocks.
 	 * On genuine filesystem errors we don't even think about doing
 	 * that. */
-	if (err == -EAGAIN)
+	if (err == -EAGAIN) {
 		for (i = 0; i < num; i++)
 			ext3_free_blocks(handle, inode, 
 					 le32_to_cpu(where[i].key), 1);
+		ext3_free_blocks(handle, inode, le32_to_cpu(where[num].key),
+				 blks);
+	}
 	return err;
 }
 
@@ -690,27 +794,40 @@ err_out:
  * allocations is needed - we simply release blocks and do not touch anything
  * reachable from inode.
  *
+ * Up to @maxblocks blocks are mapped or allocated at once, as long as they
+ * are contiguous on disk and referred to by the same indirect block.  The
+ * return value is the number of blocks mapped at bh_result->b_blocknr, zero
+ * for a hole when create == 0, or a negative error.
+ *
  * akpm: `handle' can be NULL if create == 0.
  *
  * The BKL may not be held on entry here.  Be sure to take it early.
  */
 
 static int
-ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
-		struct buffer_head *bh_result, int create, int extend_disksize)
+ext3_get_blocks_handle(handle_t *handle, struct inode *inode, sector_t iblock,
+		unsigned long maxblocks, struct buffer_head *bh_result,
+		int create, int extend_disksize)
 {
 	int err = -EIO;
 	int offsets[4];
 	Indirect chain[4];
 	Indirect *partial;
 	unsigned long goal;
-	int left;
-	int boundary = 0;
-	int depth = ext3_block_to_path(inode, iblock, offsets, &boundary);
+	int indirect_blks;
+	int blocks_to_boundary = 0;
+	int depth;
 	struct ext3_inode_info *ei = EXT3_I(inode);
+	int count = 0;
+	unsigned long first_block = 0;
 
 	J_ASSERT(handle != NULL || create == 0);
 
+	if (ei->i_flags & EXT3_EXTENTS_FL)
+		return ext3_ext_get_blocks(handle, inode, iblock, maxblocks,
+					   bh_result, create, extend_disksize);
+
+	depth = ext3_block_to_path(inode, iblock, offsets, &blocks_to_boundary);
 	if (depth == 0)
 		goto out;
 
@@ -719,11 +836,29 @@ reread:
 
 	/* Simplest case - block found, no allocation needed */
 	if (!partial) {
+		first_block = le32_to_cpu(chain[depth - 1].key);
 		clear_buffer_new(bh_result);
+		count++;
+		/* Map the blocks which follow it on disk as well */
+		while (count < maxblocks && count <= blocks_to_boundary) {
+			unsigned long blk;
+
+			if (!verify_chain(chain, chain + depth - 1)) {
+				/* truncated under us: reread the chain */
+				partial = chain + depth - 1;
+				count = 0;
+				goto changed;
+			}
+			blk = le32_to_cpu(*(chain[depth-1].p + count));
+			if (blk != first_block + count)
+				break;
+			count++;
+		}
 got_it:
-		map_bh(bh_result, inode->i_sb, le32_to_cpu(chain[depth-1].key));
-		if (boundary)
+		map_bh(bh_result, inode->i_sb, first_block);
+		if (count > blocks_to_boundary)
 			set_buffer_boundary(bh_result);
+		err = count;
 		/* Clean up and exit */
 		partial = chain+depth-1; /* the whole chain */
 		goto cleanup;
@@ -757,13 +892,23 @@ out:
 		goto changed;
 	}
 
-	left = (chain + depth) - partial;
+	/* the number of blocks need to allocate for [d,t]indirect blocks */
+	indirect_blks = (chain + depth) - partial - 1;
 
+	/*
+	 * Next look up the indirect map to count the totoal number of
+	 * direct blocks to allocate for this branch.
+	 */
+	count = ext3_blks_to_allocate(partial, indirect_blks,
+					maxblocks, blocks_to_boundary);
 	/*
 	 * Block out ext3_truncate while we alter the tree
 	 */
-	err = ext3_alloc_branch(handle, inode, left, goal,
-					offsets+(partial-chain), partial);
+	if (create == EXT3_GET_BLOCKS_DELALLOC)
+		ei->i_da_alloc_task = current;
+	err = ext3_alloc_branch(handle, inode, indirect_blks, &count, goal,
+				offsets+(partial-chain), partial);
+	ei->i_da_alloc_task = NULL;
 
 	/* The ext3_splice_branch call will free and forget any buffers
 	 * on the new chain if there is a failure, but that risks using
@@ -772,12 +917,16 @@ out:
 	 * may need to return -EAGAIN upwards in the worst case.  --sct */
 	if (!err)
 		err = ext3_splice_branch(handle, inode, iblock, chain,
-					 partial, left);
+					 partial, indirect_blks, count);
 	/* i_disksize growing is protected by truncate_sem
 	 * don't forget to protect it if you're about to implement
 	 * concurrent ext3_get_block() -bzzz */
-	if (!err && extend_disksize && inode->i_size > ei->i_disksize)
-		ei->i_disksize = inode->i_size;
+	if (!err && extend_disksize) {
+		if (create == EXT3_GET_BLOCKS_DELALLOC)
+			ext3_da_update_disksize(inode, iblock, count);
+		else if (inode->i_size > ei->i_disksize)
+			ei->i_disksize = inode->i_size;
+	}
 	up(&ei->truncate_sem);
 	if (err == -EAGAIN)
 		goto changed;
@@ -785,6 +934,7 @@ out:
 		goto cleanup;
 
 	set_buffer_new(bh_result);
+	first_block = le32_to_cpu(chain[depth - 1].key);
 	goto got_it;
 
 changed:
@@ -797,6 +947,19 @@ changed:
 	goto reread;
 }
 
+static int
+ext3_get_block_handle(handle_t *handle, struct inode *inode, sector_t iblock,
+		struct buffer_head *bh_result, int create, int extend_disksize)
+{
+	int ret;
+
+	ret = ext3_get_blocks_handle(handle, inode, iblock, 1, bh_result,
+				     create, extend_disksize);
+	if (ret > 0)
+		ret = 0;
+	return ret;
+}
+
 static int ext3_get_block(struct inode *inode, sector_t iblock,
 			struct buffer_head *bh_result, int create)
 {
@@ -807,11 +970,169 @@ static int ext3_get_block(struct inode *inode, sector_t iblock,
 		handle = ext3_journal_current_handle();
 		J_ASSERT(handle != 0);
 	}
+	if (create && buffer_delay(bh_result)) {
+		/*
+		 * A delayed buffer being allocated for real: the block comes
+		 * out of its reservation, which is only dropped once it has.
+		 */
+		ret = ext3_get_block_handle(handle, inode, iblock, bh_result,
+					    EXT3_GET_BLOCKS_DELALLOC, 1);
+		if (!ret) {
+			clear_buffer_delay(bh_result);
+			ext3_da_release_blocks(inode, 1);
+		}
+		return ret;
+	}
 	ret = ext3_get_block_handle(handle, inode, iblock,
 				bh_result, create, 1);
 	return ret;
 }
 
+/*
+ * Delayed allocation.
+ *
+ * write() only reserves space for the holes it fills: the buffers are left
+ * unmapped and marked BH_Delay, and no transaction is started.  The blocks
+ * are allocated by ext3_get_block() when writeback reaches the page, where
+ * block_write_full_page() finds the dirty unmapped buffers.  Allocating a
+ * whole run of pages in file order at that point keeps files written by
+ * concurrent appenders contiguous, and blocks of data which is truncated
+ * before writeback never reach the bitmaps or the journal.
+ *
+ * Each delayed block reserves itself plus a worst-case share of indirect
+ * blocks (see ext3_da_meta_blocks()) against s_dirtyblocks_counter, so that
+ * allocation at writeback time cannot run out of space.
+ */
+static unsigned long ext3_da_meta_blocks(struct inode *inode,
+					 unsigned long blocks)
+{
+	unsigned long icap = EXT3_ADDR_PER_BLOCK(inode->i_sb);
+	unsigned long ind;
+
+	if (!blocks)
+		return 0;
+	ind = (blocks + icap - 1) / icap;
+	/* indirect blocks, the double indirect blocks above them, and one
+	 * triple indirect block */
+	return ind + (ind + icap - 1) / icap + 1;
+}
+
+static int ext3_da_reserve_block(struct inode *inode)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long meta;
+	int ret;
+
+	spin_lock(&ei->i_da_lock);
+	meta = ext3_da_meta_blocks(inode, ei->i_da_data_blocks + 1);
+	ret = ext3_claim_free_blocks(inode->i_sb,
+				     1 + meta - ei->i_da_meta_blocks);
+	if (!ret) {
+		ei->i_da_data_blocks++;
+		ei->i_da_meta_blocks = meta;
+	}
+	spin_unlock(&ei->i_da_lock);
+	return ret;
+}
+
+/*
+ * Raise i_disksize once the delayed blocks [iblock, iblock + count) have
+ * been allocated; truncate_sem is held.  In ordered mode the on-disk size
+ * must not cover blocks which are still delayed, so it only goes as far as
+ * the end of this run, unless these were the last delayed blocks of the
+ * inode: then everything below i_size has its blocks.
+ */
+void ext3_da_update_disksize(struct inode *inode, sector_t iblock,
+			     unsigned long count)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	loff_t disksize = i_size_read(inode);
+	loff_t end = (loff_t)(iblock + count) << inode->i_blkbits;
+
+	/* write() reserves its blocks before it raises i_size */
+	spin_lock(&ei->i_da_lock);
+	if (ei->i_da_data_blocks > count && end < disksize)
+		disksize = end;
+	spin_unlock(&ei->i_da_lock);
+	if (disksize > ei->i_disksize)
+		ei->i_disksize = disksize;
+}
+
+static void ext3_da_release_blocks(struct inode *inode, unsigned long nr)
+{
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	unsigned long meta, released;
+
+	spin_lock(&ei->i_da_lock);
+	if (unlikely(nr > ei->i_da_data_blocks)) {
+		WARN_ON(1);
+		nr = ei->i_da_data_blocks;
+	}
+	ei->i_da_data_blocks -= nr;
+	meta = ext3_da_meta_blocks(inode, ei->i_da_data_blocks);
+	released = nr + ei->i_da_meta_blocks - meta;
+	ei->i_da_meta_blocks = meta;
+	spin_unlock(&ei->i_da_lock);
+
+	ext3_release_free_blocks(inode->i_sb, released);
+}
+
+/*
+ * get_block for ext3_da_prepare_write(): map blocks which exist, and turn
+ * holes into reserved, unmapped BH_Delay buffers.  They are also marked
+ * BH_New so that block_prepare_write() zeroes what the write won't cover;
+ * b_bdev and b_blocknr are set only for its unmap_underlying_metadata()
+ * call, which finds nothing at that block number.
+ */
+static int ext3_da_get_block_prep(struct inode *inode, sector_t iblock,
+			struct buffer_head *bh_result, int create)
+{
+	int ret;
+
+	if (buffer_delay(bh_result))
+		return 0;		/* reserved by an earlier write */
+
+	ret = ext3_get_block_handle(NULL, inode, iblock, bh_result, 0, 0);
+	if (ret || buffer_mapped(bh_result))
+		return ret;
+
+	ret = ext3_da_reserve_block(inode);
+	if (ret)
+		return ret;
+	bh_result->b_bdev = inode->i_sb->s_bdev;
+	bh_result->b_blocknr = ~(sector_t)0;
+	set_buffer_new(bh_result);
+	set_buffer_delay(bh_result);
+	return 0;
+}
+
+/*
+ * Drop the reservations of the page's delayed buffers from `offset' on,
+ * for truncate and invalidation.
+ */
+static void ext3_da_invalidate_buffers(struct page *page,
+				       unsigned long offset)
+{
+	struct buffer_head *head, *bh;
+	unsigned long curr_off = 0;
+	unsigned long nr = 0;
+
+	if (!page_has_buffers(page))
+		return;
+	head = bh = page_buffers(page);
+	do {
+		if (curr_off >= offset && buffer_delay(bh)) {
+			clear_buffer_delay(bh);
+			nr++;
+		}
+		curr_off += bh->b_size;
+		bh = bh->b_this_page;
+	} while (bh != head);
+
+	if (nr)
+		ext3_da_release_blocks(page->mapping->host, nr);
+}
+
 #define DIO_CREDITS (EXT3_RESERVE_TRANS_BLOCKS + 32)
 
 static int
@@ -851,10 +1172,15 @@ ext3_direct_io_get_blocks(struct inode *inode, sector_t iblock,
 	}
 
 get_block:
-	if (ret == 0)
-		ret = ext3_get_block_handle(handle, inode, iblock,
-					bh_result, create, 0);
 	bh_result->b_size = (1 << inode->i_blkbits);
+	if (ret == 0) {
+		ret = ext3_get_blocks_handle(handle, inode, iblock,
+					max_blocks, bh_result, create, 0);
+		if (ret > 0) {
+			bh_result->b_size = (ret << inode->i_blkbits);
+			ret = 0;
+		}
+	}
 	return ret;
 }
 
@@ -996,6 +1322,19 @@ static int do_journal_get_write_access(handle_t *handle,
 	return ext3_journal_get_write_access(handle, bh);
 }
 
+static int ext3_da_prepare_write(struct file *file, struct page *page,
+				 unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	int ret, retries = 0;
+
+retry:
+	ret = block_prepare_write(page, from, to, ext3_da_get_block_prep);
+	if (ret == -ENOSPC && ext3_should_retry_alloc(inode->i_sb, &retries))
+		goto retry;
+	return ret;
+}
+
 static int ext3_prepare_write(struct file *file, struct page *page,
 			      unsigned from, unsigned to)
 {
@@ -1004,6 +1343,10 @@ static int ext3_prepare_write(struct file *file, struct page *page,
 	handle_t *handle;
 	int retries = 0;
 
+	/* No transaction for a delayed write; commit_write checks for that */
+	if (ext3_should_delay_alloc(inode) && !ext3_journal_current_handle())
+		return ext3_da_prepare_write(file, page, from, to);
+
 retry:
 	handle = ext3_journal_start(inode, needed_blocks);
 	if (IS_ERR(handle)) {
@@ -1046,6 +1389,30 @@ static int commit_write_fn(handle_t *handle, struct buffer_head *bh)
 	return ext3_journal_dirty_metadata(handle, bh);
 }
 
+/*
+ * commit_write after ext3_da_prepare_write().  While the inode has delayed
+ * blocks, i_disksize follows writeback, which raises it to the end of each
+ * run it allocates (see ext3_da_update_disksize()).  Only a write which
+ * leaves no delayed block anywhere in the file, such as an append inside
+ * the last allocated block, raises it here.
+ */
+static int ext3_da_commit_write(struct file *file, struct page *page,
+				unsigned from, unsigned to)
+{
+	struct inode *inode = page->mapping->host;
+	struct ext3_inode_info *ei = EXT3_I(inode);
+	loff_t new_i_size;
+
+	new_i_size = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
+	if (new_i_size > ei->i_disksize) {
+		spin_lock(&ei->i_da_lock);
+		if (!ei->i_da_data_blocks)
+			ei->i_disksize = new_i_size;
+		spin_unlock(&ei->i_da_lock);
+	}
+	return generic_commit_write(file, page, from, to);
+}
+
 /*
  * We need to pick up the new inode size which generic_commit_write gave us
  * `file' can be NULL - eg, when called from page_symlink().
@@ -1061,6 +1428,9 @@ static int ext3_ordered_commit_write(struct file *file, struct page *page,
 	struct inode *inode = page->mapping->host;
 	int ret = 0, ret2;
 
+	if (!handle)
+		return ext3_da_commit_write(file, page, from, to);
+
 	ret = walk_page_buffers(handle, page_buffers(page),
 		from, to, NULL, ext3_journal_dirty_data);
 
@@ -1091,6 +1461,9 @@ static int ext3_writeback_commit_write(struct file *file, struct page *page,
 	int ret = 0, ret2;
 	loff_t new_i_size;
 
+	if (!handle)
+		return ext3_da_commit_write(file, page, from, to);
+
 	new_i_size = ((loff_t)page->index << PAGE_CACHE_SHIFT) + to;
 	if (new_i_size > EXT3_I(inode)->i_disksize)
 		EXT3_I(inode)->i_disksize = new_i_size;
@@ -1154,6 +1527,11 @@ static sector_t ext3_bmap(struct address_space *mapping, sector_t block)
 	journal_t *journal;
 	int err;
 
+	/* Delayed blocks have no address until they are written back */
+	if (test_opt(inode->i_sb, DELALLOC) &&
+	    mapping_tagged(mapping, PAGECACHE_TAG_DIRTY))
+		filemap_write_and_wait(mapping);
+
 	if (EXT3_I(inode)->i_state & EXT3_STATE_JDATA) {
 		/* 
 		 * This is a REALLY heavyweight approach, but the use of
@@ -1205,6 +1583,18 @@ static int journal_dirty_data_fn(handle_t *handle, struct buffer_head *bh)
 	return 0;
 }
 
+/*
+ * Delayed blocks allocated by block_write_full_page() may have raised
+ * i_disksize; get it into the on-disk inode in the same transaction.
+ */
+static int ext3_writepage_update_disksize(handle_t *handle,
+				struct inode *inode, loff_t old_disksize)
+{
+	if (EXT3_I(inode)->i_disksize == old_disksize)
+		return 0;
+	return ext3_mark_inode_dirty(handle, inode);
+}
+
 /*
  * Note that we always start a transaction even if we're not journalling
  * data.  This is to preserve ordering: any hole instantiation within
@@ -1257,31 +1647,15 @@ static int journal_dirty_data_fn(handle_t *handle, struct buffer_head *bh)
  * AKPM2: if all the page's buffers are mapped to disk and !data=journal,
  * we don't need to open a transaction here.
  */
-static int ext3_ordered_writepage(struct page *page,
-			struct writeback_control *wbc)
+static int __ext3_ordered_writepage(handle_t *handle, struct page *page,
+				    struct writeback_control *wbc)
 {
 	struct inode *inode = page->mapping->host;
+	loff_t disksize = EXT3_I(inode)->i_disksize;
 	struct buffer_head *page_bufs;
-	handle_t *handle = NULL;
 	int ret = 0;
 	int err;
 
-	J_ASSERT(PageLocked(page));
-
-	/*
-	 * We give up here if we're reentered, because it might be for a
-	 * different filesystem.
-	 */
-	if (ext3_journal_current_handle())
-		goto out_fail;
-
-	handle = ext3_journal_start(inode, ext3_writepage_trans_blocks(inode));
-
-	if (IS_ERR(handle)) {
-		ret = PTR_ERR(handle);
-		goto out_fail;
-	}
-
 	if (!page_has_buffers(page)) {
 		create_empty_buffers(page, inode->i_sb->s_blocksize,
 				(1 << BH_Dirty)|(1 << BH_Uptodate));
@@ -1312,6 +1686,37 @@ static int ext3_ordered_writepage(struct page *page,
 	}
 	walk_page_buffers(handle, page_bufs, 0,
 			PAGE_CACHE_SIZE, NULL, bput_one);
+	err = ext3_writepage_update_disksize(handle, inode, disksize);
+	if (!ret)
+		ret = err;
+	return ret;
+}
+
+static int ext3_ordered_writepage(struct page *page,
+			struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	handle_t *handle = NULL;
+	int ret = 0;
+	int err;
+
+	J_ASSERT(PageLocked(page));
+
+	/*
+	 * We give up here if we're reentered, because it might be for a
+	 * different filesystem.
+	 */
+	if (ext3_journal_current_handle())
+		goto out_fail;
+
+	handle = ext3_journal_start(inode, ext3_writepage_trans_blocks(inode));
+
+	if (IS_ERR(handle)) {
+		ret = PTR_ERR(handle);
+		goto out_fail;
+	}
+
+	ret = __ext3_ordered_writepage(handle, page, wbc);
 	err = ext3_journal_stop(handle);
 	if (!ret)
 		ret = err;
@@ -1323,6 +1728,20 @@ out_fail:
 	return ret;
 }
 
+static int __ext3_writeback_writepage(handle_t *handle, struct page *page,
+				      struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t disksize = EXT3_I(inode)->i_disksize;
+	int ret, err;
+
+	ret = block_write_full_page(page, ext3_get_block, wbc);
+	err = ext3_writepage_update_disksize(handle, inode, disksize);
+	if (!ret)
+		ret = err;
+	return ret;
+}
+
 static int ext3_writeback_writepage(struct page *page,
 				struct writeback_control *wbc)
 {
@@ -1340,7 +1759,7 @@ static int ext3_writeback_writepage(struct page *page,
 		goto out_fail;
 	}
 
-	ret = block_write_full_page(page, ext3_get_block, wbc);
+	ret = __ext3_writeback_writepage(handle, page, wbc);
 	err = ext3_journal_stop(handle);
 	if (!ret)
 		ret = err;
@@ -1352,6 +1771,237 @@ out_fail:
 	return ret;
 }
 
+/*
+ * Upper bound on the pages ext3_writepages() allocates under one handle.
+ */
+#define EXT3_WRITEPAGES_BATCH	64
+
+/*
+ * Pages per run which leave room in the transaction for everybody else.
+ */
+static int ext3_writepages_batch(struct inode *inode)
+{
+	journal_t *journal = EXT3_JOURNAL(inode);
+	int batch;
+
+	batch = journal->j_max_transaction_buffers /
+			(2 * ext3_writepage_trans_blocks(inode));
+	if (batch > EXT3_WRITEPAGES_BATCH)
+		batch = EXT3_WRITEPAGES_BATCH;
+	return batch;
+}
+
+/* Is any buffer of the locked page still waiting for its block? */
+static int ext3_da_page_delayed(struct page *page)
+{
+	struct buffer_head *head, *bh;
+
+	if (!page_has_buffers(page))
+		return 0;
+	head = bh = page_buffers(page);
+	do {
+		if (buffer_delay(bh))
+			return 1;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return 0;
+}
+
+/*
+ * Count the delayed buffers of a locked page from `bh' on, stopping at the
+ * first one which is not delayed (*done is set then) or at `last_block'.
+ */
+static unsigned long ext3_da_count_delayed(struct buffer_head *bh,
+				sector_t block, sector_t last_block, int *done)
+{
+	struct buffer_head *head = page_buffers(bh->b_page);
+	unsigned long nr = 0;
+
+	do {
+		if (block > last_block || !buffer_delay(bh) ||
+		    !buffer_dirty(bh)) {
+			*done = 1;
+			break;
+		}
+		nr++;
+		block++;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	return nr;
+}
+
+/*
+ * Allocate the delayed blocks of `page' together with those of the dirty
+ * pages directly following it, up to `max_pages' pages, so that a whole
+ * dirty extent is mapped with a few ext3_get_blocks_handle() calls rather
+ * than one ext3_get_block() per buffer.  Following pages are only used if
+ * they can be locked without waiting; their buffers are left mapped and
+ * dirty for the writepage which reaches them next.  In ordered mode the
+ * buffers go on the transaction's data list right away, as the blocks are
+ * allocated in this transaction whether or not the pages are written in it.
+ *
+ * This is an optimisation only: whatever is left unmapped on failure is
+ * allocated by ext3_get_block() as usual.
+ */
+static void ext3_da_map_extent(handle_t *handle, struct page *page,
+			       long max_pages)
+{
+	struct address_space *mapping = page->mapping;
+	struct inode *inode = mapping->host;
+	const unsigned blkbits = inode->i_blkbits;
+	struct page *pages[EXT3_WRITEPAGES_BATCH];
+	struct buffer_head *head, *bh, *first_bh;
+	struct buffer_head map;
+	sector_t first, iblock, last_block;
+	unsigned long nr_blocks, j;
+	loff_t i_size = i_size_read(inode);
+	int nr_pages = 1, i, done = 0;
+	int ret;
+
+	if (!page_has_buffers(page) || !i_size)
+		return;
+	last_block = (i_size - 1) >> blkbits;
+	if (max_pages > EXT3_WRITEPAGES_BATCH)
+		max_pages = EXT3_WRITEPAGES_BATCH;
+
+	/* find the first delayed buffer of this page */
+	head = bh = page_buffers(page);
+	first = (sector_t)page->index << (PAGE_CACHE_SHIFT - blkbits);
+	while (!buffer_delay(bh) || !buffer_dirty(bh)) {
+		bh = bh->b_this_page;
+		if (bh == head)
+			return;
+		first++;
+	}
+	first_bh = bh;
+	nr_blocks = ext3_da_count_delayed(bh, first, last_block, &done);
+
+	/* extend the run over the following pages */
+	pages[0] = page;
+	while (!done && nr_pages < max_pages) {
+		struct page *next;
+
+		next = find_get_page(mapping, page->index + nr_pages);
+		if (!next)
+			break;
+		if (TestSetPageLocked(next)) {
+			page_cache_release(next);
+			break;
+		}
+		if (next->mapping != mapping || !PageDirty(next) ||
+		    PageWriteback(next) || !page_has_buffers(next)) {
+			unlock_page(next);
+			page_cache_release(next);
+			break;
+		}
+		j = ext3_da_count_delayed(page_buffers(next),
+					first + nr_blocks, last_block, &done);
+		if (!j) {
+			unlock_page(next);
+			page_cache_release(next);
+			break;
+		}
+		nr_blocks += j;
+		pages[nr_pages++] = next;
+	}
+
+	/* allocate the run and map its buffers */
+	i = 0;
+	bh = first_bh;
+	iblock = first;
+	while (nr_blocks) {
+		map.b_state = 0;
+		ret = ext3_get_blocks_handle(handle, inode, iblock, nr_blocks,
+					     &map, EXT3_GET_BLOCKS_DELALLOC, 1);
+		if (ret <= 0)
+			break;
+		for (j = 0; j < ret; j++) {
+			clear_buffer_delay(bh);
+			map_bh(bh, inode->i_sb, map.b_blocknr + j);
+			if (buffer_new(&map))
+				unmap_underlying_metadata(bh->b_bdev,
+							  bh->b_blocknr);
+			if (ext3_should_order_data(inode))
+				ext3_journal_dirty_data(handle, bh);
+			bh = bh->b_this_page;
+			if (bh == page_buffers(pages[i]) && ++i < nr_pages)
+				bh = page_buffers(pages[i]);
+		}
+		ext3_da_release_blocks(inode, ret);
+		iblock += ret;
+		nr_blocks -= ret;
+	}
+
+	for (i = 1; i < nr_pages; i++) {
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+}
+
+/*
+ * a_ops->writepage replacement for ext3_writepages().  The handle covers
+ * one run only and is started here, with the page already locked, never
+ * around __mpage_writepages(): that sleeps in lock_page() between pages,
+ * and the holder of a page lock may itself be waiting in
+ * ext3_journal_start() (generic_commit_write -> ext3_dirty_inode) for our
+ * transaction to commit.
+ */
+static int ext3_writepage_batched(struct page *page,
+				  struct writeback_control *wbc)
+{
+	struct inode *inode = page->mapping->host;
+	loff_t disksize = EXT3_I(inode)->i_disksize;
+	long nr_pages = min(wbc->nr_to_write,
+			    (long)ext3_writepages_batch(inode));
+	handle_t *handle;
+	int ret, err;
+
+	/* pages mapped by an earlier run only need their own credits */
+	if (nr_pages < 1 || !ext3_da_page_delayed(page))
+		nr_pages = 1;
+	handle = ext3_journal_start(inode,
+			nr_pages * ext3_writepage_trans_blocks(inode));
+	if (IS_ERR(handle)) {
+		redirty_page_for_writepage(wbc, page);
+		unlock_page(page);
+		return PTR_ERR(handle);
+	}
+
+	ext3_da_map_extent(handle, page, nr_pages);
+	/* the run may have raised i_disksize */
+	err = ext3_writepage_update_disksize(handle, inode, disksize);
+
+	if (ext3_should_order_data(inode))
+		ret = __ext3_ordered_writepage(handle, page, wbc);
+	else
+		ret = __ext3_writeback_writepage(handle, page, wbc);
+	if (!ret)
+		ret = err;
+	err = ext3_journal_stop(handle);
+	if (!ret)
+		ret = err;
+	return ret;
+}
+
+/*
+ * With delayed allocation most block allocation happens here, so allocate
+ * each dirty extent as one run of blocks under a single transaction
+ * instead of one per page (see ext3_da_map_extent()): the bitmap, group
+ * descriptor and indirect blocks it shares are journalled once per run.
+ * The pages of a run that follow the first one are already mapped when
+ * their own writepage comes, which then only has the data to attach.
+ */
+static int ext3_writepages(struct address_space *mapping,
+			   struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+
+	if (!test_opt(inode->i_sb, DELALLOC) || ext3_journal_current_handle() ||
+	    ext3_writepages_batch(inode) < 2)
+		return generic_writepages(mapping, wbc);
+	return __mpage_writepages(mapping, wbc, NULL, ext3_writepage_batched);
+}
+
 static int ext3_journalled_writepage(struct page *page,
 				struct writeback_control *wbc)
 {
@@ -1431,14 +2081,30 @@ static int ext3_invalidatepage(struct page *page, unsigned long offset)
 	if (offset == 0)
 		ClearPageChecked(page);
 
+	ext3_da_invalidate_buffers(page, offset);
+
 	return journal_invalidatepage(journal, page, offset);
 }
 
 static int ext3_releasepage(struct page *page, int wait)
 {
 	journal_t *journal = EXT3_JOURNAL(page->mapping->host);
+	struct buffer_head *head, *bh;
 
 	WARN_ON(PageChecked(page));
+
+	/*
+	 * Delayed buffers are dirty until writeback allocates them, except
+	 * those left behind by a failed write or past EOF.  Give those
+	 * reservations back before the buffers go away.
+	 */
+	head = bh = page_buffers(page);
+	do {
+		if (buffer_delay(bh) && buffer_dirty(bh))
+			return 0;
+		bh = bh->b_this_page;
+	} while (bh != head);
+	ext3_da_invalidate_buffers(page, 0);
 	return journal_try_to_free_buffers(journal, page, wait);
 }
 
@@ -1541,6 +2207,7 @@ static struct address_space_operations ext3_ordered_aops = {
 	.readpage	= ext3_readpage,
 	.readpages	= ext3_readpages,
 	.writepage	= ext3_ordered_writepage,
+	.writepages	= ext3_writepages,
 	.sync_page	= block_sync_page,
 	.prepare_write	= ext3_prepare_write,
 	.commit_write	= ext3_ordered_commit_write,
@@ -1554,6 +2221,7 @@ static struct address_space_operations ext3_writeback_aops = {
 	.readpage	= ext3_readpage,
 	.readpages	= ext3_readpages,
 	.writepage	= ext3_writeback_writepage,
+	.writepages	= ext3_writepages,
 	.sync_page	= block_sync_page,
 	.prepare_write	= ext3_prepare_write,
 	.commit_write	= ext3_writeback_commit_write,
@@ -1625,7 +2293,7 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 		goto unlock;
 	}
 
-	if (!buffer_mapped(bh)) {
+	if (!buffer_mapped(bh) && !buffer_delay(bh)) {
 		BUFFER_TRACE(bh, "unmapped");
 		ext3_get_block(inode, iblock, bh, 0);
 		/* unmapped? It's a hole - nothing to do */
@@ -1666,7 +2334,8 @@ static int ext3_block_truncate_page(handle_t *handle, struct page *page,
 	if (ext3_should_journal_data(inode)) {
 		err = ext3_journal_dirty_metadata(handle, bh);
 	} else {
-		if (ext3_should_order_data(inode))
+		/* a delayed buffer has no block to order yet */
+		if (ext3_should_order_data(inode) && buffer_mapped(bh))
 			err = ext3_journal_dirty_data(handle, bh);
 		mark_buffer_dirty(bh);
 	}
@@ -2138,6 +2807,11 @@ void ext3_truncate(struct inode * inode)
 	 */
 	down(&ei->truncate_sem);
 
+	if (ei->i_flags & EXT3_EXTENTS_FL) {
+		ext3_ext_truncate(handle, inode);
+		goto out_up;
+	}
+
 	if (n == 1) {		/* direct blocks */
 		ext3_free_data(handle, inode, NULL, i_data+offsets[0],
 			       i_data + EXT3_NDIR_BLOCKS);
@@ -2200,6 +2874,7 @@ do_indirects:
 		case EXT3_TIND_BLOCK:
 			;
 	}
+out_up:
 	up(&ei->truncate_sem);
 	inode->i_mtime = inode->i_ctime = CURRENT_TIME_SEC;
 	ext3_mark_inode_dirty(handle, inode);
@@ -2843,6 +3518,9 @@ static int ext3_writepage_trans_blocks(struct inode *inode)
 	int indirects = (EXT3_NDIR_BLOCKS % bpp) ? 5 : 3;
 	int ret;
 
+	if (EXT3_I(inode)->i_flags & EXT3_EXTENTS_FL)
+		indirects = ext3_ext_calc_credits_for_insert(inode);
+
 	if (ext3_should_journal_data(inode))
 		ret = 3 * (bpp + indirects) + 2;
 	else
@@ -47,6 +47,12 @@
 #define NAMEI_RA_SIZE        (NAMEI_RA_CHUNKS * NAMEI_RA_BLOCKS)
 #define NAMEI_RA_INDEX(c,b)  (((c) * NAMEI_RA_BLOCKS) + (b))
 
+/*
+ * Number of htree leaf blocks read ahead at once, and the number of leaves
+ * an inode-ordered readdir batch spans.
+ */
+#define DX_RA_LEAVES	16
+
 static struct buffer_head *ext3_append(handle_t *handle,
 					struct inode *inode,
 					u32 *block, int *err)
@@ -526,6 +532,48 @@ static inline struct ext3_dir_entry_2 *ext3_next_entry(struct ext3_dir_entry_2 *
 	return (struct ext3_dir_entry_2 *)((char*)p + le16_to_cpu(p->rec_len));
 }
 
+/*
+ * Is the leaf block named by this index entry in memory or being read?
+ */
+static int dx_leaf_cached(struct inode *dir, struct dx_entry *entry)
+{
+	struct buffer_head *bh;
+	int err, ret;
+
+	bh = ext3_getblk(NULL, dir, dx_get_block(entry), 0, &err);
+	if (!bh)
+		return 1;
+	ret = buffer_uptodate(bh) || buffer_locked(bh);
+	brelse(bh);
+	return ret;
+}
+
+/*
+ * Start reading the leaf blocks from frame->at onwards in this index
+ * block.  Leaves are laid out in the order they were split, not in hash
+ * order, so without this every leaf of a cold directory costs a seek.
+ */
+static void dx_readahead_leaves(struct inode *dir, struct dx_frame *frame)
+{
+	struct buffer_head *bha[DX_RA_LEAVES], *bh;
+	struct dx_entry *p, *end;
+	int i, num = 0, err;
+
+	end = frame->entries + dx_get_count(frame->entries);
+	for (p = frame->at; p < end && num < DX_RA_LEAVES; p++) {
+		bh = ext3_getblk(NULL, dir, dx_get_block(p), 0, &err);
+		if (bh && !buffer_uptodate(bh) && !buffer_locked(bh))
+			bha[num++] = bh;
+		else
+			brelse(bh);
+	}
+	if (num) {
+		ll_rw_block(READA, num, bha);
+		for (i = 0; i < num; i++)
+			brelse(bha[i]);
+	}
+}
+
 /*
  * This function fills a red-black tree with information from a
  * directory block.  It returns the number directory entries loaded
@@ -568,11 +616,32 @@ static int htree_dirblock_to_tree(struct file *dir_file,
 }
 
 
+/*
+ * Starting hash of the leaf dx_probe() left `frame' at.  The first entry
+ * of an index node has no hash of its own: it starts where its parent's
+ * entry does.
+ */
+static __u32 dx_leaf_hash(struct dx_frame *frames, struct dx_frame *frame)
+{
+	for (; frame >= frames; frame--)
+		if (frame->at != frame->entries)
+			return dx_get_hash(frame->at) & ~1;
+	return 0;
+}
+
 /*
  * This function fills a red-black tree with information from a
  * directory.  We start scanning the directory in hash order, starting
  * at start_hash and start_minor_hash.
  *
+ * An inode-ordered batch always starts at the beginning of the leaf
+ * holding start_hash, and info->batch_hash is set to where that is: the
+ * cookie of the n-th name of the batch is batch_hash / 2 + n (see
+ * call_filldir()), so the leaf is found again from any of them.  The
+ * batch spans up to DX_RA_LEAVES leaves, but no more names than fit
+ * between batch_hash and the next leaf's hash, which goes in
+ * info->batch_max.
+ *
  * This function returns the number of entries inserted into the tree,
  * or a negative error code.
  */
@@ -582,9 +651,10 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	struct dx_hash_info hinfo;
 	struct ext3_dir_entry_2 *de;
 	struct dx_frame frames[2], *frame;
+	struct dir_private_info *info = dir_file->private_data;
 	struct inode *dir;
 	int block, err;
-	int count = 0;
+	int count = 0, leaves = 0;
 	int ret;
 	__u32 hashval;
 
@@ -594,6 +664,11 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	if (!(EXT3_I(dir)->i_flags & EXT3_INDEX_FL)) {
 		hinfo.hash_version = EXT3_SB(dir->i_sb)->s_def_hash_version;
 		hinfo.seed = EXT3_SB(dir->i_sb)->s_hash_seed;
+		if (info->inode_order) {
+			start_hash = start_minor_hash = 0;
+			info->batch_hash = 0;
+			info->batch_max = EXT3_HTREE_EOF;
+		}
 		count = htree_dirblock_to_tree(dir_file, dir, 0, &hinfo,
 					       start_hash, start_minor_hash);
 		*next_hash = ~0;
@@ -604,6 +679,10 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	frame = dx_probe(NULL, dir_file->f_dentry->d_inode, &hinfo, frames, &err);
 	if (!frame)
 		return err;
+	if (info->inode_order) {
+		start_hash = info->batch_hash = dx_leaf_hash(frames, frame);
+		start_minor_hash = 0;
+	}
 
 	/* Add '.' and '..' from the htree header */
 	if (!start_hash && !start_minor_hash) {
@@ -621,6 +700,14 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 	}
 
 	while (1) {
+		/*
+		 * Once the leaf after this one is found cold, read ahead
+		 * a window of leaves starting here.
+		 */
+		if (frame->at + 1 < frame->entries +
+				    dx_get_count(frame->entries) &&
+		    !dx_leaf_cached(dir, frame->at + 1))
+			dx_readahead_leaves(dir, frame);
 		block = dx_get_block(frame->at);
 		ret = htree_dirblock_to_tree(dir_file, dir, block, &hinfo,
 					     start_hash, start_minor_hash);
@@ -629,6 +716,7 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 			goto errout;
 		}
 		count += ret;
+		leaves++;
 		hashval = ~0;
 		ret = ext3_htree_next_block(dir, HASH_NB_ALWAYS, 
 					    frame, frames, &hashval);
@@ -637,13 +725,23 @@ int ext3_htree_fill_tree(struct file *dir_file, __u32 start_hash,
 			err = ret;
 			goto errout;
 		}
+		if (leaves == 1 && info->inode_order) {
+			info->batch_max = (hashval >> 1) - (start_hash >> 1);
+			if (!info->batch_max)
+				info->batch_max = 1;
+		}
 		/*
 		 * Stop if:  (a) there are no more entries, or
-		 * (b) we have inserted at least one entry and the
-		 * next hash value is not a continuation
+		 * (b) we have inserted at least one entry, the
+		 * next hash value is not a continuation and, when sorting
+		 * by inode, the batch is full or another leaf might not
+		 * fit into batch_max
 		 */
 		if ((ret == 0) ||
-		    (count && ((hashval & 1) == 0)))
+		    (count && ((hashval & 1) == 0) &&
+		     (!info->inode_order || leaves >= DX_RA_LEAVES ||
+		      count + dir->i_sb->s_blocksize / EXT3_DIR_REC_LEN(1) >
+				info->batch_max)))
 			break;
 	}
 	dx_release(frames);
@@ -936,6 +1034,14 @@ static struct buffer_head * ext3_dx_find_entry(struct dentry *dentry,
 		return NULL;
 	hash = hinfo.hash;
 	do {
+		/*
+		 * A cold leaf just after a warm one looks like lookups
+		 * following readdir in hash order (ls -l): read ahead.
+		 */
+		if (frame->at > frame->entries &&
+		    dx_leaf_cached(dir, frame->at - 1) &&
+		    !dx_leaf_cached(dir, frame->at))
+			dx_readahead_leaves(dir, frame);
 		block = dx_get_block(frame->at);
 		if (!(bh = ext3_bread (NULL,dir, block, 0, err)))
 			goto errout;
@@ -0,0 +1,151 @@
+/*
+ *  linux/fs/ext3/prefetch.c
+ *
+ *  Background read of the block group metadata after mount.
+ *
+ *  ext3_read_inode, ext3_new_inode and the allocators read bitmaps and
+ *  inode table blocks one at a time as they first touch a group, so the
+ *  first scan of a freshly mounted filesystem seeks from group to group
+ *  and waits for each block.  With the "prefetch" mount option a kernel
+ *  thread walks the groups in order and reads each group's bitmaps and
+ *  the in-use part of its inode table as a few large sequential reads,
+ *  leaving the buffers in the cache for those paths to find.
+ *
+ *  The thread runs at the lowest priority, waits for each group before
+ *  starting the next so that only one batch is in flight, and is stopped
+ *  from ext3_put_super.
+ */
+
+#include <linux/fs.h>
+#include <linux/jbd.h>
+#include <linux/ext3_fs.h>
+#include <linux/ext3_jbd.h>
+#include <linux/buffer_head.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+
+/* Blocks submitted together; adjacent ones are merged by the elevator */
+#define PREFETCH_BATCH	64
+
+/*
+ * Read blocks [block, block + count) that are not already cached, and
+ * wait for them.
+ */
+static void prefetch_run(struct super_block *sb, unsigned long block,
+			 unsigned long count)
+{
+	struct buffer_head *bha[PREFETCH_BATCH], *bh;
+	int i, num;
+
+	while (count && !kthread_should_stop()) {
+		num = 0;
+		while (count && num < PREFETCH_BATCH) {
+			bh = sb_getblk(sb, block++);
+			count--;
+			if (bh && !buffer_uptodate(bh))
+				bha[num++] = bh;
+			else
+				brelse(bh);
+		}
+		if (!num)
+			continue;
+		ll_rw_block(READ, num, bha);
+		for (i = 0; i < num; i++) {
+			wait_on_buffer(bha[i]);
+			brelse(bha[i]);
+		}
+		cond_resched();
+	}
+}
+
+/*
+ * Number of inode table blocks up to and including the last in-use inode
+ * of a group.  New inodes take the first free bit, so the in-use inodes
+ * are mostly at the front of the table.
+ */
+static unsigned long itable_blocks_used(struct super_block *sb,
+					struct ext3_group_desc *desc)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+	struct buffer_head *bh;
+	long bit;
+
+	if (le16_to_cpu(desc->bg_free_inodes_count) == sbi->s_inodes_per_group)
+		return 0;
+	bh = sb_bread(sb, le32_to_cpu(desc->bg_inode_bitmap));
+	if (!bh)
+		return sbi->s_itb_per_group;
+	for (bit = sbi->s_inodes_per_group - 1; bit >= 0; bit--)
+		if (ext3_test_bit(bit, bh->b_data))
+			break;
+	brelse(bh);
+	return (bit + sbi->s_inodes_per_block) / sbi->s_inodes_per_block;
+}
+
+static void prefetch_group(struct super_block *sb, unsigned int group)
+{
+	struct ext3_group_desc *desc;
+	unsigned long block_bitmap, inode_bitmap, itable;
+
+	desc = ext3_get_group_desc(sb, group, NULL);
+	if (!desc)
+		return;
+	block_bitmap = le32_to_cpu(desc->bg_block_bitmap);
+	inode_bitmap = le32_to_cpu(desc->bg_inode_bitmap);
+	itable = le32_to_cpu(desc->bg_inode_table);
+
+	/* mke2fs puts the three next to each other: one run */
+	if (block_bitmap + 1 == inode_bitmap && inode_bitmap + 1 == itable) {
+		prefetch_run(sb, block_bitmap,
+			     2 + itable_blocks_used(sb, desc));
+		return;
+	}
+	prefetch_run(sb, block_bitmap, 1);
+	prefetch_run(sb, inode_bitmap, 1);
+	prefetch_run(sb, itable, itable_blocks_used(sb, desc));
+}
+
+static int ext3_prefetch_thread(void *data)
+{
+	struct super_block *sb = data;
+	unsigned int group;
+
+	set_user_nice(current, 19);
+	for (group = 0; group < EXT3_SB(sb)->s_groups_count; group++) {
+		if (kthread_should_stop())
+			break;
+		prefetch_group(sb, group);
+	}
+
+	/* kthread_stop() must find us alive */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+void ext3_start_prefetch(struct super_block *sb)
+{
+	struct task_struct *task;
+
+	task = kthread_run(ext3_prefetch_thread, sb, "ext3pf-%s", sb->s_id);
+	if (IS_ERR(task)) {
+		printk(KERN_WARNING "EXT3-fs: %s: cannot start prefetch "
+		       "thread, error %ld\n", sb->s_id, PTR_ERR(task));
+		return;
+	}
+	EXT3_SB(sb)->s_prefetch_task = task;
+}
+
+void ext3_stop_prefetch(struct super_block *sb)
+{
+	struct ext3_sb_info *sbi = EXT3_SB(sb);
+
+	if (sbi->s_prefetch_task) {
+		kthread_stop(sbi->s_prefetch_task);
+		sbi->s_prefetch_task = NULL;
+	}
+}
@@ -378,6 +378,7 @@ static void ext3_put_super (struct super_block * sb)
 	struct ext3_super_block *es = sbi->s_es;
 	int i;
 
+	ext3_stop_prefetch(sb);
 	ext3_xattr_put_super(sb);
 	journal_destroy(sbi->s_journal);
 	if (!(sb->s_flags & MS_RDONLY)) {
@@ -394,6 +395,7 @@ static void ext3_put_super (struct super_block * sb)
 	percpu_counter_destroy(&sbi->s_freeblocks_counter);
 	percpu_counter_destroy(&sbi->s_freeinodes_counter);
 	percpu_counter_destroy(&sbi->s_dirs_counter);
+	percpu_counter_destroy(&sbi->s_dirtyblocks_counter);
 	brelse(sbi->s_sbh);
 #ifdef CONFIG_QUOTA
 	for (i = 0; i < MAXQUOTAS; i++) {
@@ -443,6 +445,9 @@ static struct inode *ext3_alloc_inode(struct super_block *sb)
 	ei->i_default_acl = EXT3_ACL_NOT_CACHED;
 #endif
 	ei->i_rsv_window.rsv_end = EXT3_RESERVE_WINDOW_NOT_ALLOCATED;
+	ei->i_da_data_blocks = 0;
+	ei->i_da_meta_blocks = 0;
+	ei->i_da_alloc_task = NULL;
 	ei->vfs_inode.i_version = 1;
 	return &ei->vfs_inode;
 }
@@ -463,6 +468,7 @@ static void init_once(void * foo, kmem_cache_t * cachep, unsigned long flags)
 		init_rwsem(&ei->xattr_sem);
 #endif
 		init_MUTEX(&ei->truncate_sem);
+		spin_lock_init(&ei->i_da_lock);
 		inode_init_once(&ei->vfs_inode);
 	}
 }
@@ -583,6 +589,9 @@ enum {
 	Opt_usrjquota, Opt_grpjquota, Opt_offusrjquota, Opt_offgrpjquota,
 	Opt_jqfmt_vfsold, Opt_jqfmt_vfsv0,
 	Opt_ignore, Opt_barrier, Opt_err, Opt_resize,
+	Opt_delalloc, Opt_nodelalloc, Opt_extents, Opt_noextents,
+	Opt_journal_async_commit, Opt_sortdir, Opt_nosortdir,
+	Opt_prefetch, Opt_noprefetch,
 };
 
 static match_table_t tokens = {
@@ -630,6 +639,15 @@ static match_table_t tokens = {
 	{Opt_ignore, "quota"},
 	{Opt_ignore, "usrquota"},
 	{Opt_barrier, "barrier=%u"},
+	{Opt_delalloc, "delalloc"},
+	{Opt_nodelalloc, "nodelalloc"},
+	{Opt_extents, "extents"},
+	{Opt_noextents, "noextents"},
+	{Opt_journal_async_commit, "journal_async_commit"},
+	{Opt_sortdir, "sortdir"},
+	{Opt_nosortdir, "nosortdir"},
+	{Opt_prefetch, "prefetch"},
+	{Opt_noprefetch, "noprefetch"},
 	{Opt_err, NULL},
 	{Opt_resize, "resize"},
 };
@@ -773,6 +791,33 @@ static int parse_options (char * options, struct super_block *sb,
 		case Opt_noreservation:
 			clear_opt(sbi->s_mount_opt, RESERVATION);
 			break;
+		case Opt_delalloc:
+			set_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_nodelalloc:
+			clear_opt(sbi->s_mount_opt, DELALLOC);
+			break;
+		case Opt_extents:
+			set_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_noextents:
+			clear_opt(sbi->s_mount_opt, EXTENTS);
+			break;
+		case Opt_journal_async_commit:
+			set_opt(sbi->s_mount_opt, JOURNAL_ASYNC_COMMIT);
+			break;
+		case Opt_sortdir:
+			set_opt(sbi->s_mount_opt, SORTDIR);
+			break;
+		case Opt_nosortdir:
+			clear_opt(sbi->s_mount_opt, SORTDIR);
+			break;
+		case Opt_prefetch:
+			set_opt(sbi->s_mount_opt, PREFETCH);
+			break;
+		case Opt_noprefetch:
+			clear_opt(sbi->s_mount_opt, PREFETCH);
+			break;
 		case Opt_journal_update:
 			/* @@@ FIXME */
 			/* Eventually we will want to be able to create
@@ -989,6 +1034,9 @@ static int ext3_setup_super(struct super_block *sb, struct ext3_super_block *es,
 	es->s_mtime = cpu_to_le32(get_seconds());
 	ext3_update_dynamic_rev(sb);
 	EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_RECOVER);
+	/* Old kernels must not mount a fs that may hold extent-mapped files */
+	if (test_opt(sb, EXTENTS))
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
 
 	ext3_commit_super(sb, es, 1);
 	if (test_opt(sb, DEBUG))
@@ -1469,6 +1517,7 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	percpu_counter_init(&sbi->s_freeblocks_counter);
 	percpu_counter_init(&sbi->s_freeinodes_counter);
 	percpu_counter_init(&sbi->s_dirs_counter);
+	percpu_counter_init(&sbi->s_dirtyblocks_counter);
 	bgl_lock_init(&sbi->s_blockgroup_lock);
 
 	for (i = 0; i < db_count; i++) {
@@ -1564,6 +1613,24 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 		break;
 	}
 
+	/*
+	 * Asynchronous commit changes what recovery must check, so the
+	 * features have to be on disk before the first such commit.
+	 */
+	if (test_opt(sb, JOURNAL_ASYNC_COMMIT) &&
+	    !(sb->s_flags & MS_RDONLY) &&
+	    !JFS_HAS_INCOMPAT_FEATURE(sbi->s_journal,
+				      JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (!journal_set_features(sbi->s_journal,
+				JFS_FEATURE_COMPAT_CHECKSUM, 0,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+			printk(KERN_ERR "EXT3-fs: Journal does not support "
+			       "asynchronous commit\n");
+			goto failed_mount3;
+		}
+		journal_update_superblock(sbi->s_journal, 1);
+	}
+
 	/*
 	 * The journal_load will have done any necessary log recovery,
 	 * so we can safely mount the rest of the filesystem now.
@@ -1610,6 +1677,9 @@ static int ext3_fill_super (struct super_block *sb, void *data, int silent)
 	percpu_counter_mod(&sbi->s_dirs_counter,
 		ext3_count_dirs(sb));
 
+	if (test_opt(sb, PREFETCH))
+		ext3_start_prefetch(sb);
+
 	lock_kernel();
 	return 0;
 
@@ -2128,6 +2198,13 @@ static int ext3_remount (struct super_block * sb, int * flags, char * data)
 			if (!ext3_setup_super (sb, es, 0))
 				sb->s_flags &= ~MS_RDONLY;
 		}
+	} else if (test_opt(sb, EXTENTS) && !(sb->s_flags & MS_RDONLY) &&
+		   !EXT3_HAS_INCOMPAT_FEATURE(sb,
+				EXT3_FEATURE_INCOMPAT_EXTENTS)) {
+		lock_super(sb);
+		EXT3_SET_INCOMPAT_FEATURE(sb, EXT3_FEATURE_INCOMPAT_EXTENTS);
+		ext3_commit_super(sb, es, 1);
+		unlock_super(sb);
 	}
 	return 0;
 }
@@ -2136,6 +2213,7 @@ static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 {
 	struct ext3_super_block *es = EXT3_SB(sb)->s_es;
 	unsigned long overhead;
+	unsigned long dirty;
 	int i;
 
 	if (test_opt (sb, MINIX_DF))
@@ -2177,6 +2255,12 @@ static int ext3_statfs (struct super_block * sb, struct kstatfs * buf)
 	buf->f_bsize = sb->s_blocksize;
 	buf->f_blocks = le32_to_cpu(es->s_blocks_count) - overhead;
 	buf->f_bfree = ext3_count_free_blocks (sb);
+	/* blocks reserved for delayed allocation are as good as used */
+	dirty = percpu_counter_read_positive(&EXT3_SB(sb)->s_dirtyblocks_counter);
+	if (buf->f_bfree > dirty)
+		buf->f_bfree -= dirty;
+	else
+		buf->f_bfree = 0;
 	buf->f_bavail = buf->f_bfree - le32_to_cpu(es->s_r_blocks_count);
 	if (buf->f_bfree < le32_to_cpu(es->s_r_blocks_count))
 		buf->f_bavail = 0;
@@ -13,6 +13,8 @@
 #include <linux/vmalloc.h>
 #include <linux/file.h>
 #include <linux/bitops.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
 
 
 /*
@@ -48,84 +50,6 @@ void free_fd_array(struct file **array, int num)
 		vfree(array);
 }
 
-/*
- * Expand the fd array in the files_struct.  Called with the files
- * spinlock held for write.
- */
-
-static int expand_fd_array(struct files_struct *files, int nr)
-	__releases(files->file_lock)
-	__acquires(files->file_lock)
-{
-	struct file **new_fds;
-	int error, nfds;
-
-	
-	error = -EMFILE;
-	if (files->max_fds >= NR_OPEN || nr >= NR_OPEN)
-		goto out;
-
-	nfds = files->max_fds;
-	spin_unlock(&files->file_lock);
-
-	/* 
-	 * Expand to the max in easy steps, and keep expanding it until
-	 * we have enough for the requested fd array size. 
-	 */
-
-	do {
-#if NR_OPEN_DEFAULT < 256
-		if (nfds < 256)
-			nfds = 256;
-		else 
-#endif
-		if (nfds < (PAGE_SIZE / sizeof(struct file *)))
-			nfds = PAGE_SIZE / sizeof(struct file *);
-		else {
-			nfds = nfds * 2;
-			if (nfds > NR_OPEN)
-				nfds = NR_OPEN;
-		}
-	} while (nfds <= nr);
-
-	error = -ENOMEM;
-	new_fds = alloc_fd_array(nfds);
-	spin_lock(&files->file_lock);
-	if (!new_fds)
-		goto out;
-
-	/* Copy the existing array and install the new pointer */
-
-	if (nfds > files->max_fds) {
-		struct file **old_fds;
-		int i;
-		
-		old_fds = xchg(&files->fd, new_fds);
-		i = xchg(&files->max_fds, nfds);
-
-		/* Don't copy/clear the array if we are creating a new
-		   fd array for fork() */
-		if (i) {
-			memcpy(new_fds, old_fds, i * sizeof(struct file *));
-			/* clear the remainder of the array */
-			memset(&new_fds[i], 0,
-			       (nfds-i) * sizeof(struct file *)); 
-
-			spin_unlock(&files->file_lock);
-			free_fd_array(old_fds, i);
-			spin_lock(&files->file_lock);
-		}
-	} else {
-		/* Somebody expanded the array while we slept ... */
-		spin_unlock(&files->file_lock);
-		free_fd_array(new_fds, nfds);
-		spin_lock(&files->file_lock);
-	}
-	error = 0;
-out:
-	return error;
-}
-
 /*
  * Allocate an fdset array, using kmalloc or vmalloc.
  * Note: the array isn't cleared at allocation time.
@@ -155,78 +79,192 @@ void free_fdset(fd_set *array, int num)
 }
 
 /*
- * Expand the fdset in the files_struct.  Called with the files spinlock
- * held for write.
+ * Old fd tables are freed after an RCU grace period, from softirq
+ * context.  Tables that were big enough to need vmalloc() can't be
+ * vfree()d there, so they are queued and released from keventd.
  */
-static int expand_fdset(struct files_struct *files, int nr)
-	__releases(file->file_lock)
-	__acquires(file->file_lock)
+static struct fdtable *fdtable_defer_list;
+static DEFINE_SPINLOCK(fdtable_defer_lock);
+static struct work_struct fdtable_defer_work;
+
+static void __free_fdtable(struct fdtable *fdt)
 {
-	fd_set *new_openset = NULL, *new_execset = NULL;
-	int error, nfds = 0;
+	free_fdset(fdt->open_fds, fdt->max_fdset);
+	free_fdset(fdt->close_on_exec, fdt->max_fdset);
+	free_fd_array(fdt->fd, fdt->max_fds);
+	kfree(fdt);
+}
 
-	error = -EMFILE;
-	if (files->max_fdset >= NR_OPEN || nr >= NR_OPEN)
-		goto out;
+static void free_fdtable_work(void *data)
+{
+	struct fdtable *fdt, *next;
 
-	nfds = files->max_fdset;
-	spin_unlock(&files->file_lock);
+	spin_lock_bh(&fdtable_defer_lock);
+	fdt = fdtable_defer_list;
+	fdtable_defer_list = NULL;
+	spin_unlock_bh(&fdtable_defer_lock);
+
+	for (; fdt; fdt = next) {
+		next = fdt->next;
+		__free_fdtable(fdt);
+	}
+}
+
+static void free_fdtable_rcu(struct rcu_head *rcu)
+{
+	struct fdtable *fdt = container_of(rcu, struct fdtable, rcu);
+
+	if (fdt->max_fdset / 8 <= PAGE_SIZE &&
+	    fdt->max_fds * sizeof(struct file *) <= PAGE_SIZE) {
+		__free_fdtable(fdt);
+		return;
+	}
+
+	spin_lock(&fdtable_defer_lock);
+	fdt->next = fdtable_defer_list;
+	fdtable_defer_list = fdt;
+	spin_unlock(&fdtable_defer_lock);
+	schedule_work(&fdtable_defer_work);
+}
+
+/*
+ * Release an fd table that lockless readers may still be looking at.
+ * The table embedded in the files_struct is never freed here.
+ */
+void free_fdtable(struct fdtable *fdt)
+{
+	call_rcu(&fdt->rcu, free_fdtable_rcu);
+}
+
+void __init files_defer_init(void)
+{
+	INIT_WORK(&fdtable_defer_work, free_fdtable_work, NULL);
+}
+
+/*
+ * Allocate a new fd table big enough to hold descriptor nr, growing
+ * the fd array and the fd sets in the usual easy steps from their
+ * current sizes.
+ */
+static struct fdtable *alloc_fdtable(struct fdtable *cur, int nr)
+{
+	struct fdtable *fdt;
+	int nfds, nfdset;
 
-	/* Expand to the max in easy steps */
-	do {
-		if (nfds < (PAGE_SIZE * 8))
-			nfds = PAGE_SIZE * 8;
+	/*
+	 * Both parts are always reallocated so the new table never shares
+	 * storage with the old one; the embedded sizes are never reused.
+	 */
+	nfds = cur->max_fds;
+	while (nfds <= nr || nfds <= NR_OPEN_DEFAULT) {
+#if NR_OPEN_DEFAULT < 256
+		if (nfds < 256)
+			nfds = 256;
+		else 
+#endif
+		if (nfds < (PAGE_SIZE / sizeof(struct file *)))
+			nfds = PAGE_SIZE / sizeof(struct file *);
 		else {
 			nfds = nfds * 2;
 			if (nfds > NR_OPEN)
 				nfds = NR_OPEN;
 		}
-	} while (nfds <= nr);
-
-	error = -ENOMEM;
-	new_openset = alloc_fdset(nfds);
-	new_execset = alloc_fdset(nfds);
-	spin_lock(&files->file_lock);
-	if (!new_openset || !new_execset)
-		goto out;
+	}
 
-	error = 0;
-	
-	/* Copy the existing tables and install the new pointers */
-	if (nfds > files->max_fdset) {
-		int i = files->max_fdset / (sizeof(unsigned long) * 8);
-		int count = (nfds - files->max_fdset) / 8;
-		
-		/* 
-		 * Don't copy the entire array if the current fdset is
-		 * not yet initialised.  
-		 */
-		if (i) {
-			memcpy (new_openset, files->open_fds, files->max_fdset/8);
-			memcpy (new_execset, files->close_on_exec, files->max_fdset/8);
-			memset (&new_openset->fds_bits[i], 0, count);
-			memset (&new_execset->fds_bits[i], 0, count);
+	nfdset = cur->max_fdset;
+	while (nfdset <= nr || nfdset <= __FD_SETSIZE) {
+		if (nfdset < (PAGE_SIZE * 8))
+			nfdset = PAGE_SIZE * 8;
+		else {
+			nfdset = nfdset * 2;
+			if (nfdset > NR_OPEN)
+				nfdset = NR_OPEN;
 		}
-		
-		nfds = xchg(&files->max_fdset, nfds);
-		new_openset = xchg(&files->open_fds, new_openset);
-		new_execset = xchg(&files->close_on_exec, new_execset);
-		spin_unlock(&files->file_lock);
-		free_fdset (new_openset, nfds);
-		free_fdset (new_execset, nfds);
-		spin_lock(&files->file_lock);
-		return 0;
-	} 
-	/* Somebody expanded the array while we slept ... */
+	}
+
+	fdt = kmalloc(sizeof(*fdt), GFP_KERNEL);
+	if (!fdt)
+		goto out;
+	fdt->fd = alloc_fd_array(nfds);
+	fdt->open_fds = alloc_fdset(nfdset);
+	fdt->close_on_exec = alloc_fdset(nfdset);
+	if (!fdt->fd || !fdt->open_fds || !fdt->close_on_exec)
+		goto out_free;
+	fdt->max_fds = nfds;
+	fdt->max_fdset = nfdset;
+	fdt->next = NULL;
+	return fdt;
 
+out_free:
+	if (fdt->close_on_exec)
+		free_fdset(fdt->close_on_exec, nfdset);
+	if (fdt->open_fds)
+		free_fdset(fdt->open_fds, nfdset);
+	if (fdt->fd)
+		free_fd_array(fdt->fd, nfds);
+	kfree(fdt);
 out:
+	return NULL;
+}
+
+/*
+ * Copy the contents of the current table into a bigger one and clear
+ * the remainder.  Called with files->file_lock held.
+ */
+static void copy_fdtable(struct fdtable *nfdt, struct fdtable *fdt)
+{
+	int cpy, set;
+
+	cpy = fdt->max_fds * sizeof(struct file *);
+	set = (nfdt->max_fds - fdt->max_fds) * sizeof(struct file *);
+	memcpy(nfdt->fd, fdt->fd, cpy);
+	memset((char *)(nfdt->fd) + cpy, 0, set);
+
+	cpy = fdt->max_fdset / 8;
+	set = (nfdt->max_fdset - fdt->max_fdset) / 8;
+	memcpy(nfdt->open_fds, fdt->open_fds, cpy);
+	memset((char *)(nfdt->open_fds) + cpy, 0, set);
+	memcpy(nfdt->close_on_exec, fdt->close_on_exec, cpy);
+	memset((char *)(nfdt->close_on_exec) + cpy, 0, set);
+}
+
+/*
+ * Expand the fd table in the files_struct.  Called with the files
+ * spinlock held for write.
+ */
+static int expand_fdtable(struct files_struct *files, int nr)
+	__releases(files->file_lock)
+	__acquires(files->file_lock)
+{
+	struct fdtable *new_fdt, *cur_fdt;
+
+	if (nr >= NR_OPEN)
+		return -EMFILE;
+
+	cur_fdt = files_fdtable(files);
 	spin_unlock(&files->file_lock);
-	if (new_openset)
-		free_fdset(new_openset, nfds);
-	if (new_execset)
-		free_fdset(new_execset, nfds);
+	new_fdt = alloc_fdtable(cur_fdt, nr);
 	spin_lock(&files->file_lock);
-	return error;
+	if (!new_fdt)
+		return -ENOMEM;
+
+	/*
+	 * Check again since another task may have expanded the
+	 * fd table while we dropped the lock
+	 */
+	cur_fdt = files_fdtable(files);
+	if (nr >= cur_fdt->max_fds || nr >= cur_fdt->max_fdset) {
+		copy_fdtable(new_fdt, cur_fdt);
+		rcu_assign_pointer(files->fdt, new_fdt);
+		if (cur_fdt != &files->fdtab)
+			free_fdtable(cur_fdt);
+	} else {
+		/* Somebody expanded the table while we slept ... */
+		spin_unlock(&files->file_lock);
+		__free_fdtable(new_fdt);
+		spin_lock(&files->file_lock);
+	}
+	return 1;
 }
 
 /*
@@ -236,19 +274,9 @@ out:
  */
 int expand_files(struct files_struct *files, int nr)
 {
-	int err, expand = 0;
+	struct fdtable *fdt = files_fdtable(files);
 
-	if (nr >= files->max_fdset) {
-		expand = 1;
-		if ((err = expand_fdset(files, nr)))
-			goto out;
-	}
-	if (nr >= files->max_fds) {
-		expand = 1;
-		if ((err = expand_fd_array(files, nr)))
-			goto out;
-	}
-	err = expand;
-out:
-	return err;
+	if (nr < fdt->max_fdset && nr < fdt->max_fds)
+		return 0;
+	return expand_fdtable(files, nr);
 }
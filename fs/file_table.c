@@ -16,6 +16,8 @@
 #include <linux/eventpoll.h>
 #include <linux/mount.h>
 #include <linux/cdev.h>
+#include <linux/rcupdate.h>
+#include <asm/system.h>
 
 /* sysctl tunables... */
 /**
@@ -55,11 +57,42 @@ void filp_dtor(void * objp, struct kmem_cache_s *cachep, unsigned long dflags)
 	spin_unlock_irqrestore(&filp_count_lock, flags);
 }
 
-static inline void file_free(struct file *f)
+static void file_free_rcu(struct rcu_head *head)
 {
+	struct file *f = container_of(head, struct file, f_rcuhead);
 	kmem_cache_free(filp_cachep, f);
 }
 
+/*
+ * fget() may still be looking at the file through the fd table under
+ * rcu_read_lock(), so the memory is only handed back after a grace period.
+ */
+static inline void file_free(struct file *f)
+{
+	call_rcu(&f->f_rcuhead, file_free_rcu);
+}
+
+#ifdef __HAVE_ARCH_CMPXCHG
+/*
+ * Take a reference on a file found without files->file_lock.  Fails if
+ * the count already dropped to zero, i.e. the file is being torn down
+ * by a racing close().
+ */
+static inline int get_file_rcu(struct file *file)
+{
+	int c, old;
+
+	c = atomic_read(&file->f_count);
+	while (c) {
+		old = cmpxchg(&file->f_count.counter, c, c + 1);
+		if (old == c)
+			return 1;
+		c = old;
+	}
+	return 0;
+}
+#endif
+
 /* Find an unused file structure and return a pointer to it.
  * Returns NULL, if there are no more free file structures or
  * we run out of memory.
@@ -166,11 +199,19 @@ struct file fastcall *fget(unsigned int fd)
 	struct file *file;
 	struct files_struct *files = current->files;
 
+#ifdef __HAVE_ARCH_CMPXCHG
+	rcu_read_lock();
+	file = fcheck_files(files, fd);
+	if (file && !get_file_rcu(file))
+		file = NULL;
+	rcu_read_unlock();
+#else
 	spin_lock(&files->file_lock);
 	file = fcheck_files(files, fd);
 	if (file)
 		get_file(file);
 	spin_unlock(&files->file_lock);
+#endif
 	return file;
 }
 
@@ -192,6 +233,17 @@ struct file fastcall *fget_light(unsigned int fd, int *fput_needed)
 	if (likely((atomic_read(&files->count) == 1))) {
 		file = fcheck_files(files, fd);
 	} else {
+#ifdef __HAVE_ARCH_CMPXCHG
+		rcu_read_lock();
+		file = fcheck_files(files, fd);
+		if (file) {
+			if (get_file_rcu(file))
+				*fput_needed = 1;
+			else
+				file = NULL;
+		}
+		rcu_read_unlock();
+#else
 		spin_lock(&files->file_lock);
 		file = fcheck_files(files, fd);
 		if (file) {
@@ -199,6 +251,7 @@ struct file fastcall *fget_light(unsigned int fd, int *fput_needed)
 			*fput_needed = 1;
 		}
 		spin_unlock(&files->file_lock);
+#endif
 	}
 	return file;
 }
@@ -267,4 +320,5 @@ void __init files_init(unsigned long mempages)
 	files_stat.max_files = n; 
 	if (files_stat.max_files < NR_FILE)
 		files_stat.max_files = NR_FILE;
+	files_defer_init();
 } 
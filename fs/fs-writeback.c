@@ -373,6 +373,14 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 			continue;		/* blockdev has wrong queue */
 		}
 
+		/* The device's own flusher thread writes this one back */
+		if (!wbc->bdi && bdi->wb && current_is_pdflush()) {
+			if (sb != blockdev_superblock)
+				break;
+			list_move(&inode->i_list, &sb->s_dirty);
+			continue;
+		}
+
 		/* Was this inode dirtied after sync_sb_inodes was called? */
 		/**
 		 * ҳsync_sb_inodesִк󣬲űҳģԹ
@@ -0,0 +1,172 @@
+/*
+ * fs/ioprio.c
+ *
+ * ioprio_set()/ioprio_get(): per-task I/O scheduling class and level.
+ *
+ * Three classes exist.  Realtime I/O is always served first and needs
+ * CAP_SYS_ADMIN, since it can starve everybody else.  Best-effort is the
+ * default, with eight levels that set how long a task gets the disk each
+ * turn.  Idle I/O only gets the disk when nobody else has used it for a
+ * while, which is what batch jobs that must not disturb the system want.
+ *
+ * The io scheduler decides what a priority means; see
+ * Documentation/block/ioprio.txt.
+ */
+#include <linux/kernel.h>
+#include <linux/ioprio.h>
+#include <linux/sched.h>
+#include <linux/capability.h>
+#include <linux/syscalls.h>
+
+static int set_task_ioprio(struct task_struct *task, int ioprio)
+{
+	if (task->uid != current->euid &&
+	    task->uid != current->uid && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	task->ioprio = ioprio;
+	return 0;
+}
+
+asmlinkage long sys_ioprio_set(int which, int who, int ioprio)
+{
+	int class = IOPRIO_PRIO_CLASS(ioprio);
+	int data = IOPRIO_PRIO_DATA(ioprio);
+	struct task_struct *p, *g;
+	struct user_struct *user;
+	int ret;
+
+	switch (class) {
+	case IOPRIO_CLASS_RT:
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		/* fall through, rt has prio field too */
+	case IOPRIO_CLASS_BE:
+		if (data >= IOPRIO_BE_NR || data < 0)
+			return -EINVAL;
+		break;
+	case IOPRIO_CLASS_IDLE:
+		break;
+	case IOPRIO_CLASS_NONE:
+		if (data)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = -ESRCH;
+	read_lock(&tasklist_lock);
+	switch (which) {
+	case IOPRIO_WHO_PROCESS:
+		if (!who)
+			p = current;
+		else
+			p = find_task_by_pid(who);
+		if (p)
+			ret = set_task_ioprio(p, ioprio);
+		break;
+	case IOPRIO_WHO_PGRP:
+		if (!who)
+			who = process_group(current);
+		do_each_task_pid(who, PIDTYPE_PGID, p) {
+			ret = set_task_ioprio(p, ioprio);
+			if (ret)
+				goto out;
+		} while_each_task_pid(who, PIDTYPE_PGID, p);
+		break;
+	case IOPRIO_WHO_USER:
+		if (!who)
+			user = current->user;
+		else
+			user = find_user(who);
+		if (!user)
+			break;
+
+		do_each_thread(g, p) {
+			if (p->uid != user->uid)
+				continue;
+			ret = set_task_ioprio(p, ioprio);
+			if (ret)
+				goto free_uid;
+		} while_each_thread(g, p);
+free_uid:
+		if (who)
+			free_uid(user);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+out:
+	read_unlock(&tasklist_lock);
+	return ret;
+}
+
+/*
+ * Of two priorities, the one that would be served first.  Unset
+ * priorities compare as the best-effort level they resolve to.
+ */
+static int ioprio_best(int a, int b)
+{
+	int aclass = IOPRIO_PRIO_CLASS(a);
+	int bclass = IOPRIO_PRIO_CLASS(b);
+
+	if (aclass != bclass)
+		return aclass < bclass ? a : b;
+
+	return IOPRIO_PRIO_DATA(a) < IOPRIO_PRIO_DATA(b) ? a : b;
+}
+
+asmlinkage long sys_ioprio_get(int which, int who)
+{
+	struct task_struct *g, *p;
+	struct user_struct *user;
+	int ret = -ESRCH;
+
+	read_lock(&tasklist_lock);
+	switch (which) {
+	case IOPRIO_WHO_PROCESS:
+		if (!who)
+			p = current;
+		else
+			p = find_task_by_pid(who);
+		if (p)
+			ret = task_ioprio(p);
+		break;
+	case IOPRIO_WHO_PGRP:
+		if (!who)
+			who = process_group(current);
+		do_each_task_pid(who, PIDTYPE_PGID, p) {
+			if (ret == -ESRCH)
+				ret = task_ioprio(p);
+			else
+				ret = ioprio_best(ret, task_ioprio(p));
+		} while_each_task_pid(who, PIDTYPE_PGID, p);
+		break;
+	case IOPRIO_WHO_USER:
+		if (!who)
+			user = current->user;
+		else
+			user = find_user(who);
+		if (!user)
+			break;
+
+		do_each_thread(g, p) {
+			if (p->uid != user->uid)
+				continue;
+			if (ret == -ESRCH)
+				ret = task_ioprio(p);
+			else
+				ret = ioprio_best(ret, task_ioprio(p));
+		} while_each_thread(g, p);
+
+		if (who)
+			free_uid(user);
+		break;
+	default:
+		ret = -EINVAL;
+	}
+
+	read_unlock(&tasklist_lock);
+	return ret;
+}
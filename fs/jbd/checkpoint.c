@@ -74,18 +74,45 @@ static int __try_to_free_cp_buf(struct journal_head *jh)
  *
  * Called under j-state_lock *only*.  It will be unlocked if we have to wait
  * for a checkpoint to free up some space in the log.
+ *
+ * Only one process checkpoints at a time.  Everybody else sleeps on
+ * j_wait_logspace instead of queueing up for j_checkpoint_sem, so that
+ * they can go as soon as the checkpointer has moved the log tail far
+ * enough, rather than when it has finished.
  */
 void __log_wait_for_space(journal_t *journal)
 {
 	int nblocks;
+	unsigned long start = 0;
 	assert_spin_locked(&journal->j_state_lock);
 
 	nblocks = jbd_space_needed(journal);
 	while (__log_space_left(journal) < nblocks) {
 		if (journal->j_flags & JFS_ABORT)
-			return;
+			break;
+		if (!start)
+			start = jiffies;
 		spin_unlock(&journal->j_state_lock);
-		down(&journal->j_checkpoint_sem);
+
+		if (down_trylock(&journal->j_checkpoint_sem)) {
+			DEFINE_WAIT(wait);
+
+			/*
+			 * The checkpointer wakes us when it moves the tail
+			 * and when it drops the semaphore, so trying again
+			 * after prepare_to_wait() cannot miss it.
+			 */
+			prepare_to_wait(&journal->j_wait_logspace, &wait,
+					TASK_UNINTERRUPTIBLE);
+			if (down_trylock(&journal->j_checkpoint_sem)) {
+				schedule();
+				finish_wait(&journal->j_wait_logspace, &wait);
+				spin_lock(&journal->j_state_lock);
+				nblocks = jbd_space_needed(journal);
+				continue;
+			}
+			finish_wait(&journal->j_wait_logspace, &wait);
+		}
 
 		/*
 		 * Test again, another process may have checkpointed while we
@@ -99,6 +126,16 @@ void __log_wait_for_space(journal_t *journal)
 			spin_lock(&journal->j_state_lock);
 		}
 		up(&journal->j_checkpoint_sem);
+		wake_up(&journal->j_wait_logspace);
+	}
+
+	if (start) {
+		unsigned long waited = jiffies - start;
+
+		journal->j_log_wait_count++;
+		journal->j_log_wait_time += waited;
+		if (waited > journal->j_log_wait_max)
+			journal->j_log_wait_max = waited;
 	}
 }
 
@@ -197,95 +234,173 @@ out_return_1:
 	return 1;
 }
 
-#define NR_BATCH	64
+/*
+ * Sort a checkpoint batch by disk location, so that it reaches the
+ * elevator as one ascending sweep rather than in the order the buffers
+ * happened to be journaled.  Batches are small enough for insertion sort.
+ */
+static void sort_batch(struct buffer_head **bhs, int nr)
+{
+	int i, j;
 
+	for (i = 1; i < nr; i++) {
+		struct buffer_head *bh = bhs[i];
+
+		for (j = i; j > 0 && bhs[j - 1]->b_blocknr > bh->b_blocknr; j--)
+			bhs[j] = bhs[j - 1];
+		bhs[j] = bh;
+	}
+}
+
+/*
+ * Write out a batch queued by __queue_checkpoint_io() and wait for it.
+ *
+ * Each buffer is released from its transaction as soon as its own write
+ * completes.  If that retires the oldest transaction while the log is
+ * short of space, the tail is moved and the waiters in
+ * __log_wait_for_space() are woken there and then, instead of after the
+ * whole batch.
+ *
+ * Called with j_list_lock held, which is dropped and retaken.
+ */
 static void
-__flush_batch(journal_t *journal, struct buffer_head **bhs, int *batch_count)
+__flush_batch(journal_t *journal, int batch_count)
 {
+	struct buffer_head **bhs = journal->j_chkpt_bhs;
 	int i;
 
 	spin_unlock(&journal->j_list_lock);
-	ll_rw_block(WRITE, *batch_count, bhs);
-	spin_lock(&journal->j_list_lock);
-	for (i = 0; i < *batch_count; i++) {
+	sort_batch(bhs, batch_count);
+	ll_rw_block(WRITE, batch_count, bhs);
+	for (i = 0; i < batch_count; i++)
+		clear_buffer_jwrite(bhs[i]);
+
+	journal->j_checkpoint_runs++;
+	journal->j_checkpoint_written += batch_count;
+
+	for (i = 0; i < batch_count; i++) {
 		struct buffer_head *bh = bhs[i];
-		clear_buffer_jwrite(bh);
+		struct journal_head *jh;
+		int retired = 0;
+
+		wait_on_buffer(bh);
+
+		spin_lock(&journal->j_list_lock);
+		jh = journal_grab_journal_head(bh);
+		if (jh) {
+			transaction_t *oldest = journal->j_checkpoint_transactions;
+
+			if (jh->b_cp_transaction && jbd_trylock_bh_state(bh) &&
+			    __try_to_free_cp_buf(jh))
+				retired = oldest != NULL &&
+				    journal->j_checkpoint_transactions != oldest;
+			journal_put_journal_head(jh);
+		}
+		spin_unlock(&journal->j_list_lock);
 		BUFFER_TRACE(bh, "brelse");
 		__brelse(bh);
+
+		if (retired) {
+			spin_lock(&journal->j_state_lock);
+			retired = __log_space_left(journal) <
+					jbd_space_needed(journal);
+			spin_unlock(&journal->j_state_lock);
+			if (retired) {
+				cleanup_journal_tail(journal);
+				wake_up(&journal->j_wait_logspace);
+			}
+		}
 	}
-	*batch_count = 0;
+	spin_lock(&journal->j_list_lock);
 }
 
 /*
- * Try to flush one buffer from the checkpoint list to disk.
+ * Queue dirty checkpoint buffers for writeout, oldest transaction first,
+ * into journal->j_chkpt_bhs[], and release buffers which are already
+ * clean.  We go on into younger transactions until the batch is full, so
+ * that several small transactions are written out together.
  *
- * Return 1 if something happened which requires us to abort the current
- * scan of the checkpoint list.  
+ * Buffers we cannot lock right now are skipped; a later pass, or
+ * __cleanup_transaction(), deals with them.
+ *
+ * Returns the number of buffers queued, and sets *progress if any buffer
+ * was released.
  *
  * Called with j_list_lock held.
- * Called under jbd_lock_bh_state(jh2bh(jh)), and drops it
  */
-static int __flush_buffer(journal_t *journal, struct journal_head *jh,
-			struct buffer_head **bhs, int *batch_count,
-			int *drop_count)
+static int __queue_checkpoint_io(journal_t *journal, int *progress)
 {
-	struct buffer_head *bh = jh2bh(jh);
-	int ret = 0;
+	transaction_t *transaction, *last_transaction, *next_transaction;
+	int batch_count = 0;
 
-	if (buffer_dirty(bh) && !buffer_locked(bh) && jh->b_jlist == BJ_None) {
-		J_ASSERT_JH(jh, jh->b_transaction == NULL);
+	transaction = journal->j_checkpoint_transactions;
+	if (!transaction)
+		return 0;
 
-		/*
-		 * Important: we are about to write the buffer, and
-		 * possibly block, while still holding the journal lock.
-		 * We cannot afford to let the transaction logic start
-		 * messing around with this buffer before we write it to
-		 * disk, as that would break recoverability.  
-		 */
-		BUFFER_TRACE(bh, "queue");
-		get_bh(bh);
-		J_ASSERT_BH(bh, !buffer_jwrite(bh));
-		set_buffer_jwrite(bh);
-		bhs[*batch_count] = bh;
-		jbd_unlock_bh_state(bh);
-		(*batch_count)++;
-		if (*batch_count == NR_BATCH) {
-			__flush_batch(journal, bhs, batch_count);
-			ret = 1;
-		}
-	} else {
-		int last_buffer = 0;
-		if (jh->b_cpnext == jh) {
-			/* We may be about to drop the transaction.  Tell the
-			 * caller that the lists have changed.
-			 */
-			last_buffer = 1;
-		}
-		if (__try_to_free_cp_buf(jh)) {
-			(*drop_count)++;
-			ret = last_buffer;
-		}
-	}
-	return ret;
+	last_transaction = transaction->t_cpprev;
+	next_transaction = transaction;
+	do {
+		struct journal_head *jh, *last_jh, *next_jh;
+
+		transaction = next_transaction;
+		next_transaction = transaction->t_cpnext;
+		jh = transaction->t_checkpoint_list;
+		last_jh = jh->b_cpprev;
+		next_jh = jh;
+		do {
+			struct buffer_head *bh;
+
+			jh = next_jh;
+			next_jh = jh->b_cpnext;
+			bh = jh2bh(jh);
+			if (!jbd_trylock_bh_state(bh))
+				continue;
+
+			if (buffer_dirty(bh) && !buffer_locked(bh) &&
+			    jh->b_jlist == BJ_None) {
+				J_ASSERT_JH(jh, jh->b_transaction == NULL);
+
+				/*
+				 * Important: we are about to write the
+				 * buffer, and possibly block, while still
+				 * holding the journal lock.  We cannot afford
+				 * to let the transaction logic start messing
+				 * around with this buffer before we write it
+				 * to disk, as that would break
+				 * recoverability.
+				 */
+				BUFFER_TRACE(bh, "queue");
+				get_bh(bh);
+				J_ASSERT_BH(bh, !buffer_jwrite(bh));
+				set_buffer_jwrite(bh);
+				journal->j_chkpt_bhs[batch_count++] = bh;
+				jbd_unlock_bh_state(bh);
+			} else if (__try_to_free_cp_buf(jh)) {
+				/*
+				 * This may have dropped the transaction, in
+				 * which case jh == last_jh ends the walk.
+				 */
+				*progress = 1;
+			}
+		} while (jh != last_jh && batch_count < JBD_NR_BATCH);
+	} while (transaction != last_transaction &&
+		 batch_count < JBD_NR_BATCH && !need_resched());
+
+	return batch_count;
 }
 
 /*
- * Perform an actual checkpoint.  We don't write out only enough to
- * satisfy the current blocked requests: rather we submit a reasonably
- * sized chunk of the outstanding data to disk at once for
- * efficiency.  __log_wait_for_space() will retry if we didn't free enough.
- * 
- * However, we _do_ take into account the amount requested so that once
- * the IO has been queued, we can return as soon as enough of it has
- * completed to disk.  
+ * Perform an actual checkpoint.  Rather than writing out only enough to
+ * satisfy the current blocked requests, we submit everything dirty in
+ * the oldest transactions as one sorted batch, and let the log tail move
+ * as the writes complete.  __log_wait_for_space() will retry if we didn't
+ * free enough.
  *
- * The journal should be locked before calling this function.
+ * The caller must hold j_checkpoint_sem.
  */
 int log_do_checkpoint(journal_t *journal)
 {
 	int result;
-	int batch_count = 0;
-	struct buffer_head *bhs[NR_BATCH];
 
 	jbd_debug(1, "Start checkpoint\n");
 
@@ -300,71 +415,49 @@ int log_do_checkpoint(journal_t *journal)
 		return result;
 
 	/*
-	 * OK, we need to start writing disk blocks.  Try to free up a
-	 * quarter of the log in a single checkpoint if we can.
-	 */
-	/*
-	 * AKPM: check this code.  I had a feeling a while back that it
-	 * degenerates into a busy loop at unmount time.
+	 * OK, we need to start writing disk blocks.  Keep going until the
+	 * oldest transaction is gone.
 	 */
 	spin_lock(&journal->j_list_lock);
 	while (journal->j_checkpoint_transactions) {
 		transaction_t *transaction;
-		struct journal_head *jh, *last_jh, *next_jh;
-		int drop_count = 0;
-		int cleanup_ret, retry = 0;
+		int batch_count, progress = 0;
+		int cleanup_ret;
 		tid_t this_tid;
 
 		transaction = journal->j_checkpoint_transactions;
 		this_tid = transaction->t_tid;
-		jh = transaction->t_checkpoint_list;
-		last_jh = jh->b_cpprev;
-		next_jh = jh;
-		do {
-			struct buffer_head *bh;
-
-			jh = next_jh;
-			next_jh = jh->b_cpnext;
-			bh = jh2bh(jh);
-			if (!jbd_trylock_bh_state(bh)) {
-				jbd_sync_bh(journal, bh);
-				spin_lock(&journal->j_list_lock);
-				retry = 1;
-				break;
-			}
-			retry = __flush_buffer(journal, jh, bhs, &batch_count, &drop_count);
-			if (cond_resched_lock(&journal->j_list_lock)) {
-				retry = 1;
-				break;
-			}
-		} while (jh != last_jh && !retry);
 
+		batch_count = __queue_checkpoint_io(journal, &progress);
 		if (batch_count)
-			__flush_batch(journal, bhs, &batch_count);
+			__flush_batch(journal, batch_count);
 
 		/*
-		 * If someone cleaned up this transaction while we slept, we're
-		 * done
+		 * If someone cleaned up this transaction while we slept, or
+		 * we did, we're done
 		 */
 		if (journal->j_checkpoint_transactions != transaction)
 			break;
-		if (retry)
-			continue;
 		/*
 		 * Maybe it's a new transaction, but it fell at the same
 		 * address
 		 */
 		if (transaction->t_tid != this_tid)
+			break;
+		if (batch_count || progress)
 			continue;
 		/*
 		 * We have walked the whole transaction list without
-		 * finding anything to write to disk.  We had better be
-		 * able to make some progress or we are in trouble. 
+		 * finding anything to write to disk.  The oldest transaction
+		 * must be waiting for locked buffers or for a later commit,
+		 * so wait for those.  If it found nothing either, we only
+		 * lost a race for a buffer's state lock: try again.
 		 */
 		cleanup_ret = __cleanup_transaction(journal, transaction);
-		J_ASSERT(drop_count != 0 || cleanup_ret != 0);
 		if (journal->j_checkpoint_transactions != transaction)
 			break;
+		if (!cleanup_ret)
+			cond_resched_lock(&journal->j_list_lock);
 	}
 	spin_unlock(&journal->j_list_lock);
 	result = cleanup_journal_tail(journal);
@@ -21,6 +21,8 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/smp_lock.h>
+#include <linux/highmem.h>
+#include <linux/crc32.h>
 
 /*
  * Default IO end handler for temporary BJ_IO buffer_heads.
@@ -93,6 +95,120 @@ static int inverted_lock(journal_t *journal, struct buffer_head *bh)
 	return 1;
 }
 
+/*
+ * Fold a buffer about to be written to the log into the running checksum
+ * for the transaction's commit record.  Shadow buffers made by
+ * journal_write_metadata_buffer() may live in highmem.
+ */
+static __u32 journal_checksum_data(__u32 crc32_sum, struct buffer_head *bh)
+{
+	char *addr;
+	__u32 checksum;
+
+	addr = kmap_atomic(bh->b_page, KM_USER0);
+	checksum = crc32_be(crc32_sum, (void *)(addr + bh_offset(bh)),
+			    bh->b_size);
+	kunmap_atomic(addr, KM_USER0);
+
+	return checksum;
+}
+
+/*
+ * Write the commit record for a transaction, without waiting for it.
+ *
+ * On a journal with JFS_FEATURE_COMPAT_CHECKSUM the record carries the
+ * checksum of everything the transaction put in the log, which is what
+ * lets an asynchronous commit issue it together with the log blocks:
+ * recovery only trusts the commit if the checksum matches.  *cjh is left
+ * NULL if nothing was submitted.
+ */
+static int journal_submit_commit_record(journal_t *journal,
+					transaction_t *commit_transaction,
+					struct journal_head **cjh,
+					__u32 crc32_sum)
+{
+	struct journal_head *descriptor;
+	struct commit_header *tmp;
+	struct buffer_head *bh;
+
+	*cjh = NULL;
+
+	if (is_journal_aborted(journal))
+		return 0;
+
+	descriptor = journal_get_descriptor_buffer(journal);
+	if (!descriptor)
+		return -EIO;
+
+	bh = jh2bh(descriptor);
+	tmp = (struct commit_header *)bh->b_data;
+	tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
+	tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
+	tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+	if (JFS_HAS_COMPAT_FEATURE(journal, JFS_FEATURE_COMPAT_CHECKSUM)) {
+		tmp->h_chksum_type = JFS_CRC32_CHKSUM;
+		tmp->h_chksum_size = JFS_CRC32_CHKSUM_SIZE;
+		tmp->h_chksum[0] = cpu_to_be32(crc32_sum);
+	}
+
+	JBUFFER_TRACE(descriptor, "submit commit block");
+	lock_buffer(bh);
+	clear_buffer_dirty(bh);
+	set_buffer_uptodate(bh);
+	bh->b_end_io = journal_end_buffer_io_sync;
+	if (journal->j_flags & JFS_BARRIER)
+		set_buffer_ordered(bh);
+	submit_bh(WRITE, bh);
+
+	*cjh = descriptor;
+	return 0;
+}
+
+/*
+ * Wait for a commit record submitted by journal_submit_commit_record()
+ * and release it.  If the device turned out not to support barriers,
+ * stop using them and write the record again without one.
+ */
+static int journal_wait_on_commit_record(journal_t *journal,
+					 struct journal_head *descriptor)
+{
+	struct buffer_head *bh = jh2bh(descriptor);
+	int ret = 0;
+
+retry:
+	wait_on_buffer(bh);
+	/* Check what we sent rather than JFS_BARRIER: another commit
+	 * may already have turned barriers off. */
+	if (buffer_eopnotsupp(bh) && buffer_ordered(bh)) {
+		char b[BDEVNAME_SIZE];
+
+		printk(KERN_WARNING
+			"JBD: barrier-based sync failed on %s - "
+			"disabling barriers\n",
+			bdevname(journal->j_dev, b));
+		spin_lock(&journal->j_state_lock);
+		journal->j_flags &= ~JFS_BARRIER;
+		spin_unlock(&journal->j_state_lock);
+
+		/* And try again, without the barrier */
+		lock_buffer(bh);
+		clear_buffer_eopnotsupp(bh);
+		clear_buffer_ordered(bh);
+		set_buffer_uptodate(bh);
+		bh->b_end_io = journal_end_buffer_io_sync;
+		submit_bh(WRITE, bh);
+		goto retry;
+	}
+	clear_buffer_ordered(bh);
+
+	if (unlikely(!buffer_uptodate(bh)))
+		ret = -EIO;
+	put_bh(bh);		/* One for getblk() */
+	journal_put_journal_head(descriptor);
+
+	return ret;
+}
+
 /*
  * journal_commit_transaction
  *
@@ -103,6 +219,10 @@ void journal_commit_transaction(journal_t *journal)
 {
 	transaction_t *commit_transaction;
 	struct journal_head *jh, *new_jh, *descriptor;
+	struct journal_head *cjh = NULL;
+	__u32 crc32_sum = ~0;
+	struct timeval start_time, end_time;
+	long commit_time;
 	struct buffer_head *wbuf[64];
 	int bufs;
 	int flags;
@@ -121,6 +241,8 @@ void journal_commit_transaction(journal_t *journal)
 	 * all outstanding updates to complete.
 	 */
 
+	do_gettimeofday(&start_time);
+
 #ifdef COMMIT_STATS
 	spin_lock(&journal->j_list_lock);
 	summarise_journal_usage(journal);
@@ -502,6 +624,11 @@ write_out_data:
 start_journal_io:
 			for (i = 0; i < bufs; i++) {
 				struct buffer_head *bh = wbuf[i];
+
+				if (JFS_HAS_COMPAT_FEATURE(journal,
+						JFS_FEATURE_COMPAT_CHECKSUM))
+					crc32_sum = journal_checksum_data(
+							crc32_sum, bh);
 				lock_buffer(bh);
 				clear_buffer_dirty(bh);
 				set_buffer_uptodate(bh);
@@ -517,6 +644,19 @@ start_journal_io:
 		}
 	}
 
+	/*
+	 * With an asynchronous commit the commit record goes out right
+	 * behind the log blocks instead of after waiting for them: if
+	 * we crash before they all reach the disk, the checksum in the
+	 * record no longer matches and recovery ignores the transaction.
+	 */
+	if (JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (journal_submit_commit_record(journal, commit_transaction,
+						 &cjh, crc32_sum))
+			__journal_abort_hard(journal);
+	}
+
 	/* Lo and behold: we have just managed to send a transaction to
            the log.  Before we can commit it, wait for the IO so far to
            complete.  Control buffers being written are on the
@@ -616,75 +756,26 @@ wait_for_iobuf:
 
 	jbd_debug(3, "JBD: commit phase 6\n");
 
-	if (is_journal_aborted(journal))
-		goto skip_commit;
-
 	/* Done it all: now write the commit record.  We should have
 	 * cleaned up our previous buffers by now, so if we are in abort
 	 * mode we can now just skip the rest of the journal write
 	 * entirely. */
-
-	descriptor = journal_get_descriptor_buffer(journal);
-	if (!descriptor) {
-		__journal_abort_hard(journal);
-		goto skip_commit;
-	}
-
-	/* AKPM: buglet - add `i' to tmp! */
-	for (i = 0; i < jh2bh(descriptor)->b_size; i += 512) {
-		journal_header_t *tmp =
-			(journal_header_t*)jh2bh(descriptor)->b_data;
-		tmp->h_magic = cpu_to_be32(JFS_MAGIC_NUMBER);
-		tmp->h_blocktype = cpu_to_be32(JFS_COMMIT_BLOCK);
-		tmp->h_sequence = cpu_to_be32(commit_transaction->t_tid);
+	if (!JFS_HAS_INCOMPAT_FEATURE(journal,
+				JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)) {
+		if (journal_submit_commit_record(journal, commit_transaction,
+						 &cjh, crc32_sum))
+			__journal_abort_hard(journal);
 	}
 
-	JBUFFER_TRACE(descriptor, "write commit block");
-	{
-		struct buffer_head *bh = jh2bh(descriptor);
-		int ret;
-		int barrier_done = 0;
-
-		set_buffer_dirty(bh);
-		if (journal->j_flags & JFS_BARRIER) {
-			set_buffer_ordered(bh);
-			barrier_done = 1;
-		}
-		ret = sync_dirty_buffer(bh);
-		/* is it possible for another commit to fail at roughly
-		 * the same time as this one?  If so, we don't want to
-		 * trust the barrier flag in the super, but instead want
-		 * to remember if we sent a barrier request
-		 */
-		if (ret == -EOPNOTSUPP && barrier_done) {
-			char b[BDEVNAME_SIZE];
-
-			printk(KERN_WARNING
-				"JBD: barrier-based sync failed on %s - "
-				"disabling barriers\n",
-				bdevname(journal->j_dev, b));
-			spin_lock(&journal->j_state_lock);
-			journal->j_flags &= ~JFS_BARRIER;
-			spin_unlock(&journal->j_state_lock);
-
-			/* And try again, without the barrier */
-			clear_buffer_ordered(bh);
-			set_buffer_uptodate(bh);
-			set_buffer_dirty(bh);
-			ret = sync_dirty_buffer(bh);
-		}
-		if (unlikely(ret == -EIO))
-			err = -EIO;
-		put_bh(bh);		/* One for getblk() */
-		journal_put_journal_head(descriptor);
-	}
+	if (cjh && journal_wait_on_commit_record(journal, cjh))
+		err = -EIO;
 
 	/* End of a transaction!  Finally, we can do checkpoint
            processing: any buffers committed as a result of this
            transaction can be removed from any checkpoint list it was on
            before. */
 
-skip_commit: /* The journal should be unlocked by now. */
+	/* The journal should be unlocked by now. */
 
 	if (err)
 		__journal_abort_hard(journal);
@@ -788,12 +879,32 @@ restart_loop:
 	 * Really, __jornal_remove_checkpoint should be using j_state_lock but
 	 * it's a bit hassle to hold that across __journal_remove_checkpoint
 	 */
+	do_gettimeofday(&end_time);
+	commit_time = (end_time.tv_sec - start_time.tv_sec) * USEC_PER_SEC +
+			end_time.tv_usec - start_time.tv_usec;
+	if (commit_time < 0)
+		commit_time = 0;
+
 	spin_lock(&journal->j_state_lock);
 	spin_lock(&journal->j_list_lock);
 	commit_transaction->t_state = T_FINISHED;
 	J_ASSERT(commit_transaction == journal->j_committing_transaction);
 	journal->j_commit_sequence = commit_transaction->t_tid;
 	journal->j_committing_transaction = NULL;
+
+	/*
+	 * Keep a decaying average of the commit time, for sync batching
+	 * in journal_stop(), and the statistics in /proc.
+	 */
+	if (likely(journal->j_average_commit_time))
+		journal->j_average_commit_time = (commit_time +
+				journal->j_average_commit_time * 3) / 4;
+	else
+		journal->j_average_commit_time = commit_time;
+	if (commit_time > journal->j_commit_time_max)
+		journal->j_commit_time_max = commit_time;
+	journal->j_commit_count++;
+	journal->j_commit_handles += commit_transaction->t_handle_count;
 	spin_unlock(&journal->j_state_lock);
 
 	if (commit_transaction->t_checkpoint_list == NULL) {
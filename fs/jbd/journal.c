@@ -646,6 +646,101 @@ struct journal_head *journal_get_descriptor_buffer(journal_t *journal)
 	return journal_add_journal_head(bh);
 }
 
+/*
+ * Per-journal statistics, in /proc/fs/jbd/<device>/info
+ */
+#ifdef CONFIG_PROC_FS
+
+static struct proc_dir_entry *proc_jbd_stats;
+
+static int jbd_info_read_proc(char *page, char **start, off_t off,
+			      int count, int *eof, void *data)
+{
+	journal_t *journal = data;
+	int len = 0;
+
+	spin_lock(&journal->j_state_lock);
+	len += sprintf(page + len, "log_wait_count %lu\n",
+		       journal->j_log_wait_count);
+	len += sprintf(page + len, "log_wait_time_ms %u\n",
+		       jiffies_to_msecs(journal->j_log_wait_time));
+	len += sprintf(page + len, "log_wait_max_ms %u\n",
+		       jiffies_to_msecs(journal->j_log_wait_max));
+	len += sprintf(page + len, "commits %lu\n",
+		       journal->j_commit_count);
+	len += sprintf(page + len, "commit_avg_us %lu\n",
+		       journal->j_average_commit_time);
+	len += sprintf(page + len, "commit_max_us %lu\n",
+		       journal->j_commit_time_max);
+	len += sprintf(page + len, "handles_per_commit %lu\n",
+		       journal->j_commit_count ?
+		       journal->j_commit_handles / journal->j_commit_count : 0);
+	spin_unlock(&journal->j_state_lock);
+	len += sprintf(page + len, "checkpoint_batches %lu\n",
+		       journal->j_checkpoint_runs);
+	len += sprintf(page + len, "checkpoint_written %lu\n",
+		       journal->j_checkpoint_written);
+
+	if (len <= off + count)
+		*eof = 1;
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	if (len < 0)
+		len = 0;
+	return len;
+}
+
+static void journal_proc_init(journal_t *journal)
+{
+	struct proc_dir_entry *p;
+
+	if (!proc_jbd_stats)
+		return;
+
+	bdevname(journal->j_dev, journal->j_devname);
+	journal->j_proc_entry = proc_mkdir(journal->j_devname, proc_jbd_stats);
+	if (!journal->j_proc_entry)
+		return;
+
+	p = create_proc_entry("info", S_IRUGO, journal->j_proc_entry);
+	if (p) {
+		p->read_proc = jbd_info_read_proc;
+		p->data = journal;
+	}
+}
+
+static void journal_proc_exit(journal_t *journal)
+{
+	if (!journal->j_proc_entry)
+		return;
+
+	remove_proc_entry("info", journal->j_proc_entry);
+	remove_proc_entry(journal->j_devname, proc_jbd_stats);
+	journal->j_proc_entry = NULL;
+}
+
+static void __init create_jbd_stats_proc_entry(void)
+{
+	proc_jbd_stats = proc_mkdir("fs/jbd", NULL);
+}
+
+static void __exit remove_jbd_stats_proc_entry(void)
+{
+	if (proc_jbd_stats)
+		remove_proc_entry("fs/jbd", NULL);
+}
+
+#else
+
+#define journal_proc_init(journal) do {} while (0)
+#define journal_proc_exit(journal) do {} while (0)
+#define create_jbd_stats_proc_entry() do {} while (0)
+#define remove_jbd_stats_proc_entry() do {} while (0)
+
+#endif
+
 /*
  * Management for journal control blocks: functions to create and
  * destroy journal_t structures, and to initialise and read existing
@@ -735,6 +830,7 @@ journal_t * journal_init_dev(struct block_device *bdev,
 	J_ASSERT(bh != NULL);
 	journal->j_sb_buffer = bh;
 	journal->j_superblock = (journal_superblock_t *)bh->b_data;
+	journal_proc_init(journal);
 
 	return journal;
 }
@@ -781,6 +877,7 @@ journal_t * journal_init_inode (struct inode *inode) //
 	J_ASSERT(bh != NULL);
 	journal->j_sb_buffer = bh;
 	journal->j_superblock = (journal_superblock_t *)bh->b_data;
+	journal_proc_init(journal);
 
 	return journal;
 }
@@ -1117,12 +1214,14 @@ void journal_destroy(journal_t *journal)
 	/* Force any old transactions to disk */
 
 	/* Totally anal locking here... */
+	down(&journal->j_checkpoint_sem);
 	spin_lock(&journal->j_list_lock);
 	while (journal->j_checkpoint_transactions != NULL) {
 		spin_unlock(&journal->j_list_lock);
 		log_do_checkpoint(journal);
 		spin_lock(&journal->j_list_lock);
 	}
+	up(&journal->j_checkpoint_sem);
 
 	J_ASSERT(journal->j_running_transaction == NULL);
 	J_ASSERT(journal->j_committing_transaction == NULL);
@@ -1141,6 +1240,7 @@ void journal_destroy(journal_t *journal)
 		iput(journal->j_inode);
 	if (journal->j_revoke)
 		journal_destroy_revoke(journal);
+	journal_proc_exit(journal);
 	kfree(journal);
 }
 
@@ -1325,6 +1425,7 @@ int journal_flush(journal_t *journal)
 	}
 
 	/* ...and flush everything in the log out to disk. */
+	down(&journal->j_checkpoint_sem);
 	spin_lock(&journal->j_list_lock);
 	while (!err && journal->j_checkpoint_transactions != NULL) {
 		spin_unlock(&journal->j_list_lock);
@@ -1333,6 +1434,8 @@ int journal_flush(journal_t *journal)
 	}
 	spin_unlock(&journal->j_list_lock);
 	cleanup_journal_tail(journal);
+	up(&journal->j_checkpoint_sem);
+	wake_up(&journal->j_wait_logspace);
 
 	/* Finally, mark the journal as really needing no recovery.
 	 * This sets s_start==0 in the underlying superblock, which is
@@ -1946,6 +2049,7 @@ static int __init journal_init(void)
 	if (ret != 0)
 		journal_destroy_caches();
 	create_jbd_proc_entry();
+	create_jbd_stats_proc_entry();
 	return ret;
 }
 
@@ -1957,6 +2061,7 @@ static void __exit journal_exit(void)
 		printk(KERN_EMERG "JBD: leaked %d journal_heads!\n", n);
 #endif
 	remove_jbd_proc_entry();
+	remove_jbd_stats_proc_entry();
 	journal_destroy_caches();
 }
 
@@ -49,7 +49,8 @@ get_transaction(journal_t *journal, transaction_t *transaction)
 	transaction->t_journal = journal;
 	transaction->t_state = T_RUNNING;
 	transaction->t_tid = journal->j_transaction_sequence++;
-	transaction->t_expires = jiffies + journal->j_commit_interval;
+	transaction->t_start = jiffies;
+	transaction->t_expires = transaction->t_start + journal->j_commit_interval;
 	spin_lock_init(&transaction->t_handle_lock);
 
 	/* Set up the commit timer for the new transaction. */
@@ -1308,6 +1309,7 @@ int journal_stop(handle_t *handle)
 	transaction_t *transaction = handle->h_transaction;
 	journal_t *journal = transaction->t_journal;
 	int old_handle_count, err;
+	pid_t pid;
 
 	J_ASSERT(transaction->t_updates > 0);
 	J_ASSERT(journal_current_handle() == handle);
@@ -1333,13 +1335,32 @@ int journal_stop(handle_t *handle)
 	 * It doesn't cost much - we're about to run a commit and sleep
 	 * on IO anyway.  Speeds up many-threaded, many-dir operations
 	 * by 30x or more...
+	 *
+	 * But don't wait longer than a commit takes on this journal:
+	 * once the transaction is older than that, waiting for more
+	 * company costs more than a second commit would.  And a single
+	 * process doing all the sync updates has nobody to wait for.
 	 */
-	if (handle->h_sync) {
-		do {
+	pid = current->pid;
+	if (handle->h_sync && journal->j_last_sync_writer != pid) {
+		unsigned long commit_time, batch_end;
+
+		spin_lock(&journal->j_state_lock);
+		journal->j_last_sync_writer = pid;
+		commit_time = journal->j_average_commit_time;
+		spin_unlock(&journal->j_state_lock);
+
+		if (commit_time > JBD_MAX_BATCH_TIME)
+			commit_time = JBD_MAX_BATCH_TIME;
+		batch_end = transaction->t_start + usecs_to_jiffies(commit_time);
+
+		while (time_before(jiffies, batch_end)) {
 			old_handle_count = transaction->t_handle_count;
 			set_current_state(TASK_UNINTERRUPTIBLE);
 			schedule_timeout(1);
-		} while (old_handle_count != transaction->t_handle_count);
+			if (old_handle_count == transaction->t_handle_count)
+				break;
+		}
 	}
 
 	current->journal_info = NULL;
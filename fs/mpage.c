@@ -694,19 +694,34 @@ out:
 int
 mpage_writepages(struct address_space *mapping,
 		struct writeback_control *wbc, get_block_t get_block)
+{
+	return __mpage_writepages(mapping, wbc, get_block,
+			get_block ? NULL : mapping->a_ops->writepage);
+}
+EXPORT_SYMBOL(mpage_writepages);
+
+/*
+ * As mpage_writepages(), but with get_block == NULL the pages are handed to
+ * `writepage' instead of a_ops->writepage.  This lets a filesystem wrap a
+ * run of pages in state of its own, e.g. a single journal transaction.
+ */
+int
+__mpage_writepages(struct address_space *mapping,
+		struct writeback_control *wbc, get_block_t get_block,
+		writepage_t *writepage)
 {
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 	struct bio *bio = NULL;
 	sector_t last_block_in_bio = 0;
 	int ret = 0;
 	int done = 0;
-	int (*writepage)(struct page *page, struct writeback_control *wbc);
 	struct pagevec pvec;
 	int nr_pages;
 	pgoff_t index;
 	pgoff_t end = -1;		/* Inclusive */
 	int scanned = 0;
 	int is_range = 0;
+	struct blk_plug plug;
 
 	/**
 	 * дӵҽ̲ϣֱӷء
@@ -716,10 +731,6 @@ mpage_writepages(struct address_space *mapping,
 		return 0;
 	}
 
-	writepage = NULL;
-	if (get_block == NULL)
-		writepage = mapping->a_ops->writepage;
-
 	pagevec_init(&pvec, 0);
 	/**
 	 * ȷҳwbcָ߳ȴIOݴmapping->writeback_indexΪʼҳ
@@ -740,6 +751,7 @@ mpage_writepages(struct address_space *mapping,
 		is_range = 1;
 		scanned = 1;
 	}
+	blk_start_plug(&plug);
 retry:
 	/**
 	 * pagevec_lookup_tagfind_get_pages_tagҳٻвҳ
@@ -855,6 +867,7 @@ retry:
 	 */
 	if (bio)
 		mpage_bio_submit(WRITE, bio);
+	blk_finish_plug(&plug);
 	return ret;
 }
-EXPORT_SYMBOL(mpage_writepages);
+EXPORT_SYMBOL(__mpage_writepages);
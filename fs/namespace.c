@@ -22,6 +22,8 @@
 #include <linux/namei.h>
 #include <linux/security.h>
 #include <linux/mount.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <asm/uaccess.h>
 #include <asm/unistd.h>
 
@@ -39,6 +41,14 @@ static inline int sysfs_init(void)
 /* spinlock for vfsmount related operations, inplace of dcache_lock */
  __cacheline_aligned_in_smp DEFINE_SPINLOCK(vfsmount_lock);
 
+/*
+ * Bumped under vfsmount_lock around every change to the mount hash, so
+ * that lookup_mnt() can walk the hash under RCU alone and retry if a
+ * mount, umount or move raced with it.  The hash is shared by all
+ * namespaces, and so is the count.
+ */
+static seqcount_t mount_seq = SEQCNT_ZERO;
+
 /**
  * ļϵͳɢб
  */
@@ -83,12 +93,39 @@ struct vfsmount *alloc_vfsmnt(const char *name)
 /**
  * ͷmntָѰװļϵͳ
  */
-void free_vfsmnt(struct vfsmount *mnt)
+static void free_vfsmnt_rcu(struct rcu_head *head)
 {
+	struct vfsmount *mnt = container_of(head, struct vfsmount, mnt_rcu);
+
 	kfree(mnt->mnt_devname);
 	kmem_cache_free(mnt_cache, mnt);
 }
 
+void free_vfsmnt(struct vfsmount *mnt)
+{
+	call_rcu(&mnt->mnt_rcu, free_vfsmnt_rcu);
+}
+
+#ifdef __HAVE_ARCH_CMPXCHG
+/*
+ * Take a reference on a vfsmount found under rcu_read_lock().  Fails if
+ * the last reference is already gone, i.e. it was just unmounted.
+ */
+static inline int mntget_rcu(struct vfsmount *mnt)
+{
+	int c, old;
+
+	c = atomic_read(&mnt->mnt_count);
+	while (c) {
+		old = cmpxchg(&mnt->mnt_count.counter, c, c + 1);
+		if (old == c)
+			return 1;
+		c = old;
+	}
+	return 0;
+}
+#endif
+
 /*
  * Now, lookup_mnt increments the ref count before returning
  * the vfsmount struct.
@@ -101,7 +138,42 @@ struct vfsmount *lookup_mnt(struct vfsmount *mnt, struct dentry *dentry)
 	struct list_head * head = mount_hashtable + hash(mnt, dentry);
 	struct list_head * tmp = head;
 	struct vfsmount *p, *found = NULL;
+#ifdef __HAVE_ARCH_CMPXCHG
+	unsigned seq;
+
+retry:
+	rcu_read_lock();
+	seq = read_seqcount_begin(&mount_seq);
+	for (tmp = rcu_dereference(head->next); tmp != head;
+	     tmp = rcu_dereference(tmp->next)) {
+		/*
+		 * A moved mount may have carried us onto another chain,
+		 * where we would never see our head again.
+		 */
+		if (read_seqcount_retry(&mount_seq, seq))
+			break;
+		p = list_entry(tmp, struct vfsmount, mnt_hash);
+		if (p->mnt_parent == mnt && p->mnt_mountpoint == dentry) {
+			if (mntget_rcu(p))
+				found = p;
+			break;
+		}
+	}
+	rcu_read_unlock();
 
+	/*
+	 * hashed mounts are pinned, so a failed mntget_rcu() also lands here;
+	 * so does a mount that an unmount has claimed, until it is unhashed.
+	 */
+	if (read_seqcount_retry(&mount_seq, seq) ||
+	    (tmp != head && !found) || (found && found->mnt_doomed)) {
+		mntput(found);
+		found = NULL;
+		tmp = head;
+		goto retry;
+	}
+	return found;
+#else
 	spin_lock(&vfsmount_lock);
 	for (;;) {
 		tmp = tmp->next;
@@ -116,6 +188,7 @@ struct vfsmount *lookup_mnt(struct vfsmount *mnt, struct dentry *dentry)
 	}
 	spin_unlock(&vfsmount_lock);
 	return found;
+#endif
 }
 
 static inline int check_mnt(struct vfsmount *mnt)
@@ -123,22 +196,44 @@ static inline int check_mnt(struct vfsmount *mnt)
 	return mnt->mnt_namespace == current->namespace;
 }
 
+/*
+ * Called under vfsmount_lock: check that nobody but the `refs' expected
+ * holders uses @mnt, and if so mark it so that lookup_mnt() refuses it.
+ * A lockless lookup either takes its reference before our read of the
+ * count or sees mnt_doomed after taking it, so the mount can't gain a
+ * user between this check and its detach.
+ */
+static int mnt_claim_unused(struct vfsmount *mnt, int refs)
+{
+	mnt->mnt_doomed = 1;
+	smp_mb();
+	if (atomic_read(&mnt->mnt_count) != refs) {
+		mnt->mnt_doomed = 0;
+		return 0;
+	}
+	return 1;
+}
+
 static void detach_mnt(struct vfsmount *mnt, struct nameidata *old_nd)
 {
 	old_nd->dentry = mnt->mnt_mountpoint;
 	old_nd->mnt = mnt->mnt_parent;
+	write_seqcount_begin(&mount_seq);
 	mnt->mnt_parent = mnt;
 	mnt->mnt_mountpoint = mnt->mnt_root;
 	list_del_init(&mnt->mnt_child);
-	list_del_init(&mnt->mnt_hash);
+	list_del_rcu(&mnt->mnt_hash);
+	write_seqcount_end(&mount_seq);
 	old_nd->dentry->d_mounted--;
 }
 
 static void attach_mnt(struct vfsmount *mnt, struct nameidata *nd)
 {
+	write_seqcount_begin(&mount_seq);
 	mnt->mnt_parent = mntget(nd->mnt);
 	mnt->mnt_mountpoint = dget(nd->dentry);
-	list_add(&mnt->mnt_hash, mount_hashtable+hash(nd->mnt, nd->dentry));
+	list_add_rcu(&mnt->mnt_hash, mount_hashtable+hash(nd->mnt, nd->dentry));
+	write_seqcount_end(&mount_seq);
 	list_add_tail(&mnt->mnt_child, &nd->mnt->mnt_mounts);
 	nd->dentry->d_mounted++;
 }
@@ -480,7 +575,7 @@ static int do_umount(struct vfsmount *mnt, int flags)
 	 * ûӰװļϵͳİװ㣬Ҫǿжļϵͳ
 	 * umount_treeжļϵͳļϵͳ
 	 */
-	if (atomic_read(&mnt->mnt_count) == 2 || flags & MNT_DETACH) {
+	if (flags & MNT_DETACH || mnt_claim_unused(mnt, 2)) {
 		if (!list_empty(&mnt->mnt_list))
 			umount_tree(mnt);
 		retval = 0;
@@ -986,20 +1081,22 @@ void mark_mounts_for_expiry(struct list_head *mounts)
 
 		/* check that it is still dead: the count should now be 2 - as
 		 * contributed by the vfsmount parent and the mntget above */
-		if (atomic_read(&mnt->mnt_count) == 2) {
+		if (mnt_claim_unused(mnt, 2)) {
 			struct vfsmount *xdmnt;
 			struct dentry *xdentry;
 
 			/* delete from the namespace */
 			list_del_init(&mnt->mnt_list);
 			list_del_init(&mnt->mnt_child);
-			list_del_init(&mnt->mnt_hash);
+			write_seqcount_begin(&mount_seq);
+			list_del_rcu(&mnt->mnt_hash);
 			mnt->mnt_mountpoint->d_mounted--;
 
 			xdentry = mnt->mnt_mountpoint;
 			mnt->mnt_mountpoint = mnt->mnt_root;
 			xdmnt = mnt->mnt_parent;
 			mnt->mnt_parent = mnt;
+			write_seqcount_end(&mount_seq);
 
 			spin_unlock(&vfsmount_lock);
 
@@ -54,6 +54,7 @@
 #include <linux/file.h>
 #include <linux/mpage.h>
 #include <linux/writeback.h>
+#include <linux/backing-dev.h>
 
 #include <linux/sunrpc/clnt.h>
 #include <linux/nfs_fs.h>
@@ -433,6 +434,7 @@ nfs_mark_request_dirty(struct nfs_page *req)
 	nfsi->ndirty++;
 	spin_unlock(&nfsi->req_lock);
 	inc_page_state(nr_dirty);
+	inc_bdi_stat(inode->i_mapping->backing_dev_info, BDI_RECLAIMABLE);
 	mark_inode_dirty(inode);
 }
 
@@ -461,6 +463,7 @@ nfs_mark_request_commit(struct nfs_page *req)
 	nfsi->ncommit++;
 	spin_unlock(&nfsi->req_lock);
 	inc_page_state(nr_unstable);
+	inc_bdi_stat(inode->i_mapping->backing_dev_info, BDI_RECLAIMABLE);
 	mark_inode_dirty(inode);
 }
 #endif
@@ -525,6 +528,7 @@ nfs_scan_dirty(struct inode *inode, struct list_head *dst, unsigned long idx_sta
 	res = nfs_scan_list(&nfsi->dirty, dst, idx_start, npages);
 	nfsi->ndirty -= res;
 	sub_page_state(nr_dirty,res);
+	add_bdi_stat(inode->i_mapping->backing_dev_info, BDI_RECLAIMABLE, -res);
 	if ((nfsi->ndirty == 0) != list_empty(&nfsi->dirty))
 		printk(KERN_ERR "NFS: desynchronized value of nfs_i.ndirty.\n");
 	return res;
@@ -905,7 +909,8 @@ static int nfs_flush_multi(struct list_head *head, struct inode *inode, int how)
 	atomic_set(&req->wb_complete, requests);
 
 	ClearPageError(page);
-	SetPageWriteback(page);
+	if (!TestSetPageWriteback(page))
+		inc_bdi_stat(page->mapping->backing_dev_info, BDI_WRITEBACK);
 	offset = 0;
 	nbytes = req->wb_bytes;
 	do {
@@ -968,7 +973,9 @@ static int nfs_flush_one(struct list_head *head, struct inode *inode, int how)
 		nfs_list_remove_request(req);
 		nfs_list_add_request(req, &data->pages);
 		ClearPageError(req->wb_page);
-		SetPageWriteback(req->wb_page);
+		if (!TestSetPageWriteback(req->wb_page))
+			inc_bdi_stat(req->wb_page->mapping->backing_dev_info,
+					BDI_WRITEBACK);
 		*pages++ = req->wb_page;
 		count += req->wb_bytes;
 	}
@@ -1311,6 +1318,7 @@ nfs_commit_done(struct rpc_task *task)
 		res++;
 	}
 	sub_page_state(nr_unstable,res);
+	add_bdi_stat(data->inode->i_mapping->backing_dev_info, BDI_RECLAIMABLE, -res);
 }
 #endif
 
@@ -19,6 +19,7 @@
 #include <linux/kmod.h>
 #include <linux/ctype.h>
 #include <linux/devfs_fs_kernel.h>
+#include <linux/rcupdate.h>
 
 #include "check.h"
 #include "devfs.h"
@@ -232,6 +233,12 @@ static ssize_t part_stat_read(struct hd_struct * p, char *page)
 		       p->reads, (unsigned long long)p->read_sectors,
 		       p->writes, (unsigned long long)p->write_sectors);
 }
+static ssize_t part_latency_read(struct hd_struct * p, char *page)
+{
+	if (!p->lat)
+		return 0;
+	return disk_latency_read(p->lat, page);
+}
 static struct part_attribute part_attr_dev = {
 	.attr = {.name = "dev", .mode = S_IRUGO },
 	.show	= part_dev_read
@@ -248,12 +255,17 @@ static struct part_attribute part_attr_stat = {
 	.attr = {.name = "stat", .mode = S_IRUGO },
 	.show	= part_stat_read
 };
+static struct part_attribute part_attr_latency = {
+	.attr = {.name = "latency", .mode = S_IRUGO },
+	.show	= part_latency_read
+};
 
 static struct attribute * default_attrs[] = {
 	&part_attr_dev.attr,
 	&part_attr_start.attr,
 	&part_attr_size.attr,
 	&part_attr_stat.attr,
+	&part_attr_latency.attr,
 	NULL,
 };
 
@@ -262,6 +274,8 @@ extern struct subsystem block_subsys;
 static void part_release(struct kobject *kobj)
 {
 	struct hd_struct * p = container_of(kobj,struct hd_struct,kobj);
+	if (p->lat)
+		free_percpu(p->lat);
 	kfree(p);
 }
 
@@ -279,6 +293,12 @@ void delete_partition(struct gendisk *disk, int part)
 	if (!p->nr_sects)
 		return;
 	disk->part[part-1] = NULL;
+	/*
+	 * Request completion looks partitions up in disk->part[] with
+	 * preemption off (blk_account_latency()): let those which saw p
+	 * finish before its histograms can be freed.
+	 */
+	synchronize_kernel();
 	p->start_sect = 0;
 	p->nr_sects = 0;
 	p->reads = p->writes = p->read_sectors = p->write_sectors = 0;
@@ -298,6 +318,7 @@ void add_partition(struct gendisk *disk, int part, sector_t start, sector_t len)
 	p->start_sect = start;
 	p->nr_sects = len;
 	p->partno = part;
+	p->lat = alloc_percpu(struct disk_latency);
 
 	devfs_mk_bdev(MKDEV(disk->major, disk->first_minor + part),
 			S_IFBLK|S_IRUSR|S_IWUSR,
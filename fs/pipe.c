@@ -15,6 +15,7 @@
 #include <linux/pipe_fs_i.h>
 #include <linux/uio.h>
 #include <linux/highmem.h>
+#include <linux/pagemap.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -90,8 +91,13 @@ static void anon_pipe_buf_release(struct pipe_inode_info *info, struct pipe_buff
 {
 	struct page *page = buf->page;
 
-	if (info->tmp_page) {
-		__free_page(page);
+	/*
+	 * A page that tee() has also linked into another pipe, or that
+	 * splice() has handed to a socket, must not be recycled as our
+	 * temporary page: somebody else still looks at its contents.
+	 */
+	if (info->tmp_page || page_count(page) != 1) {
+		page_cache_release(page);
 		return;
 	}
 	info->tmp_page = page;
@@ -107,6 +113,11 @@ static void anon_pipe_buf_unmap(struct pipe_inode_info *info, struct pipe_buffer
 	kunmap(buf->page);
 }
 
+static void anon_pipe_buf_get(struct pipe_inode_info *info, struct pipe_buffer *buf)
+{
+	page_cache_get(buf->page);
+}
+
 /**
  * anon_pipe_buf_opspipe_bufferopsָ
  */
@@ -124,6 +135,10 @@ static struct pipe_buf_operations anon_pipe_buf_ops = {
 	 * ͷŹʱã÷ʵһҳڴٻ档
 	 */
 	.release = anon_pipe_buf_release,
+	/**
+	 * tee()ƻʱãҳü
+	 */
+	.get = anon_pipe_buf_get,
 };
 
 static ssize_t
@@ -172,7 +187,7 @@ pipe_readv(struct file *filp, const struct iovec *_iov,
 			if (!buf->len) {
 				buf->ops = NULL;
 				ops->release(info, buf);
-				curbuf = (curbuf + 1) & (PIPE_BUFFERS-1);
+				curbuf = (curbuf + 1) & (info->buffers-1);
 				info->curbuf = curbuf;
 				info->nrbufs = --bufs;
 				do_wakeup = 1;
@@ -255,11 +270,13 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 
 	/* We try to merge small writes */
 	if (info->nrbufs && total_len < PAGE_SIZE) {
-		int lastbuf = (info->curbuf + info->nrbufs - 1) & (PIPE_BUFFERS-1);
+		int lastbuf = (info->curbuf + info->nrbufs - 1) & (info->buffers-1);
 		struct pipe_buffer *buf = info->bufs + lastbuf;
 		struct pipe_buf_operations *ops = buf->ops;
 		int offset = buf->offset + buf->len;
-		if (ops->can_merge && offset + total_len <= PAGE_SIZE) {
+		/* Never append into a page another pipe still references */
+		if (ops->can_merge && page_count(buf->page) == 1 &&
+		    offset + total_len <= PAGE_SIZE) {
 			void *addr = ops->map(filp, info, buf);
 			int error = pipe_iov_copy_from_user(offset + addr, iov, total_len);
 			ops->unmap(info, buf);
@@ -282,9 +299,9 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 			break;
 		}
 		bufs = info->nrbufs;
-		if (bufs < PIPE_BUFFERS) {
+		if (bufs < info->buffers) {
 			ssize_t chars;
-			int newbuf = (info->curbuf + bufs) & (PIPE_BUFFERS-1);
+			int newbuf = (info->curbuf + bufs) & (info->buffers-1);
 			struct pipe_buffer *buf = info->bufs + newbuf;
 			struct page *page = info->tmp_page;
 			int error;
@@ -327,7 +344,7 @@ pipe_writev(struct file *filp, const struct iovec *_iov,
 			if (!total_len)
 				break;
 		}
-		if (bufs < PIPE_BUFFERS)
+		if (bufs < info->buffers)
 			continue;
 		if (filp->f_flags & O_NONBLOCK) {
 			if (!ret) ret = -EAGAIN;
@@ -402,7 +419,7 @@ pipe_ioctl(struct inode *pino, struct file *filp,
 			nrbufs = info->nrbufs;
 			while (--nrbufs >= 0) {
 				count += info->bufs[buf].len;
-				buf = (buf+1) & (PIPE_BUFFERS-1);
+				buf = (buf+1) & (info->buffers-1);
 			}
 			up(PIPE_SEM(*inode));
 			return put_user(count, (int __user *)arg);
@@ -432,7 +449,7 @@ pipe_poll(struct file *filp, poll_table *wait)
 	}
 
 	if (filp->f_mode & FMODE_WRITE) {
-		mask |= (nrbufs < PIPE_BUFFERS) ? POLLOUT | POLLWRNORM : 0;
+		mask |= (nrbufs < info->buffers) ? POLLOUT | POLLWRNORM : 0;
 		if (!PIPE_READERS(*inode))
 			mask |= POLLERR;
 	}
@@ -661,13 +678,16 @@ void free_pipe_info(struct inode *inode)
 	struct pipe_inode_info *info = inode->i_pipe;
 
 	inode->i_pipe = NULL;
-	for (i = 0; i < PIPE_BUFFERS; i++) {
+	for (i = 0; i < info->buffers; i++) {
 		struct pipe_buffer *buf = info->bufs + i;
 		if (buf->ops)
 			buf->ops->release(info, buf);
 	}
 	if (info->tmp_page)
 		__free_page(info->tmp_page);
+	atomic_sub(info->buffers, &info->user->pipe_bufs);
+	free_uid(info->user);
+	kfree(info->bufs);
 	kfree(info);
 }
 
@@ -679,16 +699,112 @@ struct inode* pipe_new(struct inode* inode)
 	if (!info)
 		goto fail_page;
 	memset(info, 0, sizeof(*info));
+	info->bufs = kmalloc(PIPE_BUFFERS * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!info->bufs)
+		goto fail_info;
+	memset(info->bufs, 0, PIPE_BUFFERS * sizeof(struct pipe_buffer));
+	info->buffers = PIPE_BUFFERS;
+	info->user = get_uid(current->user);
+	atomic_add(PIPE_BUFFERS, &info->user->pipe_bufs);
 	inode->i_pipe = info;
 
 	init_waitqueue_head(PIPE_WAIT(*inode));
 	PIPE_RCOUNTER(*inode) = PIPE_WCOUNTER(*inode) = 1;
 
 	return inode;
+fail_info:
+	kfree(info);
 fail_page:
 	return NULL;
 }
 
+/*
+ * Largest ring an unprivileged user may ask for, in bytes, and the total
+ * number of ring pages (0 means no limit) all pipes of one user may hold
+ * once they have been grown with F_SETPIPE_SZ.
+ */
+int pipe_max_size = 1048576;
+int pipe_min_size = PAGE_SIZE;
+int pipe_user_pages_hard;
+
+/*
+ * Move the queued buffers into a ring of nr_pages slots. The ring is
+ * linearised on the way, so curbuf starts over at zero.
+ */
+static long pipe_set_size(struct inode *inode, unsigned int nr_pages)
+{
+	struct pipe_inode_info *info = inode->i_pipe;
+	struct pipe_buffer *bufs;
+	int i;
+
+	/* Never throw away data that is already queued */
+	if (nr_pages < info->nrbufs)
+		return -EBUSY;
+
+	if (nr_pages > info->buffers && !capable(CAP_SYS_RESOURCE) &&
+	    pipe_user_pages_hard &&
+	    atomic_read(&info->user->pipe_bufs) + nr_pages - info->buffers >
+	    pipe_user_pages_hard)
+		return -EPERM;
+
+	bufs = kmalloc(nr_pages * sizeof(struct pipe_buffer), GFP_KERNEL);
+	if (!bufs)
+		return -ENOMEM;
+	memset(bufs, 0, nr_pages * sizeof(struct pipe_buffer));
+
+	for (i = 0; i < info->nrbufs; i++)
+		bufs[i] = info->bufs[(info->curbuf + i) & (info->buffers-1)];
+
+	atomic_add(nr_pages, &info->user->pipe_bufs);
+	atomic_sub(info->buffers, &info->user->pipe_bufs);
+	kfree(info->bufs);
+	info->bufs = bufs;
+	info->buffers = nr_pages;
+	info->curbuf = 0;
+	return nr_pages * PAGE_SIZE;
+}
+
+long pipe_fcntl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct inode *inode = file->f_dentry->d_inode;
+	unsigned long nr_pages;
+	long ret;
+
+	if (!inode->i_pipe)
+		return -EBADF;
+
+	down(PIPE_SEM(*inode));
+	switch (cmd) {
+	case F_SETPIPE_SZ:
+		ret = -EINVAL;
+		if (arg > INT_MAX)
+			break;
+		if (arg < pipe_min_size)
+			arg = pipe_min_size;
+		nr_pages = roundup_pow_of_two((arg + PAGE_SIZE - 1) >> PAGE_SHIFT);
+		ret = -EPERM;
+		if (nr_pages * PAGE_SIZE > pipe_max_size &&
+		    !capable(CAP_SYS_RESOURCE))
+			break;
+		ret = pipe_set_size(inode, nr_pages);
+		break;
+	case F_GETPIPE_SZ:
+		ret = inode->i_pipe->buffers * PAGE_SIZE;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	up(PIPE_SEM(*inode));
+
+	/* Writers may have room now */
+	if (cmd == F_SETPIPE_SZ && ret > 0) {
+		wake_up_interruptible(PIPE_WAIT(*inode));
+		kill_fasync(PIPE_FASYNC_WRITERS(*inode), SIGIO, POLL_OUT);
+	}
+	return ret;
+}
+
 static struct vfsmount *pipe_mnt;
 static int pipefs_delete_dentry(struct dentry *dentry)
 {
@@ -920,7 +920,7 @@ static int proc_readfd(struct file * filp, void * dirent, filldir_t filldir)
 				goto out;
 			spin_lock(&files->file_lock);
 			for (fd = filp->f_pos-2;
-			     fd < files->max_fds;
+			     fd < files_fdtable(files)->max_fds;
 			     fd++, filp->f_pos++) {
 				unsigned int i,j;
 
@@ -278,6 +278,18 @@ static struct file_operations proc_partitions_operations = {
 	.release	= seq_release,
 };
 
+extern struct seq_operations dentry_sb_op;
+static int dentrystat_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &dentry_sb_op);
+}
+static struct file_operations proc_dentrystat_operations = {
+	.open		= dentrystat_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 extern struct seq_operations diskstats_op;
 static int diskstats_open(struct inode *inode, struct file *file)
 {
@@ -585,6 +597,7 @@ void __init proc_misc_init(void)
 	create_seq_entry("buddyinfo",S_IRUGO, &fragmentation_file_operations);
 	create_seq_entry("vmstat",S_IRUGO, &proc_vmstat_file_operations);
 	create_seq_entry("diskstats", 0, &proc_diskstats_operations);
+	create_seq_entry("dentrystat", 0, &proc_dentrystat_operations);
 #ifdef CONFIG_MODULES
 	create_seq_entry("modules", 0, &proc_modules_operations);
 #endif
@@ -684,7 +684,10 @@ static ssize_t do_sendfile(int out_fd, int in_fd, loff_t *ppos,
 	if (!(out_file->f_mode & FMODE_WRITE))
 		goto fput_out;
 	retval = -EINVAL;
-	if (!out_file->f_op || !out_file->f_op->sendpage)
+	if (!out_file->f_op)
+		goto fput_out;
+	/* without ->sendpage, fall back to copying page cache to page cache */
+	if (!out_file->f_op->sendpage && !sendfile_can_copy(out_file))
 		goto fput_out;
 	out_inode = out_file->f_dentry->d_inode;
 	retval = rw_verify_area(WRITE, out_file, &out_file->f_pos, count);
@@ -709,7 +712,10 @@ static ssize_t do_sendfile(int out_fd, int in_fd, loff_t *ppos,
 		count = max - pos;
 	}
 
-	retval = in_file->f_op->sendfile(in_file, ppos, count, file_send_actor, out_file);
+	if (out_file->f_op->sendpage)
+		retval = in_file->f_op->sendfile(in_file, ppos, count, file_send_actor, out_file);
+	else
+		retval = generic_file_sendfile_copy(in_file, ppos, count, out_file);
 
 	if (retval > 0) {
 		current->rchar += retval;
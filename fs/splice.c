@@ -0,0 +1,714 @@
+/*
+ *  linux/fs/splice.c
+ *
+ * Move data between a pipe and a file or socket without going through
+ * user space. The pipe buffers are used as the in-kernel carrier: reading
+ * from a file links page cache pages into the pipe by reference, writing
+ * to a socket hands the same pages to ->sendpage(), and tee() duplicates
+ * buffer references from one pipe into another.
+ *
+ * Writing into a regular file still copies each buffer once into the
+ * page cache of the target, through ->prepare_write()/->commit_write(),
+ * but never through a user space bounce buffer.
+ */
+
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/pagemap.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/highmem.h>
+#include <linux/poll.h>
+#include <linux/writeback.h>
+#include <linux/module.h>
+#include <linux/security.h>
+#include <linux/syscalls.h>
+
+#include <asm/uaccess.h>
+
+/*
+ * Passed to the actors of splice_from_pipe(). The actor consumes at most
+ * len bytes of buf and returns how many it took, or a negative error.
+ */
+typedef int (splice_actor)(struct pipe_inode_info *, struct pipe_buffer *,
+			   struct file *, loff_t *, size_t, int);
+
+static void *page_cache_pipe_buf_map(struct file *file,
+				     struct pipe_inode_info *info,
+				     struct pipe_buffer *buf)
+{
+	return kmap(buf->page);
+}
+
+static void page_cache_pipe_buf_unmap(struct pipe_inode_info *info,
+				      struct pipe_buffer *buf)
+{
+	kunmap(buf->page);
+}
+
+static void page_cache_pipe_buf_release(struct pipe_inode_info *info,
+					struct pipe_buffer *buf)
+{
+	page_cache_release(buf->page);
+}
+
+static void page_cache_pipe_buf_get(struct pipe_inode_info *info,
+				    struct pipe_buffer *buf)
+{
+	page_cache_get(buf->page);
+}
+
+/*
+ * Buffers pointing at page cache pages. They are shared with the file,
+ * so a write() into the pipe must never append to them.
+ */
+static struct pipe_buf_operations page_cache_pipe_buf_ops = {
+	.can_merge = 0,
+	.map = page_cache_pipe_buf_map,
+	.unmap = page_cache_pipe_buf_unmap,
+	.release = page_cache_pipe_buf_release,
+	.get = page_cache_pipe_buf_get,
+};
+
+static inline int pipe_inode(struct inode *inode)
+{
+	return S_ISFIFO(inode->i_mode) && inode->i_pipe;
+}
+
+static inline void wakeup_pipe_readers(struct inode *pipe)
+{
+	wake_up_interruptible(PIPE_WAIT(*pipe));
+	kill_fasync(PIPE_FASYNC_READERS(*pipe), SIGIO, POLL_IN);
+}
+
+static inline void wakeup_pipe_writers(struct inode *pipe)
+{
+	wake_up_interruptible(PIPE_WAIT(*pipe));
+	kill_fasync(PIPE_FASYNC_WRITERS(*pipe), SIGIO, POLL_OUT);
+}
+
+/*
+ * Find the page cache page at index, reading it in if needed, and return
+ * it uptodate with an elevated reference count.
+ */
+static struct page *splice_get_page(struct file *in, unsigned long index,
+				    unsigned long nr_pages)
+{
+	struct address_space *mapping = in->f_mapping;
+	struct page *page;
+
+	page_cache_readahead(mapping, &in->f_ra, in, index, nr_pages);
+
+	page = find_get_page(mapping, index);
+	if (!page) {
+		handle_ra_miss(mapping, &in->f_ra, index);
+		goto read_page;
+	}
+	if (PageUptodate(page))
+		return page;
+
+	/* readahead I/O may still be in flight */
+	wait_on_page_locked(page);
+	if (PageUptodate(page))
+		return page;
+	page_cache_release(page);
+
+read_page:
+	page = read_cache_page(mapping, index,
+			       (filler_t *)mapping->a_ops->readpage, in);
+	if (IS_ERR(page))
+		return page;
+	wait_on_page_locked(page);
+	if (!PageUptodate(page)) {
+		page_cache_release(page);
+		return ERR_PTR(-EIO);
+	}
+	return page;
+}
+
+/**
+ * generic_file_splice_read - link page cache pages of a file into a pipe
+ * @in:		file to read from
+ * @ppos:	position in @in
+ * @pipe:	inode of the pipe to fill
+ * @len:	number of bytes wanted
+ * @flags:	SPLICE_F_* flags
+ *
+ * Each page is added to the pipe by reference; the data is not copied.
+ */
+ssize_t generic_file_splice_read(struct file *in, loff_t *ppos,
+				 struct inode *pipe, size_t len,
+				 unsigned int flags)
+{
+	struct address_space *mapping = in->f_mapping;
+	struct inode *inode = mapping->host;
+	struct pipe_inode_info *info;
+	unsigned long last_index;
+	loff_t pos = *ppos;
+	ssize_t ret = 0;
+	int do_wakeup = 0;
+
+	if (!mapping->a_ops->readpage)
+		return -EINVAL;
+
+	last_index = (pos + len + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
+
+	down(PIPE_SEM(*pipe));
+	info = pipe->i_pipe;
+	while (len) {
+		unsigned long index, offset;
+		unsigned int this_len;
+		struct pipe_buffer *buf;
+		struct page *page;
+		loff_t isize;
+
+		if (!PIPE_READERS(*pipe)) {
+			send_sig(SIGPIPE, current, 0);
+			if (!ret)
+				ret = -EPIPE;
+			break;
+		}
+		if (info->nrbufs >= info->buffers) {
+			if (ret)
+				break;
+			if (flags & SPLICE_F_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+			if (signal_pending(current)) {
+				ret = -ERESTARTSYS;
+				break;
+			}
+			PIPE_WAITING_WRITERS(*pipe)++;
+			pipe_wait(pipe);
+			PIPE_WAITING_WRITERS(*pipe)--;
+			continue;
+		}
+
+		isize = i_size_read(inode);
+		if (pos >= isize)
+			break;
+
+		index = pos >> PAGE_CACHE_SHIFT;
+		offset = pos & ~PAGE_CACHE_MASK;
+		page = splice_get_page(in, index, last_index - index);
+		if (IS_ERR(page)) {
+			if (!ret)
+				ret = PTR_ERR(page);
+			break;
+		}
+
+		/* i_size must be checked after the page is uptodate */
+		isize = i_size_read(inode);
+		if (pos >= isize) {
+			page_cache_release(page);
+			break;
+		}
+		this_len = PAGE_CACHE_SIZE - offset;
+		if (this_len > len)
+			this_len = len;
+		if (pos + this_len > isize)
+			this_len = isize - pos;
+		mark_page_accessed(page);
+
+		buf = info->bufs + ((info->curbuf + info->nrbufs) & (info->buffers-1));
+		buf->page = page;
+		buf->offset = offset;
+		buf->len = this_len;
+		buf->ops = &page_cache_pipe_buf_ops;
+		info->nrbufs++;
+		do_wakeup = 1;
+
+		pos += this_len;
+		len -= this_len;
+		ret += this_len;
+	}
+	up(PIPE_SEM(*pipe));
+
+	if (do_wakeup)
+		wakeup_pipe_readers(pipe);
+	if (ret > 0) {
+		*ppos = pos;
+		file_accessed(in);
+	}
+	return ret;
+}
+
+EXPORT_SYMBOL(generic_file_splice_read);
+
+/*
+ * Drain up to len bytes from the pipe, feeding each buffer to actor.
+ */
+static ssize_t splice_from_pipe(struct inode *pipe, struct file *out,
+				loff_t *ppos, size_t len, unsigned int flags,
+				splice_actor *actor)
+{
+	struct pipe_inode_info *info;
+	ssize_t ret = 0;
+	int do_wakeup = 0;
+
+	down(PIPE_SEM(*pipe));
+	info = pipe->i_pipe;
+	for (;;) {
+		if (info->nrbufs) {
+			struct pipe_buffer *buf = info->bufs + info->curbuf;
+			struct pipe_buf_operations *ops = buf->ops;
+			size_t this_len = buf->len;
+			int more, err;
+
+			if (this_len > len)
+				this_len = len;
+			more = (flags & SPLICE_F_MORE) || this_len < len;
+
+			err = actor(info, buf, out, ppos, this_len, more);
+			if (err <= 0) {
+				if (!ret)
+					ret = err ? err : -EIO;
+				break;
+			}
+
+			ret += err;
+			buf->offset += err;
+			buf->len -= err;
+			if (!buf->len) {
+				buf->ops = NULL;
+				ops->release(info, buf);
+				info->curbuf = (info->curbuf + 1) & (info->buffers-1);
+				info->nrbufs--;
+				do_wakeup = 1;
+			}
+			len -= err;
+			if (!len)
+				break;
+			if (info->nrbufs)
+				continue;
+		}
+		if (!PIPE_WRITERS(*pipe))
+			break;
+		if (!PIPE_WAITING_WRITERS(*pipe)) {
+			if (ret)
+				break;
+			if (flags & SPLICE_F_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+		}
+		if (signal_pending(current)) {
+			if (!ret)
+				ret = -ERESTARTSYS;
+			break;
+		}
+		if (do_wakeup) {
+			wake_up_interruptible_sync(PIPE_WAIT(*pipe));
+			kill_fasync(PIPE_FASYNC_WRITERS(*pipe), SIGIO, POLL_OUT);
+			do_wakeup = 0;
+		}
+		pipe_wait(pipe);
+	}
+	up(PIPE_SEM(*pipe));
+
+	if (do_wakeup)
+		wakeup_pipe_writers(pipe);
+	return ret;
+}
+
+/*
+ * Copy one pipe buffer into the page cache of out at *ppos.
+ */
+static int pipe_to_file(struct pipe_inode_info *info, struct pipe_buffer *buf,
+			struct file *out, loff_t *ppos, size_t len, int more)
+{
+	struct address_space *mapping = out->f_mapping;
+	struct address_space_operations *a_ops = mapping->a_ops;
+	loff_t pos = *ppos;
+	unsigned long index = pos >> PAGE_CACHE_SHIFT;
+	unsigned int offset = pos & ~PAGE_CACHE_MASK;
+	struct page *page;
+	char *src, *dst;
+	int ret;
+
+	if (len > PAGE_CACHE_SIZE - offset)
+		len = PAGE_CACHE_SIZE - offset;
+
+	page = grab_cache_page(mapping, index);
+	if (!page)
+		return -ENOMEM;
+
+	ret = a_ops->prepare_write(out, page, offset, offset + len);
+	if (unlikely(ret))
+		goto out;
+
+	src = buf->ops->map(out, info, buf);
+	dst = kmap_atomic(page, KM_USER0);
+	memcpy(dst + offset, src + buf->offset, len);
+	flush_dcache_page(page);
+	kunmap_atomic(dst, KM_USER0);
+	buf->ops->unmap(info, buf);
+
+	ret = a_ops->commit_write(out, page, offset, offset + len);
+	if (likely(!ret)) {
+		*ppos = pos + len;
+		ret = len;
+	}
+	mark_page_accessed(page);
+out:
+	unlock_page(page);
+	page_cache_release(page);
+	if (ret > 0)
+		balance_dirty_pages_ratelimited(mapping);
+	return ret;
+}
+
+/**
+ * generic_file_splice_write - write pipe buffers into a file
+ * @pipe:	inode of the pipe to drain
+ * @out:	file to write to
+ * @ppos:	position in @out
+ * @len:	number of bytes to move
+ * @flags:	SPLICE_F_* flags
+ */
+ssize_t generic_file_splice_write(struct inode *pipe, struct file *out,
+				  loff_t *ppos, size_t len, unsigned int flags)
+{
+	struct address_space *mapping = out->f_mapping;
+	struct inode *inode = mapping->host;
+	size_t count = len;
+	ssize_t ret;
+	int err;
+
+	if (!mapping->a_ops->prepare_write)
+		return -EINVAL;
+
+	down(&inode->i_sem);
+	err = generic_write_checks(out, ppos, &count, S_ISBLK(inode->i_mode));
+	if (err || !count) {
+		up(&inode->i_sem);
+		return err;
+	}
+	err = remove_suid(out->f_dentry);
+	if (err) {
+		up(&inode->i_sem);
+		return err;
+	}
+	inode_update_time(inode, 1);
+
+	current->backing_dev_info = mapping->backing_dev_info;
+	ret = splice_from_pipe(pipe, out, ppos, count, flags, pipe_to_file);
+	current->backing_dev_info = NULL;
+	up(&inode->i_sem);
+
+	if (ret > 0 && ((out->f_flags & O_SYNC) || IS_SYNC(inode))) {
+		err = generic_osync_inode(inode, mapping,
+					  OSYNC_METADATA|OSYNC_DATA);
+		if (err)
+			ret = err;
+	}
+	return ret;
+}
+
+EXPORT_SYMBOL(generic_file_splice_write);
+
+static int pipe_to_sendpage(struct pipe_inode_info *info,
+			    struct pipe_buffer *buf, struct file *out,
+			    loff_t *ppos, size_t len, int more)
+{
+	return out->f_op->sendpage(out, buf->page, buf->offset, len,
+				   ppos, more);
+}
+
+/**
+ * generic_splice_sendpage - hand pipe buffers to a socket
+ * @pipe:	inode of the pipe to drain
+ * @out:	socket file
+ * @ppos:	position (unused by sockets)
+ * @len:	number of bytes to move
+ * @flags:	SPLICE_F_* flags
+ *
+ * The pages go to ->sendpage() by reference, the same way sendfile()
+ * feeds them from the page cache.
+ */
+ssize_t generic_splice_sendpage(struct inode *pipe, struct file *out,
+				loff_t *ppos, size_t len, unsigned int flags)
+{
+	if (!out->f_op->sendpage)
+		return -EINVAL;
+	return splice_from_pipe(pipe, out, ppos, len, flags, pipe_to_sendpage);
+}
+
+EXPORT_SYMBOL(generic_splice_sendpage);
+
+static long do_splice_from(struct inode *pipe, struct file *out,
+			   loff_t *ppos, size_t len, unsigned int flags)
+{
+	long ret;
+
+	if (!out->f_op || !out->f_op->splice_write)
+		return -EINVAL;
+	if (!(out->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	ret = rw_verify_area(WRITE, out, ppos, len);
+	if (unlikely(ret < 0))
+		return ret;
+	ret = security_file_permission(out, MAY_WRITE);
+	if (unlikely(ret < 0))
+		return ret;
+
+	return out->f_op->splice_write(pipe, out, ppos, len, flags);
+}
+
+static long do_splice_to(struct file *in, loff_t *ppos, struct inode *pipe,
+			 size_t len, unsigned int flags)
+{
+	long ret;
+
+	if (!in->f_op || !in->f_op->splice_read)
+		return -EINVAL;
+	if (!(in->f_mode & FMODE_READ))
+		return -EBADF;
+
+	ret = rw_verify_area(READ, in, ppos, len);
+	if (unlikely(ret < 0))
+		return ret;
+	ret = security_file_permission(in, MAY_READ);
+	if (unlikely(ret < 0))
+		return ret;
+
+	return in->f_op->splice_read(in, ppos, pipe, len, flags);
+}
+
+/*
+ * One side must be a pipe, and only the other side may carry an offset.
+ */
+static long do_splice(struct file *in, loff_t __user *off_in,
+		      struct file *out, loff_t __user *off_out,
+		      size_t len, unsigned int flags)
+{
+	struct inode *ipipe = in->f_dentry->d_inode;
+	struct inode *opipe = out->f_dentry->d_inode;
+	loff_t offset, *ppos;
+	long ret;
+
+	if (pipe_inode(ipipe)) {
+		if (off_in)
+			return -ESPIPE;
+		ppos = &out->f_pos;
+		if (off_out) {
+			if (out->f_op->llseek == no_llseek)
+				return -EINVAL;
+			if (copy_from_user(&offset, off_out, sizeof(loff_t)))
+				return -EFAULT;
+			ppos = &offset;
+		}
+
+		ret = do_splice_from(ipipe, out, ppos, len, flags);
+		if (off_out && copy_to_user(off_out, ppos, sizeof(loff_t)))
+			ret = -EFAULT;
+		return ret;
+	}
+
+	if (pipe_inode(opipe)) {
+		if (off_out)
+			return -ESPIPE;
+		ppos = &in->f_pos;
+		if (off_in) {
+			if (in->f_op->llseek == no_llseek)
+				return -EINVAL;
+			if (copy_from_user(&offset, off_in, sizeof(loff_t)))
+				return -EFAULT;
+			ppos = &offset;
+		}
+
+		ret = do_splice_to(in, ppos, opipe, len, flags);
+		if (off_in && copy_to_user(off_in, ppos, sizeof(loff_t)))
+			ret = -EFAULT;
+		return ret;
+	}
+
+	return -EINVAL;
+}
+
+asmlinkage long sys_splice(int fd_in, loff_t __user *off_in,
+			   int fd_out, loff_t __user *off_out,
+			   size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	int fput_in, fput_out;
+	long error;
+
+	if (unlikely(!len))
+		return 0;
+
+	error = -EBADF;
+	in = fget_light(fd_in, &fput_in);
+	if (in) {
+		out = fget_light(fd_out, &fput_out);
+		if (out) {
+			error = do_splice(in, off_in, out, off_out, len, flags);
+			fput_light(out, fput_out);
+		}
+		fput_light(in, fput_in);
+	}
+	return error;
+}
+
+/*
+ * Wait until the input pipe of a tee() has something to duplicate.
+ */
+static int link_ipipe_prep(struct inode *pipe, unsigned int flags)
+{
+	int ret = 0;
+
+	/* Unlocked peek: link_pipe() checks again under the semaphore */
+	if (pipe->i_pipe->nrbufs)
+		return 0;
+
+	down(PIPE_SEM(*pipe));
+	while (!pipe->i_pipe->nrbufs) {
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		if (!PIPE_WRITERS(*pipe))
+			break;
+		if (!PIPE_WAITING_WRITERS(*pipe)) {
+			if (flags & SPLICE_F_NONBLOCK) {
+				ret = -EAGAIN;
+				break;
+			}
+		}
+		pipe_wait(pipe);
+	}
+	up(PIPE_SEM(*pipe));
+	return ret;
+}
+
+/*
+ * Wait until the output pipe of a tee() has a free buffer slot.
+ */
+static int link_opipe_prep(struct inode *pipe, unsigned int flags)
+{
+	int ret = 0;
+
+	if (pipe->i_pipe->nrbufs < pipe->i_pipe->buffers)
+		return 0;
+
+	down(PIPE_SEM(*pipe));
+	while (pipe->i_pipe->nrbufs >= pipe->i_pipe->buffers) {
+		if (!PIPE_READERS(*pipe)) {
+			send_sig(SIGPIPE, current, 0);
+			ret = -EPIPE;
+			break;
+		}
+		if (flags & SPLICE_F_NONBLOCK) {
+			ret = -EAGAIN;
+			break;
+		}
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		PIPE_WAITING_WRITERS(*pipe)++;
+		pipe_wait(pipe);
+		PIPE_WAITING_WRITERS(*pipe)--;
+	}
+	up(PIPE_SEM(*pipe));
+	return ret;
+}
+
+/*
+ * Duplicate up to len bytes worth of buffers from ipipe into opipe
+ * without consuming them. Both semaphores are taken in address order.
+ */
+static long link_pipe(struct inode *ipipe, struct inode *opipe,
+		      size_t len, unsigned int flags)
+{
+	struct pipe_inode_info *ipi, *opi;
+	long ret = 0;
+	int i = 0;
+
+	if (ipipe < opipe) {
+		down(PIPE_SEM(*ipipe));
+		down(PIPE_SEM(*opipe));
+	} else {
+		down(PIPE_SEM(*opipe));
+		down(PIPE_SEM(*ipipe));
+	}
+	ipi = ipipe->i_pipe;
+	opi = opipe->i_pipe;
+
+	do {
+		struct pipe_buffer *ibuf, *obuf;
+
+		if (!PIPE_READERS(*opipe)) {
+			send_sig(SIGPIPE, current, 0);
+			if (!ret)
+				ret = -EPIPE;
+			break;
+		}
+		if (i >= ipi->nrbufs || opi->nrbufs >= opi->buffers)
+			break;
+
+		ibuf = ipi->bufs + ((ipi->curbuf + i) & (ipi->buffers-1));
+		obuf = opi->bufs + ((opi->curbuf + opi->nrbufs) & (opi->buffers-1));
+
+		ibuf->ops->get(ipi, ibuf);
+		*obuf = *ibuf;
+		if (obuf->len > len)
+			obuf->len = len;
+		opi->nrbufs++;
+
+		ret += obuf->len;
+		len -= obuf->len;
+		i++;
+	} while (len);
+
+	up(PIPE_SEM(*ipipe));
+	up(PIPE_SEM(*opipe));
+
+	if (ret > 0)
+		wakeup_pipe_readers(opipe);
+	return ret;
+}
+
+static long do_tee(struct file *in, struct file *out, size_t len,
+		   unsigned int flags)
+{
+	struct inode *ipipe = in->f_dentry->d_inode;
+	struct inode *opipe = out->f_dentry->d_inode;
+	long ret;
+
+	if (!pipe_inode(ipipe) || !pipe_inode(opipe) || ipipe == opipe)
+		return -EINVAL;
+	if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	ret = link_ipipe_prep(ipipe, flags);
+	if (!ret) {
+		ret = link_opipe_prep(opipe, flags);
+		if (!ret)
+			ret = link_pipe(ipipe, opipe, len, flags);
+	}
+	return ret;
+}
+
+asmlinkage long sys_tee(int fdin, int fdout, size_t len, unsigned int flags)
+{
+	struct file *in, *out;
+	int fput_in, fput_out;
+	long error;
+
+	if (unlikely(!len))
+		return 0;
+
+	error = -EBADF;
+	in = fget_light(fdin, &fput_in);
+	if (in) {
+		out = fget_light(fdout, &fput_out);
+		if (out) {
+			error = do_tee(in, out, len, flags);
+			fput_light(out, fput_out);
+		}
+		fput_light(in, fput_in);
+	}
+	return error;
+}
@@ -294,7 +294,12 @@
 #define __NR_ia32_add_key		286
 #define __NR_ia32_request_key	287
 #define __NR_ia32_keyctl		288
+#define __NR_ia32_splice		289
+#define __NR_ia32_tee		290
+#define __NR_ia32_sync_file_range	291
+#define __NR_ia32_ioprio_set		292
+#define __NR_ia32_ioprio_get		293
 
-#define IA32_NR_syscalls 290	/* must be > than biggest syscall! */
+#define IA32_NR_syscalls 294	/* must be > than biggest syscall! */
 
 #endif /* _ASM_X86_64_IA32_UNISTD_H_ */
@@ -563,8 +563,18 @@ __SYSCALL(__NR_add_key, sys_add_key)
 __SYSCALL(__NR_request_key, sys_request_key)
 #define __NR_keyctl		250
 __SYSCALL(__NR_keyctl, sys_keyctl)
-
-#define __NR_syscall_max __NR_keyctl
+#define __NR_splice		251
+__SYSCALL(__NR_splice, sys_splice)
+#define __NR_tee		252
+__SYSCALL(__NR_tee, sys_tee)
+#define __NR_sync_file_range	253
+__SYSCALL(__NR_sync_file_range, sys_sync_file_range)
+#define __NR_ioprio_set		254
+__SYSCALL(__NR_ioprio_set, sys_ioprio_set)
+#define __NR_ioprio_get		255
+__SYSCALL(__NR_ioprio_get, sys_ioprio_get)
+
+#define __NR_syscall_max __NR_ioprio_get
 #ifndef __NO_STUBS
 
 /* user-visible error numbers are in the range -1 - -4095 */
@@ -27,6 +27,18 @@ enum bdi_state {
 
 typedef int (congested_fn)(void *, int);
 
+struct bdi_writeback;
+
+/*
+ * Per-device page counts, kept next to the global nr_dirty/nr_unstable
+ * and nr_writeback page states.
+ */
+enum bdi_stat_item {
+	BDI_RECLAIMABLE,	/* dirty and unstable pages */
+	BDI_WRITEBACK,		/* pages under writeback */
+	NR_BDI_STAT_ITEMS
+};
+
 /**
  * 
  */
@@ -38,11 +50,61 @@ struct backing_dev_info {
 	void *congested_data;	/* Pointer to aux data for congested func */
 	void (*unplug_io_fn)(struct backing_dev_info *, struct page *);
 	void *unplug_io_data;
+
+	/**
+	 * ֶζΪ0ʼ̬backing_dev_infoĳʼ
+	 * ڸ豸ҳ(NFSȶҳ)ͻдҳ
+	 */
+	atomic_t stat[NR_BDI_STAT_ITEMS];
+	/**
+	 * ɻдҳȫ˥ҳ޶
+	 */
+	atomic_t completions;
+	unsigned long completions_period;
+	/**
+	 * д豸Ľ̳ҳ޶
+	 */
+	int dirty_exceeded;
+	/**
+	 * 豸רõĻд̣߳bdi_register
+	 * ΪNULLʱ豸ҳpdflush̳߳ػд
+	 */
+	struct bdi_writeback *wb;
 };
 
 extern struct backing_dev_info default_backing_dev_info;
 void default_unplug_io_fn(struct backing_dev_info *bdi, struct page *page);
 
+static inline void add_bdi_stat(struct backing_dev_info *bdi,
+				enum bdi_stat_item item, int nr)
+{
+	atomic_add(nr, &bdi->stat[item]);
+}
+
+static inline void inc_bdi_stat(struct backing_dev_info *bdi,
+				enum bdi_stat_item item)
+{
+	atomic_inc(&bdi->stat[item]);
+}
+
+static inline void dec_bdi_stat(struct backing_dev_info *bdi,
+				enum bdi_stat_item item)
+{
+	atomic_dec(&bdi->stat[item]);
+}
+
+static inline long bdi_stat(struct backing_dev_info *bdi,
+			    enum bdi_stat_item item)
+{
+	long nr = atomic_read(&bdi->stat[item]);
+
+	return nr < 0 ? 0 : nr;
+}
+
+int bdi_register(struct backing_dev_info *bdi, const char *name);
+void bdi_unregister(struct backing_dev_info *bdi);
+int bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages);
+
 int writeback_acquire(struct backing_dev_info *bdi);
 int writeback_in_progress(struct backing_dev_info *bdi);
 void writeback_release(struct backing_dev_info *bdi);
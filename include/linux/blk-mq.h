@@ -0,0 +1,102 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+
+/*
+ * Multi-queue block layer: bios become requests on a per-cpu software
+ * queue and go to one of the driver's hardware queues without a shared
+ * queue_lock.  There is no io scheduler.  See drivers/block/blk-mq.c and
+ * Documentation/block/blk-mq.txt.
+ */
+
+#define BLK_MQ_MAX_DEPTH	256	/* tags per hardware queue */
+
+/*
+ * Lockless tag map: a tag is a bit set with test_and_set_bit(), each cpu
+ * searching from where it last succeeded.
+ */
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned long		*map;		/* tags in use */
+	wait_queue_head_t	wait;		/* for a free tag */
+};
+
+/*
+ * Software queue, one per cpu
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;	/* waiting for dispatch */
+	unsigned int		cpu;
+	unsigned int		last_tag;	/* tag search hint */
+	struct blk_mq_hw_ctx	*hctx;		/* where rq_list goes */
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Hardware dispatch queue
+ */
+struct blk_mq_hw_ctx {
+	spinlock_t		lock;		/* protects dispatch */
+	struct list_head	dispatch;	/* turned away by the driver */
+	unsigned long		state;		/* BLK_MQ_S_* */
+
+	struct blk_mq_ctx	**ctxs;		/* software queues feeding us */
+	unsigned int		nr_ctx;
+
+	struct blk_mq_tags	tags;
+	struct request		*rqs;		/* one request per tag */
+
+	request_queue_t		*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+
+	struct work_struct	run_work;	/* blk_mq_run_hw_queue(, 1) */
+} ____cacheline_aligned_in_smp;
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(request_queue_t *, const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+
+struct blk_mq_ops {
+	/*
+	 * Start a request on the hardware; returns BLK_MQ_RQ_QUEUE_*.  May
+	 * run on several cpus at once, also for the same hardware queue.
+	 */
+	queue_rq_fn		*queue_rq;
+	/* Hardware queue for a cpu; NULL spreads the cpus evenly */
+	map_queue_fn		*map_queue;
+	/* Set up hctx->driver_data; may be NULL */
+	init_hctx_fn		*init_hctx;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* at most BLK_MQ_MAX_DEPTH */
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* request taken */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* keep it, stop the queue */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end it with -EIO */
+
+	BLK_MQ_S_STOPPED	= 0,	/* hctx->state: don't dispatch */
+};
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ((hctx) = (q)->queue_hw_ctx[i]); (i)++)
+
+extern request_queue_t *blk_mq_init_queue(struct blk_mq_reg *, void *);
+extern void blk_mq_free_queue(request_queue_t *);
+extern struct blk_mq_hw_ctx *blk_mq_map_queue(request_queue_t *, const int);
+extern void blk_mq_end_io(struct request *, int);
+extern void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, int);
+extern void blk_mq_run_queues(request_queue_t *, int);
+extern void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+extern void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *);
+
+#endif
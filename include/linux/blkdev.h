@@ -25,6 +25,9 @@ struct elevator_queue;
  */
 typedef struct elevator_queue elevator_t;
 struct request_pm_state;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -137,6 +140,7 @@ struct request {
 	struct list_head queuelist; /* looking for ->queue? you must _not_
 				     * access it directly, use
 				     * blkdev_dequeue_request! */
+	struct list_head donelist;	/* see blk_complete_request() */
 	/**
 	 * ־
 	 */
@@ -206,6 +210,9 @@ struct request {
 	 * ʼʱ䡣
 	 */
 	unsigned long start_time;
+	/* sched_clock() at creation and at issue, for the latency histograms */
+	unsigned long long start_ns, issue_ns;
+	int partno;		/* partition holding the first sector, or 0 */
 
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -229,6 +236,7 @@ struct request {
 	 * ر
 	 */
 	int tag;
+	struct blk_mq_ctx *mq_ctx;	/* software queue, multi-queue mode */
 	/**
 	 * ҪҪݵĻָ롣ָںַУҪֱʹá
 	 * ڵǰbioеbio_dataĽ
@@ -253,6 +261,9 @@ struct request {
 	 * ȴݴֹɱ
 	 */
 	struct completion *waiting;
+	/* completion callback and data of a REQ_CLONE request */
+	void (*end_io)(struct request *);
+	void *end_io_data;
 	/**
 	 * Ӳʹõݵָ롣
 	 */
@@ -334,6 +345,7 @@ enum rq_flag_bits {
 	__REQ_PM_SHUTDOWN,	/* shutdown request */
 	__REQ_BAR_PREFLUSH,	/* barrier pre-flush done */
 	__REQ_BAR_POSTFLUSH,	/* barrier post-flush */
+	__REQ_CLONE,		/* clone of another request, see end_io */
 	__REQ_NR_BITS,		/* stops here */
 };
 
@@ -433,6 +445,11 @@ enum rq_flag_bits {
  * һҪ͸̿"ˢ¶"
  */
 #define REQ_BAR_POSTFLUSH	(1 << __REQ_BAR_POSTFLUSH)
+/*
+ * Request is embedded in its owner (request based dm) rather than taken
+ * from q->rq, and end_that_request_last() hands it back through end_io.
+ */
+#define REQ_CLONE	(1 << __REQ_CLONE)
 
 /*
  * State information carried for REQ_PM_SUSPEND and REQ_PM_RESUME
@@ -468,6 +485,7 @@ struct bio_vec;
 typedef int (merge_bvec_fn) (request_queue_t *, struct bio *, struct bio_vec *);
 typedef void (activity_fn) (void *data, int rw);
 typedef int (issue_flush_fn) (request_queue_t *, struct gendisk *, sector_t *);
+typedef void (softirq_done_fn)(struct request *);
 
 enum blk_queue_state {
 	Queue_down,
@@ -556,6 +574,11 @@ struct request_queue
 	 * ˢеķͨ󽫶ա
 	 */
 	issue_flush_fn		*issue_flush_fn;
+	/*
+	 * Completion of requests handed to blk_complete_request(), run
+	 * from the block softirq.
+	 */
+	softirq_done_fn		*softirq_done_fn;
 
 	/*
 	 * Auto-unplugging state
@@ -688,6 +711,14 @@ struct request_queue
 	 */
 	struct blk_queue_tag	*queue_tags;
 
+	/*
+	 * Multi-queue mode, see drivers/block/blk-mq.c
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx	*queue_ctx;	/* per-cpu software queues */
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
 	/**
 	 * еü
 	 */
@@ -714,6 +745,10 @@ struct request_queue
 	 * ʱʱͷֱIOԳ򱻶̬ȡ
 	 */
 	struct list_head	drain_list;
+
+#ifdef CONFIG_BLK_DEV_IO_TRACE
+	struct blk_trace	*blk_trace;
+#endif
 };
 
 #define RQ_INACTIVE		(-1)
@@ -879,6 +914,23 @@ extern struct request *blk_rq_map_user(request_queue_t *, int, void __user *, un
 extern int blk_rq_unmap_user(struct request *, struct bio *, unsigned int);
 extern int blk_execute_rq(request_queue_t *, struct gendisk *, struct request *);
 
+/*
+ * Per-task plugging.  Requests a task builds between blk_start_plug()
+ * and blk_finish_plug() stay on its plug, where further bios merge into
+ * them without queue_lock, and go to their queues in one locked batch
+ * per queue when the plug is finished, fills up or the task sleeps.
+ */
+struct blk_plug {
+	struct list_head list;		/* requests, via ->queuelist */
+	unsigned int count;
+};
+#define BLK_MAX_PLUG_REQUESTS	16
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug(struct task_struct *);
+extern void blk_schedule_flush_plug(struct task_struct *);
+
 static inline request_queue_t *bdev_get_queue(struct block_device *bdev)
 {
 	return bdev->bd_disk->queue;
@@ -910,6 +962,7 @@ extern int end_that_request_first(struct request *, int, int);
 extern int end_that_request_chunk(struct request *, int, int);
 extern void end_that_request_last(struct request *);
 extern void end_request(struct request *req, int uptodate);
+extern void blk_complete_request(struct request *);
 
 /*
  * end_that_request_first/chunk() takes an uptodate argument. we account
@@ -928,7 +981,7 @@ static inline void blkdev_dequeue_request(struct request *req)
 
 	list_del_init(&req->queuelist);
 
-	if (req->rl)
+	if (req->rl || (req->flags & REQ_CLONE))
 		elv_remove_request(req->q, req);
 }
 
@@ -936,6 +989,7 @@ static inline void blkdev_dequeue_request(struct request *req)
  * Access functions for manipulating queue properties
  */
 extern request_queue_t *blk_init_queue(request_fn_proc *, spinlock_t *);
+extern int blk_init_allocated_queue(request_queue_t *, request_fn_proc *, spinlock_t *);
 extern void blk_cleanup_queue(request_queue_t *);
 extern void blk_queue_make_request(request_queue_t *, make_request_fn *);
 extern void blk_queue_bounce_limit(request_queue_t *, u64);
@@ -952,6 +1006,7 @@ extern void blk_queue_dma_alignment(request_queue_t *, int);
 extern struct backing_dev_info *blk_get_backing_dev_info(struct block_device *bdev);
 extern void blk_queue_ordered(request_queue_t *, int);
 extern void blk_queue_issue_flush_fn(request_queue_t *, issue_flush_fn *);
+extern void blk_queue_softirq_done(request_queue_t *, softirq_done_fn *);
 extern int blkdev_scsi_issue_flush_fn(request_queue_t *, struct gendisk *, sector_t *);
 
 extern int blk_rq_map_sg(request_queue_t *, struct request *, struct scatterlist *);
@@ -982,6 +1037,7 @@ extern void blk_queue_invalidate_tags(request_queue_t *);
 extern long blk_congestion_wait(int rw, long timeout);
 
 extern void blk_rq_bio_prep(request_queue_t *, struct request *, struct bio *);
+extern int blk_insert_cloned_request(request_queue_t *, struct request *);
 extern int blkdev_issue_flush(struct block_device *, sector_t *);
 
 #define MAX_PHYS_SEGMENTS 128
@@ -993,6 +1049,9 @@ extern int blkdev_issue_flush(struct block_device *, sector_t *);
 #define blkdev_entry_to_request(entry) list_entry((entry), struct request, queuelist)
 
 extern void drive_stat_acct(struct request *, int, int);
+extern void blk_rq_init_latency(struct request *);
+extern void blk_account_latency(struct request *);
+extern unsigned long long blk_rq_age_ns(struct request *);
 
 static inline int queue_hardsect_size(request_queue_t *q)
 {
@@ -0,0 +1,153 @@
+#ifndef _LINUX_BLKTRACE_H
+#define _LINUX_BLKTRACE_H
+
+#include <linux/types.h>
+
+/*
+ * Block I/O tracing: per-queue records of the life of each request,
+ * collected in per-CPU buffers and read from debugfs.  See
+ * Documentation/block/blktrace.txt.
+ */
+
+/*
+ * Trace categories, selectable through blk_user_trace_setup.act_mask
+ */
+enum blktrace_cat {
+	BLK_TC_READ	= 1 << 0,	/* reads */
+	BLK_TC_WRITE	= 1 << 1,	/* writes */
+	BLK_TC_BARRIER	= 1 << 2,	/* barrier */
+	BLK_TC_SYNC	= 1 << 3,	/* sync */
+	BLK_TC_QUEUE	= 1 << 4,	/* queueing and merging */
+	BLK_TC_REQUEUE	= 1 << 5,	/* requeueing */
+	BLK_TC_ISSUE	= 1 << 6,	/* issue to the driver */
+	BLK_TC_COMPLETE	= 1 << 7,	/* completion */
+	BLK_TC_INSERT	= 1 << 8,	/* insertion into the scheduler */
+	BLK_TC_PLUG	= 1 << 9,	/* plug, unplug, wait for request */
+
+	BLK_TC_END	= 1 << 15,
+};
+
+#define BLK_TC_SHIFT		(16)
+#define BLK_TC_ACT(act)		((act) << BLK_TC_SHIFT)
+
+/*
+ * Basic trace actions
+ */
+enum blktrace_act {
+	__BLK_TA_QUEUE = 1,		/* bio entered __make_request */
+	__BLK_TA_BACKMERGE,		/* bio merged at the back of a request */
+	__BLK_TA_FRONTMERGE,		/* bio merged at the front of a request */
+	__BLK_TA_SLEEPRQ,		/* waiting for a free request */
+	__BLK_TA_INSERT,		/* request handed to the io scheduler */
+	__BLK_TA_ISSUE,			/* request handed to the driver */
+	__BLK_TA_REQUEUE,		/* request given back by the driver */
+	__BLK_TA_COMPLETE,		/* (part of) request completed */
+	__BLK_TA_PLUG,			/* queue was plugged */
+	__BLK_TA_UNPLUG,		/* queue was unplugged */
+};
+
+/*
+ * Trace actions in full, category bits included
+ */
+#define BLK_TA_QUEUE		(__BLK_TA_QUEUE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_BACKMERGE	(__BLK_TA_BACKMERGE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_FRONTMERGE	(__BLK_TA_FRONTMERGE | BLK_TC_ACT(BLK_TC_QUEUE))
+#define BLK_TA_SLEEPRQ		(__BLK_TA_SLEEPRQ | BLK_TC_ACT(BLK_TC_PLUG))
+#define BLK_TA_INSERT		(__BLK_TA_INSERT | BLK_TC_ACT(BLK_TC_INSERT))
+#define BLK_TA_ISSUE		(__BLK_TA_ISSUE | BLK_TC_ACT(BLK_TC_ISSUE))
+#define BLK_TA_REQUEUE		(__BLK_TA_REQUEUE | BLK_TC_ACT(BLK_TC_REQUEUE))
+#define BLK_TA_COMPLETE		(__BLK_TA_COMPLETE | BLK_TC_ACT(BLK_TC_COMPLETE))
+#define BLK_TA_PLUG		(__BLK_TA_PLUG | BLK_TC_ACT(BLK_TC_PLUG))
+#define BLK_TA_UNPLUG		(__BLK_TA_UNPLUG | BLK_TC_ACT(BLK_TC_PLUG))
+
+#define BLK_IO_TRACE_MAGIC	0x65617400
+#define BLK_IO_TRACE_VERSION	0x01
+
+/*
+ * One trace record, as read from debugfs block/<dev>/trace<cpu>
+ */
+struct blk_io_trace {
+	__u32 magic;		/* BLK_IO_TRACE_MAGIC | version */
+	__u32 sequence;		/* per-CPU event number, gaps mean drops */
+	__u64 time;		/* sched_clock() in ns */
+	__u64 sector;		/* first sector */
+	__u32 bytes;		/* transfer length */
+	__u32 action;		/* what happened, BLK_TA_* | category bits */
+	__u32 pid;		/* who did it */
+	__u32 device;		/* traced device, kernel dev_t layout */
+	__u16 cpu;		/* on which cpu did it happen */
+	__u16 error;		/* completion error, positive errno */
+	__u32 pad;
+};
+
+/*
+ * User setup structure passed with BLKTRACESETUP
+ */
+struct blk_user_trace_setup {
+	char name[32];			/* output: directory under block/ */
+	__u16 act_mask;			/* input: categories to trace, 0 all */
+	__u32 buf_size;			/* input: bytes per sub-buffer */
+	__u32 buf_nr;			/* input: sub-buffers per CPU */
+	__u64 start_lba;		/* input: only trace this range */
+	__u64 end_lba;
+	__u32 pid;			/* input: only queue events of pid */
+};
+
+#ifdef __KERNEL__
+#include <linux/blkdev.h>
+
+#ifdef CONFIG_BLK_DEV_IO_TRACE
+extern int blk_trace_ioctl(struct block_device *, unsigned, char __user *);
+extern void blk_trace_shutdown(request_queue_t *);
+extern void __blk_add_trace(request_queue_t *, sector_t, int, int, u32, int);
+
+/**
+ * blk_add_trace - record one block layer event
+ * @q:		queue the event happened on
+ * @sector:	first sector of the I/O
+ * @bytes:	its length
+ * @rw:		bio style direction and flags
+ * @what:	BLK_TA_* action
+ * @error:	completion error or 0
+ *
+ * Costs one test of q->blk_trace when the queue is not being traced.
+ */
+static inline void blk_add_trace(request_queue_t *q, sector_t sector,
+				 int bytes, int rw, u32 what, int error)
+{
+	if (unlikely(q->blk_trace))
+		__blk_add_trace(q, sector, bytes, rw, what, error);
+}
+
+static inline void blk_add_trace_bio(request_queue_t *q, struct bio *bio,
+				     u32 what)
+{
+	blk_add_trace(q, bio->bi_sector, bio->bi_size, bio->bi_rw, what, 0);
+}
+
+static inline void blk_add_trace_rq(request_queue_t *q, struct request *rq,
+				    u32 what)
+{
+	int rw = rq_data_dir(rq);
+
+	if (rq->flags & REQ_HARDBARRIER)
+		rw |= 1 << BIO_RW_BARRIER;
+	blk_add_trace(q, rq->hard_sector, rq->hard_nr_sectors << 9, rw,
+		      what, 0);
+}
+
+static inline void blk_add_trace_generic(request_queue_t *q, u32 what)
+{
+	blk_add_trace(q, 0, 0, 0, what, 0);
+}
+#else
+#define blk_trace_ioctl(bdev, cmd, arg)		(-ENOTTY)
+#define blk_trace_shutdown(q)			do { } while (0)
+#define blk_add_trace(q, s, b, rw, what, e)	do { } while (0)
+#define blk_add_trace_bio(q, bio, what)		do { } while (0)
+#define blk_add_trace_rq(q, rq, what)		do { } while (0)
+#define blk_add_trace_generic(q, what)		do { } while (0)
+#endif /* CONFIG_BLK_DEV_IO_TRACE */
+#endif /* __KERNEL__ */
+
+#endif
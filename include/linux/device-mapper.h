@@ -11,6 +11,7 @@
 struct dm_target;
 struct dm_table;
 struct dm_dev;
+struct request;
 
 typedef enum { STATUSTYPE_INFO, STATUSTYPE_TABLE } status_type_t;
 
@@ -52,6 +53,36 @@ typedef int (*dm_endio_fn) (struct dm_target *ti,
 			    struct bio *bio, int error,
 			    union map_info *map_context);
 
+/*
+ * Request based targets (see dm_table_request_based()) get whole
+ * requests merged by the io scheduler of the mapped device instead of
+ * bios.  The clone shares the bios of the original; map_rq must point
+ * clone->q and clone->rq_disk at the queue and disk it should go to.
+ * It returns:
+ * < 0: error
+ * = 0: no way to issue it now, requeue the original and retry later
+ * > 0: remapped, the core inserts the clone into clone->q
+ */
+typedef int (*dm_map_request_fn) (struct dm_target *ti, struct request *clone,
+				  union map_info *map_context);
+
+/*
+ * Called from softirq context when a clone from map_rq has completed.
+ * Returns:
+ * 0   : the original is completed with @error
+ * 1   : requeue the original and map it again
+ */
+typedef int (*dm_request_endio_fn) (struct dm_target *ti,
+				    struct request *clone, int error,
+				    union map_info *map_context);
+
+/*
+ * Returns non-zero when the target could not take another request
+ * right now; requests are then left in the io scheduler to grow by
+ * merging.  Called with the queue lock of the mapped device held.
+ */
+typedef int (*dm_busy_fn) (struct dm_target *ti);
+
 typedef void (*dm_presuspend_fn) (struct dm_target *ti);
 typedef void (*dm_postsuspend_fn) (struct dm_target *ti);
 typedef void (*dm_resume_fn) (struct dm_target *ti);
@@ -90,6 +121,10 @@ struct target_type {
 	dm_map_fn map;
 	/* ɻص */
 	dm_endio_fn end_io;
+	/* request based targets: map, completion and queue depth hooks */
+	dm_map_request_fn map_rq;
+	dm_request_endio_fn rq_end_io;
+	dm_busy_fn busy;
 	/* ǰĻص */
 	dm_presuspend_fn presuspend;
 	/* Ļص */
@@ -0,0 +1,134 @@
+/*
+ *  linux/include/linux/ext3_extents.h
+ *
+ *  Extent-mapped files for ext3.
+ *
+ *  An extent-mapped inode keeps a small B-tree in i_data instead of the
+ *  direct/indirect block pointers.  The tree root is an ext3_extent_header
+ *  followed by up to four entries; deeper nodes are whole blocks.  Leaves
+ *  hold ext3_extents, runs of up to EXT_MAX_LEN blocks contiguous both in
+ *  the file and on disk; interior nodes hold ext3_extent_idx entries keyed
+ *  by the first logical block of the child they point to.
+ */
+
+#ifndef _LINUX_EXT3_EXTENTS_H
+#define _LINUX_EXT3_EXTENTS_H
+
+#include <linux/ext3_jbd.h>
+
+/*
+ * On-disk leaf entry: a run of blocks
+ */
+struct ext3_extent {
+	__le32	ee_block;	/* first logical block extent covers */
+	__le16	ee_len;		/* number of blocks covered by extent */
+	__le16	ee_start_hi;	/* high 16 bits of physical block */
+	__le32	ee_start;	/* low 32 bits of physical block */
+};
+
+/*
+ * On-disk index entry: points to the next level of the tree
+ */
+struct ext3_extent_idx {
+	__le32	ei_block;	/* index covers logical blocks from 'block' */
+	__le32	ei_leaf;	/* pointer to the physical block of the next
+				 * level; leaf or next index could be here */
+	__le16	ei_leaf_hi;	/* high 16 bits of physical block */
+	__u16	ei_unused;
+};
+
+/*
+ * Each block (leaves and indexes), even the inode-stored one, has a header
+ */
+struct ext3_extent_header {
+	__le16	eh_magic;	/* probably will support different formats */
+	__le16	eh_entries;	/* number of valid entries */
+	__le16	eh_max;		/* capacity of store in entries */
+	__le16	eh_depth;	/* has tree real underlying blocks? */
+	__le32	eh_generation;	/* generation of the tree */
+};
+
+#define EXT3_EXT_MAGIC		0xf30a
+
+/* Longest run a single extent can describe */
+#define EXT_MAX_LEN		32768
+
+/* Deepest tree we are prepared to walk */
+#define EXT3_EXT_MAX_DEPTH	5
+
+/*
+ * In-core path from the root to a leaf, as found by ext3_ext_find_extent().
+ * p_bh is NULL for the root, which lives in the inode.
+ */
+struct ext3_ext_path {
+	unsigned long			p_block;
+	__u16				p_depth;
+	struct ext3_extent		*p_ext;
+	struct ext3_extent_idx		*p_idx;
+	struct ext3_extent_header	*p_hdr;
+	struct buffer_head		*p_bh;
+};
+
+#define EXT_FIRST_EXTENT(__hdr__) \
+	((struct ext3_extent *) (((char *) (__hdr__)) +		\
+				 sizeof(struct ext3_extent_header)))
+#define EXT_FIRST_INDEX(__hdr__) \
+	((struct ext3_extent_idx *) (((char *) (__hdr__)) +	\
+				     sizeof(struct ext3_extent_header)))
+#define EXT_LAST_EXTENT(__hdr__) \
+	(EXT_FIRST_EXTENT((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+#define EXT_LAST_INDEX(__hdr__) \
+	(EXT_FIRST_INDEX((__hdr__)) + le16_to_cpu((__hdr__)->eh_entries) - 1)
+#define EXT_MAX_EXTENT(__hdr__) \
+	(EXT_FIRST_EXTENT((__hdr__)) + le16_to_cpu((__hdr__)->eh_max) - 1)
+#define EXT_MAX_INDEX(__hdr__) \
+	(EXT_FIRST_INDEX((__hdr__)) + le16_to_cpu((__hdr__)->eh_max) - 1)
+
+static inline struct ext3_extent_header *ext_inode_hdr(struct inode *inode)
+{
+	return (struct ext3_extent_header *) EXT3_I(inode)->i_data;
+}
+
+static inline struct ext3_extent_header *ext_block_hdr(struct buffer_head *bh)
+{
+	return (struct ext3_extent_header *) bh->b_data;
+}
+
+static inline unsigned short ext_depth(struct inode *inode)
+{
+	return le16_to_cpu(ext_inode_hdr(inode)->eh_depth);
+}
+
+static inline unsigned long ext_pblock(struct ext3_extent *ex)
+{
+	return le32_to_cpu(ex->ee_start);
+}
+
+static inline unsigned long idx_pblock(struct ext3_extent_idx *ix)
+{
+	return le32_to_cpu(ix->ei_leaf);
+}
+
+static inline void ext3_ext_store_pblock(struct ext3_extent *ex,
+					 unsigned long pb)
+{
+	ex->ee_start = cpu_to_le32(pb);
+	ex->ee_start_hi = 0;
+}
+
+static inline void ext3_idx_store_pblock(struct ext3_extent_idx *ix,
+					 unsigned long pb)
+{
+	ix->ei_leaf = cpu_to_le32(pb);
+	ix->ei_leaf_hi = 0;
+}
+
+extern void ext3_ext_tree_init(struct inode *inode);
+extern int ext3_ext_get_blocks(handle_t *handle, struct inode *inode,
+			       sector_t iblock, unsigned long maxblocks,
+			       struct buffer_head *bh_result, int create,
+			       int extend_disksize);
+extern void ext3_ext_truncate(handle_t *handle, struct inode *inode);
+extern int ext3_ext_calc_credits_for_insert(struct inode *inode);
+
+#endif	/* _LINUX_EXT3_EXTENTS_H */
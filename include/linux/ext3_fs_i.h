@@ -127,6 +127,24 @@ struct ext3_inode_info {
 	 * by other means, so we have truncate_sem.
 	 */
 	struct semaphore truncate_sem;
+
+	/*
+	 * With delayed allocation, blocks for newly written data are only
+	 * reserved at write() time and allocated when the pages are written
+	 * back.  These count the data blocks (one per BH_Delay buffer) and
+	 * the worst-case indirect blocks this inode has reserved but not yet
+	 * allocated.  Protected by i_da_lock.
+	 */
+	spinlock_t i_da_lock;
+	unsigned long i_da_data_blocks;
+	unsigned long i_da_meta_blocks;
+
+	/*
+	 * Set by the holder of truncate_sem while it allocates delayed
+	 * blocks: ext3_new_blocks() lets this task take them out of the
+	 * reservation above instead of the free space left to others.
+	 */
+	struct task_struct *i_da_alloc_task;
 	struct inode vfs_inode;
 };
 
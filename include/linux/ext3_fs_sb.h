@@ -57,6 +57,7 @@ struct ext3_sb_info {   //ext3
 	struct percpu_counter s_freeblocks_counter;
 	struct percpu_counter s_freeinodes_counter;
 	struct percpu_counter s_dirs_counter;
+	struct percpu_counter s_dirtyblocks_counter;	/* ӳٷԤĿ */
 	struct blockgroup_lock s_blockgroup_lock;
 
 	/* root of the per fs reservation window tree */
@@ -70,6 +71,9 @@ struct ext3_sb_info {   //ext3
 	struct list_head s_orphan;
 	unsigned long s_commit_interval;
 	struct block_device *journal_bdev;
+
+	/* Metadata prefetch thread, see prefetch.c */
+	struct task_struct *s_prefetch_task;
 #ifdef CONFIG_JBD_DEBUG
 	struct timer_list turn_ro_timer;	/* For turning read-only (crash simulation) */
 	wait_queue_head_t ro_wait_queue;	/* For people waiting for the fs to go read-only */
@@ -265,4 +265,21 @@ static inline int ext3_should_writeback_data(struct inode *inode)
 	return 0;
 }
 
+/*
+ * Delayed allocation is used for regular files in data=ordered and
+ * data=writeback mode.  Quota is only charged when the blocks are
+ * allocated, and writeback has nobody to return EDQUOT to, so it is
+ * not used while quotas are on.
+ */
+static inline int ext3_should_delay_alloc(struct inode *inode)
+{
+	if (!test_opt(inode->i_sb, DELALLOC))
+		return 0;
+	if (ext3_should_journal_data(inode))
+		return 0;
+	if (sb_any_quota_enabled(inode->i_sb))
+		return 0;
+	return 1;
+}
+
 #endif	/* _LINUX_EXT3_JBD_H */
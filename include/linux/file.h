@@ -9,6 +9,7 @@
 #include <linux/posix_types.h>
 #include <linux/compiler.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 
 /*
  * The default fd array needs to be at least BITS_PER_LONG,
@@ -16,6 +17,43 @@
  */
 #define NR_OPEN_DEFAULT BITS_PER_LONG
 
+/*
+ * The fd array and fd sets.  A files_struct publishes its current table
+ * through ->fdt; lookups may walk it under rcu_read_lock() while
+ * expand_files() installs a bigger one under ->file_lock and hands the
+ * old one to RCU for freeing.
+ */
+/**
+ * ļչʱ±ɱRCUںͷš
+ */
+struct fdtable {
+	/**
+	 * ļĵǰš
+	 */
+	unsigned int max_fds;
+	/**
+	 * ļĵǰš
+	 */
+	int max_fdset;
+	/**
+	 * ļָ롣
+	 */
+	struct file ** fd;      /* current fd array */
+	/**
+	 * execʱҪرյļָ롣
+	 */
+	fd_set *close_on_exec;
+	/**
+	 * ļָ롣
+	 */
+	fd_set *open_fds;
+	/**
+	 * ӳͷžɱ
+	 */
+	struct rcu_head rcu;
+	struct fdtable *next;
+};
+
 /*
  * Open file table structure
  */
@@ -32,29 +70,17 @@ struct files_struct {
 		 */
         spinlock_t file_lock;     /* Protects all the below members.  Nests inside tsk->alloc_lock */
 		/**
-		 * ļĵǰš
+		 * ǰʹõļ߿ֻRCU
 		 */
-        int max_fds;
+        struct fdtable *fdt;
 		/**
-		 * ļĵǰš
+		 * Ƕĳʼļ
 		 */
-        int max_fdset;
+        struct fdtable fdtab;
 		/**
 		 * ϴηļ1.
 		 */
         int next_fd;
-		/**
-		 * ļָ롣
-		 */
-        struct file ** fd;      /* current fd array */
-		/**
-		 * execʱҪرյļָ롣
-		 */
-        fd_set *close_on_exec;
-		/**
-		 * ļָ롣
-		 */
-        fd_set *open_fds;
 		/**
 		 * ִexecʱҪرյļĳʼϡ
 		 */
@@ -69,6 +95,8 @@ struct files_struct {
         struct file * fd_array[NR_OPEN_DEFAULT];
 };
 
+#define files_fdtable(files) (rcu_dereference((files)->fdt))
+
 extern void FASTCALL(__fput(struct file *));
 extern void FASTCALL(fput(struct file *));
 
@@ -95,13 +123,19 @@ extern fd_set *alloc_fdset(int);
 extern void free_fdset(fd_set *, int);
 
 extern int expand_files(struct files_struct *, int nr);
+extern void free_fdtable(struct fdtable *fdt);
+extern void __init files_defer_init(void);
 
+/*
+ * Caller must hold files->file_lock or be inside rcu_read_lock().
+ */
 static inline struct file * fcheck_files(struct files_struct *files, unsigned int fd)
 {
 	struct file * file = NULL;
+	struct fdtable *fdt = files_fdtable(files);
 
-	if (fd < files->max_fds)
-		file = files->fd[fd];
+	if (fd < fdt->max_fds)
+		file = rcu_dereference(fdt->fd[fd]);
 	return file;
 }
 
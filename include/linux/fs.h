@@ -78,6 +78,11 @@ extern int dir_notify_enable;
 #define SEL_OUT		2
 #define SEL_EX		4
 
+/* flags for sync_file_range() */
+#define SYNC_FILE_RANGE_WAIT_BEFORE	1
+#define SYNC_FILE_RANGE_WRITE		2
+#define SYNC_FILE_RANGE_WAIT_AFTER	4
+
 /* public flags for file_system_type */
 /**
  * ͵ļϵͳλϡ
@@ -246,6 +251,10 @@ extern int dir_notify_enable;
 #define BLKBSZGET  _IOR(0x12,112,size_t)
 #define BLKBSZSET  _IOW(0x12,113,size_t)
 #define BLKGETSIZE64 _IOR(0x12,114,size_t)	/* return device size in bytes (u64 *arg) */
+#define BLKTRACESETUP _IOWR(0x12,115,struct blk_user_trace_setup)
+#define BLKTRACESTART _IO(0x12,116)
+#define BLKTRACESTOP _IO(0x12,117)
+#define BLKTRACETEARDOWN _IO(0x12,118)
 
 #define BMAP_IOCTL 1		/* obsolete - kept for compatibility */
 #define FIBMAP	   _IO(0x00,1)	/* bmap access */
@@ -1084,6 +1093,10 @@ struct file {
 	 * ָļַռĶ
 	 */
 	struct address_space	*f_mapping;
+	/**
+	 * ļRCUںűͷţfile_free
+	 */
+	struct rcu_head		f_rcuhead;
 };
 extern spinlock_t files_lock;
 #define file_list_lock() spin_lock(&files_lock);
@@ -1412,6 +1425,13 @@ struct super_block {
 	 * ļ
 	 */
 	struct list_head	s_files;
+	/**
+	 * δĿ¼LRUԼеĿ¼͸Ŀ¼
+	 * dcache_lock
+	 */
+	struct list_head	s_dentry_lru;	/* unused dentry lru */
+	int			s_nr_dentry_unused;	/* # of dentry on lru */
+	int			s_nr_dentry_negative;	/* # of negative dentry on lru */
 
 	/**
 	 * ָ豸ָ
@@ -1739,6 +1759,15 @@ struct file_operations {
 	 * ڶflockϵͳõΪͼļʱص˺
 	 */
 	int (*flock) (struct file *, int, struct file_lock *);
+	/**
+	 * spliceϵͳõд벿֣ѹܵеҳдļ͵׽֡
+	 * һǹܵڵ㣬߲йܵź
+	 */
+	ssize_t (*splice_write)(struct inode *, struct file *, loff_t *, size_t, unsigned int);
+	/**
+	 * spliceϵͳõĶȡ֣ļҳٻеҳõķʽܵݡ
+	 */
+	ssize_t (*splice_read)(struct file *, loff_t *, struct inode *, size_t, unsigned int);
 };
 
 /**
@@ -2320,6 +2349,12 @@ extern int filemap_fdatawrite(struct address_space *);
 extern int filemap_flush(struct address_space *);
 extern int filemap_fdatawait(struct address_space *);
 extern int filemap_write_and_wait(struct address_space *mapping);
+extern int __filemap_fdatawrite_range(struct address_space *mapping,
+				loff_t start, loff_t end, int sync_mode);
+extern int wait_on_page_writeback_range(struct address_space *mapping,
+				pgoff_t start, pgoff_t end);
+extern int do_sync_file_range(struct file *file, loff_t offset,
+				loff_t endbyte, unsigned int flags);
 extern void sync_supers(void);
 extern void sync_filesystems(int wait);
 extern void emergency_sync(void);
@@ -2418,6 +2453,9 @@ extern int generic_file_mmap(struct file *, struct vm_area_struct *);
 extern int generic_file_readonly_mmap(struct file *, struct vm_area_struct *);
 extern int file_read_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size);
 extern int file_send_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size);
+extern int file_copy_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size);
+extern int sendfile_can_copy(struct file *);
+extern ssize_t generic_file_sendfile_copy(struct file *, loff_t *, size_t, struct file *);
 extern ssize_t generic_file_read(struct file *, char __user *, size_t, loff_t *);
 int generic_write_checks(struct file *file, loff_t *pos, size_t *count, int isblk);
 extern ssize_t generic_file_write(struct file *, const char __user *, size_t, loff_t *);
@@ -2435,6 +2473,9 @@ extern ssize_t do_sync_write(struct file *filp, const char __user *buf, size_t l
 ssize_t generic_file_write_nolock(struct file *file, const struct iovec *iov,
 				unsigned long nr_segs, loff_t *ppos);
 extern ssize_t generic_file_sendfile(struct file *, loff_t *, size_t, read_actor_t, void *);
+extern ssize_t generic_file_splice_read(struct file *, loff_t *, struct inode *, size_t, unsigned int);
+extern ssize_t generic_file_splice_write(struct inode *, struct file *, loff_t *, size_t, unsigned int);
+extern ssize_t generic_splice_sendpage(struct inode *, struct file *, loff_t *, size_t, unsigned int);
 extern void do_generic_mapping_read(struct address_space *mapping,
 				    struct file_ra_state *, struct file *,
 				    loff_t *, read_descriptor_t *, read_actor_t);
@@ -99,6 +99,7 @@ struct hd_struct {
 	 * partno:з
 	 */
 	int policy, partno;
+	struct disk_latency *lat;	/* per cpu, NULL if allocation failed */
 };
 
 #define GENHD_FL_REMOVABLE			1
@@ -116,6 +117,20 @@ struct disk_stats {
 	unsigned time_in_queue;
 };
 
+/*
+ * Per cpu latency histograms of completed requests, for the whole disk and
+ * for each partition.  Bucket 0 counts requests that took under 1us, bucket
+ * n those that took [2^(n-1), 2^n) us and the last one everything slower.
+ * Queue time runs from the creation of a request to its issue to the
+ * driver, device time from issue to completion.
+ */
+#define DISK_LAT_BUCKETS	24
+
+struct disk_latency {
+	unsigned long queue[2][DISK_LAT_BUCKETS];	/* [READ/WRITE][bucket] */
+	unsigned long device[2][DISK_LAT_BUCKETS];
+};
+
 /**
  * ʾһĴ豸Ҳڱʾһ
  */
@@ -181,6 +196,7 @@ struct gendisk {
 #else
 	struct disk_stats dkstats;
 #endif
+	struct disk_latency *lat;	/* per cpu, see struct disk_latency */
 };
 
 /* Structure for sysfs attributes on block devices */
@@ -280,6 +296,8 @@ extern void disk_round_stats(struct gendisk *disk);
 
 /* drivers/block/genhd.c */
 extern int get_blkdev_list(char *);
+extern struct hd_struct *disk_map_sector(struct gendisk *disk, sector_t sector);
+extern ssize_t disk_latency_read(struct disk_latency *lat, char *page);
 extern void add_disk(struct gendisk *disk);
 extern void del_gendisk(struct gendisk *gp);
 extern void unlink_gendisk(struct gendisk *gp);
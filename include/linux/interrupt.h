@@ -107,6 +107,7 @@ enum
 	NET_TX_SOFTIRQ,		//緢ж
 	NET_RX_SOFTIRQ,		//ж
 	SCSI_SOFTIRQ,		//SCSIж
+	BLOCK_SOFTIRQ,		//豸ж
 	TASKLET_SOFTIRQ		//taskletж
 };
 
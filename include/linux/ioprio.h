@@ -0,0 +1,63 @@
+#ifndef IOPRIO_H
+#define IOPRIO_H
+
+#include <linux/sched.h>
+
+/*
+ * An I/O priority is 16 bits: the scheduling class in the top 3 bits and
+ * the level within the class below them.  Levels run from 0 (highest) to
+ * IOPRIO_BE_NR - 1 for the realtime and best-effort classes; the idle
+ * class has no levels.
+ */
+#define IOPRIO_BITS		(16)
+#define IOPRIO_CLASS_SHIFT	(13)
+#define IOPRIO_PRIO_MASK	((1UL << IOPRIO_CLASS_SHIFT) - 1)
+
+#define IOPRIO_PRIO_CLASS(mask)	((mask) >> IOPRIO_CLASS_SHIFT)
+#define IOPRIO_PRIO_DATA(mask)	((mask) & IOPRIO_PRIO_MASK)
+#define IOPRIO_PRIO_VALUE(class, data)	(((class) << IOPRIO_CLASS_SHIFT) | (data))
+
+#define ioprio_valid(mask)	(IOPRIO_PRIO_CLASS((mask)) != IOPRIO_CLASS_NONE)
+
+/*
+ * IOPRIO_CLASS_NONE means "not set": such a task is served as best-effort
+ * at a level derived from its nice value.
+ */
+enum {
+	IOPRIO_CLASS_NONE,
+	IOPRIO_CLASS_RT,
+	IOPRIO_CLASS_BE,
+	IOPRIO_CLASS_IDLE,
+};
+
+#define IOPRIO_BE_NR	(8)
+
+/* "which" argument of ioprio_set()/ioprio_get() */
+enum {
+	IOPRIO_WHO_PROCESS = 1,
+	IOPRIO_WHO_PGRP,
+	IOPRIO_WHO_USER,
+};
+
+/*
+ * Best-effort level for a task without an explicit priority: nice -20..19
+ * maps onto levels 0..7.
+ */
+static inline int task_nice_ioprio(struct task_struct *task)
+{
+	return (task_nice(task) + 20) / 5;
+}
+
+/*
+ * The priority a task is actually served at, with IOPRIO_CLASS_NONE
+ * resolved to a best-effort level.
+ */
+static inline int task_ioprio(struct task_struct *task)
+{
+	if (ioprio_valid(task->ioprio))
+		return task->ioprio;
+
+	return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, task_nice_ioprio(task));
+}
+
+#endif
@@ -47,6 +47,12 @@
  */
 #define JBD_DEFAULT_MAX_COMMIT_AGE 5
 
+/*
+ * The longest a synchronous handle will hold back a commit so that other
+ * synchronous updates can join the transaction, in microseconds.
+ */
+#define JBD_MAX_BATCH_TIME	15000
+
 #ifdef CONFIG_JBD_DEBUG
 /*
  * Define JBD_EXPENSIVE_CHECKING to enable more expensive internal
@@ -142,6 +148,31 @@ typedef struct journal_header_s
 	__be32		h_sequence;
 } journal_header_t;
 
+/*
+ * Checksum types recorded in a commit block.
+ */
+#define JFS_CRC32_CHKSUM	1
+
+#define JFS_CRC32_CHKSUM_SIZE	4
+
+#define JFS_CHECKSUM_BYTES	(32 / sizeof(__u32))
+
+/*
+ * Commit block header for storing transactional checksums: the checksum
+ * covers every descriptor and metadata block the transaction wrote to
+ * the log.  Commit blocks written without a checksum leave these fields
+ * zero.
+ */
+struct commit_header
+{
+	__be32		h_magic;
+	__be32		h_blocktype;
+	__be32		h_sequence;
+	unsigned char	h_chksum_type;
+	unsigned char	h_chksum_size;
+	unsigned char	h_padding[2];
+	__be32		h_chksum[JFS_CHECKSUM_BYTES];
+};
 
 /* 
  * The block tag: used to describe a single buffer in the journal 
@@ -228,12 +259,16 @@ typedef struct journal_superblock_s
 	((j)->j_format_version >= 2 &&					\
 	 ((j)->j_superblock->s_feature_incompat & cpu_to_be32((mask))))
 
+#define JFS_FEATURE_COMPAT_CHECKSUM	0x00000001
+
 #define JFS_FEATURE_INCOMPAT_REVOKE	0x00000001
+#define JFS_FEATURE_INCOMPAT_ASYNC_COMMIT	0x00000004
 
 /* Features known to this kernel version: */
-#define JFS_KNOWN_COMPAT_FEATURES	0
+#define JFS_KNOWN_COMPAT_FEATURES	JFS_FEATURE_COMPAT_CHECKSUM
 #define JFS_KNOWN_ROCOMPAT_FEATURES	0
-#define JFS_KNOWN_INCOMPAT_FEATURES	JFS_FEATURE_INCOMPAT_REVOKE
+#define JFS_KNOWN_INCOMPAT_FEATURES	(JFS_FEATURE_INCOMPAT_REVOKE | \
+					 JFS_FEATURE_INCOMPAT_ASYNC_COMMIT)
 
 #ifdef __KERNEL__
 
@@ -546,6 +581,11 @@ struct transaction_s
 	 */
 	unsigned long		t_expires;
 
+	/*
+	 * When did the transaction start, in jiffies? [no locking]
+	 */
+	unsigned long		t_start;
+
 	/*
 	 * How many handles used this transaction? [t_handle_lock]
 	 */
@@ -553,6 +593,11 @@ struct transaction_s
 
 };
 
+/*
+ * Largest number of buffers checkpointing writes out in one sorted batch.
+ */
+#define JBD_NR_BATCH	256
+
 /**
  * struct journal_s - The journal_s type is the concrete type associated with
  *     journal_t.
@@ -606,6 +651,19 @@ struct transaction_s
  * @j_commit_timer:  The timer used to wakeup the commit thread
  * @j_revoke: The revoke table - maintains the list of revoked blocks in the
  *     current transaction.
+ * @j_chkpt_bhs: Batch of checkpoint buffers being written out
+ * @j_log_wait_count: Number of times handles waited for log space
+ * @j_log_wait_time: Total jiffies spent waiting for log space
+ * @j_log_wait_max: Longest single wait for log space, in jiffies
+ * @j_checkpoint_runs: Number of checkpoint batches written
+ * @j_checkpoint_written: Number of buffers written by checkpointing
+ * @j_last_sync_writer: pid of the last process to close a sync handle
+ * @j_average_commit_time: Decaying average commit time, in microseconds
+ * @j_commit_count: Number of transactions committed
+ * @j_commit_time_max: Longest commit, in microseconds
+ * @j_commit_handles: Number of handles in all committed transactions
+ * @j_devname: Name of the journal device, for /proc
+ * @j_proc_entry: Per-journal statistics directory in /proc/fs/jbd
  */
 
 struct journal_s      //־͵ journal_t
@@ -788,6 +846,40 @@ struct journal_s      //
 	struct jbd_revoke_table_s *j_revoke;
 	struct jbd_revoke_table_s *j_revoke_table[2];
 
+	/*
+	 * Checkpoint writeout batch: filled under j_list_lock, submitted
+	 * and waited upon by the holder of j_checkpoint_sem.
+	 */
+	struct buffer_head	*j_chkpt_bhs[JBD_NR_BATCH];
+
+	/*
+	 * How often, and for how long in total, handles had to wait for
+	 * checkpointing to free log space. [j_state_lock]
+	 */
+	unsigned long		j_log_wait_count;
+	unsigned long		j_log_wait_time;
+	unsigned long		j_log_wait_max;
+
+	/* Checkpoint writeout statistics [j_checkpoint_sem] */
+	unsigned long		j_checkpoint_runs;
+	unsigned long		j_checkpoint_written;
+
+	/*
+	 * Synchronous commit batching: who closed the last sync handle, and
+	 * how long commits take on average, in microseconds. [j_state_lock]
+	 */
+	pid_t			j_last_sync_writer;
+	unsigned long		j_average_commit_time;
+
+	/* Commit statistics [j_state_lock] */
+	unsigned long		j_commit_count;
+	unsigned long		j_commit_time_max;
+	unsigned long		j_commit_handles;
+
+	/* Statistics in /proc/fs/jbd/<j_devname>/ */
+	char			j_devname[BDEVNAME_SIZE];
+	struct proc_dir_entry	*j_proc_entry;
+
 	/*
 	 * An opaque pointer to fs-private information.  ext3 puts its
 	 * superblock pointer here
@@ -14,6 +14,7 @@
 
 #include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <asm/atomic.h>
 
 /**
@@ -74,6 +75,10 @@ struct vfsmount
 	 * ļϵͳΪڣ־
 	 */
 	int mnt_expiry_mark;		/* true if marked for expiry */
+	/**
+	 * жȷļϵͳвժlookup_mnt()ٷ
+	 */
+	int mnt_doomed;			/* being unmounted, refused by lookup_mnt */
 	/**
 	 * 豸ļ
 	 */
@@ -91,6 +96,10 @@ struct vfsmount
 	 * ռָ
 	 */
 	struct namespace *mnt_namespace; /* containing namespace */
+	/**
+	 * lookup_mnt()RCU±ɢбҪȿڹͷš
+	 */
+	struct rcu_head mnt_rcu;
 };
 
 static inline struct vfsmount *mntget(struct vfsmount *mnt)
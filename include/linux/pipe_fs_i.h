@@ -3,6 +3,7 @@
 
 #define PIPEFS_MAGIC 0x50495045
 
+/* Default ring size in pages; F_SETPIPE_SZ can change it per pipe */
 #define PIPE_BUFFERS (16)
 
 struct pipe_buffer {
@@ -16,12 +17,15 @@ struct pipe_buf_operations {
 	void * (*map)(struct file *, struct pipe_inode_info *, struct pipe_buffer *);
 	void (*unmap)(struct pipe_inode_info *, struct pipe_buffer *);
 	void (*release)(struct pipe_inode_info *, struct pipe_buffer *);
+	void (*get)(struct pipe_inode_info *, struct pipe_buffer *);
 };
 
 struct pipe_inode_info {
 	wait_queue_head_t wait;
 	unsigned int nrbufs, curbuf;
-	struct pipe_buffer bufs[PIPE_BUFFERS];
+	unsigned int buffers;		/* ring size, always a power of two */
+	struct pipe_buffer *bufs;
+	struct user_struct *user;	/* charged for the ring pages */
 	struct page *tmp_page;
 	unsigned int start;
 	unsigned int readers;
@@ -56,4 +60,17 @@ void pipe_wait(struct inode * inode);
 struct inode* pipe_new(struct inode* inode);
 void free_pipe_info(struct inode* inode);
 
+extern int pipe_max_size, pipe_min_size;
+extern int pipe_user_pages_hard;
+long pipe_fcntl(struct file *, unsigned int, unsigned long);
+
+/*
+ * splice() and tee() flags
+ */
+#define SPLICE_F_MOVE		(0x01)	/* move pages instead of copying */
+#define SPLICE_F_NONBLOCK	(0x02)	/* don't block on the pipe splicing (but
+					   we may still block on the fd we splice
+					   from/to, of course */
+#define SPLICE_F_MORE		(0x04)	/* expect more data */
+
 #endif
@@ -633,6 +633,7 @@ struct user_struct {
 	atomic_t processes;	/* How many processes does this user have? */
 	atomic_t files;		/* How many open files does this user have? */
 	atomic_t sigpending;	/* How many pending signals does this user have? */
+	atomic_t pipe_bufs;	/* How many pipe ring pages does this user have? */
 	/* protected by mq_lock	*/
 	unsigned long mq_bytes;	/* How many bytes can be allocated to mqueue? */
 	unsigned long locked_shm; /* How many pages of mlocked shm ? */
@@ -765,6 +766,7 @@ extern void cpu_attach_domain(struct sched_domain *sd, int cpu);
 
 struct io_context;			/* See blkdev.h */
 void exit_io_context(void);
+struct blk_plug;			/* See blkdev.h */
 
 #define NGROUPS_SMALL		32
 #define NGROUPS_PER_BLOCK	((int)(PAGE_SIZE / sizeof(gid_t)))
@@ -821,6 +823,8 @@ struct task_struct {
 	 * еĶ̬Ȩ;̬Ȩ
 	 */
 	int prio, static_prio;
+	/* I/O scheduling class and level, see <linux/ioprio.h> */
+	unsigned short ioprio;
 	/**
 	 * жСÿȼӦһжС
 	 */
@@ -1083,6 +1087,7 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+	struct blk_plug *plug;		/* requests held back by this task */
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -670,6 +670,9 @@ enum
 	FS_XFS=17,	/* struct: control xfs parameters */
 	FS_AIO_NR=18,	/* current system-wide number of aio requests */
 	FS_AIO_MAX_NR=19,	/* system-wide maximum number of aio requests */
+	FS_DENTRY_NEGATIVE_MAX=20, /* int: per-sb limit on unused negative dentries */
+	FS_PIPE_MAX_SIZE=21,	/* int: largest pipe ring a user may set, in bytes */
+	FS_PIPE_USER_PAGES_HARD=22, /* int: per-user limit on pipe ring pages */
 };
 
 /* /proc/sys/fs/quota/ */
@@ -3193,6 +3193,14 @@ asmlinkage void __sched schedule(void)
 	}
 	profile_hit(SCHED_PROFILING, __builtin_return_address(0));
 
+	/*
+	 * A task going to sleep must not sit on plugged requests it
+	 * may be about to wait for.
+	 */
+	if (unlikely(current->plug) && current->state != TASK_RUNNING &&
+	    !(preempt_count() & PREEMPT_ACTIVE))
+		blk_schedule_flush_plug(current);
+
 need_resched:
 	/**
 	 * ȽֹռٳʼһЩ
@@ -188,7 +188,7 @@ static int sync_page(void *word)
  * be waited upon, and not just skipped over.
  */
 /* дļڵݵ */
-static int __filemap_fdatawrite_range(struct address_space *mapping,
+int __filemap_fdatawrite_range(struct address_space *mapping,
 	loff_t start, loff_t end, int sync_mode)
 {
 	int ret;
@@ -238,7 +238,7 @@ EXPORT_SYMBOL(filemap_flush);
  * Wait for writeback to complete against pages indexed by start->end
  * inclusive
  */
-static int wait_on_page_writeback_range(struct address_space *mapping,
+int wait_on_page_writeback_range(struct address_space *mapping,
 				pgoff_t start, pgoff_t end)
 {
 	struct pagevec pvec;
@@ -1359,6 +1359,140 @@ ssize_t generic_file_sendfile(struct file *in_file, loff_t *ppos,
 
 EXPORT_SYMBOL(generic_file_sendfile);
 
+/*
+ * sendfile() actor for targets without ->sendpage: copy the source page
+ * straight into the page cache of the target at its f_pos, the same way
+ * generic_file_buffered_write() would, but without a user space buffer.
+ * The caller holds the target's i_sem.
+ */
+int file_copy_actor(read_descriptor_t * desc, struct page *page, unsigned long offset, unsigned long size)
+{
+	struct file *file = desc->arg.data;
+	struct address_space *mapping = file->f_mapping;
+	struct address_space_operations *a_ops = mapping->a_ops;
+	struct inode *inode = mapping->host;
+	unsigned long count = desc->count;
+	unsigned long written = 0;
+	loff_t pos = file->f_pos;
+	long status = 0;
+
+	if (size > count)
+		size = count;
+
+	while (written < size) {
+		unsigned long index = pos >> PAGE_CACHE_SHIFT;
+		unsigned long dst_offset = pos & (PAGE_CACHE_SIZE - 1);
+		unsigned long bytes = PAGE_CACHE_SIZE - dst_offset;
+		struct page *dst;
+		char *src_addr, *dst_addr;
+
+		if (bytes > size - written)
+			bytes = size - written;
+
+		dst = grab_cache_page(mapping, index);
+		if (!dst) {
+			status = -ENOMEM;
+			break;
+		}
+
+		status = a_ops->prepare_write(file, dst, dst_offset, dst_offset + bytes);
+		if (unlikely(status)) {
+			loff_t isize = i_size_read(inode);
+
+			unlock_page(dst);
+			page_cache_release(dst);
+			/* trim blocks prepare_write instantiated past i_size */
+			if (pos + bytes > isize)
+				vmtruncate(inode, isize);
+			break;
+		}
+
+		src_addr = kmap_atomic(page, KM_USER0);
+		dst_addr = kmap_atomic(dst, KM_USER1);
+		memcpy(dst_addr + dst_offset, src_addr + offset + written, bytes);
+		kunmap_atomic(dst_addr, KM_USER1);
+		kunmap_atomic(src_addr, KM_USER0);
+		flush_dcache_page(dst);
+
+		status = a_ops->commit_write(file, dst, dst_offset, dst_offset + bytes);
+		unlock_page(dst);
+		mark_page_accessed(dst);
+		page_cache_release(dst);
+		if (status < 0)
+			break;
+
+		written += bytes;
+		pos += bytes;
+		balance_dirty_pages_ratelimited(mapping);
+		cond_resched();
+	}
+
+	file->f_pos = pos;
+	if (status < 0)
+		desc->error = status;
+	desc->count = count - written;
+	desc->written += written;
+	return written;
+}
+
+/*
+ * Can sendfile() write into this file through file_copy_actor()?
+ */
+int sendfile_can_copy(struct file *file)
+{
+	struct address_space *mapping = file->f_mapping;
+
+	if (!S_ISREG(file->f_dentry->d_inode->i_mode))
+		return 0;
+	if (file->f_flags & O_DIRECT)
+		return 0;
+	return mapping->a_ops->prepare_write && mapping->a_ops->commit_write;
+}
+
+/*
+ * File to file sendfile(): read through the source's page cache with
+ * its usual readahead and copy each page into the target's page cache.
+ */
+ssize_t generic_file_sendfile_copy(struct file *in_file, loff_t *ppos,
+				   size_t count, struct file *out_file)
+{
+	struct address_space *mapping = out_file->f_mapping;
+	struct inode *inode = mapping->host;
+	loff_t pos;
+	ssize_t ret;
+	int err;
+
+	/* Source and target pages would be one and the same */
+	if (in_file->f_mapping == mapping)
+		return -EINVAL;
+
+	down(&inode->i_sem);
+	pos = out_file->f_pos;
+	ret = generic_write_checks(out_file, &pos, &count, 0);
+	if (ret || !count)
+		goto out;
+	ret = remove_suid(out_file->f_dentry);
+	if (ret)
+		goto out;
+	inode_update_time(inode, 1);
+
+	out_file->f_pos = pos;
+	current->backing_dev_info = mapping->backing_dev_info;
+	ret = in_file->f_op->sendfile(in_file, ppos, count, file_copy_actor, out_file);
+	current->backing_dev_info = NULL;
+out:
+	up(&inode->i_sem);
+
+	if (ret > 0 && ((out_file->f_flags & O_SYNC) || IS_SYNC(inode))) {
+		err = generic_osync_inode(inode, mapping, OSYNC_METADATA|OSYNC_DATA);
+		if (err < 0)
+			ret = err;
+	}
+	return ret;
+}
+
+EXPORT_SYMBOL(generic_file_sendfile_copy);
+
 static ssize_t
 do_readahead(struct address_space *mapping, struct file *filp,
 	     unsigned long index, unsigned long nr)
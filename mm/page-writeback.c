@@ -29,6 +29,9 @@
 #include <linux/sysctl.h>
 #include <linux/cpu.h>
 #include <linux/syscalls.h>
+#include <linux/kthread.h>
+
+#include <asm/div64.h>
 
 /*
  * The maximum number of pages to writeout in a single bdflush/kupdate
@@ -46,7 +49,17 @@
 static long ratelimit_pages = 32;
 
 static long total_pages;	/* The total number of pages in the machine. */
-static int dirty_exceeded;	/* Dirty mem may be over limit */
+
+/*
+ * Writeout completions, counted globally and per backing device, decide
+ * what share of the dirty limit each device gets.  Every time the global
+ * count passes another period of 1 << writeout_period_shift pages, each
+ * device's count is halved (lazily, when the device is next looked at),
+ * so the shares follow the devices' recent writeout speed.  The counts
+ * are a heuristic and are updated without any lock.
+ */
+static atomic_t vm_completions = ATOMIC_INIT(0);
+static int writeout_period_shift = 12;
 
 /*
  * When balance_dirty_pages decides that the caller needs to perform some
@@ -106,6 +119,7 @@ EXPORT_SYMBOL(laptop_mode);
 
 
 static void background_writeout(unsigned long _min_pages);
+static void wakeup_flushers(long nr_pages);
 
 struct writeback_state
 {
@@ -188,6 +202,57 @@ get_dirty_limits(struct writeback_state *wbs, long *pbackground, long *pdirty,
 	*pdirty = dirty;
 }
 
+static void bdi_writeout_decay(struct backing_dev_info *bdi)
+{
+	unsigned long period, missed;
+
+	period = (unsigned int)atomic_read(&vm_completions) >> writeout_period_shift;
+	missed = period - bdi->completions_period;
+	if (missed) {
+		int nr = atomic_read(&bdi->completions);
+
+		atomic_set(&bdi->completions, missed < 31 ? nr >> missed : 0);
+		bdi->completions_period = period;
+	}
+}
+
+/*
+ * Called as a page of bdi finishes writeback.
+ */
+static void bdi_writeout_inc(struct backing_dev_info *bdi)
+{
+	bdi_writeout_decay(bdi);
+	atomic_inc(&bdi->completions);
+	atomic_inc(&vm_completions);
+}
+
+/*
+ * Scale the global dirty limit down to bdi's share of the recent writeout
+ * completions.  The decayed per-device counts sum up to about one period
+ * plus however far the current period has gone.
+ */
+static long bdi_dirty_limit(struct backing_dev_info *bdi, long dirty)
+{
+	unsigned long total = (unsigned int)atomic_read(&vm_completions);
+	unsigned long period_len = 1UL << writeout_period_shift;
+	unsigned long denominator;
+	u64 limit;
+
+	if (total >= period_len)
+		denominator = period_len + (total & (period_len - 1));
+	else
+		denominator = total;
+	if (!denominator)
+		return dirty;	/* nothing written yet, nothing to go by */
+
+	bdi_writeout_decay(bdi);
+	limit = (u64)dirty * atomic_read(&bdi->completions);
+	do_div(limit, denominator);
+	if (limit > dirty)
+		limit = dirty;
+	return limit;
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
  * data.  It looks at the number of dirty pages in the machine and will force
@@ -199,8 +264,11 @@ static void balance_dirty_pages(struct address_space *mapping)
 {
 	struct writeback_state wbs;
 	long nr_reclaimable;
+	long bdi_nr_reclaimable;
+	long bdi_nr_writeback;
 	long background_thresh;
 	long dirty_thresh;
+	long bdi_thresh;
 	unsigned long pages_written = 0;
 	unsigned long write_chunk = sync_writeback_pages();
 
@@ -214,13 +282,22 @@ static void balance_dirty_pages(struct address_space *mapping)
 			.nr_to_write	= write_chunk,
 		};
 
+		/*
+		 * Each device is held to its share of the dirty limit, so
+		 * a slow device piling up dirty pages only throttles the
+		 * tasks writing to it.
+		 */
 		get_dirty_limits(&wbs, &background_thresh,
 					&dirty_thresh, mapping);
 		nr_reclaimable = wbs.nr_dirty + wbs.nr_unstable;
-		if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
+		bdi_thresh = bdi_dirty_limit(bdi, dirty_thresh);
+		bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
+		bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
+		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
 			break;
 
-		dirty_exceeded = 1;
+		if (!bdi->dirty_exceeded)
+			bdi->dirty_exceeded = 1;
 
 		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
 		 * Unstable writes are a feature of certain networked
@@ -228,12 +305,15 @@ static void balance_dirty_pages(struct address_space *mapping)
 		 * written to the server's write cache, but has not yet
 		 * been flushed to permanent storage.
 		 */
-		if (nr_reclaimable) {
+		if (bdi_nr_reclaimable) {
 			writeback_inodes(&wbc);
 			get_dirty_limits(&wbs, &background_thresh,
 					&dirty_thresh, mapping);
 			nr_reclaimable = wbs.nr_dirty + wbs.nr_unstable;
-			if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
+			bdi_thresh = bdi_dirty_limit(bdi, dirty_thresh);
+			bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
+			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
+			if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
 				break;
 			pages_written += write_chunk - wbc.nr_to_write;
 			if (pages_written >= write_chunk)
@@ -242,8 +322,9 @@ static void balance_dirty_pages(struct address_space *mapping)
 		blk_congestion_wait(WRITE, HZ/10);
 	}
 
-	if (nr_reclaimable + wbs.nr_writeback <= dirty_thresh)
-		dirty_exceeded = 0;
+	if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh &&
+	    bdi->dirty_exceeded)
+		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
 		return;		/* pdflush is already working this queue */
@@ -257,8 +338,10 @@ static void balance_dirty_pages(struct address_space *mapping)
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
 	if ((laptop_mode && pages_written) ||
-	     (!laptop_mode && (nr_reclaimable > background_thresh)))
-		pdflush_operation(background_writeout, 0);
+	     (!laptop_mode && (nr_reclaimable > background_thresh))) {
+		if (bdi_start_writeback(bdi, 0) < 0)
+			pdflush_operation(background_writeout, 0);
+	}
 }
 
 /**
@@ -280,7 +363,7 @@ void balance_dirty_pages_ratelimited(struct address_space *mapping)
 	long ratelimit;
 
 	ratelimit = ratelimit_pages;
-	if (dirty_exceeded)
+	if (mapping->backing_dev_info->dirty_exceeded)
 		ratelimit = 8;
 
 	/*
@@ -305,12 +388,11 @@ EXPORT_SYMBOL(balance_dirty_pages_ratelimited);
  * ϵͳɨҳٻҪˢµҳ,pdflushĻص֮һ.
  * _min_pages:	Ҫˢµ̵ҳ
  */
-static void background_writeout(unsigned long _min_pages)
+static void __background_writeout(struct backing_dev_info *bdi,
+				  long min_pages)
 {
-	long min_pages = _min_pages;
-	
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = NULL,
 		.nr_to_write	= 0,
@@ -326,6 +408,8 @@ static void background_writeout(unsigned long _min_pages)
 		if (wbs.nr_dirty + wbs.nr_unstable < background_thresh
 				&& min_pages <= 0)
 			break;
+		if (bdi && !bdi_stat(bdi, BDI_RECLAIMABLE))
+			break;
 		wbc.encountered_congestion = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
 		wbc.pages_skipped = 0;
@@ -353,6 +437,11 @@ static void background_writeout(unsigned long _min_pages)
 	}
 }
 
+static void background_writeout(unsigned long _min_pages)
+{
+	__background_writeout(NULL, _min_pages);
+}
+
 /*
  * Start writeback of `nr_pages' pages.  If `nr_pages' is zero, write back
  * the whole world.  Returns 0 if a pdflush thread was dispatched.  Returns
@@ -375,6 +464,7 @@ int wakeup_bdflush(long nr_pages)
 		get_writeback_state(&wbs);
 		nr_pages = wbs.nr_dirty + wbs.nr_unstable;
 	}
+	wakeup_flushers(nr_pages);
 	/**
 	 * pdflush_operationѿpdflusḥ߳ίִbackground_writeout
 	 */
@@ -410,15 +500,11 @@ static struct timer_list laptop_mode_wb_timer =
 /**
  * ҳٻǷ""˺ܳʱҳ
  */
-static void wb_kupdate(unsigned long arg)
+static void __wb_kupdate(struct backing_dev_info *bdi, long nr_to_write)
 {
 	unsigned long oldest_jif;
-	unsigned long start_jif;
-	unsigned long next_jif;
-	long nr_to_write;
-	struct writeback_state wbs;
 	struct writeback_control wbc = {
-		.bdi		= NULL,
+		.bdi		= bdi,
 		.sync_mode	= WB_SYNC_NONE,
 		.older_than_this = &oldest_jif,
 		.nr_to_write	= 0,
@@ -426,25 +512,11 @@ static void wb_kupdate(unsigned long arg)
 		.for_kupdate	= 1,
 	};
 
-	/**
-	 * ĳдС
-	 * ȷκγʱͨᳬ5S
-	 */
-	sync_supers();
-
-	get_writeback_state(&wbs);
 	/**
 	 * ǰʱȥ30룬ڴʱҳΪҪдҳЩҳ
 	 * Ҳ˵һҳΪҳʱ30S
 	 */
 	oldest_jif = jiffies - (dirty_expire_centisecs * HZ) / 100;
-	start_jif = jiffies;
-	next_jif = start_jif + (dirty_writeback_centisecs * HZ) / 100;
-	/**
-	 * page_stateȷҳٻҳĴ
-	 */
-	nr_to_write = wbs.nr_dirty + wbs.nr_unstable +
-			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
 	/**
 	 * ֱҳдв˳
 	 */
@@ -463,6 +535,31 @@ static void wb_kupdate(unsigned long arg)
 		}
 		nr_to_write -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 	}
+}
+
+/**
+ * ҳٻǷ""˺ܳʱҳ
+ */
+static void wb_kupdate(unsigned long arg)
+{
+	unsigned long start_jif;
+	unsigned long next_jif;
+	struct writeback_state wbs;
+
+	/**
+	 * ĳдС
+	 * ȷκγʱͨᳬ5S
+	 */
+	sync_supers();
+
+	get_writeback_state(&wbs);
+	start_jif = jiffies;
+	next_jif = start_jif + (dirty_writeback_centisecs * HZ) / 100;
+	/**
+	 * page_stateȷҳٻҳĴ
+	 */
+	__wb_kupdate(NULL, wbs.nr_dirty + wbs.nr_unstable +
+			(inodes_stat.nr_inodes - inodes_stat.nr_unused));
 	/**
 	 * ִʱ̫´ζʱȵǰʱ˲һ룬ǿ1ſʼһδ
 	 */
@@ -472,6 +569,181 @@ static void wb_kupdate(unsigned long arg)
 		mod_timer(&wb_timer, next_jif);
 }
 
+
+/*
+ * Per-device flusher threads.
+ *
+ * Each registered backing_dev_info gets a thread of its own which does the
+ * background and periodic (kupdate) writeback for that device alone.  A slow
+ * or congested device then only stalls its own thread, instead of tying up
+ * the shared pdflush threads that every other device depends on.  Devices
+ * which were never registered (NFS, anonymous and memory-backed ones) are
+ * still written back from pdflush, which skips the inodes of devices that
+ * have a flusher.
+ */
+struct bdi_writeback {
+	struct backing_dev_info *bdi;
+	struct task_struct *task;
+	wait_queue_head_t wait;
+	int work;			/* background writeout requested */
+	long nr_pages;			/* pages requested by wakeup_bdflush */
+	int users;			/* disks sharing this queue */
+	struct list_head list;		/* on bdi_list */
+};
+
+static LIST_HEAD(bdi_list);
+static DEFINE_SPINLOCK(bdi_lock);	/* bdi_list, bdi->wb and wb->work */
+static DECLARE_MUTEX(bdi_sem);		/* serialises register/unregister */
+
+static int bdi_writeback_thread(void *data)
+{
+	struct bdi_writeback *wb = data;
+	struct backing_dev_info *bdi = wb->bdi;
+	unsigned long next_kupdate;
+
+	current->flags |= PF_FLUSHER;
+	set_user_nice(current, 0);
+	next_kupdate = jiffies + (dirty_writeback_centisecs * HZ) / 100;
+
+	while (!kthread_should_stop()) {
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+		long nr_pages;
+		int work;
+
+		if (dirty_writeback_centisecs) {
+			timeout = next_kupdate - jiffies;
+			if (timeout < 0)
+				timeout = 0;
+		}
+		wait_event_interruptible_timeout(wb->wait,
+				wb->work || kthread_should_stop(), timeout);
+		try_to_freeze(PF_FREEZE);
+		if (kthread_should_stop())
+			break;
+
+		spin_lock(&bdi_lock);
+		work = wb->work;
+		nr_pages = wb->nr_pages;
+		wb->work = 0;
+		wb->nr_pages = 0;
+		spin_unlock(&bdi_lock);
+
+		if (work)
+			__background_writeout(bdi, nr_pages);
+
+		if (dirty_writeback_centisecs &&
+		    time_after_eq(jiffies, next_kupdate)) {
+			__wb_kupdate(bdi, bdi_stat(bdi, BDI_RECLAIMABLE) +
+				(inodes_stat.nr_inodes - inodes_stat.nr_unused));
+			next_kupdate = jiffies +
+				(dirty_writeback_centisecs * HZ) / 100;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Queue background writeout of at least `nr_pages' pages on the flusher
+ * thread of `bdi'.  Returns -1 if the device has no flusher, in which case
+ * the caller should fall back to pdflush.
+ */
+int bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	struct bdi_writeback *wb;
+
+	spin_lock(&bdi_lock);
+	wb = bdi->wb;
+	if (wb) {
+		wb->work = 1;
+		wb->nr_pages += nr_pages;
+		wake_up(&wb->wait);
+	}
+	spin_unlock(&bdi_lock);
+	return wb ? 0 : -1;
+}
+
+static void wakeup_flushers(long nr_pages)
+{
+	struct bdi_writeback *wb;
+
+	spin_lock(&bdi_lock);
+	list_for_each_entry(wb, &bdi_list, list) {
+		wb->work = 1;
+		wb->nr_pages += nr_pages;
+		wake_up(&wb->wait);
+	}
+	spin_unlock(&bdi_lock);
+}
+
+/*
+ * Start a flusher thread for `bdi'.  Disks which share a request queue
+ * share its thread, so registrations are counted.
+ */
+int bdi_register(struct backing_dev_info *bdi, const char *name)
+{
+	struct bdi_writeback *wb;
+	struct task_struct *task;
+	int err = 0;
+
+	if (bdi->memory_backed)
+		return 0;
+
+	down(&bdi_sem);
+	if (bdi->wb) {
+		bdi->wb->users++;
+		goto out;
+	}
+	wb = kmalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb) {
+		err = -ENOMEM;
+		goto out;
+	}
+	memset(wb, 0, sizeof(*wb));
+	wb->bdi = bdi;
+	wb->users = 1;
+	init_waitqueue_head(&wb->wait);
+
+	task = kthread_create(bdi_writeback_thread, wb, "flush-%s", name);
+	if (IS_ERR(task)) {
+		kfree(wb);
+		err = PTR_ERR(task);
+		goto out;
+	}
+	wb->task = task;
+
+	spin_lock(&bdi_lock);
+	list_add_tail(&wb->list, &bdi_list);
+	bdi->wb = wb;
+	spin_unlock(&bdi_lock);
+	wake_up_process(task);
+out:
+	up(&bdi_sem);
+	return err;
+}
+EXPORT_SYMBOL(bdi_register);
+
+/*
+ * Drop a registration.  The last one stops the thread; whatever is still
+ * dirty on the device is left to pdflush.
+ */
+void bdi_unregister(struct backing_dev_info *bdi)
+{
+	struct bdi_writeback *wb;
+
+	down(&bdi_sem);
+	wb = bdi->wb;
+	if (wb && --wb->users == 0) {
+		spin_lock(&bdi_lock);
+		list_del(&wb->list);
+		bdi->wb = NULL;
+		spin_unlock(&bdi_lock);
+		kthread_stop(wb->task);
+		kfree(wb);
+	}
+	up(&bdi_sem);
+}
+EXPORT_SYMBOL(bdi_unregister);
+
 /*
  * sysctl handler for /proc/sys/vm/dirty_writeback_centisecs
  */
@@ -479,6 +751,8 @@ int dirty_writeback_centisecs_handler(ctl_table *table, int write,
 		struct file *file, void __user *buffer, size_t *length, loff_t *ppos)
 {
 	proc_dointvec(table, write, file, buffer, length, ppos);
+	/* Let the flusher threads pick up the new interval */
+	wakeup_flushers(0);
 	if (dirty_writeback_centisecs) {
 		mod_timer(&wb_timer,
 			jiffies + (dirty_writeback_centisecs * HZ) / 100);
@@ -594,6 +868,12 @@ void __init page_writeback_init(void)
 		if (vm_dirty_ratio <= 0)
 			vm_dirty_ratio = 1;
 	}
+
+	/* One writeout period is roughly twice the dirty limit */
+	writeout_period_shift = 1 + fls((total_pages * vm_dirty_ratio) / 100);
+	if (writeout_period_shift > 30)
+		writeout_period_shift = 30;
+
 	mod_timer(&wb_timer, jiffies + (dirty_writeback_centisecs * HZ) / 100);
 	set_ratelimit();
 	register_cpu_notifier(&ratelimit_nb);
@@ -676,8 +956,11 @@ int __set_page_dirty_nobuffers(struct page *page)
 			mapping2 = page_mapping(page);
 			if (mapping2) { /* Race with truncate? */
 				BUG_ON(mapping2 != mapping);
-				if (!mapping->backing_dev_info->memory_backed)
+				if (!mapping->backing_dev_info->memory_backed) {
 					inc_page_state(nr_dirty);
+					inc_bdi_stat(mapping->backing_dev_info,
+							BDI_RECLAIMABLE);
+				}
 				radix_tree_tag_set(&mapping->page_tree,
 					page_index(page), PAGECACHE_TAG_DIRTY);
 			}
@@ -762,8 +1045,11 @@ int test_clear_page_dirty(struct page *page)
 						page_index(page),
 						PAGECACHE_TAG_DIRTY);
 			spin_unlock_irqrestore(&mapping->tree_lock, flags);
-			if (!mapping->backing_dev_info->memory_backed)
+			if (!mapping->backing_dev_info->memory_backed) {
 				dec_page_state(nr_dirty);
+				dec_bdi_stat(mapping->backing_dev_info,
+						BDI_RECLAIMABLE);
+			}
 			return 1;
 		}
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
@@ -793,8 +1079,11 @@ int clear_page_dirty_for_io(struct page *page)
 
 	if (mapping) {
 		if (TestClearPageDirty(page)) {
-			if (!mapping->backing_dev_info->memory_backed)
+			if (!mapping->backing_dev_info->memory_backed) {
 				dec_page_state(nr_dirty);
+				dec_bdi_stat(mapping->backing_dev_info,
+						BDI_RECLAIMABLE);
+			}
 			return 1;
 		}
 		return 0;
@@ -837,10 +1126,13 @@ int test_clear_page_writeback(struct page *page)
 
 		spin_lock_irqsave(&mapping->tree_lock, flags);
 		ret = TestClearPageWriteback(page);
-		if (ret)
+		if (ret) {
 			radix_tree_tag_clear(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
+			dec_bdi_stat(mapping->backing_dev_info, BDI_WRITEBACK);
+			bdi_writeout_inc(mapping->backing_dev_info);
+		}
 		spin_unlock_irqrestore(&mapping->tree_lock, flags);
 	} else {
 		ret = TestClearPageWriteback(page);
@@ -858,10 +1150,12 @@ int test_set_page_writeback(struct page *page)
 
 		spin_lock_irqsave(&mapping->tree_lock, flags);
 		ret = TestSetPageWriteback(page);
-		if (!ret)
+		if (!ret) {
 			radix_tree_tag_set(&mapping->page_tree,
 						page_index(page),
 						PAGECACHE_TAG_WRITEBACK);
+			inc_bdi_stat(mapping->backing_dev_info, BDI_WRITEBACK);
+		}
 		if (!PageDirty(page))
 			radix_tree_tag_clear(&mapping->page_tree,
 						page_index(page),
@@ -155,8 +155,11 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 {
 	unsigned page_idx;
 	struct pagevec lru_pvec;
+	struct blk_plug plug;
 	int ret = 0;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		goto out;
@@ -177,6 +180,7 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 	}
 	pagevec_lru_add(&lru_pvec);
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
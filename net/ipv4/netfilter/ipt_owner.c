@@ -36,7 +36,7 @@ match_comm(const struct sk_buff *skb, const char *comm)
 		files = p->files;
 		if(files) {
 			spin_lock(&files->file_lock);
-			for (i=0; i < files->max_fds; i++) {
+			for (i=0; i < files_fdtable(files)->max_fds; i++) {
 				if (fcheck_files(files, i) ==
 				    skb->sk->sk_socket->file) {
 					spin_unlock(&files->file_lock);
@@ -68,7 +68,7 @@ match_pid(const struct sk_buff *skb, pid_t pid)
 	files = p->files;
 	if(files) {
 		spin_lock(&files->file_lock);
-		for (i=0; i < files->max_fds; i++) {
+		for (i=0; i < files_fdtable(files)->max_fds; i++) {
 			if (fcheck_files(files, i) ==
 			    skb->sk->sk_socket->file) {
 				spin_unlock(&files->file_lock);
@@ -102,7 +102,7 @@ match_sid(const struct sk_buff *skb, pid_t sid)
 		files = p->files;
 		if (files) {
 			spin_lock(&files->file_lock);
-			for (i=0; i < files->max_fds; i++) {
+			for (i=0; i < files_fdtable(files)->max_fds; i++) {
 				if (fcheck_files(files, i) == file) {
 					found = 1;
 					break;
@@ -1704,12 +1704,14 @@ static inline void flush_unauthorized_files(struct files_struct * files)
 	for (;;) {
 		unsigned long set, i;
 		int fd;
+		struct fdtable *fdt;
 
 		j++;
 		i = j * __NFDBITS;
-		if (i >= files->max_fds || i >= files->max_fdset)
+		fdt = files_fdtable(files);
+		if (i >= fdt->max_fds || i >= fdt->max_fdset)
 			break;
-		set = files->open_fds->fds_bits[j];
+		set = fdt->open_fds->fds_bits[j];
 		if (!set)
 			continue;
 		spin_unlock(&files->file_lock);